@@ -0,0 +1,875 @@
+#ifndef _IMAGEDECODER_HPP__
+#define _IMAGEDECODER_HPP__
+
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <stdint.h>
+
+namespace GLUtils {
+
+/**
+  * Decodes baseline JPEG and 8 or 16 bit non-interlaced PNG images to RGB8,
+  * which covers the textures we load. Unlike DevIL, decoding
+  * uses no global state, so any number of threads may decode at once, e.g.,
+  * the threads of an ImageLoader. Other images, such as progressive JPEGs,
+  * are left to DevIL.
+  */
+class ImageDecoder {
+public:
+	/**
+	  * Decodes the image file held in data to tightly packed RGB8 texels,
+	  * rows from the top of the image down.
+	  * @return false if the image is not a JPEG or PNG this decoder supports,
+	  * or is damaged, so that the caller can fall back to DevIL
+	  */
+	static bool decode(const unsigned char* data, size_t size, unsigned int& width, unsigned int& height,
+			std::vector<unsigned char>& rgb) {
+		if (size >= 2 && data[0] == 0xFF && data[1] == 0xD8) {
+			JpegDecoder jpeg(data, size);
+			return jpeg.decode(width, height, rgb);
+		}
+		const unsigned char png_signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+		if (size >= 8 && std::memcmp(data, png_signature, 8) == 0) {
+			return decodePng(data, size, width, height, rgb);
+		}
+		return false;
+	}
+
+private:
+	/**
+	  * Largest number of pixels decoded, which keeps the sizes within 32 bits
+	  */
+	static const uint32_t max_pixels = 1u << 28;
+
+	static inline unsigned char clamp(int v) {
+		return static_cast<unsigned char>((v < 0) ? 0 : ((v > 255) ? 255 : v));
+	}
+
+	static inline uint32_t readBigEndian16(const unsigned char* p) {
+		return (static_cast<uint32_t>(p[0]) << 8) | p[1];
+	}
+
+	static inline uint32_t readBigEndian32(const unsigned char* p) {
+		return (readBigEndian16(p) << 16) | readBigEndian16(p+2);
+	}
+
+	/**
+	  * Decoder for sequential, Huffman coded JPEG with 8 bit samples and one
+	  * (gray) or three (YCbCr, or RGB when the Adobe marker says so)
+	  * components, with any sampling factors that divide the largest ones
+	  */
+	class JpegDecoder {
+	public:
+		JpegDecoder(const unsigned char* data, size_t size) {
+			this->data = data;
+			this->size = size;
+			pos = 2;
+			restart_interval = 0;
+			n_components = 0;
+			frame_width = frame_height = 0;
+			transform = -1;
+			std::memset(quant, 0, sizeof(quant));
+			std::memset(huffman, 0, sizeof(huffman));
+		}
+
+		bool decode(unsigned int& width, unsigned int& height, std::vector<unsigned char>& rgb) {
+			bool scanned = false;
+			while (true) {
+				//Markers may be preceded by any number of fill bytes
+				if (pos >= size || data[pos] != 0xFF) return false;
+				while (pos < size && data[pos] == 0xFF) ++pos;
+				if (pos >= size) return false;
+				unsigned char marker = data[pos++];
+				if (marker == 0xD9) break;
+				if (marker >= 0xD0 && marker <= 0xD7) continue;
+				if (pos+2 > size) return false;
+				size_t length = readBigEndian16(data+pos);
+				if (length < 2 || pos+length > size) return false;
+				const unsigned char* segment = data+pos+2;
+				length -= 2;
+				pos += length+2;
+
+				switch (marker) {
+				case 0xDB:
+					if (!readQuantizationTables(segment, length)) return false;
+					break;
+				case 0xC4:
+					if (!readHuffmanTables(segment, length)) return false;
+					break;
+				case 0xC0:
+				case 0xC1:
+					if (n_components != 0 || !readFrame(segment, length)) return false;
+					break;
+				case 0xDD:
+					if (length < 2) return false;
+					restart_interval = readBigEndian16(segment);
+					break;
+				case 0xEE:
+					//Adobe marker, which tells whether three components are YCbCr or RGB
+					if (length >= 12 && std::memcmp(segment, "Adobe", 5) == 0) transform = segment[11];
+					break;
+				case 0xDA:
+					//Only a single scan holding every component is supported
+					if (n_components == 0 || scanned || !readScan(segment, length)) return false;
+					scanned = true;
+					break;
+				default:
+					//Progressive, lossless and arithmetic coded frames are left to DevIL
+					if ((marker >= 0xC2 && marker <= 0xCF) && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) return false;
+					break;
+				}
+			}
+			if (!scanned) return false;
+
+			width = frame_width;
+			height = frame_height;
+			convert(rgb);
+			return true;
+		}
+
+	private:
+		static const unsigned int fast_bits = 9; //< Codes up to this length are decoded with one lookup
+
+		struct HuffmanTable {
+			bool defined;
+			unsigned char symbols[256];
+			int max_code[18]; //< Largest code of each length, -1 if none
+			int offset[17]; //< Index of the first symbol of each length, minus its code
+			unsigned short fast[1 << fast_bits]; //< (length << 8) | symbol, 0 if the code is longer than fast_bits
+		};
+
+		struct Component {
+			unsigned int id;
+			unsigned int h, v; //< Sampling factors
+			unsigned int quant; //< Quantization table
+			unsigned int dc, ac; //< Huffman tables, set by the scan
+			unsigned int stride; //< Width of the plane, a whole number of blocks
+			unsigned int width, height; //< Size of the samples in the image
+			int prediction; //< Last DC coefficient
+			std::vector<unsigned char> plane;
+		};
+
+		bool readQuantizationTables(const unsigned char* p, size_t length) {
+			while (length > 0) {
+				unsigned int precision = p[0] >> 4;
+				unsigned int id = p[0] & 15;
+				size_t n = 1 + 64*(precision+1);
+				if (id > 3 || precision > 1 || length < n) return false;
+				for (unsigned int k=0; k<64; ++k) {
+					quant[id][k] = precision ? static_cast<unsigned short>(readBigEndian16(p+1+2*k)) : p[1+k];
+				}
+				p += n;
+				length -= n;
+			}
+			return true;
+		}
+
+		bool readHuffmanTables(const unsigned char* p, size_t length) {
+			while (length > 0) {
+				if (length < 17) return false;
+				unsigned int type = p[0] >> 4;
+				unsigned int id = p[0] & 15;
+				if (type > 1 || id > 3) return false;
+				HuffmanTable& table = huffman[type][id];
+				unsigned int count = 0;
+				for (unsigned int l=1; l<=16; ++l) count += p[l];
+				if (count > 256 || length < 17+count) return false;
+				std::memcpy(table.symbols, p+17, count);
+
+				//Canonical codes: each length starts at the codes of the previous length plus one, doubled
+				std::memset(table.fast, 0, sizeof(table.fast));
+				int code = 0;
+				unsigned int k = 0;
+				for (unsigned int l=1; l<=16; ++l) {
+					table.offset[l] = static_cast<int>(k) - code;
+					for (unsigned int i=0; i<p[l]; ++i, ++k, ++code) {
+						if (code >= (1 << l)) return false;
+						if (l <= fast_bits) {
+							unsigned int first = static_cast<unsigned int>(code) << (fast_bits-l);
+							for (unsigned int j=0; j<(1u << (fast_bits-l)); ++j) {
+								table.fast[first+j] = static_cast<unsigned short>((l << 8) | table.symbols[k]);
+							}
+						}
+					}
+					table.max_code[l] = p[l] ? code-1 : -1;
+					code <<= 1;
+				}
+				table.max_code[17] = 0x7FFFFFFF;
+				table.defined = true;
+				p += 17+count;
+				length -= 17+count;
+			}
+			return true;
+		}
+
+		bool readFrame(const unsigned char* p, size_t length) {
+			if (length < 6 || p[0] != 8) return false;
+			frame_height = readBigEndian16(p+1);
+			frame_width = readBigEndian16(p+3);
+			n_components = p[5];
+			if (frame_width == 0 || frame_height == 0 || (n_components != 1 && n_components != 3)) return false;
+			if (static_cast<uint64_t>(frame_width)*frame_height > max_pixels) return false;
+			if (length < 6 + 3*n_components) return false;
+
+			h_max = v_max = 1;
+			for (unsigned int c=0; c<n_components; ++c) {
+				Component& component = components[c];
+				component.id = p[6+3*c];
+				component.h = p[7+3*c] >> 4;
+				component.v = p[7+3*c] & 15;
+				component.quant = p[8+3*c];
+				if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4 || component.quant > 3) return false;
+				h_max = (std::max)(h_max, component.h);
+				v_max = (std::max)(v_max, component.v);
+			}
+
+			//A single component is not interleaved, and is coded one block at a time
+			if (n_components == 1) {
+				components[0].h = components[0].v = 1;
+				h_max = v_max = 1;
+			}
+
+			mcus_x = (frame_width + 8*h_max-1)/(8*h_max);
+			mcus_y = (frame_height + 8*v_max-1)/(8*v_max);
+			for (unsigned int c=0; c<n_components; ++c) {
+				Component& component = components[c];
+				if (h_max % component.h != 0 || v_max % component.v != 0) return false;
+				component.stride = mcus_x*component.h*8;
+				component.width = (frame_width*component.h + h_max-1)/h_max;
+				component.height = (frame_height*component.v + v_max-1)/v_max;
+				component.plane.resize(static_cast<size_t>(component.stride)*mcus_y*component.v*8);
+			}
+			return true;
+		}
+
+		bool readScan(const unsigned char* p, size_t length) {
+			if (length < 1 || p[0] != n_components || length < 4 + 2*n_components) return false;
+			for (unsigned int i=0; i<n_components; ++i) {
+				if (p[1+2*i] != components[i].id) return false;
+				components[i].dc = p[2+2*i] >> 4;
+				components[i].ac = p[2+2*i] & 15;
+				if (components[i].dc > 3 || components[i].ac > 3) return false;
+				if (!huffman[0][components[i].dc].defined || !huffman[1][components[i].ac].defined) return false;
+				components[i].prediction = 0;
+			}
+
+			//The coded data runs until the next marker that is not a restart marker
+			bits = 0;
+			n_bits = 0;
+			int coefficients[64];
+			unsigned int mcus = 0;
+			for (unsigned int my=0; my<mcus_y; ++my) {
+				for (unsigned int mx=0; mx<mcus_x; ++mx) {
+					if (restart_interval > 0 && mcus > 0 && mcus % restart_interval == 0 && !restart()) return false;
+					++mcus;
+					for (unsigned int c=0; c<n_components; ++c) {
+						Component& component = components[c];
+						for (unsigned int by=0; by<component.v; ++by) {
+							for (unsigned int bx=0; bx<component.h; ++bx) {
+								if (!decodeBlock(component, coefficients)) return false;
+								size_t x = (mx*component.h + bx)*8;
+								size_t y = (my*component.v + by)*8;
+								inverseDCT(coefficients, &component.plane[y*component.stride + x], component.stride);
+							}
+						}
+					}
+				}
+			}
+
+			//Go on with the markers after the coded data
+			while (pos+1 < size && !(data[pos] == 0xFF && data[pos+1] != 0x00 && (data[pos+1] < 0xD0 || data[pos+1] > 0xD7))) ++pos;
+			return true;
+		}
+
+		/**
+		  * Skips to the data after the next restart marker, and resets the decoder
+		  */
+		bool restart() {
+			bits = 0;
+			n_bits = 0;
+			while (pos+1 < size && !(data[pos] == 0xFF && data[pos+1] >= 0xD0 && data[pos+1] <= 0xD7)) ++pos;
+			if (pos+1 >= size) return false;
+			pos += 2;
+			for (unsigned int c=0; c<n_components; ++c) components[c].prediction = 0;
+			return true;
+		}
+
+		/**
+		  * Makes sure there are at least 57 bits in the bit buffer, enough for
+		  * a Huffman code and the bits of the coefficient that follows it. Past
+		  * the end of the coded data, at a marker, the buffer is filled with zeros.
+		  */
+		inline void fill() {
+			while (n_bits <= 56) {
+				uint64_t byte = 0;
+				if (pos < size && data[pos] != 0xFF) {
+					byte = data[pos++];
+				}
+				else if (pos+1 < size && data[pos] == 0xFF && data[pos+1] == 0x00) {
+					byte = 0xFF;
+					pos += 2;
+				}
+				bits |= byte << (56-n_bits);
+				n_bits += 8;
+			}
+		}
+
+		inline int decodeHuffman(const HuffmanTable& table) {
+			fill();
+			unsigned int entry = table.fast[bits >> (64-fast_bits)];
+			if (entry != 0) {
+				unsigned int l = entry >> 8;
+				bits <<= l;
+				n_bits -= l;
+				return entry & 0xFF;
+			}
+			for (unsigned int l=fast_bits+1; l<=16; ++l) {
+				int code = static_cast<int>(bits >> (64-l));
+				if (code <= table.max_code[l]) {
+					bits <<= l;
+					n_bits -= l;
+					return table.symbols[(table.offset[l] + code) & 0xFF];
+				}
+			}
+			return -1;
+		}
+
+		/**
+		  * Reads n bits, at most 16, as the signed value of a coefficient.
+		  * Only called right after decodeHuffman(), which filled the buffer.
+		  */
+		inline int receive(unsigned int n) {
+			if (n == 0) return 0;
+			int value = static_cast<int>(bits >> (64-n));
+			bits <<= n;
+			n_bits -= n;
+			return (value < (1 << (n-1))) ? value - (1 << n) + 1 : value;
+		}
+
+		bool decodeBlock(Component& component, int* coefficients) {
+			static const unsigned char zigzag[64] = {
+				0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+				12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+				35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+				58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+			};
+			const unsigned short* q = quant[component.quant];
+			std::memset(coefficients, 0, 64*sizeof(int));
+
+			int t = decodeHuffman(huffman[0][component.dc]);
+			if (t < 0 || t > 11) return false;
+			component.prediction += receive(t);
+			if (component.prediction < -32768 || component.prediction > 32767) return false;
+			coefficients[0] = component.prediction*q[0];
+
+			for (unsigned int k=1; k<64; ) {
+				int rs = decodeHuffman(huffman[1][component.ac]);
+				if (rs < 0) return false;
+				unsigned int run = rs >> 4;
+				unsigned int n = rs & 15;
+				if (n == 0) {
+					if (run != 15) break;
+					k += 16;
+					continue;
+				}
+				k += run;
+				if (k > 63) return false;
+				coefficients[zigzag[k]] = receive(n)*q[k];
+				++k;
+			}
+			return true;
+		}
+
+		/**
+		  * Transforms the coefficients of a block back to 8x8 samples, with
+		  * the integer inverse DCT of libjpeg (jidctint.c), so that images
+		  * decode the same as through DevIL
+		  */
+		static void inverseDCT(const int* coefficients, unsigned char* out, unsigned int stride) {
+			const int bits = 13;
+			const int pass1_bits = 2;
+			int64_t workspace[64];
+
+			//Columns, keeping pass1_bits of extra precision
+			for (unsigned int c=0; c<8; ++c) {
+				const int* in = coefficients + c;
+				int64_t* ws = workspace + c;
+				if (in[8] == 0 && in[16] == 0 && in[24] == 0 && in[32] == 0 && in[40] == 0 && in[48] == 0 && in[56] == 0) {
+					//Most columns only have a DC term
+					int64_t dc = static_cast<int64_t>(in[0])*(1 << pass1_bits);
+					for (unsigned int k=0; k<8; ++k) ws[8*k] = dc;
+					continue;
+				}
+				int64_t result[8];
+				idct1D(in[0], in[8], in[16], in[24], in[32], in[40], in[48], in[56], result);
+				for (unsigned int k=0; k<8; ++k) ws[8*k] = descale(result[k], bits-pass1_bits);
+			}
+
+			//Rows, to samples
+			for (unsigned int r=0; r<8; ++r) {
+				const int64_t* ws = workspace + 8*r;
+				unsigned char* row = out + r*stride;
+				if (ws[1] == 0 && ws[2] == 0 && ws[3] == 0 && ws[4] == 0 && ws[5] == 0 && ws[6] == 0 && ws[7] == 0) {
+					unsigned char dc = clamp64(descale(ws[0], pass1_bits+3) + 128);
+					for (unsigned int k=0; k<8; ++k) row[k] = dc;
+					continue;
+				}
+				int64_t result[8];
+				idct1D(ws[0], ws[1], ws[2], ws[3], ws[4], ws[5], ws[6], ws[7], result);
+				for (unsigned int k=0; k<8; ++k) row[k] = clamp64(descale(result[k], bits+pass1_bits+3) + 128);
+			}
+		}
+
+		static inline unsigned char clamp64(int64_t v) {
+			return static_cast<unsigned char>((v < 0) ? 0 : ((v > 255) ? 255 : v));
+		}
+
+		static inline int64_t descale(int64_t x, int n) {
+			return (x + (static_cast<int64_t>(1) << (n-1))) >> n;
+		}
+
+		/**
+		  * One dimensional inverse DCT of 8 values, scaled by 2^13. The sums are
+		  * 64 bit, so that coefficients of damaged images cannot overflow them.
+		  */
+		static inline void idct1D(int64_t s0, int64_t s1, int64_t s2, int64_t s3, int64_t s4, int64_t s5, int64_t s6, int64_t s7,
+				int64_t* result) {
+			//Even part
+			int64_t z1 = (s2 + s6)*4433;
+			int64_t tmp2 = z1 - s6*15137;
+			int64_t tmp3 = z1 + s2*6270;
+			int64_t tmp0 = (s0 + s4)*8192;
+			int64_t tmp1 = (s0 - s4)*8192;
+			int64_t tmp10 = tmp0 + tmp3;
+			int64_t tmp13 = tmp0 - tmp3;
+			int64_t tmp11 = tmp1 + tmp2;
+			int64_t tmp12 = tmp1 - tmp2;
+
+			//Odd part
+			tmp0 = s7;
+			tmp1 = s5;
+			tmp2 = s3;
+			tmp3 = s1;
+			z1 = tmp0 + tmp3;
+			int64_t z2 = tmp1 + tmp2;
+			int64_t z3 = tmp0 + tmp2;
+			int64_t z4 = tmp1 + tmp3;
+			int64_t z5 = (z3 + z4)*9633;
+			tmp0 *= 2446;
+			tmp1 *= 16819;
+			tmp2 *= 25172;
+			tmp3 *= 12299;
+			z1 *= -7373;
+			z2 *= -20995;
+			z3 = z3*-16069 + z5;
+			z4 = z4*-3196 + z5;
+			tmp0 += z1 + z3;
+			tmp1 += z2 + z4;
+			tmp2 += z2 + z3;
+			tmp3 += z1 + z4;
+
+			result[0] = tmp10 + tmp3;
+			result[7] = tmp10 - tmp3;
+			result[1] = tmp11 + tmp2;
+			result[6] = tmp11 - tmp2;
+			result[2] = tmp12 + tmp1;
+			result[5] = tmp12 - tmp1;
+			result[3] = tmp13 + tmp0;
+			result[4] = tmp13 - tmp0;
+		}
+
+		/**
+		  * Upsamples row y of component c to full width. Components sampled
+		  * at half the resolution horizontally and/or vertically use the
+		  * triangle filter of libjpeg, which weights the nearer sample 3/4,
+		  * and other factors replicate the samples.
+		  * @param sums Room for a row of the component
+		  */
+		void upsampleRow(unsigned int c, unsigned int y, unsigned char* row, int* sums) {
+			const Component& component = components[c];
+			unsigned int fx = h_max/component.h;
+			unsigned int fy = v_max/component.v;
+			unsigned int w = component.width;
+			unsigned int h = component.height;
+			bool smooth_x = (fx == 2 && w > 1);
+			bool smooth_y = (fy == 2 && (fx == 1 || smooth_x));
+			unsigned int sy = y/fy;
+			const unsigned char* near_row = &component.plane[static_cast<size_t>(sy)*component.stride];
+			if (fx == 1 && !smooth_y) {
+				std::memcpy(row, near_row, frame_width);
+				return;
+			}
+			if (!smooth_x && !smooth_y) {
+				for (unsigned int x=0, sx=0; x<frame_width; sx++) {
+					for (unsigned int k=0; k<fx && x<frame_width; ++k, ++x) row[x] = near_row[sx];
+				}
+				return;
+			}
+
+			//Vertical pass, scaling the samples by 4 if it filters
+			bool lower = (y & 1) != 0;
+			if (smooth_y) {
+				unsigned int ny = lower ? (std::min)(sy+1, h-1) : ((sy > 0) ? sy-1 : 0);
+				const unsigned char* far_row = &component.plane[static_cast<size_t>(ny)*component.stride];
+				for (unsigned int sx=0; sx<w; ++sx) sums[sx] = 3*near_row[sx] + far_row[sx];
+			}
+			else {
+				for (unsigned int sx=0; sx<w; ++sx) sums[sx] = near_row[sx];
+			}
+
+			if (!smooth_x) {
+				for (unsigned int x=0; x<frame_width; ++x) row[x] = clamp((sums[x] + (lower ? 2 : 1)) >> 2);
+				return;
+			}
+
+			//Horizontal pass, with the same rounding as libjpeg
+			int shift = smooth_y ? 4 : 2;
+			int bias_left = smooth_y ? 8 : 1;
+			int bias_right = smooth_y ? 7 : 2;
+			for (unsigned int sx=0; sx<w; ++sx) {
+				int current = sums[sx];
+				int left = (sx > 0) ? sums[sx-1] : current;
+				int right = (sx+1 < w) ? sums[sx+1] : current;
+				if (2*sx < frame_width) row[2*sx] = clamp((3*current + left + bias_left) >> shift);
+				if (2*sx+1 < frame_width) row[2*sx+1] = clamp((3*current + right + bias_right) >> shift);
+			}
+		}
+
+		/**
+		  * Upsamples the components and converts them to RGB, one row at a time
+		  */
+		void convert(std::vector<unsigned char>& rgb) {
+			rgb.resize(3*static_cast<size_t>(frame_width)*frame_height);
+			std::vector<unsigned char> rows(3*frame_width);
+			std::vector<int> sums(frame_width);
+			unsigned char* p0 = &rows[0];
+			unsigned char* p1 = (n_components == 3) ? &rows[frame_width] : p0;
+			unsigned char* p2 = (n_components == 3) ? &rows[2*frame_width] : p0;
+			for (unsigned int y=0; y<frame_height; ++y) {
+				upsampleRow(0, y, p0, sums.data());
+				if (n_components == 3) {
+					upsampleRow(1, y, p1, sums.data());
+					upsampleRow(2, y, p2, sums.data());
+				}
+
+				unsigned char* out = &rgb[3*static_cast<size_t>(y)*frame_width];
+				if (n_components == 1 || transform == 0) {
+					for (unsigned int x=0; x<frame_width; ++x) {
+						out[3*x] = p0[x];
+						out[3*x+1] = p1[x];
+						out[3*x+2] = p2[x];
+					}
+				}
+				else {
+					//JFIF YCbCr to RGB, in the fixed point of libjpeg (jdcolor.c)
+					const int half = 1 << 15;
+					for (unsigned int x=0; x<frame_width; ++x) {
+						int luma = p0[x];
+						int cb = p1[x] - 128;
+						int cr = p2[x] - 128;
+						out[3*x] = clamp(luma + ((91881*cr + half) >> 16));
+						out[3*x+1] = clamp(luma + ((-22554*cb - 46802*cr + half) >> 16));
+						out[3*x+2] = clamp(luma + ((116130*cb + half) >> 16));
+					}
+				}
+			}
+		}
+
+		const unsigned char* data;
+		size_t size;
+		size_t pos; //< Next byte to read
+		uint64_t bits; //< Bit buffer, next bit in the most significant bit
+		unsigned int n_bits;
+		unsigned int restart_interval; //< MCUs between restart markers, 0 if none
+		unsigned short quant[4][64]; //< In zigzag order
+		HuffmanTable huffman[2][4]; //< DC and AC tables
+		Component components[3];
+		unsigned int n_components;
+		unsigned int frame_width, frame_height;
+		unsigned int h_max, v_max; //< Largest sampling factors
+		unsigned int mcus_x, mcus_y;
+		int transform; //< Color transform of the Adobe marker, -1 if none
+	};
+
+	/**
+	  * Reads the bits of a zlib stream, least significant bit first
+	  */
+	struct BitReader {
+		const unsigned char* data;
+		size_t size;
+		size_t pos;
+		uint32_t bits;
+		unsigned int n_bits;
+		bool overrun; //< Set when reading past the end
+
+		inline uint32_t read(unsigned int n) {
+			while (n_bits < n) {
+				uint32_t byte = 0;
+				if (pos < size) byte = data[pos++];
+				else overrun = true;
+				bits |= byte << n_bits;
+				n_bits += 8;
+			}
+			uint32_t value = bits & ((1u << n) - 1);
+			bits >>= n;
+			n_bits -= n;
+			return value;
+		}
+	};
+
+	/**
+	  * Canonical Huffman code of a deflate block, decoded one bit at a time
+	  */
+	struct InflateTable {
+		unsigned short counts[16]; //< Number of codes of each length
+		unsigned short symbols[288]; //< Ordered by code
+
+		bool build(const unsigned char* lengths, unsigned int n) {
+			unsigned short offsets[16];
+			std::memset(counts, 0, sizeof(counts));
+			for (unsigned int i=0; i<n; ++i) counts[lengths[i]]++;
+			counts[0] = 0;
+			offsets[1] = 0;
+			for (unsigned int l=1; l<15; ++l) offsets[l+1] = offsets[l] + counts[l];
+			for (unsigned int i=0; i<n; ++i) {
+				if (lengths[i] != 0) symbols[offsets[lengths[i]]++] = static_cast<unsigned short>(i);
+			}
+			return true;
+		}
+
+		inline int decode(BitReader& in) const {
+			int code = 0;
+			int first = 0;
+			int index = 0;
+			for (unsigned int l=1; l<16; ++l) {
+				code |= static_cast<int>(in.read(1));
+				int count = counts[l];
+				if (code - first < count) return symbols[index + code - first];
+				index += count;
+				first = (first + count) << 1;
+				code <<= 1;
+			}
+			return -1;
+		}
+	};
+
+	/**
+	  * Decompresses a zlib stream to out, which holds the expected size
+	  * @return false if the stream is damaged, or does not fill out
+	  */
+	static bool inflate(const unsigned char* data, size_t size, std::vector<unsigned char>& out) {
+		static const unsigned short length_base[29] = {
+			3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+		};
+		static const unsigned char length_extra[29] = {
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+		};
+		static const unsigned short distance_base[30] = {
+			1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+			1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+		};
+		static const unsigned char distance_extra[30] = {
+			0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+		};
+		static const unsigned char code_length_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+		//zlib header: deflate, and no preset dictionary
+		if (size < 2 || (data[0] & 15) != 8 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[1] & 32)) return false;
+		BitReader in = {data, size, 2, 0, 0, false};
+		size_t written = 0;
+		bool last = false;
+		InflateTable lengths, distances;
+		while (!last) {
+			last = in.read(1) != 0;
+			unsigned int type = in.read(2);
+			if (type == 0) {
+				//Stored block, starting at the next byte
+				in.bits = 0;
+				in.n_bits = 0;
+				if (in.pos+4 > size) return false;
+				unsigned int n = data[in.pos] | (data[in.pos+1] << 8);
+				unsigned int n_complement = data[in.pos+2] | (data[in.pos+3] << 8);
+				in.pos += 4;
+				if ((n ^ 0xFFFF) != n_complement || in.pos+n > size || written+n > out.size()) return false;
+				std::memcpy(&out[written], data+in.pos, n);
+				in.pos += n;
+				written += n;
+				continue;
+			}
+
+			unsigned char code_lengths[288+32];
+			if (type == 1) {
+				//Fixed codes
+				for (unsigned int i=0; i<288; ++i) code_lengths[i] = (i < 144) ? 8 : ((i < 256) ? 9 : ((i < 280) ? 7 : 8));
+				lengths.build(code_lengths, 288);
+				for (unsigned int i=0; i<30; ++i) code_lengths[i] = 5;
+				distances.build(code_lengths, 30);
+			}
+			else if (type == 2) {
+				//Dynamic codes, whose lengths are themselves Huffman coded
+				unsigned int n_lengths = in.read(5) + 257;
+				unsigned int n_distances = in.read(5) + 1;
+				unsigned int n_codes = in.read(4) + 4;
+				if (n_lengths > 286 || n_distances > 30) return false;
+				unsigned char length_lengths[19] = {0};
+				for (unsigned int i=0; i<n_codes; ++i) length_lengths[code_length_order[i]] = static_cast<unsigned char>(in.read(3));
+				InflateTable length_codes;
+				length_codes.build(length_lengths, 19);
+				for (unsigned int i=0; i<n_lengths+n_distances; ) {
+					int symbol = length_codes.decode(in);
+					if (symbol < 0) return false;
+					if (symbol < 16) {
+						code_lengths[i++] = static_cast<unsigned char>(symbol);
+						continue;
+					}
+					unsigned char value = 0;
+					unsigned int repeat;
+					if (symbol == 16) {
+						if (i == 0) return false;
+						value = code_lengths[i-1];
+						repeat = 3 + in.read(2);
+					}
+					else if (symbol == 17) {
+						repeat = 3 + in.read(3);
+					}
+					else {
+						repeat = 11 + in.read(7);
+					}
+					if (i+repeat > n_lengths+n_distances) return false;
+					while (repeat-- > 0) code_lengths[i++] = value;
+				}
+				lengths.build(code_lengths, n_lengths);
+				distances.build(code_lengths+n_lengths, n_distances);
+			}
+			else {
+				return false;
+			}
+
+			while (true) {
+				int symbol = lengths.decode(in);
+				if (symbol < 0 || in.overrun) return false;
+				if (symbol < 256) {
+					if (written >= out.size()) return false;
+					out[written++] = static_cast<unsigned char>(symbol);
+					continue;
+				}
+				if (symbol == 256) break;
+				symbol -= 257;
+				if (symbol >= 29) return false;
+				size_t length = length_base[symbol] + in.read(length_extra[symbol]);
+				int d = distances.decode(in);
+				if (d < 0 || d >= 30) return false;
+				size_t distance = distance_base[d] + in.read(distance_extra[d]);
+				if (distance > written || written+length > out.size()) return false;
+				for (size_t i=0; i<length; ++i, ++written) out[written] = out[written-distance];
+			}
+			if (in.overrun) return false;
+		}
+		return written == out.size();
+	}
+
+	static inline unsigned char paeth(int a, int b, int c) {
+		int p = a + b - c;
+		int pa = std::abs(p-a);
+		int pb = std::abs(p-b);
+		int pc = std::abs(p-c);
+		return static_cast<unsigned char>((pa <= pb && pa <= pc) ? a : ((pb <= pc) ? b : c));
+	}
+
+	static bool decodePng(const unsigned char* data, size_t size, unsigned int& width, unsigned int& height,
+			std::vector<unsigned char>& rgb) {
+		size_t pos = 8;
+		unsigned int depth = 0, type = 0;
+		width = height = 0;
+		std::vector<unsigned char> compressed;
+		std::vector<unsigned char> palette;
+		while (pos+12 <= size) {
+			uint32_t length = readBigEndian32(data+pos);
+			const unsigned char* chunk = data+pos+4;
+			const unsigned char* payload = data+pos+8;
+			if (length > size-pos-12) return false;
+			pos += 12 + length;
+
+			if (std::memcmp(chunk, "IHDR", 4) == 0) {
+				if (length < 13) return false;
+				width = readBigEndian32(payload);
+				height = readBigEndian32(payload+4);
+				depth = payload[8];
+				type = payload[9];
+
+				//Interlaced images, and gray or palette images with fewer than 8 bits, are left to DevIL
+				if (payload[10] != 0 || payload[11] != 0 || payload[12] != 0) return false;
+				if (depth != 8 && !(depth == 16 && type != 3)) return false;
+				if (type != 0 && type != 2 && type != 3 && type != 4 && type != 6) return false;
+				if (width == 0 || height == 0 || static_cast<uint64_t>(width)*height > max_pixels) return false;
+			}
+			else if (std::memcmp(chunk, "PLTE", 4) == 0) {
+				palette.assign(payload, payload+length);
+			}
+			else if (std::memcmp(chunk, "IDAT", 4) == 0) {
+				compressed.insert(compressed.end(), payload, payload+length);
+			}
+			else if (std::memcmp(chunk, "IEND", 4) == 0) {
+				break;
+			}
+		}
+		if (width == 0 || compressed.empty() || (type == 3 && palette.size() < 3)) return false;
+
+		static const unsigned int channels_of_type[7] = {1, 0, 3, 1, 2, 0, 4};
+		unsigned int channels = channels_of_type[type];
+		size_t pixel_size = channels*depth/8; //< Bytes between a byte and the same byte of the previous pixel
+		size_t row_size = width*pixel_size;
+		std::vector<unsigned char> filtered((row_size+1)*height);
+		if (!inflate(compressed.data(), compressed.size(), filtered)) return false;
+
+		//Undo the filter of each row in place, against the unfiltered row above
+		std::vector<unsigned char> zero_row(row_size, 0);
+		for (unsigned int y=0; y<height; ++y) {
+			unsigned char filter = filtered[y*(row_size+1)];
+			unsigned char* row = &filtered[y*(row_size+1) + 1];
+			const unsigned char* above = (y > 0) ? row - (row_size+1) : zero_row.data();
+			for (size_t i=0; i<row_size; ++i) {
+				int a = (i >= pixel_size) ? row[i-pixel_size] : 0;
+				int b = above[i];
+				int c = (i >= pixel_size) ? above[i-pixel_size] : 0;
+				switch (filter) {
+				case 0: break;
+				case 1: row[i] = static_cast<unsigned char>(row[i] + a); break;
+				case 2: row[i] = static_cast<unsigned char>(row[i] + b); break;
+				case 3: row[i] = static_cast<unsigned char>(row[i] + ((a+b) >> 1)); break;
+				case 4: row[i] = static_cast<unsigned char>(row[i] + paeth(a, b, c)); break;
+				default: return false;
+				}
+			}
+		}
+
+		//Keep the most significant byte of 16 bit samples, and drop alpha
+		size_t sample_size = depth/8;
+		rgb.resize(3*static_cast<size_t>(width)*height);
+		for (unsigned int y=0; y<height; ++y) {
+			const unsigned char* row = &filtered[y*(row_size+1) + 1];
+			for (unsigned int x=0; x<width; ++x) {
+				const unsigned char* pixel = row + x*pixel_size;
+				unsigned char* out = &rgb[3*(static_cast<size_t>(y)*width + x)];
+				if (type == 3) {
+					if (3*static_cast<size_t>(pixel[0])+2 >= palette.size()) return false;
+					std::memcpy(out, &palette[3*pixel[0]], 3);
+				}
+				else if (channels < 3) {
+					out[0] = out[1] = out[2] = pixel[0];
+				}
+				else {
+					for (unsigned int c=0; c<3; ++c) out[c] = pixel[c*sample_size];
+				}
+			}
+		}
+		return true;
+	}
+};
+
+} //Namespace GLUtils
+
+#endif
@@ -0,0 +1,177 @@
+#include "Benchmark.h"
+
+#include <map>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+
+#include "Timer.h"
+
+namespace {
+	std::string quote(const std::string& value) {
+		std::string result = "\"";
+		for (size_t i=0; i<value.size(); ++i) {
+			if (value[i] == '"' || value[i] == '\\') result += '\\';
+			result += value[i];
+		}
+		return result + "\"";
+	}
+
+	/**
+	  * Returns the value of key in one JSON object of a report, without quotes
+	  * for strings, or an empty string if it is missing
+	  */
+	std::string getField(const std::string& object, const std::string& key) {
+		size_t pos = object.find(quote(key));
+		if (pos == std::string::npos) return "";
+		pos = object.find(':', pos);
+		if (pos == std::string::npos) return "";
+		pos = object.find_first_not_of(" \t\r\n", pos+1);
+		if (pos == std::string::npos) return "";
+
+		std::string value;
+		if (object[pos] == '"') {
+			for (++pos; pos < object.size() && object[pos] != '"'; ++pos) {
+				if (object[pos] == '\\' && pos+1 < object.size()) ++pos;
+				value += object[pos];
+			}
+		}
+		else {
+			size_t end = object.find_first_of(",} \t\r\n", pos);
+			value = object.substr(pos, end-pos);
+		}
+		return value;
+	}
+}
+
+void BenchmarkReport::add(std::string name, std::string unit, double value, bool higher_is_better, std::ostream& out) {
+	BenchmarkResult result;
+	result.name = name;
+	result.unit = unit;
+	result.value = value;
+	result.higher_is_better = higher_is_better;
+	results.push_back(result);
+
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::left << std::setw(40) << name << " " << std::right << std::setw(14)
+		<< std::setprecision(6) << value << " " << unit << std::endl;
+	out.flags(flags);
+	out.precision(precision);
+}
+
+void BenchmarkReport::writeJson(std::ostream& out) const {
+	out << "{\n  \"benchmarks\": [\n";
+	for (unsigned int i=0; i<results.size(); ++i) {
+		const BenchmarkResult& r = results[i];
+		out << "    {\"name\": " << quote(r.name) << ", \"unit\": " << quote(r.unit)
+			<< ", \"value\": " << std::setprecision(9) << r.value
+			<< ", \"higher_is_better\": " << (r.higher_is_better ? "true" : "false") << "}"
+			<< ((i+1 < results.size()) ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+BenchmarkReport BenchmarkReport::readJson(std::string filename) {
+	std::ifstream in(filename.c_str());
+	if (!in.good()) {
+		std::stringstream log;
+		log << "Unable to read benchmark results from " << filename;
+		throw std::runtime_error(log.str());
+	}
+	std::stringstream contents;
+	contents << in.rdbuf();
+	std::string json = contents.str();
+
+	//Every result is one flat object inside the benchmarks array
+	BenchmarkReport report;
+	size_t begin = json.find('[');
+	while (begin != std::string::npos) {
+		begin = json.find('{', begin+1);
+		if (begin == std::string::npos) break;
+		size_t end = json.find('}', begin);
+		if (end == std::string::npos) break;
+		std::string object = json.substr(begin, end-begin+1);
+
+		BenchmarkResult result;
+		result.name = getField(object, "name");
+		result.unit = getField(object, "unit");
+		result.higher_is_better = (getField(object, "higher_is_better") == "true");
+		std::stringstream value(getField(object, "value"));
+		value >> result.value;
+		if (result.name.empty() || value.fail()) {
+			std::stringstream log;
+			log << "Invalid benchmark result " << object << " in " << filename;
+			throw std::runtime_error(log.str());
+		}
+		report.results.push_back(result);
+		begin = end;
+	}
+	return report;
+}
+
+unsigned int BenchmarkReport::compare(const BenchmarkReport& baseline, double tolerance, std::ostream& out) const {
+	std::map<std::string, const BenchmarkResult*> base;
+	for (unsigned int i=0; i<baseline.results.size(); ++i) {
+		base[baseline.results[i].name] = &baseline.results[i];
+	}
+
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	unsigned int regressions = 0;
+	out << std::left << std::setw(40) << "benchmark" << std::right << std::setw(14) << "baseline"
+		<< std::setw(14) << "current" << std::setw(10) << "change" << std::endl;
+	for (unsigned int i=0; i<results.size(); ++i) {
+		const BenchmarkResult& r = results[i];
+		out << std::left << std::setw(40) << r.name << std::right << std::setprecision(4);
+		std::map<std::string, const BenchmarkResult*>::iterator found = base.find(r.name);
+		if (found == base.end() || found->second->value <= 0.0) {
+			if (found != base.end()) base.erase(found);
+			out << std::setw(14) << "-" << std::setw(14) << r.value << "  not in baseline" << std::endl;
+			continue;
+		}
+
+		double old_value = found->second->value;
+		double change = (r.value - old_value)/old_value;
+		double worse = r.higher_is_better ? -change : change;
+		out << std::setw(14) << old_value << std::setw(14) << r.value << std::setw(9)
+			<< std::fixed << std::setprecision(1) << 100.0*change << "%" << std::defaultfloat;
+		if (worse > tolerance) {
+			out << "  REGRESSION";
+			++regressions;
+		}
+		out << std::endl;
+		base.erase(found);
+	}
+	for (std::map<std::string, const BenchmarkResult*>::iterator it=base.begin(); it!=base.end(); ++it) {
+		out << std::left << std::setw(40) << it->first << "  not run" << std::endl;
+	}
+	out.flags(flags);
+	out.precision(precision);
+	return regressions;
+}
+
+double measureRate(const std::function<void (size_t)>& run, double min_time, unsigned int repetitions) {
+	size_t n = 1;
+	double best = 0.0;
+	Timer timer;
+	while (true) {
+		timer.restart();
+		run(n);
+		double elapsed = timer.elapsed();
+		if (elapsed >= min_time) {
+			best = n/elapsed;
+			break;
+		}
+		n *= 2;
+	}
+
+	for (unsigned int i=1; i<repetitions; ++i) {
+		timer.restart();
+		run(n);
+		best = std::max(best, n/timer.elapsed());
+	}
+	return best;
+}
@@ -0,0 +1,91 @@
+#ifndef _BENCHMARK_H__
+#define _BENCHMARK_H__
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <functional>
+#include <utility>
+
+/**
+  * One measured number, such as the rate of a micro-benchmark or the time of
+  * a render
+  */
+struct BenchmarkResult {
+	std::string name; //< E.g., micro/sphere_intersect or macro/demo/800x600/4t
+	std::string unit;
+	double value;
+	bool higher_is_better;
+};
+
+/**
+  * What to run, see bench --help
+  */
+struct BenchmarkOptions {
+	std::vector<std::pair<unsigned int, unsigned int> > resolutions; //< Of the macro-benchmarks
+	std::vector<unsigned int> threads; //< Thread counts of the macro-benchmarks
+	unsigned int repetitions; //< The best of this many runs is reported
+	double min_time; //< Shortest run of a micro-benchmark, in seconds
+	std::string cube_map; //< Directory of the cube map used by the scenes
+	std::string filter; //< Only run benchmarks whose name contains this
+};
+
+/**
+  * The results of a benchmark run, which are written to and read from JSON
+  * files, so that a run can be compared with a stored baseline:
+  *
+  *   {
+  *     "benchmarks": [
+  *       {"name": "micro/sphere_intersect", "unit": "rays/s", "value": 123456789, "higher_is_better": true},
+  *       ...
+  *     ]
+  *   }
+  */
+class BenchmarkReport {
+public:
+	/**
+	  * Adds a result, and prints it to out as it comes in
+	  */
+	void add(std::string name, std::string unit, double value, bool higher_is_better, std::ostream& out);
+
+	inline const std::vector<BenchmarkResult>& getResults() const { return results; }
+
+	void writeJson(std::ostream& out) const;
+
+	/**
+	  * Reads a report written by writeJson()
+	  * @throws std::runtime_error if the file cannot be read
+	  */
+	static BenchmarkReport readJson(std::string filename);
+
+	/**
+	  * Prints how every result changed from the same result in baseline. A
+	  * result is a regression if it is worse than the baseline by more than
+	  * tolerance, a fraction of the baseline value.
+	  * @return The number of regressions
+	  */
+	unsigned int compare(const BenchmarkReport& baseline, double tolerance, std::ostream& out) const;
+
+private:
+	std::vector<BenchmarkResult> results;
+};
+
+/**
+  * Calls run(n), which is expected to do n units of work, with n doubling
+  * until one call takes at least min_time seconds, and then repeats that
+  * call. Returns the best rate seen, in units per second.
+  */
+double measureRate(const std::function<void (size_t)>& run, double min_time, unsigned int repetitions);
+
+/**
+  * Measures single intersection tests and shading calls, in calls per second,
+  * and BVH builds and refits, in primitives per second
+  */
+void runMicroBenchmarks(const BenchmarkOptions& options, BenchmarkReport& report, std::ostream& out);
+
+/**
+  * Renders the standard scenes at every resolution and thread count, in seconds per frame
+  */
+void runMacroBenchmarks(const BenchmarkOptions& options, BenchmarkReport& report, std::ostream& out);
+
+#endif
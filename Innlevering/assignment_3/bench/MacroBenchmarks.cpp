@@ -0,0 +1,134 @@
+#include "Benchmark.h"
+
+#include <cmath>
+#include <memory>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+
+#include "RayTracer.h"
+#include "DemoScene.hpp"
+#include "Sphere.hpp"
+#include "Triangle.h"
+#include "TriangleMesh.hpp"
+#include "SceneObjectEffect.hpp"
+#include "Timer.h"
+
+namespace {
+	/**
+	  * A scene to render, added to a ray tracer by setup
+	  */
+	struct StandardScene {
+		std::string name;
+		bool uses_cube_map;
+		std::function<void (RayTracer&)> setup;
+	};
+
+	/**
+	  * 10000 small spheres in a grid, alternately shaded with phong and
+	  * reflection, so that most of the time goes to the BVH and shadow rays
+	  */
+	void addSpheres(RayTracer& rt) {
+		std::shared_ptr<SceneObjectEffect> phong(new PhongEffect(glm::vec3(0.6f, 0.3f, 0.3f), glm::vec3(0.0f, 5.0f, 10.0f)));
+		std::shared_ptr<SceneObjectEffect> reflect(new ReflectSteelEffect());
+		for (int i=0; i<100; ++i) {
+			for (int j=0; j<100; ++j) {
+				glm::vec3 center(-5.0f + 0.1f*i, -5.0f + 0.1f*j, -2.0f + 0.5f*std::sin(0.3f*i)*std::cos(0.2f*j));
+				std::shared_ptr<SceneObject> sphere(new Sphere(center, 0.045f, ((i+j) % 2 == 0) ? phong : reflect));
+				rt.addSceneObject(sphere);
+			}
+		}
+	}
+
+	/**
+	  * A tessellated sphere of about 200000 triangles on a mirror floor
+	  */
+	void addMesh(RayTracer& rt) {
+		const unsigned int segments = 316;
+		const float pi = 3.14159265f;
+		std::vector<glm::vec3> vertices;
+		std::vector<unsigned int> indices;
+		for (unsigned int i=0; i<=segments; ++i) {
+			for (unsigned int j=0; j<segments; ++j) {
+				float theta = pi*i/segments;
+				float phi = 2.0f*pi*j/segments;
+				vertices.push_back(glm::vec3(0.0f, 0.0f, 2.0f) + 3.0f*glm::vec3(std::sin(theta)*std::cos(phi),
+					std::cos(theta), std::sin(theta)*std::sin(phi)));
+			}
+		}
+		for (unsigned int i=0; i<segments; ++i) {
+			for (unsigned int j=0; j<segments; ++j) {
+				unsigned int a = i*segments + j;
+				unsigned int b = i*segments + (j+1) % segments;
+				unsigned int c = a + segments;
+				unsigned int d = b + segments;
+				indices.push_back(a); indices.push_back(c); indices.push_back(b);
+				indices.push_back(b); indices.push_back(c); indices.push_back(d);
+			}
+		}
+
+		std::shared_ptr<SceneObjectEffect> phong(new PhongEffect(glm::vec3(0.3f), glm::vec3(0.0f, 5.0f, 10.0f)));
+		std::shared_ptr<SceneObject> mesh(new TriangleMesh(vertices, indices, phong));
+		rt.addSceneObject(mesh);
+
+		std::shared_ptr<SceneObjectEffect> reflect(new ReflectSteelEffect());
+		std::shared_ptr<SceneObject> floor0(new Triangle(glm::vec3(-20.0f, -3.0f, 20.0f), glm::vec3(20.0f, -3.0f, 20.0f), glm::vec3(-20.0f, -3.0f, -20.0f), reflect));
+		std::shared_ptr<SceneObject> floor1(new Triangle(glm::vec3(20.0f, -3.0f, 20.0f), glm::vec3(20.0f, -3.0f, -20.0f), glm::vec3(-20.0f, -3.0f, -20.0f), reflect));
+		rt.addSceneObject(floor0);
+		rt.addSceneObject(floor1);
+	}
+}
+
+void runMacroBenchmarks(const BenchmarkOptions& options, BenchmarkReport& report, std::ostream& out) {
+	std::shared_ptr<SceneObject> cube_map;
+	try {
+		cube_map = DemoScene::loadCubeMap(options.cube_map);
+	}
+	catch (std::runtime_error& e) {
+		out << "Skipping the scenes with a cube map: " << e.what() << std::endl;
+	}
+
+	std::vector<StandardScene> scenes;
+	StandardScene demo = { "demo", true, [&](RayTracer& rt) {
+		DemoScene::addObjects(rt);
+		rt.addSceneObject(cube_map);
+	} };
+	StandardScene spheres = { "spheres", false, addSpheres };
+	StandardScene mesh = { "mesh", true, [&](RayTracer& rt) {
+		addMesh(rt);
+		rt.addSceneObject(cube_map);
+	} };
+	scenes.push_back(demo);
+	scenes.push_back(spheres);
+	scenes.push_back(mesh);
+
+	for (unsigned int s=0; s<scenes.size(); ++s) {
+		if (scenes[s].uses_cube_map && !cube_map) continue;
+		for (unsigned int r=0; r<options.resolutions.size(); ++r) {
+			for (unsigned int t=0; t<options.threads.size(); ++t) {
+				unsigned int width = options.resolutions[r].first;
+				unsigned int height = options.resolutions[r].second;
+				std::stringstream name;
+				name << "macro/" << scenes[s].name << "/" << width << "x" << height << "/" << options.threads[t] << "t";
+				if (name.str().find(options.filter) == std::string::npos) continue;
+
+				RayTracer rt(width, height);
+				scenes[s].setup(rt);
+				rt.setThreads(options.threads[t]);
+
+				//The first render also builds the acceleration structure
+				rt.render();
+				double best = 0.0;
+				for (unsigned int i=0; i<options.repetitions; ++i) {
+					Timer timer;
+					rt.render();
+					double elapsed = timer.elapsed();
+					if (i == 0 || elapsed < best) best = elapsed;
+				}
+				report.add(name.str(), "s", best, false, out);
+			}
+		}
+	}
+}
@@ -0,0 +1,185 @@
+#include "Benchmark.h"
+
+#include <random>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+
+#include "RayTracerState.h"
+#include "BVH.hpp"
+#include "Sphere.hpp"
+#include "Triangle.h"
+#include "CubeMap.hpp"
+#include "DemoScene.hpp"
+#include "SceneObjectEffect.hpp"
+
+namespace {
+	const unsigned int n_rays = 4096; //< Power of two, so that the rays can be cycled with a mask
+	volatile unsigned int sink; //< Keeps the results of the benchmarks alive
+
+	/**
+	  * Rays from the origin towards random points in a box around target, of
+	  * which about half hit an object of size one at target
+	  */
+	std::vector<Ray> createRays(glm::vec3 target, float spread) {
+		std::mt19937 rng(612);
+		std::uniform_real_distribution<float> offset(-spread, spread);
+		std::vector<Ray> rays;
+		for (unsigned int i=0; i<n_rays; ++i) {
+			glm::vec3 point = target + glm::vec3(offset(rng), offset(rng), offset(rng));
+			rays.push_back(Ray(glm::vec3(0.0f), glm::normalize(point)));
+		}
+		return rays;
+	}
+
+	bool isSelected(const BenchmarkOptions& options, const std::string& name) {
+		return name.find(options.filter) != std::string::npos;
+	}
+
+	void benchmarkIntersect(const BenchmarkOptions& options, BenchmarkReport& report, std::ostream& out,
+			std::string name, SceneObject& object) {
+		if (!isSelected(options, name)) return;
+		std::vector<Ray> rays = createRays(glm::vec3(0.0f, 0.0f, -5.0f), 1.4f);
+		double rate = measureRate([&](size_t n) {
+			unsigned int hits = 0;
+			for (size_t i=0; i<n; ++i) {
+				HitRecord hit;
+				if (object.intersect(rays[i & (n_rays-1)], 0, hit)) ++hits;
+			}
+			sink += hits;
+		}, options.min_time, options.repetitions);
+		report.add(name, "rays/s", rate, true, out);
+	}
+
+	/**
+	  * Bounds of n small boxes at random positions in a cube, like the
+	  * triangles of a detailed mesh
+	  */
+	std::vector<AABB> createBoxes(unsigned int n, float offset) {
+		std::mt19937 rng(612);
+		std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+		std::uniform_real_distribution<float> size(0.01f, 0.1f);
+		std::vector<AABB> boxes;
+		for (unsigned int i=0; i<n; ++i) {
+			glm::vec3 p(position(rng)+offset, position(rng), position(rng));
+			boxes.push_back(AABB(p, p+glm::vec3(size(rng), size(rng), size(rng))));
+		}
+		return boxes;
+	}
+
+	/**
+	  * Building a BVH over 200000 primitives on one and on all hardware
+	  * threads, and refitting it to the primitives after they have moved
+	  */
+	void benchmarkBVH(const BenchmarkOptions& options, BenchmarkReport& report, std::ostream& out) {
+		const unsigned int n = 200000;
+		std::vector<AABB> boxes = createBoxes(n, 0.0f);
+		std::vector<unsigned int> threads(1, 1);
+		unsigned int hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+		if (hardware_threads > 1) threads.push_back(hardware_threads);
+		for (unsigned int t=0; t<threads.size(); ++t) {
+			std::stringstream name;
+			name << "micro/bvh_build/" << threads[t] << "t";
+			if (!isSelected(options, name.str())) continue;
+			double rate = measureRate([&](size_t iterations) {
+				for (size_t i=0; i<iterations; ++i) {
+					BVH bvh;
+					bvh.build(boxes, threads[t]);
+					sink += static_cast<unsigned int>(bvh.getNodes().size());
+				}
+			}, options.min_time, options.repetitions);
+			report.add(name.str(), "prims/s", n*rate, true, out);
+		}
+
+		if (isSelected(options, "micro/bvh_refit")) {
+			BVH bvh;
+			bvh.build(boxes);
+			std::vector<AABB> moved = createBoxes(n, 0.5f);
+			double rate = measureRate([&](size_t iterations) {
+				for (size_t i=0; i<iterations; ++i) {
+					sink += bvh.refit((i % 2 == 0) ? moved : boxes) ? 1 : 0;
+				}
+			}, options.min_time, options.repetitions);
+			report.add("micro/bvh_refit", "prims/s", n*rate, true, out);
+		}
+	}
+}
+
+void runMicroBenchmarks(const BenchmarkOptions& options, BenchmarkReport& report, std::ostream& out) {
+	std::shared_ptr<SceneObjectEffect> color(new ColorEffect(glm::vec3(1.0f)));
+
+	Sphere sphere(glm::vec3(0.0f, 0.0f, -5.0f), 1.0f, color);
+	benchmarkIntersect(options, report, out, "micro/sphere_intersect", sphere);
+
+	Triangle triangle(glm::vec3(-1.0f, -1.0f, -5.0f), glm::vec3(1.0f, -1.0f, -5.0f), glm::vec3(0.0f, 1.0f, -5.0f), color);
+	benchmarkIntersect(options, report, out, "micro/triangle_intersect", triangle);
+
+	benchmarkBVH(options, report, out);
+
+	//The rest shade with the cube map as the environment
+	bool lookup = isSelected(options, "micro/cubemap_lookup");
+	bool fresnel = isSelected(options, "micro/fresnel_raytrace");
+	if (!lookup && !fresnel) return;
+	std::shared_ptr<SceneObject> cube_map;
+	try {
+		cube_map = DemoScene::loadCubeMap(options.cube_map);
+	}
+	catch (std::runtime_error& e) {
+		out << "Skipping the cube map benchmarks: " << e.what() << std::endl;
+		return;
+	}
+
+	if (lookup) {
+		//Texture lookups in every direction, in the full size level
+		std::vector<Ray> rays = createRays(glm::vec3(0.0f), 1.0f);
+		RayTracerState state(glm::vec3(0.0f));
+		HitRecord hit;
+		SceneObjectEffect* effect = cube_map->getEffect();
+		double rate = measureRate([&](size_t n) {
+			float sum = 0.0f;
+			for (size_t i=0; i<n; ++i) {
+				Ray ray = rays[i & (n_rays-1)];
+				sum += effect->rayTrace(ray, hit, state).x;
+			}
+			sink += static_cast<unsigned int>(sum);
+		}, options.min_time, options.repetitions);
+		report.add("micro/cubemap_lookup", "lookups/s", rate, true, out);
+	}
+
+	if (fresnel) {
+		//Shading of glass, which traces the whole tree of reflected and
+		//refracted rays through the sphere and out into the cube map
+		std::shared_ptr<SceneObjectEffect> glass(new FresnelEffect());
+		std::shared_ptr<SceneObject> ball(new Sphere(glm::vec3(0.0f, 0.0f, -5.0f), 1.0f, glass));
+		RayTracerState state(glm::vec3(0.0f));
+		state.addSceneObject(ball);
+		state.addSceneObject(cube_map);
+		state.buildAccelerationStructure();
+
+		std::vector<Ray> rays;
+		std::vector<HitRecord> hits;
+		std::vector<Ray> candidates = createRays(glm::vec3(0.0f, 0.0f, -5.0f), 0.7f);
+		for (unsigned int i=0; rays.size() < n_rays; ++i) {
+			const Ray& ray = candidates[i % n_rays];
+			HitRecord hit;
+			if (!ball->intersect(ray, 0, hit)) continue;
+			hit.point = ray.getOrigin() + ray.getDirection()*hit.t;
+			rays.push_back(ray);
+			hits.push_back(hit);
+		}
+
+		double rate = measureRate([&](size_t n) {
+			float sum = 0.0f;
+			for (size_t i=0; i<n; ++i) {
+				Ray ray = rays[i & (n_rays-1)];
+				sum += glass->rayTrace(ray, hits[i & (n_rays-1)], state).x;
+			}
+			sink += static_cast<unsigned int>(sum);
+		}, options.min_time, options.repetitions);
+		report.add("micro/fresnel_raytrace", "calls/s", rate, true, out);
+	}
+}
@@ -0,0 +1,134 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Benchmark.h"
+
+namespace {
+	void printUsage() {
+		std::cout << "Usage: bench [options]\n"
+			"  --micro               Only run the micro-benchmarks\n"
+			"  --macro               Only run the macro-benchmarks\n"
+			"  --quick               One small resolution on all threads, and shorter runs\n"
+			"  --filter text         Only run benchmarks whose name contains text\n"
+			"  --resolutions list    Macro-benchmark resolutions (320x240,800x600,1920x1080)\n"
+			"  --threads list        Macro-benchmark thread counts (1 and all hardware threads)\n"
+			"  --repetitions n       Report the best of n runs (3)\n"
+			"  --cubemap directory   Cube map of the scenes (cubemaps/SaintLazarusChurch3)\n"
+			"  --json file           Write the results to file\n"
+			"  --baseline file       Compare the results with those in file, written by --json\n"
+			"  --tolerance fraction  How much worse than the baseline is a regression (0.1)\n"
+			"Exits with status 2 if any benchmark regressed.\n";
+	}
+
+	std::vector<std::string> split(const std::string& list) {
+		std::vector<std::string> parts;
+		std::stringstream in(list);
+		std::string part;
+		while (std::getline(in, part, ',')) parts.push_back(part);
+		return parts;
+	}
+
+	std::vector<std::pair<unsigned int, unsigned int> > parseResolutions(const std::string& list) {
+		std::vector<std::pair<unsigned int, unsigned int> > resolutions;
+		std::vector<std::string> parts = split(list);
+		for (unsigned int i=0; i<parts.size(); ++i) {
+			unsigned int width = 0, height = 0;
+			char x = 0;
+			std::stringstream in(parts[i]);
+			in >> width >> x >> height;
+			if (in.fail() || x != 'x' || width == 0 || height == 0) {
+				throw std::runtime_error("Invalid resolution " + parts[i] + ", expected e.g. 800x600");
+			}
+			resolutions.push_back(std::make_pair(width, height));
+		}
+		return resolutions;
+	}
+
+	std::vector<unsigned int> parseThreads(const std::string& list) {
+		std::vector<unsigned int> threads;
+		std::vector<std::string> parts = split(list);
+		for (unsigned int i=0; i<parts.size(); ++i) {
+			int n = std::atoi(parts[i].c_str());
+			if (n <= 0) throw std::runtime_error("Invalid thread count " + parts[i]);
+			threads.push_back(static_cast<unsigned int>(n));
+		}
+		return threads;
+	}
+}
+
+/**
+  * Runs the micro- and macro-benchmarks of the ray tracer, see printUsage()
+  */
+int main(int argc, char *argv[]) {
+	try {
+		unsigned int hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+		BenchmarkOptions options;
+		options.resolutions = parseResolutions("320x240,800x600,1920x1080");
+		options.threads.push_back(1);
+		if (hardware_threads > 1) options.threads.push_back(hardware_threads);
+		options.repetitions = 3;
+		options.min_time = 0.2;
+		options.cube_map = "cubemaps/SaintLazarusChurch3";
+
+		bool micro = true;
+		bool macro = true;
+		std::string json;
+		std::string baseline;
+		double tolerance = 0.1;
+
+		for (int i=1; i<argc; ++i) {
+			std::string arg = argv[i];
+			bool has_value = (i+1 < argc);
+			if (arg == "--micro") macro = false;
+			else if (arg == "--macro") micro = false;
+			else if (arg == "--quick") {
+				options.resolutions = parseResolutions("320x240");
+				options.threads.assign(1, hardware_threads);
+				options.repetitions = 1;
+				options.min_time = 0.05;
+			}
+			else if (arg == "--filter" && has_value) options.filter = argv[++i];
+			else if (arg == "--resolutions" && has_value) options.resolutions = parseResolutions(argv[++i]);
+			else if (arg == "--threads" && has_value) options.threads = parseThreads(argv[++i]);
+			else if (arg == "--repetitions" && has_value) options.repetitions = std::max(std::atoi(argv[++i]), 1);
+			else if (arg == "--cubemap" && has_value) options.cube_map = argv[++i];
+			else if (arg == "--json" && has_value) json = argv[++i];
+			else if (arg == "--baseline" && has_value) baseline = argv[++i];
+			else if (arg == "--tolerance" && has_value) tolerance = std::atof(argv[++i]);
+			else {
+				printUsage();
+				return (arg == "--help") ? 0 : 1;
+			}
+		}
+
+		BenchmarkReport report;
+		if (micro) runMicroBenchmarks(options, report, std::cout);
+		if (macro) runMacroBenchmarks(options, report, std::cout);
+
+		if (!json.empty()) {
+			std::ofstream out(json.c_str());
+			report.writeJson(out);
+			if (!out.good()) throw std::runtime_error("Unable to write " + json);
+			std::cout << "Wrote " << json << std::endl;
+		}
+
+		if (!baseline.empty()) {
+			std::cout << std::endl;
+			unsigned int regressions = report.compare(BenchmarkReport::readJson(baseline), tolerance, std::cout);
+			if (regressions > 0) {
+				std::cout << regressions << " benchmarks regressed by more than " << 100.0*tolerance << "%" << std::endl;
+				return 2;
+			}
+		}
+	} catch (std::exception &e) {
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
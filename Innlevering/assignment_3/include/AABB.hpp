@@ -0,0 +1,89 @@
+#ifndef _AABB_HPP__
+#define _AABB_HPP__
+
+#include <algorithm>
+#include <limits>
+
+#include <glm/glm.hpp>
+
+/**
+  * Axis aligned bounding box, used by the acceleration structures
+  * to quickly cull objects a ray cannot possibly hit
+  */
+struct AABB {
+	AABB() {
+		reset();
+	}
+
+	AABB(glm::vec3 min, glm::vec3 max) {
+		this->min = min;
+		this->max = max;
+	}
+
+	/**
+	  * Resets the box to an empty (inverted) box
+	  */
+	inline void reset() {
+		min = glm::vec3(std::numeric_limits<float>::max());
+		max = glm::vec3(-std::numeric_limits<float>::max());
+	}
+
+	/**
+	  * Grows the box so that it contains the point p
+	  */
+	inline void expand(const glm::vec3& p) {
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	/**
+	  * Grows the box so that it contains the box b
+	  */
+	inline void expand(const AABB& b) {
+		min = glm::min(min, b.min);
+		max = glm::max(max, b.max);
+	}
+
+	inline glm::vec3 getCentroid() const { return (min+max)*0.5f; }
+
+	inline bool isEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+	/**
+	  * Returns the surface area of the box, used by the SAH cost model
+	  */
+	inline float getSurfaceArea() const {
+		if (isEmpty()) return 0.0f;
+		glm::vec3 d = max-min;
+		return 2.0f*(d.x*d.y + d.y*d.z + d.z*d.x);
+	}
+
+	/**
+	  * Slab test against the ray origin + t*dir, for t in [0, t_max]
+	  * @param inv_dir 1/direction, precomputed once per ray
+	  * @param t_near Set to the entry distance if the box is hit
+	  * @return true if the box is hit within [0, t_max]
+	  */
+	inline bool intersect(const glm::vec3& origin, const glm::vec3& inv_dir, float t_max, float& t_near) const {
+		//1 + 2*gamma(3), the bound on the relative rounding error of the slab
+		//distances, see Ize, "Robust BVH Ray Traversal", JCGT 2013
+		const float robust_scale = 1.0000004f;
+		float t0 = 0.0f;
+		float t1 = t_max;
+		for (int k=0; k<3; ++k) {
+			float ta = (min[k]-origin[k])*inv_dir[k];
+			float tb = (max[k]-origin[k])*inv_dir[k];
+			//Written so that NaNs (origin on a slab with a zero direction) are ignored.
+			//The far distance is rounded up, so that rounding errors never make a
+			//ray that grazes the box (e.g., through a vertex) miss it.
+			t0 = std::max(t0, std::min(ta, tb));
+			t1 = std::min(t1, std::max(ta, tb)*robust_scale);
+		}
+		t_near = t0;
+		return t0 <= t1;
+	}
+
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+#endif
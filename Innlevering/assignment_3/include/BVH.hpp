@@ -0,0 +1,533 @@
+#ifndef _BVH_HPP__
+#define _BVH_HPP__
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+
+#include "AABB.hpp"
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+#include "StorageArray.hpp"
+#include "SceneBlob.hpp"
+#include "RayCounters.hpp"
+
+/**
+  * Bounding volume hierarchy over a set of bounded primitives. The BVH only
+  * knows about the bounding boxes of the primitives, and it is up to the
+  * user to supply the actual intersection test during traversal. The tree
+  * is built top-down using a binned surface area heuristic (SAH), and can
+  * be refitted to primitives that have moved without building it again.
+  */
+class BVH {
+public:
+	/**
+	  * A node in the flattened tree. Interior nodes store their left child
+	  * directly after themselves, and the right child at offset. Leaves
+	  * store count primitives starting at offset in the index list.
+	  */
+	struct Node {
+		AABB bounds;
+		unsigned int offset;
+		unsigned int count; //< 0 for interior nodes
+	};
+
+	BVH() {
+		build_cost = 0.0f;
+	}
+
+	/**
+	  * Builds the hierarchy over primitives with the given bounds. Primitive k
+	  * in bounds is referred to as k when traversing. Large hierarchies are
+	  * built on n_threads threads, 0 for all hardware threads: the subtrees
+	  * of the nodes near the root are built concurrently into arrays of their
+	  * own, which are then joined. The tree is the same for any number of threads.
+	  */
+	void build(const std::vector<AABB>& bounds, unsigned int n_threads=0) {
+		nodes.clear();
+		indices.clear();
+		build_cost = 0.0f;
+		if (bounds.empty()) return;
+
+		std::vector<BuildPrimitive> prims(bounds.size());
+		for (unsigned int k=0; k<bounds.size(); ++k) {
+			prims[k].bounds = bounds[k];
+			prims[k].centroid = bounds[k].getCentroid();
+			prims[k].index = k;
+		}
+		if (n_threads == 0) n_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+		Subtree tree;
+		tree.nodes.reserve(2*bounds.size());
+		tree.indices.reserve(bounds.size());
+		buildRecursive(prims, 0, static_cast<unsigned int>(prims.size()), 0, n_threads, tree);
+		nodes.swap(tree.nodes);
+		indices.swap(tree.indices);
+		build_cost = getCost();
+	}
+
+	/**
+	  * Updates the bounds of every node to new bounds of the primitives,
+	  * given like to build(), keeping the tree as it is. This is much faster
+	  * than build(), but the tree gets worse the further the primitives move
+	  * from where they were when it was built.
+	  * @return false if the tree has become so much worse that it should be built again
+	  */
+	bool refit(const std::vector<AABB>& bounds) {
+		if (bounds.size() != indices.size()) {
+			throw std::runtime_error("Unable to refit a BVH to a different number of primitives");
+		}
+
+		//Children are stored after their parents, so going backwards
+		//refits both children of a node before the node itself
+		std::vector<Node> refitted(nodes.data(), nodes.data()+nodes.size());
+		for (size_t i=refitted.size(); i-- > 0; ) {
+			Node& node = refitted[i];
+			node.bounds.reset();
+			if (node.count > 0) {
+				for (unsigned int j=node.offset; j<node.offset+node.count; ++j) node.bounds.expand(bounds[indices[j]]);
+			}
+			else {
+				node.bounds.expand(refitted[i+1].bounds);
+				node.bounds.expand(refitted[node.offset].bounds);
+			}
+		}
+		nodes.swap(refitted);
+
+		//Allow the refitted tree to cost up to twice as much as the built tree
+		return getCost() <= 2.0f*build_cost;
+	}
+
+	/**
+	  * Returns the SAH cost of the tree: the expected number of nodes visited
+	  * and primitives tested by a ray through the bounds of the root
+	  */
+	float getCost() const {
+		if (nodes.empty()) return 0.0f;
+		float root_area = nodes[0].bounds.getSurfaceArea();
+		if (root_area <= 0.0f) return 0.0f;
+
+		float cost = 0.0f;
+		for (unsigned int i=0; i<nodes.size(); ++i) {
+			cost += nodes[i].bounds.getSurfaceArea()*((nodes[i].count > 0) ? nodes[i].count : getTraversalCost());
+		}
+		return cost/root_area;
+	}
+
+	inline bool isEmpty() const { return nodes.empty(); }
+	inline const StorageArray<Node>& getNodes() const { return nodes; }
+	inline const StorageArray<unsigned int>& getIndices() const { return indices; }
+
+	/**
+	  * Writes the built hierarchy, which read() uses in place without building it again
+	  */
+	void write(BlobWriter& out) const {
+		out.writeArray(nodes);
+		out.writeArray(indices);
+	}
+
+	void read(BlobReader& in) {
+		in.readArray(nodes);
+		in.readArray(indices);
+		build_cost = getCost();
+	}
+
+	/**
+	  * Visits every primitive whose leaf the ray passes through before t_max,
+	  * front to back. The callback intersect(k) is called with the primitive
+	  * index k, and is expected to shrink t_max when it finds a closer hit, so
+	  * that subtrees further away than the closest hit so far are skipped.
+	  */
+	template <typename IntersectFunc>
+	inline void traverse(const Ray& ray, const float& t_max, IntersectFunc& intersect) const {
+		LeafVisitor<IntersectFunc> visitor(indices, intersect);
+		traverseLeaves(ray, t_max, visitor);
+	}
+
+	/**
+	  * Same as traverse(), but calls visit_leaf(offset, count) once per leaf
+	  * instead of once per primitive. Positions [offset, offset+count) refer
+	  * to getIndices(), which lets users that store their primitives in index
+	  * order loop over contiguous memory.
+	  */
+	template <typename LeafFunc>
+	inline void traverseLeaves(const Ray& ray, const float& t_max, LeafFunc& visit_leaf) const {
+		if (nodes.empty()) return;
+
+		const glm::vec3& origin = ray.getOrigin();
+		const glm::vec3& dir = ray.getDirection();
+		const glm::vec3 inv_dir(1.0f/dir.x, 1.0f/dir.y, 1.0f/dir.z);
+
+		unsigned int stack[max_depth];
+		unsigned int stack_size = 0;
+		unsigned int current = 0;
+		float t_near;
+
+		RayCounters::countNodeTests(1);
+		if (!nodes[0].bounds.intersect(origin, inv_dir, t_max, t_near)) return;
+
+		while (true) {
+			const Node& node = nodes[current];
+			if (node.count > 0) {
+				RayCounters::countPrimitiveTests(node.count);
+				visit_leaf(node.offset, node.count);
+			}
+			else {
+				unsigned int left = current+1;
+				unsigned int right = node.offset;
+				float t_left, t_right;
+				RayCounters::countNodeTests(2);
+				bool hit_left = nodes[left].bounds.intersect(origin, inv_dir, t_max, t_left);
+				bool hit_right = nodes[right].bounds.intersect(origin, inv_dir, t_max, t_right);
+
+				if (hit_left && hit_right) {
+					//Visit the closest child first, and come back for the other one
+					if (t_right < t_left) std::swap(left, right);
+					stack[stack_size++] = right;
+					current = left;
+					continue;
+				}
+				else if (hit_left) {
+					current = left;
+					continue;
+				}
+				else if (hit_right) {
+					current = right;
+					continue;
+				}
+			}
+
+			//Pop the next node off the stack, skipping nodes that are now
+			//further away than the closest hit
+			bool found = false;
+			while (stack_size > 0 && !found) {
+				current = stack[--stack_size];
+				RayCounters::countNodeTests(1);
+				found = nodes[current].bounds.intersect(origin, inv_dir, t_max, t_near);
+			}
+			if (!found) break;
+		}
+	}
+
+	/**
+	  * Any-hit version of traverseLeaves(): visits the leaves the ray passes
+	  * through before t_max, in no particular order, until visit_leaf(offset, count)
+	  * returns true. Since t_max never shrinks, children are only tested once.
+	  * @return true if visit_leaf() returned true for some leaf
+	  */
+	template <typename LeafFunc>
+	inline bool traverseLeavesAny(const Ray& ray, float t_max, LeafFunc& visit_leaf) const {
+		if (nodes.empty()) return false;
+
+		const glm::vec3& origin = ray.getOrigin();
+		const glm::vec3& dir = ray.getDirection();
+		const glm::vec3 inv_dir(1.0f/dir.x, 1.0f/dir.y, 1.0f/dir.z);
+
+		unsigned int stack[max_depth];
+		unsigned int stack_size = 0;
+		unsigned int current = 0;
+		float t_near;
+
+		RayCounters::countNodeTests(1);
+		if (!nodes[0].bounds.intersect(origin, inv_dir, t_max, t_near)) return false;
+
+		while (true) {
+			const Node& node = nodes[current];
+			if (node.count > 0) {
+				RayCounters::countPrimitiveTests(node.count);
+				if (visit_leaf(node.offset, node.count)) return true;
+			}
+			else {
+				unsigned int left = current+1;
+				unsigned int right = node.offset;
+				RayCounters::countNodeTests(2);
+				bool hit_left = nodes[left].bounds.intersect(origin, inv_dir, t_max, t_near);
+				bool hit_right = nodes[right].bounds.intersect(origin, inv_dir, t_max, t_near);
+
+				if (hit_left && hit_right) {
+					stack[stack_size++] = right;
+					current = left;
+					continue;
+				}
+				else if (hit_left) {
+					current = left;
+					continue;
+				}
+				else if (hit_right) {
+					current = right;
+					continue;
+				}
+			}
+
+			if (stack_size == 0) return false;
+			current = stack[--stack_size];
+		}
+	}
+
+	/**
+	  * Packet version of traverse(): visits every leaf that at least one active
+	  * ray in the packet passes through before its closest hit so far. The
+	  * callback intersect(k) is expected to update the hits in the packet.
+	  */
+	template <typename IntersectFunc>
+	inline void traversePacket(const RayPacket& packet, const PacketKernels& kernels, IntersectFunc& intersect) const {
+		LeafVisitor<IntersectFunc> visitor(indices, intersect);
+		traversePacketLeaves(packet, kernels, visitor);
+	}
+
+	/**
+	  * Packet version of traverseLeaves()
+	  */
+	template <typename LeafFunc>
+	inline void traversePacketLeaves(const RayPacket& packet, const PacketKernels& kernels, LeafFunc& visit_leaf) const {
+		if (nodes.empty()) return;
+
+		unsigned int stack[max_depth];
+		unsigned int stack_size = 0;
+		unsigned int current = 0;
+		const unsigned int lanes = RayCounters::countLanes(packet.active);
+
+		RayCounters::countNodeTests(lanes);
+		if (!intersectBox(packet, kernels, 0)) return;
+
+		while (true) {
+			const Node& node = nodes[current];
+			if (node.count > 0) {
+				RayCounters::countPrimitiveTests(node.count*lanes);
+				visit_leaf(node.offset, node.count);
+			}
+			else {
+				unsigned int left = current+1;
+				unsigned int right = node.offset;
+				RayCounters::countNodeTests(2*lanes);
+				bool hit_left = intersectBox(packet, kernels, left);
+				bool hit_right = intersectBox(packet, kernels, right);
+
+				if (hit_left && hit_right) {
+					stack[stack_size++] = right;
+					current = left;
+					continue;
+				}
+				else if (hit_left) {
+					current = left;
+					continue;
+				}
+				else if (hit_right) {
+					current = right;
+					continue;
+				}
+			}
+
+			bool found = false;
+			while (stack_size > 0 && !found) {
+				current = stack[--stack_size];
+				RayCounters::countNodeTests(lanes);
+				found = intersectBox(packet, kernels, current);
+			}
+			if (!found) break;
+		}
+	}
+
+private:
+	static const unsigned int max_depth = 64;
+	static const unsigned int max_leaf_size = 4;
+	static const unsigned int n_bins = 12;
+	static const unsigned int parallel_size = 4096; //< Smallest subtree split between two threads
+
+	struct BuildPrimitive {
+		AABB bounds;
+		glm::vec3 centroid;
+		unsigned int index;
+	};
+
+	struct Bin {
+		AABB bounds;
+		unsigned int count;
+	};
+
+	/**
+	  * The nodes and indices of a (sub)tree under construction, with offsets
+	  * relative to its own arrays
+	  */
+	struct Subtree {
+		std::vector<Node> nodes;
+		std::vector<unsigned int> indices;
+	};
+
+	/**
+	  * Adapts a per-primitive callback to a per-leaf callback
+	  */
+	template <typename IntersectFunc>
+	struct LeafVisitor {
+		LeafVisitor(const StorageArray<unsigned int>& indices, IntersectFunc& intersect)
+			: indices(indices), intersect(intersect) {}
+
+		inline void operator()(unsigned int offset, unsigned int count) {
+			for (unsigned int i=offset; i<offset+count; ++i) {
+				intersect(indices[i]);
+			}
+		}
+
+		const StorageArray<unsigned int>& indices;
+		IntersectFunc& intersect;
+	};
+
+	/**
+	  * Builds the subtree for prims[begin, end) into tree on up to n_threads
+	  * threads, and returns its node index
+	  */
+	unsigned int buildRecursive(std::vector<BuildPrimitive>& prims, unsigned int begin, unsigned int end, unsigned int depth,
+			unsigned int n_threads, Subtree& tree) {
+		unsigned int node_index = static_cast<unsigned int>(tree.nodes.size());
+		tree.nodes.push_back(Node());
+
+		AABB bounds, centroid_bounds;
+		for (unsigned int i=begin; i<end; ++i) {
+			bounds.expand(prims[i].bounds);
+			centroid_bounds.expand(prims[i].centroid);
+		}
+		tree.nodes[node_index].bounds = bounds;
+
+		unsigned int count = end-begin;
+		glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+		int axis = (extent.x > extent.y) ? ((extent.x > extent.z) ? 0 : 2) : ((extent.y > extent.z) ? 1 : 2);
+
+		//All centroids in one point, or too few primitives to bother splitting
+		if (count <= 1 || extent[axis] <= 0.0f || depth+1 >= max_depth) {
+			makeLeaf(prims, begin, end, node_index, tree);
+			return node_index;
+		}
+
+		//Find the cheapest split plane along each axis using binning
+		float best_cost = std::numeric_limits<float>::max();
+		int best_axis = -1;
+		unsigned int best_split = 0;
+		for (int a=0; a<3; ++a) {
+			if (extent[a] <= 0.0f) continue;
+
+			Bin bins[n_bins];
+			for (unsigned int b=0; b<n_bins; ++b) bins[b].count = 0;
+			for (unsigned int i=begin; i<end; ++i) {
+				unsigned int b = getBin(prims[i].centroid, centroid_bounds, a);
+				bins[b].count++;
+				bins[b].bounds.expand(prims[i].bounds);
+			}
+
+			//Sweep from the right to get the cost of everything right of each plane
+			float right_area[n_bins];
+			unsigned int right_count[n_bins];
+			AABB acc;
+			unsigned int acc_count = 0;
+			for (unsigned int b=n_bins-1; b>0; --b) {
+				acc.expand(bins[b].bounds);
+				acc_count += bins[b].count;
+				right_area[b] = acc.getSurfaceArea();
+				right_count[b] = acc_count;
+			}
+
+			acc.reset();
+			acc_count = 0;
+			for (unsigned int b=0; b<n_bins-1; ++b) {
+				acc.expand(bins[b].bounds);
+				acc_count += bins[b].count;
+				float cost = acc_count*acc.getSurfaceArea() + right_count[b+1]*right_area[b+1];
+				if (acc_count > 0 && right_count[b+1] > 0 && cost < best_cost) {
+					best_cost = cost;
+					best_axis = a;
+					best_split = b;
+				}
+			}
+		}
+
+		//SAH cost relative to intersecting everything in a leaf
+		float leaf_cost = static_cast<float>(count);
+		float split_cost = getTraversalCost() + best_cost/bounds.getSurfaceArea();
+		if (best_axis < 0 || (count <= max_leaf_size && leaf_cost <= split_cost)) {
+			makeLeaf(prims, begin, end, node_index, tree);
+			return node_index;
+		}
+
+		BuildPrimitive* first = &prims[0]+begin;
+		BuildPrimitive* last = &prims[0]+end;
+		BuildPrimitive* middle = std::partition(first, last, [&](const BuildPrimitive& p) {
+			return getBin(p.centroid, centroid_bounds, best_axis) <= best_split;
+		});
+		unsigned int mid = begin + static_cast<unsigned int>(middle-first);
+
+		unsigned int right;
+		if (n_threads > 1 && count >= parallel_size) {
+			//Build the left subtree on another thread, which only touches
+			//prims[begin, mid), and put both subtrees behind this node
+			Subtree left_tree, right_tree;
+			std::exception_ptr error;
+			std::thread worker([&]() {
+				try {
+					buildRecursive(prims, begin, mid, depth+1, n_threads/2, left_tree);
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+			});
+			buildRecursive(prims, mid, end, depth+1, n_threads-n_threads/2, right_tree);
+			worker.join();
+			if (error) std::rethrow_exception(error);
+			append(tree, left_tree);
+			right = append(tree, right_tree);
+		}
+		else {
+			buildRecursive(prims, begin, mid, depth+1, n_threads, tree);
+			right = buildRecursive(prims, mid, end, depth+1, n_threads, tree);
+		}
+		tree.nodes[node_index].offset = right;
+		tree.nodes[node_index].count = 0;
+		return node_index;
+	}
+
+	inline void makeLeaf(const std::vector<BuildPrimitive>& prims, unsigned int begin, unsigned int end, unsigned int node_index,
+			Subtree& tree) {
+		tree.nodes[node_index].offset = static_cast<unsigned int>(tree.indices.size());
+		tree.nodes[node_index].count = end-begin;
+		for (unsigned int i=begin; i<end; ++i) tree.indices.push_back(prims[i].index);
+	}
+
+	/**
+	  * Cost of visiting a node, relative to intersecting a primitive
+	  */
+	static inline float getTraversalCost() { return 1.0f; }
+
+	/**
+	  * Appends the subtree sub to tree, and returns the node index of its root
+	  */
+	static unsigned int append(Subtree& tree, const Subtree& sub) {
+		unsigned int node_base = static_cast<unsigned int>(tree.nodes.size());
+		unsigned int index_base = static_cast<unsigned int>(tree.indices.size());
+		for (unsigned int i=0; i<sub.nodes.size(); ++i) {
+			Node node = sub.nodes[i];
+			node.offset += (node.count > 0) ? index_base : node_base;
+			tree.nodes.push_back(node);
+		}
+		tree.indices.insert(tree.indices.end(), sub.indices.begin(), sub.indices.end());
+		return node_base;
+	}
+
+	inline bool intersectBox(const RayPacket& packet, const PacketKernels& kernels, unsigned int node) const {
+		const AABB& b = nodes[node].bounds;
+		return kernels.intersectBox(packet, &b.min[0], &b.max[0]) != 0;
+	}
+
+	static inline unsigned int getBin(const glm::vec3& centroid, const AABB& centroid_bounds, int axis) {
+		float rel = (centroid[axis]-centroid_bounds.min[axis]) / (centroid_bounds.max[axis]-centroid_bounds.min[axis]);
+		unsigned int b = static_cast<unsigned int>(rel*n_bins);
+		return std::min(b, n_bins-1);
+	}
+
+	StorageArray<Node> nodes;
+	StorageArray<unsigned int> indices;
+	float build_cost; //< Of the tree as built, see getCost()
+};
+
+#endif
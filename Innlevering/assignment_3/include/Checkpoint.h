@@ -0,0 +1,162 @@
+#ifndef _CHECKPOINT_H__
+#define _CHECKPOINT_H__
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "TileScheduler.h"
+
+/**
+  * The samples taken in the pixels of one tile, and the sampling settings
+  * they were taken with. Pixels are stored row by row from the bottom.
+  */
+struct TileSamples {
+	std::vector<glm::vec3> sum; //< Sum of the samples in each pixel
+	std::vector<float> sum_sq; //< Sum of the squared luminance of the samples in each pixel
+	std::vector<unsigned int> count; //< Number of samples in each pixel
+	unsigned int min_samples; //< See RayTracer::setAdaptiveSampling()
+	unsigned int max_samples; //< 0 for four samples at fixed offsets
+	float threshold;
+
+	TileSamples() {
+		min_samples = 0;
+		max_samples = 0;
+		threshold = 0.0f;
+	}
+
+	inline bool sameSettings(const TileSamples& other) const {
+		return min_samples == other.min_samples && max_samples == other.max_samples && threshold == other.threshold;
+	}
+};
+
+/**
+  * A file holding the finished tiles of a render, so that an interrupted
+  * render can be resumed without rendering them again. Tiles are appended
+  * as they finish, and written to disk every few seconds. A tile appended
+  * more than once, when a resumed render refines it, is read back from its
+  * last record. Opening the file for resuming compacts it to the last
+  * record of each tile, and drops a record cut short by a crash.
+  */
+class Checkpoint {
+public:
+	/**
+	  * What the samples in the file depend on. A file with another key is
+	  * started over instead of resumed.
+	  */
+	struct Key {
+		uint32_t width;
+		uint32_t height;
+		uint32_t tile_size;
+		uint32_t adaptive; //< 1 for adaptive sampling, 0 for four samples at fixed offsets
+		uint64_t scene; //< See RayTracerState::getGeometryHash()
+		uint64_t effects; //< See RayTracerState::getEffectHash()
+		glm::vec3 camera;
+	};
+
+	/**
+	  * Opens the checkpoint file of the image described by key
+	  * @param resume Keeps the tiles already in the file, instead of starting over
+	  * @param interval Seconds between writes of the finished tiles to disk
+	  * @throws std::runtime_error if the file cannot be written, or is not a checkpoint file
+	  */
+	Checkpoint(std::string filename, const Key& key, bool resume, double interval=30.0);
+	~Checkpoint();
+
+	/**
+	  * Reads the samples of a tile from the file
+	  * @return false if the tile is not in the file
+	  */
+	bool find(const Tile& tile, TileSamples& samples);
+
+	/**
+	  * Appends the samples of a finished tile. Can be called from several
+	  * threads at the same time.
+	  */
+	void add(const Tile& tile, const TileSamples& samples);
+
+	/**
+	  * Writes the tiles added so far to disk
+	  */
+	void flush();
+
+	/**
+	  * Returns the number of tiles found in the file when it was opened
+	  */
+	inline unsigned int getResumedTileCount() const { return resumed_tiles; }
+
+	/**
+	  * Returns why the tiles in the file were not resumed, e.g., since it is of
+	  * another camera position, or an empty string
+	  */
+	inline const std::string& getDiscardReason() const { return discard_reason; }
+
+private:
+	Checkpoint(const Checkpoint&);
+	Checkpoint& operator=(const Checkpoint&);
+
+	static const uint32_t version = 3;
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		Key key;
+	};
+
+	struct RecordHeader {
+		uint32_t tile; //< Tile index
+		uint32_t pixels;
+		uint32_t min_samples;
+		uint32_t max_samples;
+		float threshold;
+		uint32_t checksum; //< Of the pixels
+	};
+
+	struct Pixel {
+		float sum[3];
+		float sum_sq;
+		uint32_t count;
+	};
+
+	static const char* getMagic() {
+		return "RTCHKPNT";
+	}
+
+	static uint32_t checksum(const std::vector<Pixel>& pixels);
+
+	/**
+	  * Reads the record at offset of in, checking that it is complete
+	  */
+	static bool readRecord(std::istream& in, uint64_t offset, RecordHeader& header, std::vector<Pixel>& pixels);
+
+	/**
+	  * Returns why a file with the header old cannot be resumed with key, or
+	  * an empty string if it can
+	  */
+	static std::string getMismatch(const Header& old, const Key& key);
+
+	/**
+	  * Copies the last record of every tile in the file to a new file, which replaces it
+	  */
+	void compact(const Header& header);
+
+	std::string filename;
+	unsigned int n_tiles;
+	double interval;
+	double last_flush;
+	unsigned int resumed_tiles;
+	std::string discard_reason; //< See getDiscardReason()
+
+	std::mutex lock;
+	std::vector<uint64_t> offsets; //< Offset of the last record of each tile, 0 if none
+	uint64_t size; //< Size of the file, including records not flushed yet
+	std::ofstream out;
+	std::ifstream in;
+	std::vector<char> pending; //< Records not written to out yet
+};
+
+#endif
@@ -4,31 +4,82 @@
 #include <string>
 #include <limits>
 #include <sstream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <exception>
 
 #include <glm/glm.hpp>
 
 #include <IL/il.h>
 #include <IL/ilu.h>
 
-class CubeMap : public SceneObject {
+#include "SceneObject.hpp"
+#include "SceneObjectEffect.hpp"
+#include "Intersection.hpp"
+#include "TiledImage.h"
+#include "TextureCache.hpp"
+#include "ImageDecoder.hpp"
+
+/**
+  * The cube map surrounds the whole scene. It is both a scene object and the
+  * effect that shades it, since its color only depends on the ray direction.
+  * The faces are kept as compact, tiled and mip-mapped images, and looked up
+  * in the mip level that matches the footprint of the ray cone, so that the
+  * wide cones of rays reflected off curved surfaces read a few texels of a
+  * small level instead of scattered texels all over the full size face.
+  */
+class CubeMap : public SceneObject, public SceneObjectEffect {
 public:
 	CubeMap(std::string posx, std::string negx, 
 			std::string posy, std::string negy,
-			std::string posz, std::string negz) {
+			std::string posz, std::string negz,
+			TiledImage::Format format=TiledImage::RGB9E5) {
 		ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
-		loadImage(posx, this->posx);
-		loadImage(negx, this->negx);
-		loadImage(posy, this->posy);
-		loadImage(negy, this->negy);
-		loadImage(posz, this->posz);
-		loadImage(negz, this->negz);
+		TextureCache cache;
+
+		//Load the six faces on one thread each. Only images that fall back
+		//to DevIL are decoded one face at a time, see loadImage().
+		const std::string filenames[6] = {posx, negx, posy, negy, posz, negz};
+		TiledImage* faces[6] = {&this->posx, &this->negx, &this->posy, &this->negy, &this->posz, &this->negz};
+		std::string keys[6];
+		std::exception_ptr errors[6];
+		std::vector<std::thread> threads;
+		for (unsigned int i=0; i<6; ++i) {
+			threads.push_back(std::thread([&, i]() {
+				try {
+					loadImage(cache, filenames[i], *faces[i], format, keys[i]);
+				}
+				catch (...) {
+					errors[i] = std::current_exception();
+				}
+			}));
+		}
+		for (unsigned int i=0; i<6; ++i) threads[i].join();
+		for (unsigned int i=0; i<6; ++i) {
+			if (errors[i]) std::rethrow_exception(errors[i]);
+		}
+
+		//The cache keys hash the contents of the faces
+		image_hash = hashBytes(NULL, 0);
+		for (unsigned int i=0; i<6; ++i) {
+			image_hash = hashBytes(reinterpret_cast<const unsigned char*>(keys[i].data()), keys[i].size(), image_hash);
+		}
+	}
+
+	/**
+	  * Returns the number of bytes used by the texels of all faces
+	  */
+	size_t getMemoryUsage() const {
+		return posx.getMemoryUsage() + negx.getMemoryUsage() + posy.getMemoryUsage()
+			+ negy.getMemoryUsage() + posz.getMemoryUsage() + negz.getMemoryUsage();
 	}
 	
 	/**
 	  * Ray-trace function that returns what texel you hit in the
 	  * cube map, since any ray will hit some point in the cube map
 	  */
-	glm::vec3 rayTrace(Ray &ray, const float& t, RayTracerState& state) {
+	glm::vec3 rayTrace(Ray &ray, const HitRecord& hit, RayTracerState& state) {
 		glm::vec3 out_color(0.1f);
 		glm::vec3 dir =  ray.getDirection();
 
@@ -37,7 +88,7 @@ public:
 
 		float ss = 0;
 		float ts = 0;
-		texture *tex;
+		const TiledImage* tex;
 		if (glm::abs(dir.x) >= glm::abs(dir.y) && glm::abs(dir.x) >= glm::abs(dir.z)) {
 
 			if (dir.x >= 0) {
@@ -94,7 +145,12 @@ public:
 				tex = &negz;
 			}
 		}
-		out_color = readTexture(*tex, ss, ts);
+
+		//One texel in the middle of a face spans about 2/width radians, since the
+		//face spans two units at unit distance. Pick the level where the cone
+		//spreads over about one texel; cones narrower than a texel use level 0.
+		float lod = glm::log2(ray.getSpread()*0.5f*tex->getWidth());
+		out_color = tex->sample(ss, ts, lod);
 		return out_color;
 	}
 	
@@ -102,95 +158,90 @@ public:
 	  * A ray will always hit the cube map by definition, but the point of intersection
 	  * is as far away as possible
 	  */
-	float intersect(const Ray& r) {
-		return std::numeric_limits<float>::max();
+	bool intersect(const Ray& r, int k, HitRecord& hit) {
+		float t = std::numeric_limits<float>::max();
+		if (!Intersection::isCloser(t, k, hit)) return false;
+
+		hit.t = t;
+		hit.object = k;
+		hit.normal = -glm::normalize(r.getDirection());
+		hit.uv = glm::vec2(0.0f);
+		hit.curvature = 0.0f;
+		return true;
 	}
 
-private:
-	struct texture {
-		std::vector<float> data;
-		unsigned int width;
-		unsigned int height;
-	};
+	SceneObjectEffect* getEffect() { return this; }
 
 	/**
-	  * Returns the texel at texture coordinate [s, t] in texture tex
+	  * Hashes the images of the faces
 	  */
-	static glm::vec3 readTexture(texture& tex, float s, float t) {
-		glm::vec3 out_color;
-
-		float xf = std::min(s*tex.width, tex.width-1.0f);
-		float yf = std::min(t*tex.height, tex.height-1.0f);
-
-		unsigned int xm = static_cast<unsigned int>(xf);
-		unsigned int xmC = static_cast<unsigned int>(glm::ceil(xf));
-		unsigned int ym = static_cast<unsigned int>(yf);
-		unsigned int ymC = static_cast<unsigned int>(glm::ceil(yf));
-
-		unsigned int i0 = (ym*tex.width + xm)*3;
-		unsigned int i1 = (ymC * tex.width + xm)*3;
-		unsigned int i2 = (ymC * tex.width + xmC)*3;
-		unsigned int i3 = (ym * tex.width + xmC)*3;
-		
-		float remX;
-		float remY;
-
-		if(xm == xmC) {
-			remX = 1;
-		} else {
-			remX = xm / xmC - 1.0f;
-		}
+	uint64_t getParameterHash() { return image_hash; }
 
-		if(ym == ymC) {
-			remX = 1;
-		} else {
-			remY = ym / ymC - 1.0f;
+private:
+	/**
+	  * Loads an image into memory from file, or maps it from the cache if it
+	  * has been loaded before. Images that are decoded are added to the cache.
+	  * Safe to call from several threads: JPEG and PNG files are decoded in
+	  * parallel by ImageDecoder, and other images under a lock by DevIL,
+	  * since DevIL keeps the bound image in global state.
+	  * @param key Set to the cache key of the image, which hashes its contents
+	  */
+	static void loadImage(TextureCache& cache, std::string filename, TiledImage& tex, TiledImage::Format format, std::string& key) {
+		MappedFile source(filename);
+		key = cache.getKey(source.getData(), source.getSize(),
+			(format == TiledImage::RGB9E5) ? "TiledImage RGB9E5" : "TiledImage RGB16F");
+		TextureCache::Entry entry;
+		if (cache.find(key, entry)) {
+			try {
+				tex = TiledImage(entry);
+				return;
+			}
+			catch (std::runtime_error&) {
+				//Decode the image again
+			}
 		}
 
-		for (int k=0; k<3; ++k) {
-			float c0 = tex.data.at(i0+k);
-			/*
-			float c1 = tex.data.at(i1+k);
-			float c2 = tex.data.at(i2+k);
-			float c3 = tex.data.at(i3+k);
-			float remTop = glm::mix(c2, c1, remY);
-			float remBotton = glm::mix(c0, c3, remX);
-			out_color[k] = glm::mix(remTop, remBotton, remY+remX);
-			*/
-			out_color[k] = c0;
+		unsigned int width, height;
+		std::vector<float> data;
+		std::vector<unsigned char> rgb;
+		if (ImageDecoder::decode(source.getData(), source.getSize(), width, height, rgb)) {
+			//Top down rows, like the ones DevIL copies out of a JPEG or PNG
+			data.resize(rgb.size());
+			for (size_t i=0; i<rgb.size(); ++i) data[i] = rgb[i]/255.0f;
 		}
-
-		return out_color;
-	}
-
-	/**
-	  * Loads an image into memory from file
-	  */
-	static void loadImage(std::string filename, texture& tex) {
-		ILuint ImageName;
-
-		ilGenImages(1, &ImageName); // Grab a new image name.
-		ilBindImage(ImageName); 
-		
-		if (!ilLoadImage(filename.c_str())) {
-			ILenum e;
-			std::stringstream error;
-			while ((e = ilGetError()) != IL_NO_ERROR) {
-				error << e << ": " << iluErrorString(e) << std::endl;
+		else {
+			static std::mutex devil_mutex;
+			std::lock_guard<std::mutex> lock(devil_mutex);
+			ILuint ImageName;
+
+			ilGenImages(1, &ImageName); // Grab a new image name.
+			ilBindImage(ImageName); 
+			
+			if (!ilLoadL(IL_TYPE_UNKNOWN, source.getData(), static_cast<ILuint>(source.getSize()))) {
+				ILenum e;
+				std::stringstream error;
+				error << "Unable to load " << filename << std::endl;
+				while ((e = ilGetError()) != IL_NO_ERROR) {
+					error << e << ": " << iluErrorString(e) << std::endl;
+				}
+				ilDeleteImages(1, &ImageName); // Delete the image name. 
+				throw std::runtime_error(error.str());
 			}
+
+			width = ilGetInteger(IL_IMAGE_WIDTH); // getting image width
+			height = ilGetInteger(IL_IMAGE_HEIGHT); // and height
+			data.resize(width*height*3);
+			
+			ilCopyPixels(0, 0, 0, width, height, 1, IL_RGB, IL_FLOAT, data.data());
 			ilDeleteImages(1, &ImageName); // Delete the image name. 
-			throw std::runtime_error(error.str());
 		}
 
-		tex.width = ilGetInteger(IL_IMAGE_WIDTH); // getting image width
-		tex.height = ilGetInteger(IL_IMAGE_HEIGHT); // and height
-		tex.data.resize(tex.width*tex.height*3);
-		
-		ilCopyPixels(0, 0, 0, tex.width, tex.height, 1, IL_RGB, IL_FLOAT, tex.data.data());
-		ilDeleteImages(1, &ImageName); // Delete the image name. 
+		tex = TiledImage(data, width, height, format);
+		tex.store(cache, key);
 	}
 
-	texture posx, negx, posy, negy, posz, negz;
+	TiledImage posx, negx, posy, negy, posz, negz;
+	uint64_t image_hash; //< See getParameterHash()
 };
 
 #endif
@@ -0,0 +1,60 @@
+#ifndef _DEMOSCENE_HPP__
+#define _DEMOSCENE_HPP__
+
+#include <memory>
+#include <string>
+
+#include "RayTracer.h"
+#include "Sphere.hpp"
+#include "Triangle.h"
+#include "CubeMap.hpp"
+#include "SceneObjectEffect.hpp"
+
+/**
+  * The scene of the assignment: three spheres and a triangle showing off the
+  * effects, in front of a cube map
+  */
+class DemoScene {
+public:
+	/**
+	  * Adds the spheres and the triangle to rt
+	  */
+	static void addObjects(RayTracer& rt) {
+		std::shared_ptr<SceneObjectEffect> phong = getModelEffect();
+		std::shared_ptr<SceneObjectEffect> fresnel(new FresnelEffect());
+		std::shared_ptr<SceneObjectEffect> reflect(new ReflectSteelEffect());
+
+		std::shared_ptr<SceneObject> s1(new Sphere(glm::vec3(-3.0f, 0.0f, 6.0f), 2.0f, fresnel));
+		rt.addSceneObject(s1);
+		std::shared_ptr<SceneObject> s2(new Sphere(glm::vec3(3.0f, 0.0f, 3.0f), 2.0f, phong));
+		rt.addSceneObject(s2);
+		std::shared_ptr<SceneObject> s3(new Sphere(glm::vec3(0.0f, 3.0f, 9.0f), 2.0f, reflect));
+		rt.addSceneObject(s3);
+		std::shared_ptr<SceneObject> s4(new Triangle(glm::vec3(-2.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.5f, 0.0f), glm::vec3(2.0f, 0.0f, 0.0f), reflect));
+		rt.addSceneObject(s4);
+	}
+
+	/**
+	  * Loads the cube map in directory, from the files posx.jpg, negx.jpg, etc.
+	  */
+	static std::shared_ptr<SceneObject> loadCubeMap(std::string directory) {
+		return std::shared_ptr<SceneObject>(new CubeMap(directory + "/posx.jpg", directory + "/negx.jpg",
+			directory + "/posy.jpg", directory + "/negy.jpg",
+			directory + "/posz.jpg", directory + "/negz.jpg"));
+	}
+
+	/**
+	  * Returns the effect used for models added to the scene
+	  */
+	static std::shared_ptr<SceneObjectEffect> getModelEffect() {
+		return std::shared_ptr<SceneObjectEffect>(new PhongEffect(glm::vec3(0.3, 0.3, 0.3), glm::vec3(0.0, 0.0, 10.0)));
+	}
+
+	/**
+	  * Where models are placed, and how large they are, see MeshLoader::load()
+	  */
+	static glm::vec3 getModelPosition() { return glm::vec3(0.0f, -2.0f, 5.0f); }
+	static float getModelSize() { return 3.0f; }
+};
+
+#endif
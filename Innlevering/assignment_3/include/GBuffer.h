@@ -0,0 +1,85 @@
+#ifndef _GBUFFER_H__
+#define _GBUFFER_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "HitRecord.hpp"
+#include "StorageArray.hpp"
+#include "TileScheduler.h"
+
+/**
+  * The closest hit of every primary ray of a render: the distance t, the
+  * object, the normal and the position. As long as the camera, resolution
+  * and geometry stay the same, the next render shades these hits again
+  * instead of tracing the primary rays, so that changing effects, such as
+  * colors or lights, only costs shading and secondary rays. The hits are
+  * stored per tile, and per pixel in the order the samples of the pixel are
+  * numbered. Sample k of a pixel is always taken at the same position, so a
+  * render may take more or fewer samples than the one that filled the
+  * G-buffer, and only traces the samples that are missing.
+  */
+class GBuffer {
+public:
+	/**
+	  * What the primary rays depend on, besides the geometry
+	  */
+	struct Key {
+		uint32_t width;
+		uint32_t height;
+		uint32_t tile_size;
+		uint32_t adaptive; //< 1 if the samples are placed for adaptive sampling, 0 for four samples at fixed offsets
+		glm::vec3 camera;
+
+		inline bool operator==(const Key& other) const {
+			return width == other.width && height == other.height && tile_size == other.tile_size
+				&& adaptive == other.adaptive && camera == other.camera;
+		}
+	};
+
+	GBuffer(const Key& key);
+
+	inline const Key& getKey() const { return key; }
+
+	/**
+	  * Returns the hit of sample k in pixel (x, y), or NULL if it is not in the G-buffer
+	  */
+	const HitRecord* find(unsigned int x, unsigned int y, unsigned int k) const;
+
+	/**
+	  * Stores the hits of a tile, given the number of samples of each pixel
+	  * in the tile, row by row, and the hits of the samples in the same order.
+	  * May be called concurrently for different tiles.
+	  */
+	void setTile(const Tile& tile, const std::vector<unsigned int>& counts, const std::vector<HitRecord>& hits);
+
+	/**
+	  * Writes the G-buffer to filename, replacing it, along with the hash of
+	  * the geometry it was traced against, see RayTracerState::getGeometryHash()
+	  * @throws std::runtime_error if the file cannot be written
+	  */
+	void write(std::string filename, uint64_t geometry) const;
+
+	/**
+	  * Reads a G-buffer written by write(), whose hits are used in place in
+	  * the memory mapped file
+	  * @return NULL if the file does not exist, or is for another key or geometry
+	  */
+	static std::shared_ptr<GBuffer> read(std::string filename, const Key& key, uint64_t geometry);
+
+private:
+	struct TileHits {
+		StorageArray<uint32_t> first; //< Index of the first hit of each pixel, followed by the number of hits
+		StorageArray<HitRecord> hits;
+	};
+
+	Key key;
+	unsigned int tiles_x; //< Number of tiles in each row
+	std::vector<TileHits> tiles; //< By Tile::index, empty for tiles not rendered
+};
+
+#endif
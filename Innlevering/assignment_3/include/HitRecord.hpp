@@ -0,0 +1,29 @@
+#ifndef _HITRECORD_HPP__
+#define _HITRECORD_HPP__
+
+#include <limits>
+
+#include <glm/glm.hpp>
+
+/**
+  * Everything we know about the closest intersection between a ray and the
+  * scene. Intersection tests fill it in as they find closer hits, and the
+  * effect of the object that was hit gets it for shading, so that nothing
+  * needs to be recomputed after the closest hit has been found.
+  */
+struct HitRecord {
+	HitRecord() {
+		t = std::numeric_limits<float>::max();
+		object = -1;
+		curvature = 0.0f;
+	}
+
+	float t; //< Ray parameter of the closest hit so far, doubles as the maximum distance to test
+	int object; //< Scene index of the object hit, -1 if none
+	glm::vec3 point; //< Point of intersection, set once the closest hit is known
+	glm::vec3 normal; //< Unit geometric normal at the point of intersection
+	glm::vec2 uv; //< Barycentric coordinates of b and c for triangles, 0 for other objects
+	float curvature; //< Curvature of the surface at the point, 1/radius for spheres and 0 for flat surfaces
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef _IMAGESTREAM_H__
+#define _IMAGESTREAM_H__
+
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+#include "ImageWriter.h"
+#include "TileScheduler.h"
+
+/**
+  * Writes an image to file a tile at a time, in any order, so that the
+  * whole frame never needs to be in memory. The file is created at its
+  * full size up front, with black pixels, and every tile is converted and
+  * written into place as soon as it is given. The part of the image
+  * written so far can be viewed while the rest is being rendered.
+  * Only the native formats of ImageWriter (ppm, pfm and bmp) are supported.
+  */
+class ImageStream {
+public:
+	/**
+	  * Creates the first free file name basenameXXXX.extension
+	  */
+	ImageStream(unsigned int width, unsigned int height, std::string basename, std::string extension);
+	~ImageStream();
+
+	/**
+	  * Writes the pixels of a tile, given as float RGB, row by row from the
+	  * bottom like the frame buffer. Can be called from several threads at
+	  * the same time for different tiles.
+	  */
+	void writeTile(const Tile& tile, const float* rgb);
+
+	inline const std::string& getFilename() const { return filename; }
+
+private:
+	ImageStream(const ImageStream&);
+	ImageStream& operator=(const ImageStream&);
+
+	/**
+	  * Writes size bytes at the given position in the file, without moving
+	  * the file pointer other threads are writing with
+	  */
+	void writeAt(const void* data, size_t size, uint64_t offset);
+
+	int fd;
+	std::string filename;
+	unsigned int width;
+	unsigned int height;
+	ImageWriter::Format format;
+	size_t header_size;
+	size_t row_size;
+	size_t pixel_size; //< Bytes per pixel in the file
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef _IMAGEWRITER_H__
+#define _IMAGEWRITER_H__
+
+#include <string>
+#include <cstddef>
+
+#include "FrameBuffer.hpp"
+
+/**
+  * Writes frame buffers to image files. PPM, PFM (lossless floats) and BMP
+  * are written natively: rows are converted in parallel, a band at a time,
+  * and each band is written with a single call, so that saving uses little
+  * memory beyond the frame buffer itself. Other formats are saved through
+  * DevIL, which makes a copy of the frame buffer. Row 0 of the frame buffer
+  * is the bottom of the image.
+  */
+class ImageWriter {
+public:
+	/**
+	  * Saves fb to the first free file name basenameXXXX.extension
+	  * @return The name of the file written
+	  */
+	static std::string save(FrameBuffer& fb, std::string basename, std::string extension);
+
+	/**
+	  * Saves fb to filename, replacing it if it exists. The format is given
+	  * by the extension of filename.
+	  */
+	static void saveAs(FrameBuffer& fb, std::string filename);
+
+	/**
+	  * Creates and opens the first free file name basenameXXXX.extension for
+	  * writing. The file is created exclusively (O_EXCL), so concurrent
+	  * savers never get the same name. The first free number is found with a
+	  * binary search over which names exist, assuming they are numbered
+	  * consecutively, and remembered for the next call.
+	  * @param filename Set to the name of the file created
+	  * @return The file descriptor
+	  */
+	static int createUniqueFile(std::string basename, std::string extension, std::string& filename);
+
+	/**
+	  * Writes size bytes to the file descriptor, or throws std::runtime_error
+	  */
+	static void writeAll(int fd, const void* data, size_t size);
+
+	static void closeFile(int fd);
+
+	enum Format { PPM, PFM, BMP, OTHER };
+
+	/**
+	  * Returns the format written for a file extension, OTHER if saved through DevIL
+	  */
+	static Format getFormat(std::string extension);
+
+	/**
+	  * Returns the header of a native image file, which is followed by
+	  * height rows of getRowSize() bytes
+	  */
+	static std::string getHeader(unsigned int width, unsigned int height, Format format);
+
+	/**
+	  * Returns the size in bytes of one row of pixels in a native image file
+	  */
+	static size_t getRowSize(unsigned int width, Format format);
+
+	/**
+	  * Returns the row of the file that frame buffer row y is stored in
+	  */
+	static unsigned int getFileRow(unsigned int y, unsigned int height, Format format);
+
+	/**
+	  * Converts n float RGB pixels to the pixels of a native image file
+	  */
+	static void convert(const float* in, unsigned int n, Format format, unsigned char* out);
+
+private:
+	/**
+	  * Writes fb in one of the native formats
+	  */
+	static void writeNative(int fd, FrameBuffer& fb, Format format);
+
+	/**
+	  * Converts float RGB values in [0, 1] to bytes, rounding to nearest
+	  */
+	static void quantize(const float* in, size_t n, unsigned char* out);
+
+	/**
+	  * Saves fb to filename, which already exists, with DevIL
+	  */
+	static void saveDevIL(FrameBuffer& fb, std::string filename);
+};
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef _INTERSECTION_HPP__
+#define _INTERSECTION_HPP__
+
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+
+/**
+  * Ray-primitive intersection tests shared by the scene objects and the
+  * structure-of-arrays scene storage, so that both give exactly the same hits.
+  * The tests that take a HitRecord only record hits that are closer than the
+  * closest hit so far, and skip as much work as possible for the others.
+  */
+namespace Intersection {
+
+	/**
+	  * Tests whether the hit (t, k) is closer than the closest hit so far.
+	  * Ties are resolved in favour of the highest object index, so that the
+	  * result does not depend on the order objects are tested in.
+	  */
+	inline bool isCloser(float t, int k, const HitRecord& hit) {
+		const float z_offset = 10e-4f;
+		return (t > z_offset && (t < hit.t || (t == hit.t && k > hit.object)));
+	}
+
+	/**
+	  * Computes the ray-sphere intersection
+	  * @return The ray parameter t of the intersection, or -1 if there is none
+	  */
+	inline float sphere(const glm::vec3& p, float radius, const Ray& r) {
+		const glm::vec3 d = r.getDirection();
+		const glm::vec3 p0 = r.getOrigin();
+		float a = glm::dot(d, d);
+		float b = 2.0f*glm::dot(d, (p0-p));
+		float c = glm::dot(p0-p, p0-p)-radius*radius;
+		float abc = (b*b-4.0f*a*c);
+
+		if (abc >= 0.0f) {
+			float t0 = (-b - glm::sqrt(abc)) / (2*a);
+			float t1 = (-b + glm::sqrt(abc)) / (2*a);
+
+			//Inside the sphere, take the intersection in front of us
+			if((t0 * t1) < 0) {
+				if(t0 > t1) {
+					return t0;
+				}
+				return t1;
+			}
+
+			if(t0 > 0 && t1 > 0) {
+				if(t0 > t1) {
+					return t1;
+				}
+				return t0;
+			}
+		}
+		return -1;
+	}
+
+	/**
+	  * Intersects the sphere, which has scene index k, and records the hit
+	  * including normal if it is the closest so far. Spherical coordinates are
+	  * left to the effects that need them, since they follow from the normal.
+	  */
+	inline bool sphere(const glm::vec3& p, float radius, const Ray& r, int k, HitRecord& hit) {
+		float t = sphere(p, radius, r);
+		if (!isCloser(t, k, hit)) return false;
+
+		glm::vec3 q = r.getDirection() * t;
+		q += r.getOrigin();
+		glm::vec3 n = (q - p) / radius;
+
+		hit.t = t;
+		hit.object = k;
+		hit.normal = n;
+		hit.uv = glm::vec2(0.0f);
+		hit.curvature = 1.0f / radius;
+		return true;
+	}
+
+	/**
+	  * Computes the ray-triangle intersection by intersecting the plane of the
+	  * triangle, and testing whether the point lies inside all three edges.
+	  * The inside test is skipped if the plane is further away than the
+	  * closest hit so far. Records the hit and its barycentric coordinates
+	  * if it is the closest so far.
+	  * @param ca, ab, bc The precomputed edges c-a, a-b and b-c
+	  * @param normal The unit normal of the triangle
+	  * @param k The scene index of the triangle
+	  */
+	inline bool triangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c,
+			const glm::vec3& ca, const glm::vec3& ab, const glm::vec3& bc,
+			const glm::vec3& normal, const Ray& r, int k, HitRecord& hit) {
+		float t = glm::dot((a - r.getOrigin()), normal) / (glm::dot(r.getDirection(), normal));
+		if (!isCloser(t, k, hit)) return false;
+
+		glm::vec3 q = r.getOrigin() + t * r.getDirection();
+
+		//Twice the areas of the sub-triangles opposite b, c and a
+		float w_b = glm::dot(glm::cross(q-a, ca), normal);
+		float w_c = glm::dot(glm::cross(q-b, ab), normal);
+		float w_a = glm::dot(glm::cross(q-c, bc), normal);
+		if (w_b > 0 && w_c > 0 && w_a > 0) {
+			hit.t = t;
+			hit.object = k;
+			hit.normal = normal;
+			hit.uv = glm::vec2(w_b, w_c) / (w_a + w_b + w_c);
+			hit.curvature = 0.0f;
+			return true;
+		}
+
+		return false;
+	}
+
+	/**
+	  * Per-ray constants of the watertight ray-triangle test: the ray is
+	  * transformed so that it starts in the origin and points along +z,
+	  * which reduces the test to 2D edge functions that never let a ray slip
+	  * through the shared edge between two triangles.
+	  * See Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection", JCGT 2013.
+	  */
+	struct WatertightRay {
+		WatertightRay(const Ray& r) {
+			const glm::vec3& d = r.getDirection();
+			origin = r.getOrigin();
+
+			//Axis where the direction is largest becomes z, keeping the winding
+			kz = (glm::abs(d.x) > glm::abs(d.y)) ? ((glm::abs(d.x) > glm::abs(d.z)) ? 0 : 2) : ((glm::abs(d.y) > glm::abs(d.z)) ? 1 : 2);
+			kx = (kz+1) % 3;
+			ky = (kx+1) % 3;
+			if (d[kz] < 0.0f) std::swap(kx, ky);
+
+			sx = d[kx]/d[kz];
+			sy = d[ky]/d[kz];
+			sz = 1.0f/d[kz];
+		}
+
+		glm::vec3 origin;
+		int kx, ky, kz; //< Permutation of the axes
+		float sx, sy, sz; //< Shear constants
+	};
+
+	/**
+	  * Watertight intersection of the triangle (a, b, c), which is part of
+	  * the object with scene index k. Records the hit with barycentric
+	  * coordinates if it is the closest so far, but leaves the normal to the
+	  * caller, since it is shared by all hits on the triangle.
+	  */
+	inline bool watertightTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c,
+			const WatertightRay& r, int k, HitRecord& hit) {
+		const glm::vec3 A = a - r.origin;
+		const glm::vec3 B = b - r.origin;
+		const glm::vec3 C = c - r.origin;
+
+		const float ax = A[r.kx] - r.sx*A[r.kz];
+		const float ay = A[r.ky] - r.sy*A[r.kz];
+		const float bx = B[r.kx] - r.sx*B[r.kz];
+		const float by = B[r.ky] - r.sy*B[r.kz];
+		const float cx = C[r.kx] - r.sx*C[r.kz];
+		const float cy = C[r.ky] - r.sy*C[r.kz];
+
+		float u = cx*by - cy*bx;
+		float v = ax*cy - ay*cx;
+		float w = bx*ay - by*ax;
+
+		//Exactly on an edge: recompute in double precision to get the sign right
+		if (u == 0.0f || v == 0.0f || w == 0.0f) {
+			u = static_cast<float>(static_cast<double>(cx)*by - static_cast<double>(cy)*bx);
+			v = static_cast<float>(static_cast<double>(ax)*cy - static_cast<double>(ay)*cx);
+			w = static_cast<float>(static_cast<double>(bx)*ay - static_cast<double>(by)*ax);
+		}
+
+		if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) return false;
+
+		const float det = u + v + w;
+		if (det == 0.0f) return false;
+
+		const float t = (u*r.sz*A[r.kz] + v*r.sz*B[r.kz] + w*r.sz*C[r.kz]) / det;
+		if (!isCloser(t, k, hit)) return false;
+
+		hit.t = t;
+		hit.object = k;
+		hit.uv = glm::vec2(v, w) / det;
+		hit.curvature = 0.0f;
+		return true;
+	}
+}
+
+#endif
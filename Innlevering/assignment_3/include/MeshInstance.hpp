@@ -0,0 +1,101 @@
+#ifndef _MESHINSTANCE_HPP__
+#define _MESHINSTANCE_HPP__
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+
+#include "SceneObject.hpp"
+#include "SceneObjectEffect.hpp"
+#include "TriangleMesh.hpp"
+#include "SceneBlob.hpp"
+
+/**
+  * A copy of a triangle mesh placed in the scene with an affine transform.
+  * Any number of instances share one mesh, so memory grows with the unique
+  * geometry, and each instance only adds its transforms. The scene BVH over
+  * the instances is the top level, and the BVH of the mesh the bottom level:
+  * rays are transformed into the coordinate system of the mesh, and the mesh
+  * is intersected there as it is.
+  */
+class MeshInstance : public SceneObject {
+public:
+	/**
+	  * @param mesh The shared mesh, which is not added to the scene itself
+	  * @param transform Affine transform from the coordinate system of the mesh to the scene
+	  * @param effect Shades this instance, instead of the effect of the mesh
+	  */
+	MeshInstance(std::shared_ptr<TriangleMesh> mesh, const glm::mat4& transform,
+			std::shared_ptr<SceneObjectEffect> effect) {
+		this->mesh = mesh;
+		this->effect = effect;
+		setTransform(transform);
+	}
+
+	/**
+	  * Moves the instance. Call RayTracer::markSceneObjectsMoved() before the
+	  * next render(), so that the scene BVH is refitted to the new bounds.
+	  */
+	void setTransform(const glm::mat4& transform) {
+		glm::mat3 linear(transform);
+		float determinant = glm::determinant(linear);
+		if (determinant == 0.0f) {
+			std::stringstream err;
+			err << "Mesh instance transform is not invertible";
+			throw std::runtime_error(err.str());
+		}
+
+		this->transform = transform;
+		inverse = glm::inverse(transform);
+
+		//Mirroring flips the winding of the triangles, and with it the normals the mesh computes
+		normal_matrix = glm::transpose(glm::mat3(inverse)) * ((determinant < 0.0f) ? -1.0f : 1.0f);
+	}
+
+	inline const glm::mat4& getTransform() const { return transform; }
+	inline const std::shared_ptr<TriangleMesh>& getMesh() const { return mesh; }
+
+	/**
+	  * Intersects the ray with the mesh in the coordinate system of the mesh
+	  */
+	bool intersect(const Ray& r, int k, HitRecord& hit) {
+		//The direction is not normalized, so that t is the same in both coordinate systems
+		const Ray local(glm::vec3(inverse * glm::vec4(r.getOrigin(), 1.0f)),
+			glm::vec3(inverse * glm::vec4(r.getDirection(), 0.0f)));
+		if (!mesh->intersect(local, k, hit)) return false;
+		hit.normal = glm::normalize(normal_matrix * hit.normal);
+		return true;
+	}
+
+	/**
+	  * Hashes the transform along with the buffers of the mesh
+	  */
+	uint64_t getGeometryHash() {
+		return hashBytes(reinterpret_cast<const unsigned char*>(&transform), sizeof(glm::mat4), mesh->getGeometryHash());
+	}
+
+	/**
+	  * Bounds the transformed corners of the bounding box of the mesh
+	  */
+	bool getBounds(AABB& bounds) {
+		AABB local;
+		if (!mesh->getBounds(local)) return false;
+		bounds.reset();
+		for (unsigned int i=0; i<8; ++i) {
+			glm::vec3 corner((i & 1) ? local.max.x : local.min.x, (i & 2) ? local.max.y : local.min.y,
+				(i & 4) ? local.max.z : local.min.z);
+			bounds.expand(glm::vec3(transform * glm::vec4(corner, 1.0f)));
+		}
+		return true;
+	}
+
+private:
+	std::shared_ptr<TriangleMesh> mesh;
+	glm::mat4 transform; //< From mesh to scene coordinates
+	glm::mat4 inverse; //< From scene to mesh coordinates
+	glm::mat3 normal_matrix; //< Transforms normals of the mesh to the scene
+};
+
+#endif
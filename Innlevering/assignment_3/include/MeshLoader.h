@@ -0,0 +1,43 @@
+#ifndef _MESHLOADER_H__
+#define _MESHLOADER_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include <glm/glm.hpp>
+
+#include "TriangleMesh.hpp"
+
+/**
+  * Loads model files (obj, 3ds, ...) through assimp into the ray tracer.
+  * The node hierarchy of the model is flattened with its transforms applied,
+  * and all its meshes end up in one TriangleMesh with a shared vertex buffer
+  * and its own BVH, so that the whole model is a single scene object.
+  */
+class MeshLoader {
+public:
+	/**
+	  * Loads the model in its own coordinate system
+	  */
+	static std::shared_ptr<TriangleMesh> load(std::string filename, std::shared_ptr<SceneObjectEffect> effect);
+
+	/**
+	  * Loads the model, and scales and translates it so that its bounding box
+	  * is centered at center, and its largest side has length size
+	  */
+	static std::shared_ptr<TriangleMesh> load(std::string filename, std::shared_ptr<SceneObjectEffect> effect,
+			glm::vec3 center, float size);
+
+private:
+	static void loadVertices(std::string filename, std::vector<glm::vec3>& vertices, std::vector<unsigned int>& indices);
+
+	static void loadRecursive(std::vector<glm::vec3>& vertices, std::vector<unsigned int>& indices,
+			unsigned int& skipped_faces, const aiScene* scene, const aiNode* node, aiMatrix4x4 transform);
+};
+
+#endif
@@ -5,14 +5,24 @@
 
 /**
   * The ray class holds the state information of a ray in our ray-tracer:
-  * point of origin and direction
+  * point of origin and direction, and the bookkeeping needed to bound the
+  * cost of tracing it (recursion depth, throughput and ray budget). Each ray
+  * also carries a cone around it, which tells how large an area the ray
+  * stands for when it is used to look up textures.
   */
 class Ray {
 public:
+	static const unsigned int unlimited_budget = 0xffffffffu;
+
 	Ray(glm::vec3 origin, glm::vec3 direction) {
 		this->origin = origin;
 		this->direction = direction;
 		depth = 0;
+		weight = 1.0f;
+		budget = unlimited_budget;
+		seed = 0;
+		width = 0.0f;
+		spread = 0.0f;
 	}
 
 	/**
@@ -25,16 +35,88 @@ public:
 	  */
 	inline const glm::vec3& getDirection() const { return direction; }
 
+	/**
+	  * Returns the recursion depth of the ray, 0 for primary rays
+	  */
+	inline unsigned int getDepth() const { return depth; }
+
+	/**
+	  * Returns the throughput of the ray: how much its color contributes to
+	  * the color of the primary ray it was spawned from
+	  */
+	inline float getWeight() const { return weight; }
+
+	/**
+	  * Returns the number of rays that may still be traced in the tree of rays
+	  * spawned from this ray, not counting the ray itself, or unlimited_budget
+	  */
+	inline unsigned int getBudget() const { return budget; }
+
+	/**
+	  * Returns the width of the ray cone at the origin of the ray
+	  */
+	inline float getWidth() const { return width; }
+
+	/**
+	  * Returns the spread angle of the ray cone in radians: how fast
+	  * its width grows with the distance travelled
+	  */
+	inline float getSpread() const { return spread; }
+
 	/**
 	  * Spanws a new ray from this ray originating from getOrigin() + t*getDirection() 
-	  * going in the direction of d
+	  * going in the direction of d. The new ray gets the remaining ray budget,
+	  * or is invalid if the budget is used up.
 	  */
-	inline Ray spawn(float t, glm::vec3 d) const {
+	inline Ray spawn(float t, glm::vec3 d) {
+		Ray r = spawn(t, d, 1.0f, (budget == unlimited_budget || budget == 0) ? budget : budget-1);
+		if (budget == 0) r.depth = max_depth+1;
+		return r;
+	}
+
+	/**
+	  * Spawns a new ray like spawn(t, d), where the new ray contributes
+	  * weight to the color of this ray, and may spawn at most budget rays
+	  * itself. Used when a ray splits into several rays that share the budget.
+	  */
+	inline Ray spawn(float t, glm::vec3 d, float weight, unsigned int budget) {
 		Ray r(getOrigin()+t*getDirection(), d);
 		r.depth = this->depth + 1;
+		r.weight = this->weight * weight;
+		r.budget = budget;
+		r.seed = hash(nextSeed());
+		r.width = this->width + this->spread*t*glm::length(this->direction);
+		r.spread = this->spread;
 		return r;
 	}
 
+	/**
+	  * Returns a pseudo random number in [0, 1). Every ray has its own
+	  * sequence, derived from the ray it was spawned from, so that the result
+	  * of stochastic shading does not depend on the order rays are traced in.
+	  */
+	inline float random() {
+		return (nextSeed() >> 8) * (1.0f/16777216.0f);
+	}
+
+	/**
+	  * Scales the throughput of the ray, e.g., to compensate for
+	  * rays that are randomly terminated
+	  */
+	inline void scaleWeight(float s) {
+		weight *= s;
+	}
+
+	/**
+	  * Widens (or narrows, for concave surfaces) the cone of a ray reflected
+	  * off a surface with the given curvature at the origin of the ray. The
+	  * normal turns by width*curvature across the cone, which turns the
+	  * reflected directions twice as much.
+	  */
+	inline void reflectCone(float curvature) {
+		spread += 2.0f*curvature*width;
+	}
+
 	/**
 	  * Tests whether or not this ray should be raytraced further
 	  */
@@ -52,10 +134,33 @@ public:
 private:
 	friend class RayTracer;
 
+	/**
+	  * Integer hash used to decorrelate the random sequences of
+	  * neighbouring samples and of rays spawned from the same ray
+	  */
+	static inline unsigned int hash(unsigned int x) {
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	inline unsigned int nextSeed() {
+		seed = seed*1664525u + 1013904223u;
+		return seed;
+	}
+
 	static const unsigned int max_depth = 7;
 	unsigned int depth;
+	float weight; //< Throughput relative to the primary ray
+	unsigned int budget; //< Rays that may still be spawned from this ray
+	unsigned int seed; //< State of the random sequence
+	float width; //< Width of the ray cone at the origin
+	float spread; //< Spread angle of the ray cone
 	glm::vec3 origin;
 	glm::vec3 direction;
 };
 
-#endif
\ No newline at end of file
+#endif
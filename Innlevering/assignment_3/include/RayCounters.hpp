@@ -0,0 +1,130 @@
+#ifndef _RAY_COUNTERS_HPP__
+#define _RAY_COUNTERS_HPP__
+
+#include "Ray.hpp"
+
+/**
+  * Counters of the work done by one thread while ray-tracing. They are only
+  * compiled in when RAYTRACER_STATS is defined (e.g., make STATS=1): otherwise
+  * the count functions are empty, and cost nothing. Every thread counts into
+  * its own counters without locking, and the ray tracer takes the difference
+  * of the counters of a thread over each tile it renders, see RenderStats.
+  */
+struct RayCounters {
+	enum RayType { PRIMARY_RAY, REFLECT_RAY, REFRACT_RAY, SHADOW_RAY, RAY_TYPES };
+	static const unsigned int depth_bins = 10; //< Deeper rays are counted in the last bin
+
+#ifdef RAYTRACER_STATS
+	static const bool enabled = true;
+#else
+	static const bool enabled = false;
+#endif
+
+	unsigned long long rays[RAY_TYPES]; //< Rays traced, by type
+	unsigned long long depth[depth_bins]; //< Rays intersected with the scene, by recursion depth
+	unsigned long long node_tests; //< Ray-box tests in BVH nodes
+	unsigned long long primitive_tests; //< Ray-object tests in BVH leaves and object lists
+
+	/**
+	  * Returns the number of intersection tests, of both kinds
+	  */
+	inline unsigned long long getTests() const { return node_tests + primitive_tests; }
+
+	inline unsigned long long getRays() const {
+		unsigned long long n = 0;
+		for (unsigned int i=0; i<RAY_TYPES; ++i) n += rays[i];
+		return n;
+	}
+
+	inline void add(const RayCounters& other) {
+		for (unsigned int i=0; i<RAY_TYPES; ++i) rays[i] += other.rays[i];
+		for (unsigned int i=0; i<depth_bins; ++i) depth[i] += other.depth[i];
+		node_tests += other.node_tests;
+		primitive_tests += other.primitive_tests;
+	}
+
+	inline void subtract(const RayCounters& other) {
+		for (unsigned int i=0; i<RAY_TYPES; ++i) rays[i] -= other.rays[i];
+		for (unsigned int i=0; i<depth_bins; ++i) depth[i] -= other.depth[i];
+		node_tests -= other.node_tests;
+		primitive_tests -= other.primitive_tests;
+	}
+
+	/**
+	  * Returns the counters of the calling thread, all zero if not compiled in
+	  */
+	static inline RayCounters getThreadCounters() {
+#ifdef RAYTRACER_STATS
+		return thread_counters;
+#else
+		return RayCounters();
+#endif
+	}
+
+	/**
+	  * Returns the number of intersection tests done by the calling thread so far
+	  */
+	static inline unsigned long long getThreadTests() {
+#ifdef RAYTRACER_STATS
+		return thread_counters.getTests();
+#else
+		return 0;
+#endif
+	}
+
+	/**
+	  * Counts n rays of the given type
+	  */
+	static inline void countRays(RayType type, unsigned int n) {
+#ifdef RAYTRACER_STATS
+		thread_counters.rays[type] += n;
+#endif
+	}
+
+	/**
+	  * Counts a ray spawned by an effect, unless it is invalid, and so never traced
+	  */
+	static inline void countRay(RayType type, const Ray& ray) {
+#ifdef RAYTRACER_STATS
+		if (ray.isValid()) thread_counters.rays[type]++;
+#endif
+	}
+
+	/**
+	  * Counts n rays at the given recursion depth
+	  */
+	static inline void countDepth(unsigned int depth, unsigned int n=1) {
+#ifdef RAYTRACER_STATS
+		thread_counters.depth[(depth < depth_bins) ? depth : depth_bins-1] += n;
+#endif
+	}
+
+	static inline void countNodeTests(unsigned int n) {
+#ifdef RAYTRACER_STATS
+		thread_counters.node_tests += n;
+#endif
+	}
+
+	static inline void countPrimitiveTests(unsigned int n) {
+#ifdef RAYTRACER_STATS
+		thread_counters.primitive_tests += n;
+#endif
+	}
+
+	/**
+	  * Returns the number of active rays in a packet mask, so that packet
+	  * tests count once per ray, like the scalar tests
+	  */
+	static inline unsigned int countLanes(unsigned int active) {
+		unsigned int n = 0;
+		for (; active != 0; active &= active-1) ++n;
+		return n;
+	}
+
+#ifdef RAYTRACER_STATS
+private:
+	static thread_local RayCounters thread_counters;
+#endif
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef _RAYPACKET_HPP__
+#define _RAYPACKET_HPP__
+
+/**
+  * Ray packets are used to trace bundles of coherent rays (typically the
+  * primary rays of neighbouring samples) through the scene together using
+  * SIMD instructions. The packet is kept as a structure of arrays of plain
+  * floats so that the SIMD kernels can load one component for all lanes
+  * with a single instruction.
+  */
+struct RayPacket {
+	static const unsigned int width = 8;
+	static const unsigned int all_lanes = (1u << width) - 1;
+
+	float ox[width], oy[width], oz[width]; //< Origins
+	float dx[width], dy[width], dz[width]; //< Directions
+	float inv_dx[width], inv_dy[width], inv_dz[width]; //< 1/direction, for box tests
+	float t[width]; //< Closest hit so far
+	int object[width]; //< Scene index of the closest hit so far, -1 if none
+	unsigned int active; //< Bitmask of lanes that hold a valid ray
+
+	/**
+	  * Records a hit for one lane using the same rule as the scalar path:
+	  * closer hits win, and ties go to the object with the highest index
+	  */
+	inline void update(unsigned int lane, float t_hit, int k) {
+		const float z_offset = 10e-4f;
+		if (t_hit > z_offset && (t_hit < t[lane] || (t_hit == t[lane] && k > object[lane]))) {
+			t[lane] = t_hit;
+			object[lane] = k;
+		}
+	}
+};
+
+/**
+  * Table of SIMD intersection kernels operating on a RayPacket. The
+  * kernels only update lanes in packet.active, and use the same update
+  * rule as RayPacket::update().
+  */
+struct PacketKernels {
+	const char* name;
+
+	/**
+	  * Slab test for every active lane against the box [bmin, bmax], within [0, t]
+	  * @return Bitmask of lanes that hit the box
+	  */
+	unsigned int (*intersectBox)(const RayPacket& packet, const float* bmin, const float* bmax);
+
+	/**
+	  * Intersects the sphere (center, radius) with object index k
+	  */
+	void (*intersectSphere)(RayPacket& packet, const float* center, float radius, int k);
+
+	/**
+	  * Intersects the triangle (a, b, c) with unit normal n and object index k
+	  */
+	void (*intersectTriangle)(RayPacket& packet, const float* a, const float* b, const float* c, const float* n, int k);
+};
+
+/**
+  * Returns the widest kernels supported by the CPU we are running on
+  * (AVX2, then SSE2), or NULL if packet tracing is not available
+  */
+const PacketKernels* getPacketKernels();
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef _RAYPACKETKERNELS_HPP__
+#define _RAYPACKETKERNELS_HPP__
+
+/**
+  * Implementation of the packet intersection kernels, written once against a
+  * small SIMD abstraction and instantiated for SSE2 (RayPacket.cpp) and AVX2
+  * (RayPacketAVX2.cpp). Only include this from those two files: everything
+  * in here has internal linkage, so that code compiled for AVX2 can never be
+  * picked by the linker for the SSE2 path.
+  *
+  * Each kernel mirrors the operation order of the scalar intersect() in
+  * Sphere.hpp and Triangle.h, so that packets and single rays agree bit for bit
+  * as long as the compiler does not fuse multiply-adds differently.
+  */
+
+#ifndef RAYPACKET_TARGET
+#define RAYPACKET_TARGET
+#endif
+
+#include <immintrin.h>
+
+#include "RayPacket.hpp"
+
+namespace {
+
+/**
+  * SSE2: four lanes per register
+  */
+struct SSE2 {
+	static const unsigned int width = 4;
+	typedef __m128 vfloat;
+	typedef __m128i vint;
+
+	static RAYPACKET_TARGET inline vfloat load(const float* p) { return _mm_loadu_ps(p); }
+	static RAYPACKET_TARGET inline void store(float* p, vfloat v) { _mm_storeu_ps(p, v); }
+	static RAYPACKET_TARGET inline vint loadi(const int* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+	static RAYPACKET_TARGET inline void storei(int* p, vint v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+	static RAYPACKET_TARGET inline vfloat set1(float f) { return _mm_set1_ps(f); }
+	static RAYPACKET_TARGET inline vint set1i(int i) { return _mm_set1_epi32(i); }
+	static RAYPACKET_TARGET inline vint lanebits() { return _mm_setr_epi32(1, 2, 4, 8); }
+
+	static RAYPACKET_TARGET inline vfloat add(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat sub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat mul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat div(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat sqrt(vfloat a) { return _mm_sqrt_ps(a); }
+	static RAYPACKET_TARGET inline vfloat min(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat max(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat neg(vfloat a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+
+	static RAYPACKET_TARGET inline vfloat lt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat le(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat gt(vfloat a, vfloat b) { return _mm_cmpgt_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat ge(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat eq(vfloat a, vfloat b) { return _mm_cmpeq_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat gti(vint a, vint b) { return _mm_castsi128_ps(_mm_cmpgt_epi32(a, b)); }
+	static RAYPACKET_TARGET inline vfloat eqi(vint a, vint b) { return _mm_castsi128_ps(_mm_cmpeq_epi32(a, b)); }
+	static RAYPACKET_TARGET inline vint andi(vint a, vint b) { return _mm_and_si128(a, b); }
+
+	static RAYPACKET_TARGET inline vfloat mask_and(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat mask_or(vfloat a, vfloat b) { return _mm_or_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat select(vfloat m, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+	static RAYPACKET_TARGET inline vint selecti(vfloat m, vint a, vint b) { return _mm_castps_si128(select(m, _mm_castsi128_ps(a), _mm_castsi128_ps(b))); }
+	static RAYPACKET_TARGET inline unsigned int movemask(vfloat m) { return static_cast<unsigned int>(_mm_movemask_ps(m)); }
+};
+
+#ifdef RAYPACKET_AVX2
+/**
+  * AVX2: eight lanes per register
+  */
+struct AVX2 {
+	static const unsigned int width = 8;
+	typedef __m256 vfloat;
+	typedef __m256i vint;
+
+	static RAYPACKET_TARGET inline vfloat load(const float* p) { return _mm256_loadu_ps(p); }
+	static RAYPACKET_TARGET inline void store(float* p, vfloat v) { _mm256_storeu_ps(p, v); }
+	static RAYPACKET_TARGET inline vint loadi(const int* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	static RAYPACKET_TARGET inline void storei(int* p, vint v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	static RAYPACKET_TARGET inline vfloat set1(float f) { return _mm256_set1_ps(f); }
+	static RAYPACKET_TARGET inline vint set1i(int i) { return _mm256_set1_epi32(i); }
+	static RAYPACKET_TARGET inline vint lanebits() { return _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128); }
+
+	static RAYPACKET_TARGET inline vfloat add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat div(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat sqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+	static RAYPACKET_TARGET inline vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat neg(vfloat a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+
+	static RAYPACKET_TARGET inline vfloat lt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	static RAYPACKET_TARGET inline vfloat le(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	static RAYPACKET_TARGET inline vfloat gt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	static RAYPACKET_TARGET inline vfloat ge(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+	static RAYPACKET_TARGET inline vfloat eq(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+	static RAYPACKET_TARGET inline vfloat gti(vint a, vint b) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(a, b)); }
+	static RAYPACKET_TARGET inline vfloat eqi(vint a, vint b) { return _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b)); }
+	static RAYPACKET_TARGET inline vint andi(vint a, vint b) { return _mm256_and_si256(a, b); }
+
+	static RAYPACKET_TARGET inline vfloat mask_and(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat mask_or(vfloat a, vfloat b) { return _mm256_or_ps(a, b); }
+	static RAYPACKET_TARGET inline vfloat select(vfloat m, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, m); }
+	static RAYPACKET_TARGET inline vint selecti(vfloat m, vint a, vint b) { return _mm256_castps_si256(select(m, _mm256_castsi256_ps(a), _mm256_castsi256_ps(b))); }
+	static RAYPACKET_TARGET inline unsigned int movemask(vfloat m) { return static_cast<unsigned int>(_mm256_movemask_ps(m)); }
+};
+#endif
+
+/**
+  * Returns a lane mask for lanes [base, base+S::width) that are set in active
+  */
+template <class S>
+RAYPACKET_TARGET inline typename S::vfloat activeMask(unsigned int active, unsigned int base) {
+	typename S::vint bits = S::lanebits();
+	typename S::vint set = S::andi(S::set1i(static_cast<int>(active >> base)), bits);
+	return S::eqi(set, bits);
+}
+
+/**
+  * Writes the candidate hits t for object k into the packet, for the lanes
+  * in valid, using the same rule as RayPacket::update()
+  */
+template <class S>
+RAYPACKET_TARGET inline void updateHits(RayPacket& packet, unsigned int base, typename S::vfloat t, typename S::vfloat valid, int k) {
+	typename S::vfloat t_cur = S::load(packet.t+base);
+	typename S::vint k_cur = S::loadi(packet.object+base);
+	typename S::vint k_new = S::set1i(k);
+
+	typename S::vfloat closer = S::lt(t, t_cur);
+	typename S::vfloat tie = S::mask_and(S::eq(t, t_cur), S::gti(k_new, k_cur));
+	typename S::vfloat hit = S::mask_and(valid, S::gt(t, S::set1(10e-4f)));
+	hit = S::mask_and(hit, S::mask_or(closer, tie));
+	hit = S::mask_and(hit, activeMask<S>(packet.active, base));
+
+	if (S::movemask(hit) == 0) return;
+	S::store(packet.t+base, S::select(hit, t, t_cur));
+	S::storei(packet.object+base, S::selecti(hit, k_new, k_cur));
+}
+
+template <class S>
+RAYPACKET_TARGET unsigned int intersectBox(const RayPacket& packet, const float* bmin, const float* bmax) {
+	unsigned int mask = 0;
+	for (unsigned int base=0; base<RayPacket::width; base+=S::width) {
+		const typename S::vfloat robust_scale = S::set1(1.0000004f);
+		typename S::vfloat t0 = S::set1(0.0f);
+		typename S::vfloat t1 = S::load(packet.t+base);
+		const float* origin[3] = {packet.ox+base, packet.oy+base, packet.oz+base};
+		const float* inv_dir[3] = {packet.inv_dx+base, packet.inv_dy+base, packet.inv_dz+base};
+		for (int k=0; k<3; ++k) {
+			typename S::vfloat o = S::load(origin[k]);
+			typename S::vfloat inv = S::load(inv_dir[k]);
+			typename S::vfloat ta = S::mul(S::sub(S::set1(bmin[k]), o), inv);
+			typename S::vfloat tb = S::mul(S::sub(S::set1(bmax[k]), o), inv);
+			//Same NaN behaviour and rounding as AABB::intersect
+			t0 = S::max(S::min(tb, ta), t0);
+			t1 = S::min(S::mul(S::max(tb, ta), robust_scale), t1);
+		}
+		mask |= S::movemask(S::le(t0, t1)) << base;
+	}
+	return mask & packet.active;
+}
+
+template <class S>
+RAYPACKET_TARGET void intersectSphere(RayPacket& packet, const float* center, float radius, int k) {
+	for (unsigned int base=0; base<RayPacket::width; base+=S::width) {
+		if (((packet.active >> base) & ((1u << S::width)-1)) == 0) continue;
+
+		typename S::vfloat dx = S::load(packet.dx+base);
+		typename S::vfloat dy = S::load(packet.dy+base);
+		typename S::vfloat dz = S::load(packet.dz+base);
+		typename S::vfloat px = S::sub(S::load(packet.ox+base), S::set1(center[0]));
+		typename S::vfloat py = S::sub(S::load(packet.oy+base), S::set1(center[1]));
+		typename S::vfloat pz = S::sub(S::load(packet.oz+base), S::set1(center[2]));
+
+		typename S::vfloat a = S::add(S::add(S::mul(dx, dx), S::mul(dy, dy)), S::mul(dz, dz));
+		typename S::vfloat b = S::mul(S::set1(2.0f), S::add(S::add(S::mul(dx, px), S::mul(dy, py)), S::mul(dz, pz)));
+		typename S::vfloat c = S::sub(S::add(S::add(S::mul(px, px), S::mul(py, py)), S::mul(pz, pz)), S::set1(radius*radius));
+		typename S::vfloat abc = S::sub(S::mul(b, b), S::mul(S::mul(S::set1(4.0f), a), c));
+
+		typename S::vfloat root = S::sqrt(abc);
+		typename S::vfloat two_a = S::mul(S::set1(2.0f), a);
+		typename S::vfloat t0 = S::div(S::sub(S::neg(b), root), two_a);
+		typename S::vfloat t1 = S::div(S::add(S::neg(b), root), two_a);
+
+		//Origin inside the sphere: take the far root, in front: the near root
+		typename S::vfloat zero = S::set1(0.0f);
+		typename S::vfloat t0_larger = S::gt(t0, t1);
+		typename S::vfloat straddle = S::lt(S::mul(t0, t1), zero);
+		typename S::vfloat in_front = S::mask_and(S::gt(t0, zero), S::gt(t1, zero));
+		typename S::vfloat t = S::select(straddle, S::select(t0_larger, t0, t1),
+			S::select(in_front, S::select(t0_larger, t1, t0), S::set1(-1.0f)));
+
+		updateHits<S>(packet, base, t, S::ge(abc, zero), k);
+	}
+}
+
+template <class S>
+RAYPACKET_TARGET void intersectTriangle(RayPacket& packet, const float* a, const float* b, const float* c, const float* n, int k) {
+	for (unsigned int base=0; base<RayPacket::width; base+=S::width) {
+		if (((packet.active >> base) & ((1u << S::width)-1)) == 0) continue;
+
+		typename S::vfloat ox = S::load(packet.ox+base);
+		typename S::vfloat oy = S::load(packet.oy+base);
+		typename S::vfloat oz = S::load(packet.oz+base);
+		typename S::vfloat dx = S::load(packet.dx+base);
+		typename S::vfloat dy = S::load(packet.dy+base);
+		typename S::vfloat dz = S::load(packet.dz+base);
+		typename S::vfloat nx = S::set1(n[0]);
+		typename S::vfloat ny = S::set1(n[1]);
+		typename S::vfloat nz = S::set1(n[2]);
+
+		//Ray-plane intersection
+		typename S::vfloat num = S::add(S::add(
+			S::mul(S::sub(S::set1(a[0]), ox), nx),
+			S::mul(S::sub(S::set1(a[1]), oy), ny)),
+			S::mul(S::sub(S::set1(a[2]), oz), nz));
+		typename S::vfloat den = S::add(S::add(S::mul(dx, nx), S::mul(dy, ny)), S::mul(dz, nz));
+		typename S::vfloat t = S::div(num, den);
+		typename S::vfloat qx = S::add(ox, S::mul(t, dx));
+		typename S::vfloat qy = S::add(oy, S::mul(t, dy));
+		typename S::vfloat qz = S::add(oz, S::mul(t, dz));
+
+		//Inside test against each edge: dot(cross(q-p0, p1-p0), n) > 0
+		const float* corners[3][2] = {{a, c}, {b, a}, {c, b}};
+		typename S::vfloat inside = S::eq(t, t); //All lanes set unless t is NaN
+		for (int e=0; e<3; ++e) {
+			const float* p0 = corners[e][0];
+			const float* p1 = corners[e][1];
+			typename S::vfloat ux = S::sub(qx, S::set1(p0[0]));
+			typename S::vfloat uy = S::sub(qy, S::set1(p0[1]));
+			typename S::vfloat uz = S::sub(qz, S::set1(p0[2]));
+			typename S::vfloat vx = S::set1(p1[0]-p0[0]);
+			typename S::vfloat vy = S::set1(p1[1]-p0[1]);
+			typename S::vfloat vz = S::set1(p1[2]-p0[2]);
+			typename S::vfloat cx = S::sub(S::mul(uy, vz), S::mul(vy, uz));
+			typename S::vfloat cy = S::sub(S::mul(uz, vx), S::mul(vz, ux));
+			typename S::vfloat cz = S::sub(S::mul(ux, vy), S::mul(vx, uy));
+			typename S::vfloat d = S::add(S::add(S::mul(cx, nx), S::mul(cy, ny)), S::mul(cz, nz));
+			inside = S::mask_and(inside, S::gt(d, S::set1(0.0f)));
+		}
+
+		updateHits<S>(packet, base, t, inside, k);
+	}
+}
+
+} //Namespace
+
+#endif
@@ -4,10 +4,20 @@
 #include <memory>
 #include <string>
 #include <vector>
+#include <ostream>
+#include <atomic>
+#include <functional>
 
 #include "FrameBuffer.hpp"
 #include "SceneObject.hpp"
-#include "RayTracerState.hpp"
+#include "RayTracerState.h"
+#include "SceneBlob.hpp"
+#include "TileScheduler.h"
+#include "ImageStream.h"
+#include "Checkpoint.h"
+#include "TileCoordinator.h"
+#include "RenderStats.h"
+#include "GBuffer.h"
 
 /**
   * The RayTracer class is the main entry point for raytracing
@@ -17,24 +27,341 @@ class RayTracer {
 public:
 	RayTracer(unsigned int width, unsigned int height);
 
+	/**
+	  * Changes the size of the rendered image. The frame buffer of the last
+	  * render() is discarded.
+	  */
+	void setResolution(unsigned int width, unsigned int height);
+
+	/**
+	  * Moves the camera, which looks down the negative z axis
+	  */
+	void setCamera(glm::vec3 position);
+	glm::vec3 getCamera();
+
 	/**
 	  * Adds an object to the scene
 	  */
 	void addSceneObject(std::shared_ptr<SceneObject>& o);
 
+	/**
+	  * Tells the ray tracer that objects already in the scene have moved,
+	  * e.g., through Sphere::setCenter(), TriangleMesh::setVertices() or
+	  * MeshInstance::setTransform(), so that the next render() refits the
+	  * acceleration structures instead of building them again, see
+	  * RayTracerState::markMoved()
+	  */
+	void markSceneObjectsMoved();
+
+	/**
+	  * Uses prebuilt acceleration structures for the objects added so far,
+	  * see RayTracerState::readAccelerationStructure()
+	  */
+	void readAccelerationStructure(BlobReader& in);
+
+	/**
+	  * Enables or disables tracing primary rays in SIMD packets (on by default).
+	  * The widest instruction set supported by the CPU is selected at runtime,
+	  * and if none is available, rays are traced one at a time regardless.
+	  */
+	void setPacketTracing(bool enable);
+
+	/**
+	  * Sets the number of render threads, 0 (default) to use all hardware threads
+	  */
+	void setThreads(unsigned int n_threads);
+
+	/**
+	  * Sets the width and height in pixels of the tiles the frame is split into
+	  */
+	void setTileSize(unsigned int tile_size);
+
+	/**
+	  * Enables adaptive sampling. Every pixel starts out with min_samples samples,
+	  * and pixels whose estimated error is above threshold get twice as many
+	  * samples, until they converge or reach max_samples. The error is the larger
+	  * of the standard error of the pixel's samples and the luminance contrast to
+	  * its four neighbours. With max_samples = 0 (default), adaptive sampling is
+	  * disabled, and every pixel gets four samples at fixed offsets.
+	  */
+	void setAdaptiveSampling(unsigned int min_samples, unsigned int max_samples, float threshold=0.05f);
+
+	/**
+	  * Makes glass pick either the reflected or the refracted ray at random,
+	  * instead of tracing both (off by default). This bounds the cost of each
+	  * sample, at the price of noise that needs more samples per pixel (see
+	  * setAdaptiveSampling()) to average out.
+	  */
+	void setStochasticBranching(bool enable);
+
+	/**
+	  * Enables Russian roulette termination of rays at depth min_depth and
+	  * deeper, based on their throughput. 0 (default) disables it.
+	  */
+	void setRussianRoulette(unsigned int min_depth);
+
+	/**
+	  * Limits the number of rays traced per pixel, counting primary and secondary
+	  * rays, by splitting the budget evenly between the samples in the pixel.
+	  * Effects that would exceed the budget of a sample follow one random branch,
+	  * or stop. 0 (default) means no limit.
+	  */
+	void setRayBudget(unsigned int rays_per_pixel);
+
+	/**
+	  * Makes render() write every finished tile straight into the image file
+	  * basenameXXXX.extension (ppm, pfm or bmp), instead of keeping the frame
+	  * buffer. Memory use is then bounded by the tiles being rendered, and the
+	  * file shows the finished part of the image during the render. save() and
+	  * saveSampleCounts() are not available while streaming. An empty basename
+	  * (default) goes back to keeping the frame buffer.
+	  */
+	void setStreamingOutput(std::string basename, std::string extension="bmp");
+
+	/**
+	  * Makes render() save its finished tiles to the checkpoint file filename,
+	  * writing them to disk every interval seconds, so that an interrupted
+	  * render loses little work. With resume, the tiles already in the file
+	  * are not rendered again: tiles rendered with the current sampling
+	  * settings are used as they are, and with adaptive sampling, the others
+	  * are refined further, starting from the samples in the file, so that an
+	  * image can be resumed with more samples or a lower threshold. A file of
+	  * another image size, camera position, scene, effects and lights, or
+	  * sampling mode (adaptive or not) is started over, with a message.
+	  * Without resume, the file is overwritten. The file is deleted once all
+	  * tiles are done, unless keep is set, e.g., to refine the image later.
+	  * An empty filename (default) disables checkpointing.
+	  */
+	void setCheckpoint(std::string filename, bool resume=false, double interval=30.0, bool keep=false);
+
+	/**
+	  * Makes render() hand the tiles to worker processes instead of rendering
+	  * them on this process's threads. The workers load the scene themselves,
+	  * from scene, given as the scene file or cube map, and model of a
+	  * RenderServer job. The resolution, camera and adaptive sampling settings
+	  * of this ray tracer are sent along with it. A null coordinator (default) renders locally.
+	  */
+	void setWorkers(std::shared_ptr<TileCoordinator> workers, std::string scene);
+
+	/**
+	  * Makes render() keep the closest hit of every primary ray in a GBuffer,
+	  * and shade the hits again in the next render(), instead of tracing the
+	  * primary rays, as long as the camera, resolution, tile size, sampling
+	  * mode and geometry are the same. Changing effects, lights or the number
+	  * of samples then only costs shading. The G-buffer is kept in memory
+	  * between renders, and if filename is not empty, also in the file
+	  * filename, so that it survives the process. Not used with workers
+	  * (off by default).
+	  */
+	void setGBufferCache(bool enable, std::string filename="");
+
 	/**
 	  * Renders the current scene
+	  * @return false if cancel() stopped the render before all tiles were finished
+	  */
+	bool render();
+
+	/**
+	  * Called by renderProgressive() with the frame buffer after every pass,
+	  * numbered from 0, where last is set for the full quality pass
+	  */
+	typedef std::function<void (FrameBuffer& image, unsigned int pass, bool last)> PassCallback;
+
+	/**
+	  * Renders the current scene progressively, so that a preview is ready
+	  * long before the full quality image. The first pass traces one sample
+	  * in every block of block_size x block_size pixels, and fills the block
+	  * with it. Every following pass halves the size of the blocks, reusing
+	  * the samples of the earlier passes, until every pixel has a sample.
+	  * The last pass is a normal render(), which replaces the preview tile by
+	  * tile. publish, if set, is called after every finished pass. Not
+	  * available with streaming output or workers.
+	  * @return false if cancel() stopped the render before the last pass was finished
+	  */
+	bool renderProgressive(PassCallback publish, unsigned int block_size=8);
+
+	/**
+	  * Stops the render() or renderProgressive() in progress, and may be
+	  * called from any thread, or from the pass callback. Tiles that are
+	  * being rendered are finished, and the remaining tiles and passes are
+	  * skipped, so that the frame buffer and the checkpoint keep the tiles
+	  * finished so far. Tiles handed to workers are not cancelled. A cancel()
+	  * before the render starts stops it as soon as it starts, and the render
+	  * clears it when it returns.
+	  */
+	void cancel();
+
+	/**
+	  * Renders one tile, returning its samples instead of storing them, e.g.,
+	  * for a coordinator in another process. Builds the acceleration
+	  * structure if needed, and must not be called concurrently.
+	  */
+	void sampleTile(const Tile& tile, TileSamples& samples);
+
+	/**
+	  * Prints how much time each render thread spent busy and idle during the last render()
+	  */
+	void printSchedulerStats(std::ostream& out);
+
+	/**
+	  * Time in seconds spent on the parts of the last render()
 	  */
-	void render();
+	struct RenderTimes {
+		double build; //< Building the acceleration structures, 0 if they were up to date
+		double refit; //< Refitting them to objects that moved
+		double trace; //< Rendering the tiles
+	};
+	inline const RenderTimes& getRenderTimes() const { return times; }
+
+	/**
+	  * Returns the average number of samples per pixel in the last render()
+	  */
+	double getAverageSampleCount();
 
 	/**
 	  * Saves the currently rendered frame as an image file
 	  */
 	void save(std::string basename, std::string extension);
 
+	/**
+	  * Saves the currently rendered frame as filename, replacing it if it exists
+	  */
+	void saveAs(std::string filename);
+
+	/**
+	  * Saves the number of samples taken in each pixel during the last render()
+	  * as a gray scale image, where white is the maximum number of samples
+	  */
+	void saveSampleCounts(std::string basename, std::string extension);
+
+	/**
+	  * Saves the statistics of the last render(): a JSON summary as
+	  * basename_stats.json, and a heatmap of the cost of each pixel as
+	  * basename_costXXXX.extension. Only available when the ray tracer is
+	  * built with RAYTRACER_STATS defined (see RayCounters), and the tiles
+	  * were rendered by this process.
+	  */
+	void saveStats(std::string basename, std::string extension);
+
 private:
-	std::shared_ptr<FrameBuffer> fb;
+	/**
+	  * Creates the primary ray through the point (x, y) on the frame buffer,
+	  * given in pixel coordinates
+	  */
+	Ray createPrimaryRay(float x, float y);
+
+	/**
+	  * Builds the acceleration structure and derives the settings of a render
+	  */
+	void prepare();
+
+	/**
+	  * Renders the passes of renderProgressive(), leaving the cancel() flag
+	  * to the caller
+	  */
+	bool renderPasses(PassCallback publish, unsigned int block_size, const PacketKernels* kernels);
+
+	/**
+	  * Renders all tiles of the frame, after prepare()
+	  * @return false if cancel() skipped some of the tiles
+	  */
+	bool renderTiles(const PacketKernels* kernels);
+
+	/**
+	  * Renders one tile of a preview pass of renderProgressive(), with one
+	  * sample in the center of the first pixel of every block of block_size
+	  * x block_size pixels. The blocks are clipped to the tile. Samples
+	  * already traced by an earlier pass, as marked in traced, are reused
+	  * from centers, which hold the sample traced through each pixel center.
+	  */
+	void renderPreviewTile(const Tile& tile, const PacketKernels* kernels, unsigned int block_size,
+		std::vector<glm::vec3>& centers, std::vector<unsigned char>& traced);
+
+	/**
+	  * Renders, or resumes, one tile and stores it. Called concurrently from
+	  * the scheduler's threads.
+	  */
+	void processTile(const Tile& tile, const PacketKernels* kernels);
+
+	/**
+	  * Reads a tile from the checkpoint
+	  * @return true if the tile was found, and needs no more samples
+	  */
+	bool findResumed(const Tile& tile, TileSamples& resumed);
+
+	/**
+	  * Renders all pixels in one tile with four samples per pixel. If costs
+	  * is not NULL, it is set to the number of intersection tests done for
+	  * each pixel, row by row.
+	  */
+	void renderTile(const Tile& tile, const PacketKernels* kernels, TileSamples& samples, std::vector<float>* costs=NULL);
+
+	/**
+	  * Renders all pixels in one tile using adaptive sampling, starting from
+	  * the resumed samples, if not NULL. Sets costs like renderTile().
+	  */
+	void renderTileAdaptive(const Tile& tile, const PacketKernels* kernels, const TileSamples* resumed, TileSamples& samples,
+		std::vector<float>* costs=NULL);
+
+	/**
+	  * Returns the RenderServer job the workers load the scene from
+	  */
+	std::string getWorkerScene();
+
+	/**
+	  * Returns the sampling settings of render(), without samples
+	  */
+	TileSamples getSamplingSettings();
+
+	/**
+	  * The primary hits of the samples given to traceSamples()
+	  */
+	struct PrimaryHits {
+		std::vector<const HitRecord*> cached; //< Hit of each sample found in the G-buffer, NULL to trace the sample
+		std::vector<HitRecord> hits; //< Set to the closest hit of each sample
+	};
+
+	/**
+	  * Traces the primary rays through the given points in pixel coordinates,
+	  * and sets colors to the resulting colors. If costs is not NULL, it is
+	  * set to the number of intersection tests done for each sample, where
+	  * the samples traced together in a packet share the cost evenly. If
+	  * primary is not NULL, samples with a cached hit are only shaded, and
+	  * the hits of all samples are returned.
+	  */
+	void traceSamples(const std::vector<glm::vec2>& points, std::vector<glm::vec3>& colors, const PacketKernels* kernels,
+		std::vector<float>* costs=NULL, PrimaryHits* primary=NULL);
+
+	/**
+	  * Stores the mean of the samples in each pixel of a tile in the frame
+	  * buffer or the output stream
+	  */
+	void storeTile(const Tile& tile, const TileSamples& samples);
+
+	/**
+	  * Saves the frame buffer fb to the first free file name basenameXXXX.extension
+	  */
+	static void saveFrameBuffer(FrameBuffer& fb, std::string basename, std::string extension);
+
+	std::shared_ptr<FrameBuffer> fb; //< Not kept when streaming output
+	std::shared_ptr<FrameBuffer> sample_counts; //< Number of samples taken in each pixel, not kept when streaming output
+	std::shared_ptr<ImageStream> stream; //< Output file during render(), when streaming
+	std::string stream_basename; //< Streaming output file name, see setStreamingOutput()
+	std::string stream_extension;
+	std::shared_ptr<Checkpoint> checkpoint; //< Checkpoint file during render(), if enabled
+	std::string checkpoint_filename; //< See setCheckpoint()
+	bool checkpoint_resume;
+	double checkpoint_interval;
+	bool checkpoint_keep;
+	std::shared_ptr<TileCoordinator> workers; //< Renders the tiles, if set
+	std::string worker_scene; //< See setWorkers()
 	std::shared_ptr<RayTracerState> state;
+	bool gbuffer_enabled; //< See setGBufferCache()
+	std::string gbuffer_filename;
+	std::shared_ptr<GBuffer> gbuffer; //< Primary hits of the last render(), if enabled
+	unsigned int gbuffer_generation; //< RayTracerState::getGeneration() of the geometry in gbuffer
+	std::shared_ptr<const GBuffer> cached_hits; //< During render(), the hits of an earlier render that are still valid
+	std::shared_ptr<GBuffer> traced_hits; //< During render(), the hits of this render
 
 	/**
 	  * Defines the virtual screen we project our rays through
@@ -45,6 +372,29 @@ private:
 		float top;
 		float bottom;
 	} screen;
+
+	/**
+	  * Adaptive sampling parameters, see setAdaptiveSampling()
+	  */
+	struct {
+		unsigned int min_samples;
+		unsigned int max_samples;
+		float threshold;
+	} adaptive;
+
+	std::shared_ptr<TileScheduler> scheduler;
+	std::shared_ptr<RenderStats> stats; //< Of the last render(), if RAYTRACER_STATS is defined
+
+	bool use_packets;
+	unsigned int width;
+	unsigned int height;
+	unsigned int n_threads;
+	unsigned int tile_size;
+	unsigned int ray_budget; //< Rays per pixel, 0 if unlimited
+	unsigned int sample_budget; //< Rays per sample during render(), derived from ray_budget
+	std::atomic<unsigned long long> total_samples; //< Samples taken in the last render()
+	std::atomic<bool> cancelled; //< See cancel(), cleared when a render returns
+	RenderTimes times; //< Of the last render()
 };
 
 #endif
\ No newline at end of file
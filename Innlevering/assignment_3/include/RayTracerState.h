@@ -0,0 +1,206 @@
+#ifndef _RAYTRACER_STATE_H__
+#define _RAYTRACER_STATE_H__
+
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include "SceneObject.hpp"
+#include "HitRecord.hpp"
+#include "BVH.hpp"
+#include "SceneStorage.hpp"
+#include "SceneBlob.hpp"
+
+/**
+  * The RayTracerState class keeps track of the state of the ray-tracing:
+  * the objects in the scene, camera position, etc, and its main responsibility
+  * is to RayTrace the whole scene for each ray.
+  */
+class RayTracerState {
+public:
+	RayTracerState(glm::vec3 camera_position) {
+		this->camera_position = camera_position;
+		use_bvh = true;
+		dirty = true;
+		moved = false;
+		generation = 0;
+		geometry_hashed = false;
+		stochastic_branching = false;
+		roulette_depth = 0;
+	}
+	
+	inline std::vector<std::shared_ptr<SceneObject> >& getScene() { return scene; }
+	inline glm::vec3 getCamPos() { return camera_position; }
+	inline void setCamPos(glm::vec3 camera_position) { this->camera_position = camera_position; }
+
+	/**
+	  * Adds an object to the scene. The acceleration structure is rebuilt
+	  * on the next call to buildAccelerationStructure()
+	  */
+	inline void addSceneObject(std::shared_ptr<SceneObject>& o) {
+		scene.push_back(o);
+		dirty = true;
+		geometry_hashed = false;
+	}
+
+	/**
+	  * Selects between BVH traversal (default) and testing every object in the
+	  * scene for every ray. Both give the same closest hit, the latter is
+	  * mostly useful for comparing performance.
+	  */
+	inline void setUseBVH(bool use_bvh) { this->use_bvh = use_bvh; }
+
+	/**
+	  * Selects whether effects that split a ray into several rays (e.g., reflection
+	  * and refraction) follow all of them, or randomly pick one with probability
+	  * equal to its weight. The latter traces one ray per bounce, and converges
+	  * to the same image as the number of samples per pixel grows.
+	  */
+	inline void setStochasticBranching(bool stochastic) { stochastic_branching = stochastic; }
+	inline bool getStochasticBranching() const { return stochastic_branching; }
+
+	/**
+	  * Enables Russian roulette for rays at depth min_depth or deeper: such rays
+	  * are randomly terminated with a probability that grows as their throughput
+	  * falls, and the surviving rays are weighted up to compensate. 0 (default)
+	  * disables Russian roulette.
+	  */
+	inline void setRussianRoulette(unsigned int min_depth) { roulette_depth = min_depth; }
+
+	/**
+	  * Tells the state that objects already in the scene have moved or changed
+	  * shape, e.g., through Sphere::setCenter(), so that the next call to
+	  * buildAccelerationStructure() refits the acceleration structures to them
+	  * instead of building them again. Objects must not be changed while rays
+	  * are traced.
+	  */
+	inline void markMoved() {
+		moved = true;
+		geometry_hashed = false;
+	}
+
+	/**
+	  * What buildAccelerationStructure() did
+	  */
+	enum Update { UNCHANGED, REFITTED, BUILT };
+
+	/**
+	  * (Re)builds the acceleration structures if the scene has changed. Spheres
+	  * and triangles go into the compact per-type storage, other bounded objects
+	  * into a BVH of their own, and unbounded objects (e.g., the cube map) are
+	  * kept in a separate list that is tested for every ray. If objects have
+	  * only moved (see markMoved()), the hierarchies are refitted to their new
+	  * bounds, unless that would make them too slow. Must be called before
+	  * rayTrace(), and not concurrently with it.
+	  */
+	Update buildAccelerationStructure();
+
+	/**
+	  * Returns a number that changes whenever the acceleration structures
+	  * are built or refitted, i.e., whenever the geometry may have changed
+	  */
+	inline unsigned int getGeneration() const { return generation; }
+
+	/**
+	  * Returns a hash of the geometry of the objects: the spheres and
+	  * triangles, and the bounds and geometry of the other objects, such as
+	  * the buffers of meshes and the transforms of mesh instances, which tells
+	  * whether two scenes, e.g., loaded in different processes, have the same
+	  * geometry. The acceleration structures are not built for it, and the
+	  * hash is kept until objects are added or moved.
+	  */
+	uint64_t getGeometryHash();
+
+	/**
+	  * Returns a hash of the type and parameters of the effect of every
+	  * object, including the lights of Phong effects and the images of cube
+	  * maps, which tells whether two scenes shade their hits the same way
+	  */
+	uint64_t getEffectHash();
+
+	/**
+	  * Writes the acceleration structures, building them first if needed
+	  */
+	void writeAccelerationStructure(BlobWriter& out);
+
+	/**
+	  * Uses acceleration structures written by writeAccelerationStructure()
+	  * in place of building them. The scene must hold the same objects as
+	  * when they were written, added in the same order.
+	  * @throws std::runtime_error if they do not fit the scene
+	  */
+	void readAccelerationStructure(BlobReader& in);
+
+	/**
+	  * Performs raycasting on the scene for the ray ray
+	  * @param ray The ray to raycast with
+	  * @param closest If not NULL, set to the closest hit, with the point of intersection
+	  * @return The color of the closest object hit, or a gray background if nothing is hit
+	  */
+	glm::vec3 rayTrace(Ray& ray, HitRecord* closest=NULL);
+
+	/**
+	  * Shades the closest hit of a ray found by an earlier rayTrace(),
+	  * e.g., kept in a GBuffer, without intersecting the ray with the scene
+	  * again. Secondary rays are traced as usual.
+	  */
+	glm::vec3 shadeHit(Ray& ray, const HitRecord& closest);
+
+	/**
+	  * Any-hit query used for shadow rays: tests whether anything in the scene
+	  * lies between origin and origin + t_max*dir, without shading. Stops at
+	  * the first intersection found, and tries the object that blocked the
+	  * previous query on the same thread first, since neighbouring shadow rays
+	  * tend to be blocked by the same object.
+	  */
+	bool occluded(const glm::vec3& origin, const glm::vec3& dir, float t_max);
+
+	/**
+	  * Packet version of rayTrace(): finds the closest hit for up to
+	  * RayPacket::width rays at once using SIMD, and then shades each ray
+	  * separately. Any secondary rays spawned while shading are traced one
+	  * at a time through rayTrace(Ray&).
+	  * @param rays The rays to trace
+	  * @param n The number of rays, at most RayPacket::width
+	  * @param colors Set to the color of each ray
+	  * @param closest If not NULL, set to the closest hit of each ray, see rayTrace()
+	  */
+	void rayTracePacket(Ray* rays, unsigned int n, glm::vec3* colors, const PacketKernels& kernels,
+		HitRecord* closest=NULL);
+
+private:
+	/**
+	  * Stores the primitives of the scene again, and refits the hierarchies to them
+	  * @return false if the acceleration structures must be built again instead
+	  */
+	bool refitAccelerationStructure();
+
+	/**
+	  * Finds the closest intersection between the ray and the scene
+	  */
+	void intersect(const Ray& ray, HitRecord& hit);
+
+	/**
+	  * Shades the closest hit using the effect of the object that was hit
+	  */
+	glm::vec3 shade(Ray& ray, HitRecord& hit);
+
+	std::vector<std::shared_ptr<SceneObject> > scene;
+	glm::vec3 camera_position;
+
+	SceneStorage storage; //< Spheres and triangles, stored per primitive type
+	BVH bvh; //< Hierarchy over the other bounded objects in scene
+	std::vector<unsigned int> bounded; //< Maps BVH primitive indices to scene indices
+	std::vector<unsigned int> unbounded; //< Scene indices of objects without bounds
+	std::vector<SceneObjectEffect*> effects; //< Effect of each object in scene
+	bool use_bvh;
+	bool dirty;
+	bool moved; //< Objects have moved since the acceleration structures were built
+	unsigned int generation; //< Unique number for each build or refit of the acceleration structure
+	uint64_t geometry_hash; //< See getGeometryHash()
+	bool geometry_hashed; //< geometry_hash is up to date
+	bool stochastic_branching;
+	unsigned int roulette_depth; //< Smallest depth Russian roulette applies to, 0 if disabled
+};
+
+#endif
\ No newline at end of file
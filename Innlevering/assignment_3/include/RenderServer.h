@@ -0,0 +1,134 @@
+#ifndef _RENDERSERVER_H__
+#define _RENDERSERVER_H__
+
+#include <map>
+#include <list>
+#include <memory>
+#include <string>
+#include <istream>
+#include <ostream>
+
+#include <glm/glm.hpp>
+
+#include "RayTracer.h"
+#include "TriangleMesh.hpp"
+#include "TileCoordinator.h"
+
+/**
+  * Renders jobs read one per line from a stream, such as stdin, or a local
+  * Unix socket, and keeps what is expensive to set up between jobs: cube maps
+  * and models are only loaded the first time they are used, and every
+  * combination of them gets a ray tracer of its own, whose acceleration
+  * structure is only built for its first job. Scene files are only loaded for
+  * their first job too. The primary hits of the last job of each ray tracer
+  * are kept as well, so that a job with the same camera and resolution, e.g.,
+  * with more samples, only shades them again (see RayTracer::setGBufferCache()).
+  * Only the most recently used ray tracers are kept, along with the cube maps
+  * and models they use. A job is a line of key=value pairs separated by spaces:
+  *
+  *   output=thumb.bmp width=160 height=120 camera=0,0,10 model=bunny.obj
+  *
+  * output        The image file to write, replaced if it exists (required)
+  * width, height Size of the image (800x600)
+  * camera        Position of the camera, which looks down the negative z axis
+  *               (0,0,10, or the camera of the scene file)
+  * scene         A scene file to render instead of the demo scene, see SceneFile (none)
+  * cubemap       Directory holding posx.jpg, negx.jpg, etc., not used with a
+  *               scene file (cubemaps/SaintLazarusChurch3)
+  * model         A model to add to the demo scene or scene file, see DemoScene (none)
+  * samples       min,max,threshold for adaptive sampling, see
+  *               RayTracer::setAdaptiveSampling() (four samples per pixel)
+  *
+  * Empty lines and lines starting with # are ignored, and "quit" stops the server.
+  */
+class RenderServer {
+public:
+	/**
+	  * @param max_scenes The number of ray tracers kept between jobs, the
+	  * least recently used is dropped when a job needs another
+	  */
+	RenderServer(unsigned int max_scenes=4);
+
+	/**
+	  * Renders the jobs read from in until it ends, writing one line per
+	  * job to out: "ok <output> <seconds>", or "error <message>" if the job
+	  * failed. Failed jobs do not stop the server. Only these lines are
+	  * written to out, log messages, e.g., from loading models, go to
+	  * std::cout, which should not be out.
+	  */
+	void run(std::istream& in, std::ostream& out);
+
+	/**
+	  * Like run(), but reads the jobs from the clients of a Unix socket
+	  * created at path, one client at a time, and writes the replies back to
+	  * them. A socket left at path by an earlier server is replaced. Serves
+	  * until a client sends "quit", and then removes the socket. Only
+	  * supported on POSIX systems.
+	  * @throws std::runtime_error if the socket cannot be created
+	  */
+	void runSocket(std::string path);
+
+	/**
+	  * Renders one job, given as a line of key=value pairs
+	  * @return The name of the image file written
+	  * @throws std::runtime_error if the job is invalid or fails
+	  */
+	std::string render(std::string job);
+
+	/**
+	  * Renders tiles for a TileCoordinator connected to the socket fd, until
+	  * it disconnects. The scenes it sends are jobs without an output.
+	  */
+	void runWorker(int fd);
+
+private:
+	struct Job {
+		std::string output;
+		unsigned int width;
+		unsigned int height;
+		glm::vec3 camera;
+		bool has_camera; //< false to use the camera of the scene
+		std::string scene;
+		std::string cube_map;
+		std::string model;
+		unsigned int min_samples;
+		unsigned int max_samples; //< 0 for four samples per pixel
+		float threshold;
+	};
+
+	static Job parse(std::string line);
+
+	/**
+	  * Renders the job on line, if any, and writes its reply to out, see run()
+	  * @return false if the line asks the server to stop
+	  */
+	bool handle(std::string line, std::ostream& out);
+
+	/**
+	  * Returns the ray tracer for job, set up with its resolution, camera and sampling
+	  */
+	std::shared_ptr<RayTracer> setup(const Job& job);
+
+	/**
+	  * Returns the key of the scene of job in scenes
+	  */
+	static std::string getSceneKey(const Job& job);
+
+	/**
+	  * Returns the ray tracer for the scene of job, creating it if needed,
+	  * and dropping the least recently used ones beyond max_scenes
+	  */
+	std::shared_ptr<RayTracer> getScene(const Job& job);
+
+	std::shared_ptr<SceneObject> getCubeMap(std::string directory);
+	std::shared_ptr<TriangleMesh> getModel(std::string filename);
+
+	unsigned int max_scenes;
+	std::map<std::string, std::shared_ptr<RayTracer> > scenes; //< By scene file or cube map, and model
+	std::list<std::string> scene_order; //< Keys of scenes, most recently used first
+	std::map<std::string, glm::vec3> cameras; //< Camera of each scene in scenes
+	std::map<std::string, std::shared_ptr<SceneObject> > cube_maps; //< By directory
+	std::map<std::string, std::shared_ptr<TriangleMesh> > models; //< By file name
+};
+
+#endif
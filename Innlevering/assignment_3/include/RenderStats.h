@@ -0,0 +1,81 @@
+#ifndef _RENDER_STATS_H__
+#define _RENDER_STATS_H__
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <memory>
+
+#include "RayCounters.hpp"
+#include "TileScheduler.h"
+#include "FrameBuffer.hpp"
+
+/**
+  * Statistics of one render(), used to find out why a scene is slow: rays
+  * by type, intersection tests per ray, the recursion depth histogram, the
+  * time of each tile, and the cost of each pixel, measured as the number of
+  * intersection tests done for its samples. Every tile is recorded in its own
+  * slot by the thread that rendered it, so recording needs no locking, and
+  * the tiles are merged once the render is done. Tiles taken from a
+  * checkpoint or rendered by worker processes are not recorded.
+  */
+class RenderStats {
+public:
+	/**
+	  * @param n_tiles Number of tiles the frame is split into
+	  */
+	RenderStats(unsigned int width, unsigned int height, unsigned int n_tiles);
+
+	/**
+	  * Records a rendered tile: the time it took, the counters of the thread
+	  * over the tile, and the cost of each pixel in the tile, row by row. May
+	  * be called concurrently for different tiles.
+	  */
+	void addTile(const Tile& tile, double seconds, const RayCounters& counters, const std::vector<float>& costs);
+
+	/**
+	  * Sums up the counters of the recorded tiles
+	  */
+	void merge();
+
+	inline const RayCounters& getTotals() const { return totals; }
+
+	/**
+	  * Writes a summary of the merged statistics as JSON, including the slowest tiles
+	  */
+	void writeJson(std::ostream& out) const;
+
+	/**
+	  * Returns an image of the cost of each pixel, from black through blue,
+	  * red and yellow to white. White is the 99th percentile of the cost, so
+	  * that a few very expensive pixels do not hide the rest.
+	  */
+	std::shared_ptr<FrameBuffer> getHeatmap() const;
+
+	/**
+	  * Writes the JSON summary to basename_stats.json, and the heatmap to the
+	  * first free file name basename_costXXXX.extension
+	  */
+	void save(std::string basename, std::string extension) const;
+
+private:
+	struct TileRecord {
+		Tile tile;
+		double seconds;
+		RayCounters counters;
+		bool rendered;
+	};
+
+	/**
+	  * Returns the cost that is white in the heatmap
+	  */
+	float getHeatmapScale() const;
+
+	std::vector<TileRecord> tiles; //< Indexed by Tile::index
+	std::vector<float> costs; //< Intersection tests of each pixel
+	RayCounters totals;
+	unsigned int width;
+	unsigned int height;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef _SCENEBLOB_HPP__
+#define _SCENEBLOB_HPP__
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "StorageArray.hpp"
+
+/**
+  * Returns the FNV-1a hash of size bytes, e.g., to tell whether a blob has changed
+  * @param hash The hash of the bytes before these, to hash several buffers as one
+  */
+inline uint64_t hashBytes(const unsigned char* data, size_t size, uint64_t hash=14695981039346656037ULL) {
+	for (size_t i=0; i<size; ++i) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+  * Writes plain values and arrays of plain values into a blob, which a
+  * BlobReader reads back in the same order. Arrays start on a cache line
+  * boundary, so that a reader can use them where they are.
+  */
+class BlobWriter {
+public:
+	static const size_t alignment = 64;
+
+	template <typename T>
+	inline void write(const T& value) {
+		append(&value, sizeof(T));
+	}
+
+	template <typename T>
+	inline void writeArray(const T* values, size_t n) {
+		write(static_cast<uint64_t>(n));
+		data.resize((data.size() + alignment-1) & ~(alignment-1), 0);
+		append(values, n*sizeof(T));
+	}
+
+	template <typename T>
+	inline void writeArray(const StorageArray<T>& values) {
+		writeArray(values.data(), values.size());
+	}
+
+	template <typename T>
+	inline void writeArray(const std::vector<T>& values) {
+		writeArray(values.empty() ? NULL : &values[0], values.size());
+	}
+
+	inline void writeString(const std::string& value) {
+		writeArray(value.data(), value.size());
+	}
+
+	inline const std::vector<char>& getData() const { return data; }
+
+private:
+	inline void append(const void* values, size_t size) {
+		if (size == 0) return;
+		const char* bytes = static_cast<const char*>(values);
+		data.insert(data.end(), bytes, bytes+size);
+	}
+
+	std::vector<char> data;
+};
+
+/**
+  * Reads a blob written by a BlobWriter from memory, e.g., a mapped file.
+  * Arrays read into a StorageArray refer to the memory instead of copying
+  * it, so the memory must start on a BlobWriter::alignment boundary, as
+  * mapped files do, and is kept alive by the owner given to the reader.
+  */
+class BlobReader {
+public:
+	BlobReader(const unsigned char* data, size_t size, std::shared_ptr<const void> owner) {
+		this->data = data;
+		this->size = size;
+		this->owner = owner;
+		position = 0;
+	}
+
+	template <typename T>
+	inline T read() {
+		T value;
+		std::memcpy(&value, take(sizeof(T)), sizeof(T));
+		return value;
+	}
+
+	/**
+	  * Makes values refer to the next array in the blob
+	  */
+	template <typename T>
+	inline void readArray(StorageArray<T>& values) {
+		size_t n = readCount(sizeof(T));
+		values.setView(reinterpret_cast<const T*>(take(n*sizeof(T))), n, owner);
+	}
+
+	/**
+	  * Copies the next array in the blob into values
+	  */
+	template <typename T>
+	inline void readArray(std::vector<T>& values) {
+		size_t n = readCount(sizeof(T));
+		values.resize(n);
+		if (n > 0) std::memcpy(&values[0], take(n*sizeof(T)), n*sizeof(T));
+	}
+
+	inline std::string readString() {
+		size_t n = readCount(1);
+		return std::string(reinterpret_cast<const char*>(take(n)), n);
+	}
+
+private:
+	/**
+	  * Reads the element count of an array, and skips to the start of it
+	  */
+	inline size_t readCount(size_t element_size) {
+		uint64_t n = read<uint64_t>();
+		position = (position + BlobWriter::alignment-1) & ~(BlobWriter::alignment-1);
+		if (position > size || n > (size-position)/element_size) fail();
+		return static_cast<size_t>(n);
+	}
+
+	inline const unsigned char* take(size_t n) {
+		if (position > size || n > size-position) fail();
+		const unsigned char* result = data + position;
+		position += n;
+		return result;
+	}
+
+	void fail() {
+		throw std::runtime_error("Unexpected end of scene blob");
+	}
+
+	const unsigned char* data;
+	size_t size;
+	size_t position;
+	std::shared_ptr<const void> owner; //< Keeps data alive
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef _SCENEFILE_H__
+#define _SCENEFILE_H__
+
+#include <string>
+
+#include "RayTracer.h"
+
+/**
+  * Scenes described in text files, which are compiled into binary scene
+  * files that are memory mapped and rendered without parsing or building
+  * anything. A text scene has one statement per line, and # starts a comment:
+  *
+  *   camera 0 0 10
+  *   environment cubemaps/SaintLazarusChurch3
+  *   light 0 0 10
+  *   effect gray phong 0.3 0.3 0.3
+  *   effect glass fresnel
+  *   sphere glass -3 0 6 2
+  *   triangle gray -2 0 0 0 1.5 0 2 0 0
+  *   mesh gray bunny.obj 0 -2 5 3
+  *   model bunny bunny.obj 0 0 0 1
+  *   instance gray bunny 2 -2 4 90 1.5
+  *
+  * camera x y z            Position of the camera, which looks down the negative z axis (0 0 10)
+  * environment directory   Cube map holding posx.jpg, negx.jpg, etc. behind everything (none)
+  * light x y z [r g b [r g b]]
+  *                         Point light lighting every phong effect, with diffuse (1 1 1)
+  *                         and specular (0.7 0.7 0.7) color
+  * effect name type ...    Defines an effect for objects to use, where type is one of
+  *                         "color r g b", "phong r g b [noshadows]", "fresnel" and "reflect"
+  * sphere effect x y z radius
+  * triangle effect x y z x y z x y z
+  * mesh effect filename [x y z size]
+  *                         A model loaded through MeshLoader, optionally centered at x y z
+  *                         and scaled so that its largest side has length size
+  * model name filename [x y z size]
+  *                         Loads a model like mesh for instances to share, without adding it
+  *                         to the scene
+  * instance effect model x y z [angle [scale]]
+  *                         A copy of a model rotated angle degrees about the y axis, scaled by scale and
+  *                         moved by x y z. The copies share the vertices and BVH of the model.
+  *
+  * File names are relative to the working directory. The compiled scene holds
+  * the effects and objects, the primitives in the storage the renderer traces
+  * them in, the vertex buffers of the meshes and models, and every
+  * acceleration structure, built. Only cube map images are left out, since the
+  * TextureCache already keeps them decoded.
+  */
+class SceneFile {
+public:
+	/**
+	  * Adds the objects of a scene to rt, with their acceleration structures
+	  * prebuilt, and moves the camera of rt to the camera of the scene. A
+	  * text scene is compiled to getCompiledFilename(filename) first, unless
+	  * it is up to date with the text scene and the meshes it loads, and
+	  * filename may also be a compiled scene.
+	  * @throws std::runtime_error if the scene cannot be loaded
+	  */
+	static void load(std::string filename, RayTracer& rt);
+
+	/**
+	  * Compiles the text scene source into the binary scene file compiled
+	  * @throws std::runtime_error if the scene is invalid or cannot be written
+	  */
+	static void compile(std::string source, std::string compiled);
+
+	/**
+	  * Returns the name of the compiled scene load() uses for a text scene
+	  */
+	static std::string getCompiledFilename(std::string filename);
+};
+
+#endif
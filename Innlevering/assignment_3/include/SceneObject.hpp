@@ -3,36 +3,81 @@
 
 #include <vector>
 #include <memory>
+#include <stdint.h>
 
 #include <glm/glm.hpp>
 
 #include "Ray.hpp"
+#include "AABB.hpp"
+#include "HitRecord.hpp"
+#include "RayPacket.hpp"
 
-class RayTracerState;
 class SceneObjectEffect;
+class SceneStorage;
 
 /**
   * The abstract SceneObject class defines what a scene object needs to be able to perform:
-  * intersection test, and recursive ray-tracing.
+  * intersection test, and recursive ray-tracing through its effect.
   */
 class SceneObject {
 public:
 	/**
-	  * Computes the closest point of intersection
+	  * Computes the closest point of intersection, and records it in hit if it
+	  * is closer than hit.t. Objects should skip computing the normal etc. for
+	  * intersections that turn out to be further away.
 	  * @param r The ray to perform intersection test against
-	  * @param t If intersection found, this is set so that t*r is the point of intersection
-	  * @return true if intersection found, false otherwise
+	  * @param k The scene index of this object
+	  * @param hit The closest hit so far, updated if this object is closer
+	  * @return true if a closer intersection was found, false otherwise
 	  */
-	virtual float intersect(const Ray& r) = 0;
+	virtual bool intersect(const Ray& r, int k, HitRecord& hit) = 0;
 
 	/**
-	  * Performs recursive raytracing of the elements in scene
-	  * @param scene All elements in the scene
-	  * @param r The incoming ray to trace
-	  * @param color The color to set
-	  * @param depth The recursion depth of this tracing
+	  * Returns the effect that shades (recursively ray-traces) intersections
+	  * with this object
 	  */
-	virtual glm::vec3 rayTrace(Ray &ray, const float& t, RayTracerState& state) = 0;
+	virtual SceneObjectEffect* getEffect() { return effect.get(); }
+
+	/**
+	  * Computes the bounding box of the object, used to build the acceleration structure
+	  * @param bounds Set to the bounding box of the object
+	  * @return false if the object is unbounded (e.g., the cube map), true otherwise
+	  */
+	virtual bool getBounds(AABB& bounds) { return false; }
+
+	/**
+	  * Adds the primitives of this object to the compact scene storage, if the
+	  * storage has a representation for them.
+	  * @param k The scene index of this object
+	  * @return false if the object must be intersected through intersect() instead
+	  */
+	virtual bool store(SceneStorage& storage, int k) { return false; }
+
+	/**
+	  * Returns a hash of the geometry of an object that is not in the scene
+	  * storage, such as the buffers of a mesh, which its bounding box does not
+	  * tell apart. See RayTracerState::getGeometryHash().
+	  * @return 0 if the bounding box is all there is to the geometry
+	  */
+	virtual uint64_t getGeometryHash() { return 0; }
+
+	/**
+	  * Intersects all active rays in a packet with this object, and records
+	  * closer hits in the packet. The default implementation falls back to
+	  * intersect() for every lane; objects with a SIMD kernel override it.
+	  * @param k The scene index of this object
+	  */
+	virtual void intersectPacket(RayPacket& packet, const PacketKernels& kernels, int k) {
+		for (unsigned int lane=0; lane<RayPacket::width; ++lane) {
+			if (!(packet.active & (1u << lane))) continue;
+			Ray r(glm::vec3(packet.ox[lane], packet.oy[lane], packet.oz[lane]),
+				glm::vec3(packet.dx[lane], packet.dy[lane], packet.dz[lane]));
+			HitRecord hit;
+			hit.t = packet.t[lane];
+			hit.object = packet.object[lane];
+			if (intersect(r, k, hit)) packet.update(lane, hit.t, k);
+		}
+	}
 	
 
 protected:
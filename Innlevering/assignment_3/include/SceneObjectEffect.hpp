@@ -1,8 +1,13 @@
 #ifndef SCENEOBJECTEFFECT_HPP__
 #define SCENEOBJECTEFFECT_HPP__
 
+#include <vector>
+
 #include "Ray.hpp"
-#include "RayTracerState.hpp"
+#include "HitRecord.hpp"
+#include "RayCounters.hpp"
+#include "RayTracerState.h"
+#include "SceneBlob.hpp"
 
 /**
   * Abstract class that defines what it means to be an effect for a scene object
@@ -12,8 +17,16 @@ public:
 	/**
 	  * This function "shades" an intersection point between a scene object
 	  * and a ray. It can also fire new rays etc.
+	  * @param hit The closest intersection, with point and normal filled in
+	  */
+	virtual glm::vec3 rayTrace(Ray &ray, const HitRecord& hit, RayTracerState& state) = 0;
+
+	/**
+	  * Returns a hash of the parameters of the effect, such as its colors and
+	  * lights, see RayTracerState::getEffectHash(). Effects without parameters
+	  * return 0, since the type of the effect is hashed along with it.
 	  */
-	virtual glm::vec3 rayTrace(Ray &ray, const float& t, const glm::vec3& normal, RayTracerState& state) = 0;
+	virtual uint64_t getParameterHash() { return 0; }
 	/**
 	based on the effect, the light dissapears
 	*/
@@ -30,16 +43,22 @@ public:
 		this->color = color;
 	}
 
-	glm::vec3 rayTrace(Ray &ray, const float& t, const glm::vec3& normal, RayTracerState& state) {
+	glm::vec3 rayTrace(Ray &ray, const HitRecord& hit, RayTracerState& state) {
 		return color;
 	}
 
+	uint64_t getParameterHash() {
+		return hashBytes(reinterpret_cast<const unsigned char*>(&color), sizeof(color));
+	}
+
 private:
 	glm::vec3 color;
 };
 
 /**
-  * The phong effect simply uses phong shading to color the intersection point
+  * The phong effect simply uses phong shading to color the intersection point.
+  * It supports any number of point lights, and can cast shadow rays so that
+  * lights hidden behind other objects do not contribute (see setShadows()).
   */
 class PhongEffect : public SceneObjectEffect {
 public:
@@ -47,37 +66,76 @@ public:
 				glm::vec3 light_pos=glm::vec3(0.0),
 				glm::vec3 light_diff=glm::vec3(1.0),
 				glm::vec3 light_spec=glm::vec3(0.7)) {
-		this->light_pos = light_pos;
-		this->light_diff = light_diff;
-		this->light_spec = light_spec;
 		this->color = color;
+		this->shadows = false;
+		addLight(light_pos, light_diff, light_spec);
 	}
 
-	glm::vec3 rayTrace(Ray &ray, const float& t, const glm::vec3& normal, RayTracerState& state) {
-		glm::vec3 out_color = color;
+	/**
+	  * Adds another point light that lights the object
+	  */
+	void addLight(glm::vec3 light_pos,
+				glm::vec3 light_diff=glm::vec3(1.0),
+				glm::vec3 light_spec=glm::vec3(0.7)) {
+		Light light;
+		light.pos = light_pos;
+		light.diff = light_diff;
+		light.spec = light_spec;
+		lights.push_back(light);
+	}
+
+	/**
+	  * Enables or disables (default) shadow rays towards the lights. They
+	  * cost one occlusion query per light and hit.
+	  */
+	void setShadows(bool shadows) {
+		this->shadows = shadows;
+	}
+
+	uint64_t getParameterHash() {
+		uint64_t hash = hashBytes(reinterpret_cast<const unsigned char*>(&color), sizeof(color));
+		hash = hashBytes(reinterpret_cast<const unsigned char*>(&shadows), sizeof(shadows), hash);
+		for (unsigned int i=0; i<lights.size(); ++i) {
+			hash = hashBytes(reinterpret_cast<const unsigned char*>(&lights[i]), sizeof(Light), hash);
+		}
+		return hash;
+	}
+
+	glm::vec3 rayTrace(Ray &ray, const HitRecord& hit, RayTracerState& state) {
+		glm::vec3 out_color(0.0f);
 		ray.invalidate();
-		glm::vec3 g_l = glm::normalize(light_pos - (ray.getOrigin() + ray.getDirection() * t));
 		glm::vec3 g_v = glm::normalize(-ray.getDirection());
 
+		for (unsigned int i=0; i<lights.size(); ++i) {
+			const Light& light = lights[i];
+			glm::vec3 to_light = light.pos - hit.point;
+			glm::vec3 g_l = glm::normalize(to_light);
 
-		float diff = glm::max(0.0f, glm::dot(normal, g_l));
-		float spec = pow(glm::max(0.0f, glm::dot(normal, glm::normalize(g_v + g_l))), 128.0f);
+			if (shadows && state.occluded(hit.point, g_l, glm::length(to_light))) continue;
 
-		out_color = glm::vec3(diff * light_diff * out_color + light_spec * spec);
-		//throw std::runtime_error("PhongEffect::rayTrace(...) not implemented yet");
+			float diff = glm::max(0.0f, glm::dot(hit.normal, g_l));
+			float spec = pow(glm::max(0.0f, glm::dot(hit.normal, glm::normalize(g_v + g_l))), 128.0f);
+
+			out_color += glm::vec3(diff * light.diff * color + light.spec * spec);
+		}
 
 		return out_color;
 	}
 private:
-	glm::vec3 light_pos; //Light position
-	glm::vec3 light_diff; //Light diffuse component
-	glm::vec3 light_spec; //Light specular component
+	struct Light {
+		glm::vec3 pos; //Light position
+		glm::vec3 diff; //Light diffuse component
+		glm::vec3 spec; //Light specular component
+	};
+
+	std::vector<Light> lights;
 	glm::vec3 color;
+	bool shadows;
 };
 
 class FresnelEffect : public SceneObjectEffect {
 public:
-	glm::vec3 rayTrace(Ray &ray, const float& t, const glm::vec3& normal, RayTracerState& state) {
+	glm::vec3 rayTrace(Ray &ray, const HitRecord& hit, RayTracerState& state) {
 		const float eta_air = 1.000293f;
 		const float eta_carbondioxide = 1.00045f;
 		const float eta_water = 1.3330f;
@@ -91,7 +149,7 @@ public:
 		float eta = eta0/eta1;
 		float R0 = pow((eta0-eta1)/(eta0+eta1), 2.0f);
 
-		glm::vec3 n = normal;
+		glm::vec3 n = hit.normal;
 		glm::vec3 v = ray.getDirection();
 
 	
@@ -155,8 +213,36 @@ public:
 
 		}
 
-		Ray reflect_ray = ray.spawn(t, reflect, 10);
-		Ray refract_ray = ray.spawn(t, refract, 10);
+		//Pick one of the two branches with probability equal to its weight, so that
+		//the number of rays grows linearly instead of exponentially with the depth.
+		//Also done when the ray budget does not allow for following both branches.
+		if (state.getStochasticBranching() || ray.getBudget() < 2) {
+			if (ray.random() < fresnel) {
+				Ray reflect_ray = ray.spawn(hit.t, reflect);
+				reflect_ray.reflectCone(hit.curvature);
+				RayCounters::countRay(RayCounters::REFLECT_RAY, reflect_ray);
+				return state.rayTrace(reflect_ray);
+			}
+			else {
+				Ray refract_ray = ray.spawn(hit.t, refract);
+				RayCounters::countRay(RayCounters::REFRACT_RAY, refract_ray);
+				return state.rayTrace(refract_ray) * glm::vec3(eta, 1.0f, eta);
+			}
+		}
+
+		//Split the remaining budget between the branches according to their weights
+		unsigned int reflect_budget = Ray::unlimited_budget;
+		unsigned int refract_budget = Ray::unlimited_budget;
+		if (ray.getBudget() != Ray::unlimited_budget) {
+			unsigned int budget = ray.getBudget()-2;
+			reflect_budget = static_cast<unsigned int>(glm::clamp(fresnel, 0.0f, 1.0f)*budget);
+			refract_budget = budget-reflect_budget;
+		}
+		Ray reflect_ray = ray.spawn(hit.t, reflect, fresnel, reflect_budget);
+		Ray refract_ray = ray.spawn(hit.t, refract, 1.0f-fresnel, refract_budget);
+		reflect_ray.reflectCone(hit.curvature);
+		RayCounters::countRay(RayCounters::REFLECT_RAY, reflect_ray);
+		RayCounters::countRay(RayCounters::REFRACT_RAY, refract_ray);
 
 		glm::vec3 reflect1 = state.rayTrace(reflect_ray);
 		glm::vec3 refract1 = state.rayTrace(refract_ray);
@@ -171,13 +257,15 @@ public:
 
 class ReflectSteelEffect : public SceneObjectEffect {
 public:
-	glm::vec3 rayTrace(Ray &ray, const float& t, const glm::vec3& normal, RayTracerState& state) {
-		glm::vec3 n = glm::normalize(normal);
+	glm::vec3 rayTrace(Ray &ray, const HitRecord& hit, RayTracerState& state) {
+		glm::vec3 n = glm::normalize(hit.normal);
 		glm::vec3 v = glm::normalize(ray.getDirection());
 
 		glm::vec3 reflect = glm::reflect(v, n);
 
-		Ray reflect_ray = ray.spawn(t, reflect, 10);
+		Ray reflect_ray = ray.spawn(hit.t, reflect);
+		reflect_ray.reflectCone(hit.curvature);
+		RayCounters::countRay(RayCounters::REFLECT_RAY, reflect_ray);
 
 		glm::vec3 reflect1 = state.rayTrace(reflect_ray);
 		return glm::vec3(reflect1);
@@ -0,0 +1,384 @@
+#ifndef _SCENESTORAGE_HPP__
+#define _SCENESTORAGE_HPP__
+
+#include <vector>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+
+#include "AABB.hpp"
+#include "BVH.hpp"
+#include "HitRecord.hpp"
+#include "Intersection.hpp"
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+#include "StorageArray.hpp"
+#include "SceneBlob.hpp"
+
+/**
+  * Reorders array so that element i becomes the old element order[i]
+  */
+template <typename T>
+inline void reorderArray(StorageArray<T>& array, const std::vector<unsigned int>& order) {
+	std::vector<T> tmp(array.size());
+	for (unsigned int i=0; i<order.size(); ++i) {
+		tmp[i] = array[order[i]];
+	}
+	array.swap(tmp);
+}
+
+/**
+  * All spheres in the scene stored as a structure of arrays: one contiguous
+  * array per component instead of one heap allocated object per sphere.
+  */
+class SphereArray {
+public:
+	inline void clear() {
+		cx.clear(); cy.clear(); cz.clear();
+		radius.clear();
+		object.clear();
+	}
+
+	/**
+	  * Adds a sphere, where k is the index of the SceneObject it came from
+	  */
+	inline void add(const glm::vec3& center, float r, int k) {
+		cx.push_back(center.x); cy.push_back(center.y); cz.push_back(center.z);
+		radius.push_back(r);
+		object.push_back(k);
+	}
+
+	inline unsigned int size() const { return static_cast<unsigned int>(radius.size()); }
+
+	inline AABB getBounds(unsigned int i) const {
+		glm::vec3 p(cx[i], cy[i], cz[i]);
+		return AABB(p-glm::vec3(radius[i]), p+glm::vec3(radius[i]));
+	}
+
+	inline void reorder(const std::vector<unsigned int>& order) {
+		reorderArray(cx, order); reorderArray(cy, order); reorderArray(cz, order);
+		reorderArray(radius, order);
+		reorderArray(object, order);
+	}
+
+	inline void write(BlobWriter& out) const {
+		out.writeArray(cx); out.writeArray(cy); out.writeArray(cz);
+		out.writeArray(radius);
+		out.writeArray(object);
+	}
+
+	inline void read(BlobReader& in) {
+		in.readArray(cx); in.readArray(cy); in.readArray(cz);
+		in.readArray(radius);
+		in.readArray(object);
+		checkSizes();
+	}
+
+	/**
+	  * Intersects the ray with spheres [begin, end), and updates hit
+	  * if any of them is closer than the current closest hit
+	  */
+	inline void intersect(unsigned int begin, unsigned int end, const Ray& ray, HitRecord& hit) const {
+		for (unsigned int i=begin; i<end; ++i) {
+			Intersection::sphere(glm::vec3(cx[i], cy[i], cz[i]), radius[i], ray, object[i], hit);
+		}
+	}
+
+	/**
+	  * Tests whether any of spheres [begin, end) is closer than hit.t, and
+	  * records the first one found
+	  */
+	inline bool occluded(unsigned int begin, unsigned int end, const Ray& ray, HitRecord& hit) const {
+		for (unsigned int i=begin; i<end; ++i) {
+			if (Intersection::sphere(glm::vec3(cx[i], cy[i], cz[i]), radius[i], ray, object[i], hit)) return true;
+		}
+		return false;
+	}
+
+	inline void intersectPacket(unsigned int begin, unsigned int end, RayPacket& packet, const PacketKernels& kernels) const {
+		for (unsigned int i=begin; i<end; ++i) {
+			const float center[3] = {cx[i], cy[i], cz[i]};
+			kernels.intersectSphere(packet, center, radius[i], object[i]);
+		}
+	}
+
+private:
+	inline void checkSizes() const {
+		if (cx.size() != radius.size() || cy.size() != radius.size() || cz.size() != radius.size()
+				|| object.size() != radius.size()) {
+			throw std::runtime_error("Sphere arrays differ in size");
+		}
+	}
+
+	StorageArray<float> cx, cy, cz; //< Centers
+	StorageArray<float> radius;
+	StorageArray<int> object; //< Scene index of the SceneObject the sphere belongs to
+};
+
+/**
+  * All triangles in the scene stored as a structure of arrays, including
+  * the normal and the edges used by the inside test, so that nothing is
+  * recomputed per ray.
+  */
+class TriangleArray {
+public:
+	inline void clear() {
+		for (int k=0; k<3; ++k) {
+			a[k].clear(); b[k].clear(); c[k].clear();
+			ca[k].clear(); ab[k].clear(); bc[k].clear();
+			n[k].clear();
+		}
+		object.clear();
+	}
+
+	/**
+	  * Adds the triangle (v0, v1, v2) with unit normal, where k is the index
+	  * of the SceneObject it came from
+	  */
+	inline void add(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& normal, int k) {
+		glm::vec3 e_ca = v2 - v0;
+		glm::vec3 e_ab = v0 - v1;
+		glm::vec3 e_bc = v1 - v2;
+		for (int i=0; i<3; ++i) {
+			a[i].push_back(v0[i]); b[i].push_back(v1[i]); c[i].push_back(v2[i]);
+			ca[i].push_back(e_ca[i]); ab[i].push_back(e_ab[i]); bc[i].push_back(e_bc[i]);
+			n[i].push_back(normal[i]);
+		}
+		object.push_back(k);
+	}
+
+	inline unsigned int size() const { return static_cast<unsigned int>(object.size()); }
+
+	inline AABB getBounds(unsigned int i) const {
+		AABB bounds;
+		bounds.expand(get(a, i));
+		bounds.expand(get(b, i));
+		bounds.expand(get(c, i));
+		return bounds;
+	}
+
+	inline void reorder(const std::vector<unsigned int>& order) {
+		for (int k=0; k<3; ++k) {
+			reorderArray(a[k], order); reorderArray(b[k], order); reorderArray(c[k], order);
+			reorderArray(ca[k], order); reorderArray(ab[k], order); reorderArray(bc[k], order);
+			reorderArray(n[k], order);
+		}
+		reorderArray(object, order);
+	}
+
+	inline void write(BlobWriter& out) const {
+		for (int k=0; k<3; ++k) {
+			out.writeArray(a[k]); out.writeArray(b[k]); out.writeArray(c[k]);
+			out.writeArray(ca[k]); out.writeArray(ab[k]); out.writeArray(bc[k]);
+			out.writeArray(n[k]);
+		}
+		out.writeArray(object);
+	}
+
+	inline void read(BlobReader& in) {
+		for (int k=0; k<3; ++k) {
+			in.readArray(a[k]); in.readArray(b[k]); in.readArray(c[k]);
+			in.readArray(ca[k]); in.readArray(ab[k]); in.readArray(bc[k]);
+			in.readArray(n[k]);
+		}
+		in.readArray(object);
+		for (int k=0; k<3; ++k) {
+			if (a[k].size() != object.size() || b[k].size() != object.size() || c[k].size() != object.size()
+					|| ca[k].size() != object.size() || ab[k].size() != object.size() || bc[k].size() != object.size()
+					|| n[k].size() != object.size()) {
+				throw std::runtime_error("Triangle arrays differ in size");
+			}
+		}
+	}
+
+	/**
+	  * Intersects the ray with triangles [begin, end), and updates hit
+	  * if any of them is closer than the current closest hit
+	  */
+	inline void intersect(unsigned int begin, unsigned int end, const Ray& ray, HitRecord& hit) const {
+		for (unsigned int i=begin; i<end; ++i) {
+			Intersection::triangle(get(a, i), get(b, i), get(c, i),
+				get(ca, i), get(ab, i), get(bc, i), get(n, i), ray, object[i], hit);
+		}
+	}
+
+	/**
+	  * Tests whether any of triangles [begin, end) is closer than hit.t, and
+	  * records the first one found
+	  */
+	inline bool occluded(unsigned int begin, unsigned int end, const Ray& ray, HitRecord& hit) const {
+		for (unsigned int i=begin; i<end; ++i) {
+			if (Intersection::triangle(get(a, i), get(b, i), get(c, i),
+					get(ca, i), get(ab, i), get(bc, i), get(n, i), ray, object[i], hit)) return true;
+		}
+		return false;
+	}
+
+	inline void intersectPacket(unsigned int begin, unsigned int end, RayPacket& packet, const PacketKernels& kernels) const {
+		for (unsigned int i=begin; i<end; ++i) {
+			const float v0[3] = {a[0][i], a[1][i], a[2][i]};
+			const float v1[3] = {b[0][i], b[1][i], b[2][i]};
+			const float v2[3] = {c[0][i], c[1][i], c[2][i]};
+			const float normal[3] = {n[0][i], n[1][i], n[2][i]};
+			kernels.intersectTriangle(packet, v0, v1, v2, normal, object[i]);
+		}
+	}
+
+private:
+	static inline glm::vec3 get(const StorageArray<float> (&v)[3], unsigned int i) {
+		return glm::vec3(v[0][i], v[1][i], v[2][i]);
+	}
+
+	StorageArray<float> a[3], b[3], c[3]; //< Vertices, one array per component
+	StorageArray<float> ca[3], ab[3], bc[3]; //< Edges c-a, a-b and b-c
+	StorageArray<float> n[3]; //< Unit normals
+	StorageArray<int> object; //< Scene index of the SceneObject the triangle belongs to
+};
+
+/**
+  * Compact storage of the primitives in the scene, grouped by type, so that
+  * intersection loops run over contiguous arrays of one primitive type
+  * without pointer chasing or virtual calls. Scene objects put themselves
+  * in here through SceneObject::store().
+  *
+  * One BVH is built over all primitives, and the per-type arrays are then
+  * sorted in the order the primitives appear in the BVH leaves. Every leaf
+  * thus covers one contiguous range of spheres and one of triangles.
+  */
+class SceneStorage {
+public:
+	inline void clear() {
+		spheres.clear();
+		triangles.clear();
+		bvh.build(std::vector<AABB>());
+		sphere_prefix.clear();
+		sphere_order.clear();
+		triangle_order.clear();
+	}
+
+	/**
+	  * Builds the BVH over all primitives, and sorts them in leaf order
+	  */
+	inline void build() {
+		unsigned int n_spheres = spheres.size();
+		bvh.build(getBounds());
+
+		//Split the leaf order into one order per type, and count how many
+		//spheres come before every position in the leaf order
+		const StorageArray<unsigned int>& order = bvh.getIndices();
+		sphere_order.clear();
+		triangle_order.clear();
+		sphere_prefix.resize(order.size()+1);
+		sphere_prefix[0] = 0;
+		for (unsigned int i=0; i<order.size(); ++i) {
+			if (order[i] < n_spheres) sphere_order.push_back(order[i]);
+			else triangle_order.push_back(order[i]-n_spheres);
+			sphere_prefix[i+1] = static_cast<unsigned int>(sphere_order.size());
+		}
+		spheres.reorder(sphere_order);
+		triangles.reorder(triangle_order);
+	}
+
+	/**
+	  * Refits the BVH to primitives that have moved. The arrays must have
+	  * been cleared and filled again with as many primitives of each type, in
+	  * the same order, as before the last build(). They are then sorted in
+	  * the same leaf order as by build().
+	  * @return false if the BVH must be built again instead, because the
+	  * primitives do not match those it was built for (e.g., after read()),
+	  * or the refitted BVH has become too slow
+	  */
+	inline bool refit() {
+		if (spheres.size() != sphere_order.size() || triangles.size() != triangle_order.size()) return false;
+		std::vector<AABB> bounds = getBounds();
+		spheres.reorder(sphere_order);
+		triangles.reorder(triangle_order);
+		return bvh.refit(bounds);
+	}
+
+	/**
+	  * Writes the primitives and the BVH, as sorted by build()
+	  */
+	inline void write(BlobWriter& out) const {
+		spheres.write(out);
+		triangles.write(out);
+		bvh.write(out);
+		out.writeArray(sphere_prefix);
+	}
+
+	/**
+	  * Reads what write() wrote, which is used in place instead of building it
+	  */
+	inline void read(BlobReader& in) {
+		spheres.read(in);
+		triangles.read(in);
+		bvh.read(in);
+		in.readArray(sphere_prefix);
+		sphere_order.clear();
+		triangle_order.clear();
+		if (sphere_prefix.size() != bvh.getIndices().size()+1
+				|| bvh.getIndices().size() != spheres.size()+triangles.size()) {
+			throw std::runtime_error("Scene storage does not match its BVH");
+		}
+	}
+
+	/**
+	  * Finds the closest primitive hit by the ray, and updates hit
+	  * if it is closer than the current closest hit
+	  */
+	inline void intersect(const Ray& ray, HitRecord& hit) const {
+		auto visit_leaf = [&](unsigned int offset, unsigned int count) {
+			unsigned int s0 = sphere_prefix[offset];
+			unsigned int s1 = sphere_prefix[offset+count];
+			spheres.intersect(s0, s1, ray, hit);
+			triangles.intersect(offset-s0, offset+count-s1, ray, hit);
+		};
+		bvh.traverseLeaves(ray, hit.t, visit_leaf);
+	}
+
+	/**
+	  * Any-hit query: tests whether any primitive is closer than hit.t, and
+	  * stops at the first one found, which is recorded in hit
+	  */
+	inline bool occluded(const Ray& ray, HitRecord& hit) const {
+		auto visit_leaf = [&](unsigned int offset, unsigned int count) {
+			unsigned int s0 = sphere_prefix[offset];
+			unsigned int s1 = sphere_prefix[offset+count];
+			return spheres.occluded(s0, s1, ray, hit)
+				|| triangles.occluded(offset-s0, offset+count-s1, ray, hit);
+		};
+		return bvh.traverseLeavesAny(ray, hit.t, visit_leaf);
+	}
+
+	inline void intersectPacket(RayPacket& packet, const PacketKernels& kernels) const {
+		auto visit_leaf = [&](unsigned int offset, unsigned int count) {
+			unsigned int s0 = sphere_prefix[offset];
+			unsigned int s1 = sphere_prefix[offset+count];
+			spheres.intersectPacket(s0, s1, packet, kernels);
+			triangles.intersectPacket(offset-s0, offset+count-s1, packet, kernels);
+		};
+		bvh.traversePacketLeaves(packet, kernels, visit_leaf);
+	}
+
+	SphereArray spheres;
+	TriangleArray triangles;
+
+private:
+	/**
+	  * Returns the bounds of all spheres followed by all triangles
+	  */
+	inline std::vector<AABB> getBounds() const {
+		std::vector<AABB> bounds;
+		bounds.reserve(spheres.size() + triangles.size());
+		for (unsigned int i=0; i<spheres.size(); ++i) bounds.push_back(spheres.getBounds(i));
+		for (unsigned int i=0; i<triangles.size(); ++i) bounds.push_back(triangles.getBounds(i));
+		return bounds;
+	}
+
+	BVH bvh; //< One hierarchy over both spheres and triangles
+	StorageArray<unsigned int> sphere_prefix; //< Number of spheres before each position in leaf order
+	std::vector<unsigned int> sphere_order; //< Sphere order of the last build(), see refit()
+	std::vector<unsigned int> triangle_order;
+};
+
+#endif
@@ -1,9 +1,10 @@
 #ifndef _SPHERE_HPP__
 #define _SPHERE_HPP__
 
-#include "RayTracerState.hpp"
+#include "RayTracerState.h"
 #include "SceneObject.hpp"
 #include "SceneObjectEffect.hpp"
+#include "Intersection.hpp"
 #include <algorithm>
 #include <glm/glm.hpp>
 #include <cmath>
@@ -21,70 +22,40 @@ public:
 	}
 
 	/**
-	  * Computes the ray-sphere intersection
+	  * Moves the sphere. Call RayTracer::markSceneObjectsMoved() before the next
+	  * render() once the objects of the frame have been moved.
 	  */
-	float intersect(const Ray& r) {
-		const float z_offset = 10e-4f;
-		const glm::vec3 d = r.getDirection();
-		const glm::vec3 p0 = r.getOrigin();
-		float a = glm::dot(d, d);
-		float b = 2.0f*glm::dot(d, (p0-p));
-		float c = glm::dot(p0-p, p0-p)-this->r*this->r;
-		float abc = (b*b-4.0f*a*c);
+	inline void setCenter(glm::vec3 center) { p = center; }
+	inline glm::vec3 getCenter() const { return p; }
 
+	inline void setRadius(float radius) { r = radius; }
+	inline float getRadius() const { return r; }
+
+	/**
+	  * Computes the ray-sphere intersection, and the normal if it is the closest hit so far
+	  */
+	bool intersect(const Ray& r, int k, HitRecord& hit) {
 		static int initialized=1;
 		if (!initialized) {
 			std::cerr << "The Sphere::intersect(...) function is not implemented properly!" << std::endl;
 			++initialized;
 		}
 
-		//Just test whether or not we hit the ray to display something at least
-		if (abc >= 0.0f) {
-			float t0 = (-b - sqrt(abc)) / (2*a);
-			float t1 = (-b + sqrt(abc)) / (2*a);
-
-			if((t0 * t1) < 0) {
-				if(t0 > t1) {
-					return t0;
-				}
-				return t1;
-			}
-
-			if(t0 > 0 && t1 > 0) {
-				if(t0 > t1) {
-					return t1;
-				}
-				return t0;
-			}
+		return Intersection::sphere(p, this->r, r, k, hit);
+	}
 
-			return -1;
-		}
-		else {
-			return -1;
-		}
+	bool getBounds(AABB& bounds) {
+		bounds = AABB(p-glm::vec3(r), p+glm::vec3(r));
+		return true;
 	}
-	
-	/**
-	  * Computes normal for an intersection point on a sphere
-	  */
-	const glm::vec3 computeNormal(const Ray& r, const float& t) {
-		
-		const glm::vec3 qR = r.getDirection();
-		glm::vec3 q = qR * t;
-		q += r.getOrigin();
 
-		glm::vec3 n = (q - p) / this->r;
-		static int initialized=1;
-		if (!initialized) {
-			std::cerr << "The Sphere::computeNormal(...) function is not implemented properly!" << std::endl;
-			++initialized;
-		}
-		return n;
+	void intersectPacket(RayPacket& packet, const PacketKernels& kernels, int k) {
+		kernels.intersectSphere(packet, &p[0], r, k);
 	}
 
-	glm::vec3 rayTrace(Ray &ray, const float& t, RayTracerState& state) {
-		glm::vec3 normal = computeNormal(ray, t);
-		return effect->rayTrace(ray, t, normal, state);
+	bool store(SceneStorage& storage, int k) {
+		storage.spheres.add(p, r, k);
+		return true;
 	}
 
 protected:
@@ -0,0 +1,132 @@
+#ifndef _STORAGEARRAY_HPP__
+#define _STORAGEARRAY_HPP__
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+/**
+  * A read-mostly array of plain data that either owns its elements, like a
+  * std::vector, or refers to elements kept alive by someone else, such as a
+  * memory mapped scene file (see SceneBlob.hpp). Acceleration structures
+  * store their arrays in these, so that a prebuilt structure can be used in
+  * place without copying it. Only arrays that own their elements may be
+  * modified: any modification of a view first drops the view.
+  */
+template <typename T>
+class StorageArray {
+public:
+	StorageArray() {
+		ptr = NULL;
+		length = 0;
+	}
+
+	StorageArray(const StorageArray& other) {
+		*this = other;
+	}
+
+	StorageArray& operator=(const StorageArray& other) {
+		if (this == &other) return *this;
+		owned = other.owned;
+		owner = other.owner;
+		if (owner) {
+			ptr = other.ptr;
+			length = other.length;
+		}
+		else {
+			bindOwned();
+		}
+		return *this;
+	}
+
+	inline size_t size() const { return length; }
+	inline bool empty() const { return length == 0; }
+	inline const T* data() const { return ptr; }
+	inline const T& operator[](size_t i) const { return ptr[i]; }
+	inline T& operator[](size_t i) {
+		drop();
+		return owned[i];
+	}
+	inline const T& back() const { return ptr[length-1]; }
+
+	/**
+	  * Returns true if the elements are owned by someone else
+	  */
+	inline bool isView() const { return owner.get() != NULL; }
+
+	inline void clear() {
+		owner.reset();
+		owned.clear();
+		bindOwned();
+	}
+
+	inline void reserve(size_t n) {
+		drop();
+		owned.reserve(n);
+		bindOwned();
+	}
+
+	inline void resize(size_t n) {
+		drop();
+		owned.resize(n);
+		bindOwned();
+	}
+
+	inline void push_back(const T& value) {
+		drop();
+		owned.push_back(value);
+		bindOwned();
+	}
+
+	/**
+	  * Replaces the elements with a copy of values
+	  */
+	inline void assign(const std::vector<T>& values) {
+		owner.reset();
+		owned = values;
+		bindOwned();
+	}
+
+	/**
+	  * Swaps the elements with those of values, which gets the old elements
+	  */
+	inline void swap(std::vector<T>& values) {
+		drop();
+		owned.swap(values);
+		bindOwned();
+	}
+
+	/**
+	  * Makes the array refer to n elements at data, which stay valid as long
+	  * as owner, or a copy of it, exists
+	  */
+	inline void setView(const T* data, size_t n, std::shared_ptr<const void> owner) {
+		std::vector<T>().swap(this->owned);
+		this->owner = owner;
+		ptr = data;
+		length = n;
+	}
+
+private:
+	/**
+	  * Turns a view into an owned copy of its elements
+	  */
+	inline void drop() {
+		if (!owner) return;
+		owned.assign(ptr, ptr+length);
+		owner.reset();
+		bindOwned();
+	}
+
+	inline void bindOwned() {
+		ptr = owned.empty() ? NULL : &owned[0];
+		length = owned.size();
+	}
+
+	std::vector<T> owned;
+	std::shared_ptr<const void> owner; //< Keeps the elements of a view alive, NULL if owned
+	const T* ptr;
+	size_t length;
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef _TILECOORDINATOR_H__
+#define _TILECOORDINATOR_H__
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <functional>
+#include <stdint.h>
+
+#include "TileScheduler.h"
+#include "Checkpoint.h"
+
+/**
+  * Renders tiles in worker processes, so that a frame can use more than the
+  * cores of one process. Each worker is connected to the coordinator with a
+  * local socket, loads the scene it is sent, and then renders the tiles it
+  * is sent one at a time and sends back their samples. A few tiles are kept
+  * queued at every worker, so that they never wait for the next one. When a
+  * worker dies or fails, it is stopped and its tiles are handed to the
+  * others, and it is started again for the next run(). Only the socket is
+  * shared, so workers on other machines only need a connection of their own.
+  * Worker processes are only supported on POSIX systems.
+  */
+class TileCoordinator {
+public:
+	/**
+	  * Starts n_workers processes running "program --worker <fd>", which are
+	  * expected to call serve() on the socket fd
+	  * @throws std::runtime_error if the workers cannot be started
+	  */
+	TileCoordinator(std::string program, unsigned int n_workers);
+
+	/**
+	  * Disconnects the workers, which makes them exit, and waits for them
+	  */
+	~TileCoordinator();
+
+	/**
+	  * Renders the tiles of the scene on the workers, calling store on the
+	  * calling thread for every tile as it is done. Workers stopped by an
+	  * earlier run are started again first. A worker that fails to load the
+	  * scene or render a tile is stopped, and its tiles handed to the others.
+	  * @param scene Sent to the workers, which pass it to their load_scene
+	  * @throws std::runtime_error if all workers are stopped before the tiles
+	  * are done, with the last failure if any
+	  */
+	void run(std::string scene, const std::vector<Tile>& tiles, std::function<void (const Tile&, const TileSamples&)> store);
+
+	/**
+	  * Returns the number of workers that are still running
+	  */
+	unsigned int getWorkerCount() const;
+
+	/**
+	  * Serves the requests of a coordinator on the socket fd, until the
+	  * coordinator disconnects. Exceptions thrown by load_scene and
+	  * render_tile are sent to the coordinator.
+	  */
+	static void serve(int fd, std::function<void (const std::string&)> load_scene,
+			std::function<void (const Tile&, TileSamples&)> render_tile);
+
+private:
+	TileCoordinator(const TileCoordinator&);
+	TileCoordinator& operator=(const TileCoordinator&);
+
+	enum MessageType {
+		LOAD_SCENE = 1, //< The scene, as text
+		RENDER_TILE = 2, //< The tile
+		TILE_DONE = 3, //< The samples of the tile
+		FAILED = 4 //< An error message
+	};
+
+	/**
+	  * Every message starts with its type and the size of the rest of the message
+	  */
+	struct MessageHeader {
+		uint32_t type;
+		uint32_t size;
+	};
+
+	struct TileMessage {
+		uint32_t x0, y0;
+		uint32_t x1, y1;
+		uint32_t index;
+	};
+
+	struct SamplesHeader {
+		uint32_t index;
+		uint32_t pixels;
+		uint32_t min_samples;
+		uint32_t max_samples;
+		float threshold;
+	};
+
+	struct Pixel {
+		float sum[3];
+		float sum_sq;
+		uint32_t count;
+	};
+
+	struct Worker {
+		int fd; //< -1 once stopped
+		int pid;
+		std::deque<unsigned int> tiles; //< Indices of the tiles sent to the worker, in order
+		std::vector<char> received; //< Received data not handled yet
+	};
+
+	static std::vector<char> encodeSamples(const Tile& tile, const TileSamples& samples);
+
+	/**
+	  * Sends a message to a worker
+	  * @return false if the worker is gone
+	  */
+	static bool send(Worker& worker, uint32_t type, const void* data, size_t size);
+
+	/**
+	  * Starts the process of a stopped worker
+	  * @throws std::runtime_error if it cannot be started
+	  */
+	void start(Worker& worker);
+
+	/**
+	  * Handles the complete messages received from a worker. A worker that
+	  * failed is disconnected, and handled like one that died.
+	  */
+	void handleMessages(Worker& worker, const std::vector<Tile>& tiles, unsigned int& done,
+			std::function<void (const Tile&, const TileSamples&)>& store);
+
+	/**
+	  * Disconnects a worker, killing it if kill is true, and waits for it to exit
+	  */
+	static void stop(Worker& worker, bool kill);
+	void stopAll();
+
+	std::string program; //< Run by the workers
+	std::vector<Worker> workers;
+	std::string last_failure; //< Error message of the last worker that failed during run()
+};
+
+#endif
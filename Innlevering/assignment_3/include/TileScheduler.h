@@ -0,0 +1,87 @@
+#ifndef _TILESCHEDULER_H__
+#define _TILESCHEDULER_H__
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <ostream>
+
+/**
+  * A rectangular region [x0, x1) x [y0, y1) of the frame buffer
+  */
+struct Tile {
+	unsigned int x0, y0;
+	unsigned int x1, y1;
+	unsigned int index; //< Index of the tile in row-major tile order
+};
+
+/**
+  * The TileScheduler splits the frame into tiles and renders them on a set
+  * of worker threads. The tiles are ordered along a Morton (Z-order) curve,
+  * so that consecutive tiles are close in the image, and every thread starts
+  * with its own contiguous part of that curve in a deque. A thread that runs
+  * out of tiles steals from the back of another thread's deque, so that
+  * expensive regions of the image do not leave the other cores idle.
+  */
+class TileScheduler {
+public:
+	/**
+	  * Time spent by a worker thread during the last call to run()
+	  */
+	struct ThreadStats {
+		double busy; //< Seconds spent rendering tiles
+		double idle; //< Seconds of the frame not spent rendering tiles
+		unsigned int tiles; //< Number of tiles rendered
+		unsigned int stolen; //< Number of those tiles stolen from other threads
+	};
+
+	/**
+	  * @param n_threads Number of worker threads, 0 to use all hardware threads
+	  */
+	TileScheduler(unsigned int width, unsigned int height, unsigned int tile_size=16, unsigned int n_threads=0);
+
+	/**
+	  * Renders all tiles by calling render_tile once for every tile, and
+	  * returns when all tiles are done. If render_tile throws, the remaining
+	  * tiles are abandoned and the first exception is rethrown here.
+	  */
+	void run(std::function<void (const Tile&)> render_tile);
+
+	inline unsigned int getThreadCount() const { return n_threads; }
+	inline const std::vector<Tile>& getTiles() const { return tiles; }
+	inline const std::vector<ThreadStats>& getStats() const { return stats; }
+	inline double getElapsed() const { return elapsed; }
+
+	/**
+	  * Writes per-thread busy/idle times for the last run to out
+	  */
+	void printStats(std::ostream& out) const;
+
+private:
+	struct WorkQueue {
+		std::mutex lock;
+		std::deque<unsigned int> tiles;
+	};
+
+	void worker(unsigned int id, std::function<void (const Tile&)>& render_tile);
+	bool pop(unsigned int id, unsigned int& tile);
+	bool steal(unsigned int id, unsigned int& tile);
+
+	static unsigned int mortonCode(unsigned int x, unsigned int y);
+
+	std::vector<Tile> tiles; //< All tiles, in Morton order
+	std::vector<std::shared_ptr<WorkQueue> > queues; //< One work queue per thread
+	std::vector<ThreadStats> stats;
+	unsigned int n_threads;
+	double elapsed;
+
+	std::mutex error_lock;
+	std::exception_ptr error;
+	std::atomic<bool> abort; //< Set when a tile throws, to stop handing out tiles
+};
+
+#endif
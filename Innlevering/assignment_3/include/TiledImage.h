@@ -0,0 +1,200 @@
+#ifndef _TILEDIMAGE_H__
+#define _TILEDIMAGE_H__
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "TextureCache.hpp"
+
+/**
+  * A read-only, mip-mapped RGB image in a compact format for texture lookups
+  * in the ray tracer. Texels are stored in 8x8 tiles, so that the texels
+  * around a lookup, and the lookups of neighbouring rays, share cache lines
+  * in both directions, and not just along a row. Each texel is either
+  * RGB9E5 (three 9 bit mantissas with a shared 5 bit exponent, 4 bytes)
+  * or three half floats (6 bytes), instead of 12 bytes as float RGB.
+  * The texels can be stored in, and used in place from, a TextureCache.
+  */
+class TiledImage {
+public:
+	enum Format {
+		RGB9E5, //< Shared exponent, about 3 significant digits, non-negative values up to 65408
+		RGB16F  //< Half floats, more precise in dark channels next to bright ones, and twice the size
+	};
+
+	TiledImage();
+
+	/**
+	  * Creates the image and its mip chain from float RGB texels, stored row
+	  * by row. Negative values are clamped to zero, and values too large for
+	  * the format to its largest value.
+	  */
+	TiledImage(const std::vector<float>& rgb, unsigned int width, unsigned int height, Format format=RGB9E5);
+
+	/**
+	  * Uses the texels of an entry stored by store() in place
+	  * @throws std::runtime_error if the entry does not hold a valid image
+	  */
+	TiledImage(const TextureCache::Entry& entry);
+
+	/**
+	  * Stores the image in the texture cache as the entry with the given key
+	  * @return true if the entry was stored
+	  */
+	bool store(TextureCache& cache, std::string key) const;
+
+	inline unsigned int getWidth(unsigned int level=0) const { return levels.at(level).width; }
+	inline unsigned int getHeight(unsigned int level=0) const { return levels.at(level).height; }
+	inline unsigned int getLevelCount() const { return static_cast<unsigned int>(levels.size()); }
+	inline Format getFormat() const { return format; }
+
+	/**
+	  * Returns the number of bytes used by the texels of all levels
+	  */
+	size_t getMemoryUsage() const;
+
+	/**
+	  * Returns texel (x, y) of a mip level, where (0, 0) is the first texel given
+	  */
+	inline glm::vec3 fetch(unsigned int level, unsigned int x, unsigned int y) const {
+		const Level& l = levels[level];
+		size_t i = index(l, x, y);
+		if (format == RGB9E5) return decodeRGB9E5(reinterpret_cast<const uint32_t*>(l.texels)[i]);
+		const uint16_t* h = reinterpret_cast<const uint16_t*>(l.texels) + 3*i;
+		return glm::vec3(decodeHalf(h[0]), decodeHalf(h[1]), decodeHalf(h[2]));
+	}
+
+	/**
+	  * Bilinearly interpolates the four texels around texture coordinate
+	  * [s, t] in [0, 1] in one mip level, clamping to the edges
+	  */
+	inline glm::vec3 sampleLevel(unsigned int level, float s, float t) const {
+		const Level& l = levels[level];
+
+		//Also catches NaN from degenerate directions
+		if (!(s >= 0.0f)) s = 0.0f;
+		if (!(s <= 1.0f)) s = 1.0f;
+		if (!(t >= 0.0f)) t = 0.0f;
+		if (!(t <= 1.0f)) t = 1.0f;
+
+		//Texel centers are at half integer coordinates
+		float x = s*l.width - 0.5f;
+		float y = t*l.height - 0.5f;
+		float x_floor = glm::floor(x);
+		float y_floor = glm::floor(y);
+		float a = x - x_floor;
+		float b = y - y_floor;
+
+		int x0 = static_cast<int>(x_floor);
+		int y0 = static_cast<int>(y_floor);
+		unsigned int xa = (x0 < 0) ? 0 : x0;
+		unsigned int ya = (y0 < 0) ? 0 : y0;
+		unsigned int xb = (x0+1 < static_cast<int>(l.width)) ? x0+1 : l.width-1;
+		unsigned int yb = (y0+1 < static_cast<int>(l.height)) ? y0+1 : l.height-1;
+
+		glm::vec3 bottom = glm::mix(fetch(level, xa, ya), fetch(level, xb, ya), a);
+		glm::vec3 top = glm::mix(fetch(level, xa, yb), fetch(level, xb, yb), a);
+		return glm::mix(bottom, top, b);
+	}
+
+	/**
+	  * Trilinearly interpolates texture coordinate [s, t] between the two mip
+	  * levels around lod, where level n has 2^n times fewer texels along each axis
+	  */
+	inline glm::vec3 sample(float s, float t, float lod) const {
+		unsigned int last = getLevelCount()-1;
+		if (!(lod > 0.0f)) return sampleLevel(0, s, t);
+		if (lod >= last) return sampleLevel(last, s, t);
+
+		unsigned int level = static_cast<unsigned int>(lod);
+		float f = lod - level;
+		return glm::mix(sampleLevel(level, s, t), sampleLevel(level+1, s, t), f);
+	}
+
+	/**
+	  * Packs a color into RGB9E5, rounding to the nearest representable value
+	  */
+	static uint32_t encodeRGB9E5(glm::vec3 color);
+
+	static inline glm::vec3 decodeRGB9E5(uint32_t v) {
+		//2^(exponent - bias - mantissa bits), built directly as a float
+		uint32_t bits = ((v >> 27) + 127 - 15 - 9) << 23;
+		float scale;
+		std::memcpy(&scale, &bits, sizeof(float));
+		return glm::vec3((v & 0x1ff)*scale, ((v >> 9) & 0x1ff)*scale, ((v >> 18) & 0x1ff)*scale);
+	}
+
+	/**
+	  * Converts a non-negative float to a half float, rounding to the nearest
+	  * representable value
+	  */
+	static uint16_t encodeHalf(float f);
+
+	static inline float decodeHalf(uint16_t h) {
+		uint32_t exponent = (h >> 10) & 0x1f;
+		uint32_t mantissa = h & 0x3ff;
+		uint32_t bits = static_cast<uint32_t>(h & 0x8000) << 16;
+		if (exponent == 0) {
+			//Zero or denormal
+			float f = mantissa * (1.0f/16777216.0f);
+			return (bits != 0) ? -f : f;
+		}
+		else if (exponent == 31) bits |= 0x7f800000 | (mantissa << 13);
+		else bits |= ((exponent + 127 - 15) << 23) | (mantissa << 13);
+		float f;
+		std::memcpy(&f, &bits, sizeof(float));
+		return f;
+	}
+
+private:
+	static const unsigned int tile_shift = 3;
+	static const unsigned int tile_mask = (1 << tile_shift) - 1;
+	static const unsigned int tile_texels = 1 << (2*tile_shift);
+
+	struct Level {
+		unsigned int width;
+		unsigned int height;
+		unsigned int tiles_x; //< Tiles per row of tiles
+		const unsigned char* texels;
+		size_t size; //< Size of texels in bytes, including partially covered tiles
+	};
+
+	/**
+	  * Returns the index of texel (x, y) in the level: tiles are stored row
+	  * by row, and the texels in each tile row by row
+	  */
+	static inline size_t index(const Level& l, unsigned int x, unsigned int y) {
+		size_t tile = (y >> tile_shift)*l.tiles_x + (x >> tile_shift);
+		return tile*tile_texels + ((y & tile_mask) << tile_shift) + (x & tile_mask);
+	}
+
+	/**
+	  * Returns the tag of a format in the texture cache
+	  */
+	static inline unsigned int getCacheFormat(Format format) {
+		return (format == RGB9E5) ? 0x35453954 : 0x46363154; //"T9E5" and "T16F"
+	}
+
+	/**
+	  * Returns a level of the given size, without texels
+	  */
+	Level createLevel(unsigned int width, unsigned int height) const;
+
+	/**
+	  * Encodes float RGB texels into a level
+	  */
+	void encodeLevel(const std::vector<float>& rgb, const Level& l, unsigned char* texels);
+
+	Format format;
+	std::vector<Level> levels;
+	std::shared_ptr<std::vector<unsigned char> > storage; //< Texels of all levels, unless mapped
+	std::shared_ptr<MappedFile> mapping; //< Cache entry holding the texels, if mapped
+};
+
+#endif
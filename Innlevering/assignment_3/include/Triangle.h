@@ -1,9 +1,10 @@
 #ifndef _TRIANGLE_H__
 #define _TRIANGLE_H__
 
-#include "RayTracerState.hpp"
+#include "RayTracerState.h"
 #include "SceneObject.hpp"
 #include "SceneObjectEffect.hpp"
+#include "Intersection.hpp"
 #include <algorithm>
 #include <glm/glm.hpp>
 #include <cmath>
@@ -23,33 +24,36 @@ public:
 		glm::vec3 ac = this->c - this->a;
 
 		normal = glm::normalize(glm::cross(ab, ac));
+
+		//Edges used by the inside test
+		this->ca = this->c - this->a;
+		this->ab = this->a - this->b;
+		this->bc = this->b - this->c;
 	}
 
 	/**
-	  * Computes the ray-sphere intersection
+	  * Computes the ray-triangle intersection, and the barycentric
+	  * coordinates if it is the closest hit so far
 	  */
-	float intersect(const Ray& r) {
-		float t = glm::dot((a - r.getOrigin()), normal) / (glm::dot(r.getDirection(), normal));
-        glm::vec3 q = r.getOrigin() + t * r.getDirection();
-		
-		if (glm::dot(glm::cross(q-a, c-a), normal) > 0 &&
-                 glm::dot(glm::cross(q-b, a-b), normal) > 0 &&
-                 glm::dot(glm::cross(q-c, b-c), normal) > 0) {
-				return t;
-        }
- 
-		return -1;
+	bool intersect(const Ray& r, int k, HitRecord& hit) {
+		return Intersection::triangle(a, b, c, ca, ab, bc, normal, r, k, hit);
 	}
-	
-	/**
-	  * Computes normal for an intersection point on a sphere
-	  */
-	const glm::vec3 computeNormal(const Ray& r, const float& t) {
-		return normal;
+
+	bool getBounds(AABB& bounds) {
+		bounds.reset();
+		bounds.expand(a);
+		bounds.expand(b);
+		bounds.expand(c);
+		return true;
+	}
+
+	void intersectPacket(RayPacket& packet, const PacketKernels& kernels, int k) {
+		kernels.intersectTriangle(packet, &a[0], &b[0], &c[0], &normal[0], k);
 	}
 
-	glm::vec3 rayTrace(Ray &ray, const float& t, RayTracerState& state) {
-		return effect->rayTrace(ray, t, normal, state);
+	bool store(SceneStorage& storage, int k) {
+		storage.triangles.add(a, b, c, normal, k);
+		return true;
 	}
 
 protected:
@@ -57,6 +61,7 @@ protected:
 	glm::vec3 b;
 	glm::vec3 c;
 	glm::vec3 normal;
+	glm::vec3 ca, ab, bc; //< Precomputed edges
 };
 
 #endif	
\ No newline at end of file
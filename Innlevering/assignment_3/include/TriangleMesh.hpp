@@ -0,0 +1,189 @@
+#ifndef _TRIANGLEMESH_HPP__
+#define _TRIANGLEMESH_HPP__
+
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+
+#include "SceneObject.hpp"
+#include "SceneObjectEffect.hpp"
+#include "Intersection.hpp"
+#include "BVH.hpp"
+#include "StorageArray.hpp"
+#include "SceneBlob.hpp"
+
+/**
+  * A triangle mesh is a single scene object made up of many triangles that
+  * share one indexed vertex buffer. It has its own BVH over its triangles,
+  * so that the scene only sees one bounded object, and uses a watertight
+  * intersection test so that rays never slip through between neighbouring
+  * triangles.
+  */
+class TriangleMesh : public SceneObject {
+public:
+	/**
+	  * Creates a mesh from a vertex buffer, and an index buffer with three
+	  * indices into the vertex buffer per triangle
+	  */
+	TriangleMesh(const std::vector<glm::vec3>& vertices, const std::vector<unsigned int>& indices,
+			std::shared_ptr<SceneObjectEffect> effect) {
+		if (indices.size() % 3 != 0) {
+			std::stringstream err;
+			err << "Triangle mesh has " << indices.size() << " indices, which is not a multiple of three";
+			throw std::runtime_error(err.str());
+		}
+		for (unsigned int i=0; i<indices.size(); ++i) {
+			if (indices[i] >= vertices.size()) {
+				std::stringstream err;
+				err << "Triangle mesh index " << indices[i] << " is out of range (" << vertices.size() << " vertices)";
+				throw std::runtime_error(err.str());
+			}
+		}
+
+		this->vertices.assign(vertices);
+		this->indices.assign(indices);
+		this->effect = effect;
+		geometry_hash = 0;
+		buildHierarchy();
+	}
+
+	/**
+	  * Reads a mesh written by write(), whose buffers and BVH are used in
+	  * place instead of being copied and built again
+	  */
+	TriangleMesh(BlobReader& in, std::shared_ptr<SceneObjectEffect> effect) {
+		in.readArray(vertices);
+		in.readArray(indices);
+		bvh.read(in);
+		this->effect = effect;
+		geometry_hash = 0;
+		if (indices.size() != 3*bvh.getIndices().size()) {
+			std::stringstream err;
+			err << "Triangle mesh has " << indices.size() << " indices, but its BVH has "
+				<< bvh.getIndices().size() << " triangles";
+			throw std::runtime_error(err.str());
+		}
+	}
+
+	/**
+	  * Writes the vertex buffer, the index buffer and the BVH of the mesh
+	  */
+	void write(BlobWriter& out) const {
+		out.writeArray(vertices);
+		out.writeArray(indices);
+		bvh.write(out);
+	}
+
+	/**
+	  * Moves the vertices of the mesh, e.g., for an animated model, keeping
+	  * the triangles. The BVH of the mesh is refitted to the new vertices, or
+	  * built again if refitting would make it too slow. Call
+	  * RayTracer::markSceneObjectsMoved() before the next render().
+	  */
+	void setVertices(const std::vector<glm::vec3>& vertices) {
+		if (vertices.size() != this->vertices.size()) {
+			std::stringstream err;
+			err << "Triangle mesh has " << this->vertices.size() << " vertices, unable to move " << vertices.size();
+			throw std::runtime_error(err.str());
+		}
+		this->vertices.assign(vertices);
+		geometry_hash = 0;
+
+		//The BVH refers to the triangles by their order before buildHierarchy() sorted them
+		std::vector<AABB> sorted = getTriangleBounds();
+		std::vector<AABB> bounds(sorted.size());
+		const StorageArray<unsigned int>& order = bvh.getIndices();
+		for (unsigned int i=0; i<order.size(); ++i) bounds[order[i]] = sorted[i];
+		if (!bvh.refit(bounds)) buildHierarchy();
+	}
+
+	inline unsigned int getVertexCount() const { return static_cast<unsigned int>(vertices.size()); }
+	inline unsigned int getTriangleCount() const { return static_cast<unsigned int>(indices.size()/3); }
+
+	/**
+	  * Finds the closest triangle hit by the ray using the mesh's own BVH
+	  */
+	bool intersect(const Ray& r, int k, HitRecord& hit) {
+		const Intersection::WatertightRay ray(r);
+		int closest = -1;
+		auto visit_leaf = [&](unsigned int offset, unsigned int count) {
+			for (unsigned int i=offset; i<offset+count; ++i) {
+				if (Intersection::watertightTriangle(getVertex(i, 0), getVertex(i, 1), getVertex(i, 2), ray, k, hit)) {
+					closest = i;
+				}
+			}
+		};
+		bvh.traverseLeaves(r, hit.t, visit_leaf);
+
+		if (closest < 0) return false;
+		hit.normal = computeNormal(closest);
+		return true;
+	}
+
+	bool getBounds(AABB& bounds) {
+		if (bvh.isEmpty()) return false;
+		bounds = bvh.getNodes()[0].bounds;
+		return true;
+	}
+
+	/**
+	  * Hashes the vertex and index buffers, once for all instances of the
+	  * mesh, and again after setVertices()
+	  */
+	uint64_t getGeometryHash() {
+		if (geometry_hash == 0) {
+			uint64_t hash = hashBytes(reinterpret_cast<const unsigned char*>(vertices.data()), vertices.size()*sizeof(glm::vec3));
+			hash = hashBytes(reinterpret_cast<const unsigned char*>(indices.data()), indices.size()*sizeof(unsigned int), hash);
+			geometry_hash = (hash != 0) ? hash : 1;
+		}
+		return geometry_hash;
+	}
+
+private:
+	inline const glm::vec3& getVertex(unsigned int triangle, unsigned int corner) const {
+		return vertices[indices[3*triangle+corner]];
+	}
+
+	/**
+	  * Computes the unit geometric normal of a triangle
+	  */
+	inline glm::vec3 computeNormal(unsigned int triangle) const {
+		const glm::vec3& a = getVertex(triangle, 0);
+		return glm::normalize(glm::cross(getVertex(triangle, 1)-a, getVertex(triangle, 2)-a));
+	}
+
+	/**
+	  * Returns the bounds of every triangle, in the order of the index buffer
+	  */
+	std::vector<AABB> getTriangleBounds() const {
+		std::vector<AABB> bounds(getTriangleCount());
+		for (unsigned int i=0; i<bounds.size(); ++i) {
+			for (unsigned int j=0; j<3; ++j) bounds[i].expand(getVertex(i, j));
+		}
+		return bounds;
+	}
+
+	/**
+	  * Builds the BVH over the triangles, and sorts the triangles in
+	  * leaf order so that every leaf is a contiguous range of triangles
+	  */
+	void buildHierarchy() {
+		bvh.build(getTriangleBounds());
+
+		const StorageArray<unsigned int>& order = bvh.getIndices();
+		std::vector<unsigned int> sorted(indices.size());
+		for (unsigned int i=0; i<order.size(); ++i) {
+			for (unsigned int j=0; j<3; ++j) sorted[3*i+j] = indices[3*order[i]+j];
+		}
+		indices.swap(sorted);
+	}
+
+	StorageArray<glm::vec3> vertices;
+	StorageArray<unsigned int> indices; //< Three vertex indices per triangle, in BVH leaf order
+	BVH bvh; //< Hierarchy over the triangles of this mesh
+	uint64_t geometry_hash; //< See getGeometryHash(), 0 until computed
+};
+
+#endif
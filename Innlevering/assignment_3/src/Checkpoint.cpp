@@ -0,0 +1,249 @@
+#include "Checkpoint.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#include "Timer.h"
+
+Checkpoint::Checkpoint(std::string filename, const Key& key, bool resume, double interval) {
+	this->filename = filename;
+	this->interval = interval;
+	n_tiles = ((key.width+key.tile_size-1)/key.tile_size) * ((key.height+key.tile_size-1)/key.tile_size);
+	resumed_tiles = 0;
+	offsets.assign(n_tiles, 0);
+
+	Header header = Header();
+	std::memcpy(header.magic, getMagic(), sizeof(header.magic));
+	header.version = version;
+	header.key = key;
+
+	std::ifstream existing;
+	if (resume) existing.open(filename.c_str(), std::ios::binary);
+	if (existing.is_open()) {
+		Header old;
+		existing.read(reinterpret_cast<char*>(&old), sizeof(Header));
+		if (!existing || std::memcmp(old.magic, getMagic(), sizeof(old.magic)) != 0) {
+			std::stringstream log;
+			log << filename << " is not a checkpoint file";
+			throw std::runtime_error(log.str());
+		}
+
+		//Samples of another image are of no use, and the file is started over
+		std::string mismatch = getMismatch(old, key);
+		if (!mismatch.empty()) {
+			std::stringstream log;
+			log << "Checkpoint " << filename << " " << mismatch << ", starting over";
+			discard_reason = log.str();
+		}
+		else {
+			//Index the last record of every tile, up to the first incomplete record
+			uint64_t offset = sizeof(Header);
+			RecordHeader record;
+			std::vector<Pixel> pixels;
+			while (readRecord(existing, offset, record, pixels)) {
+				if (record.tile < n_tiles) offsets[record.tile] = offset;
+				offset += sizeof(RecordHeader) + pixels.size()*sizeof(Pixel);
+			}
+		}
+	}
+	compact(header);
+
+	out.open(filename.c_str(), std::ios::binary | std::ios::app);
+	in.open(filename.c_str(), std::ios::binary);
+	if (!out.is_open() || !in.is_open()) {
+		std::stringstream log;
+		log << "Unable to open checkpoint file " << filename;
+		throw std::runtime_error(log.str());
+	}
+	last_flush = Timer::getCurrentTime();
+}
+
+Checkpoint::~Checkpoint() {
+	try {
+		flush();
+	}
+	catch (std::runtime_error&) {
+		//The tiles will be rendered again when resuming
+	}
+}
+
+bool Checkpoint::find(const Tile& tile, TileSamples& samples) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (tile.index >= n_tiles || offsets[tile.index] == 0) return false;
+
+	//Tiles added since the last flush have to be written before they can be read
+	if (offsets[tile.index] >= size - pending.size()) {
+		out.write(pending.data(), pending.size());
+		out.flush();
+		pending.clear();
+	}
+
+	RecordHeader record;
+	std::vector<Pixel> pixels;
+	if (!readRecord(in, offsets[tile.index], record, pixels)) return false;
+	if (pixels.size() != static_cast<size_t>(tile.x1-tile.x0)*(tile.y1-tile.y0)) return false;
+
+	samples.min_samples = record.min_samples;
+	samples.max_samples = record.max_samples;
+	samples.threshold = record.threshold;
+	samples.sum.resize(pixels.size());
+	samples.sum_sq.resize(pixels.size());
+	samples.count.resize(pixels.size());
+	for (unsigned int i=0; i<pixels.size(); ++i) {
+		samples.sum[i] = glm::vec3(pixels[i].sum[0], pixels[i].sum[1], pixels[i].sum[2]);
+		samples.sum_sq[i] = pixels[i].sum_sq;
+		samples.count[i] = pixels[i].count;
+	}
+	return true;
+}
+
+void Checkpoint::add(const Tile& tile, const TileSamples& samples) {
+	RecordHeader record;
+	std::vector<Pixel> pixels(samples.count.size());
+	for (unsigned int i=0; i<pixels.size(); ++i) {
+		pixels[i].sum[0] = samples.sum[i].r;
+		pixels[i].sum[1] = samples.sum[i].g;
+		pixels[i].sum[2] = samples.sum[i].b;
+		pixels[i].sum_sq = samples.sum_sq[i];
+		pixels[i].count = samples.count[i];
+	}
+	record.tile = tile.index;
+	record.pixels = static_cast<uint32_t>(pixels.size());
+	record.min_samples = samples.min_samples;
+	record.max_samples = samples.max_samples;
+	record.threshold = samples.threshold;
+	record.checksum = checksum(pixels);
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (tile.index >= n_tiles) return;
+	const char* data = reinterpret_cast<const char*>(&record);
+	pending.insert(pending.end(), data, data + sizeof(RecordHeader));
+	data = reinterpret_cast<const char*>(pixels.data());
+	pending.insert(pending.end(), data, data + pixels.size()*sizeof(Pixel));
+	offsets[tile.index] = size;
+	size += sizeof(RecordHeader) + pixels.size()*sizeof(Pixel);
+
+	double now = Timer::getCurrentTime();
+	if (now - last_flush >= interval) {
+		out.write(pending.data(), pending.size());
+		out.flush();
+		pending.clear();
+		last_flush = now;
+		if (!out.good()) {
+			std::stringstream log;
+			log << "Unable to write checkpoint file " << filename;
+			throw std::runtime_error(log.str());
+		}
+	}
+}
+
+void Checkpoint::flush() {
+	std::lock_guard<std::mutex> guard(lock);
+	out.write(pending.data(), pending.size());
+	out.flush();
+	pending.clear();
+	last_flush = Timer::getCurrentTime();
+	if (!out.good()) {
+		std::stringstream log;
+		log << "Unable to write checkpoint file " << filename;
+		throw std::runtime_error(log.str());
+	}
+}
+
+uint32_t Checkpoint::checksum(const std::vector<Pixel>& pixels) {
+	uint32_t hash = 2166136261u; //FNV-1a
+	const unsigned char* data = reinterpret_cast<const unsigned char*>(pixels.data());
+	for (size_t i=0; i<pixels.size()*sizeof(Pixel); ++i) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+bool Checkpoint::readRecord(std::istream& in, uint64_t offset, RecordHeader& header, std::vector<Pixel>& pixels) {
+	const uint32_t max_pixels = 1 << 24;
+
+	in.clear();
+	in.seekg(static_cast<std::streamoff>(offset));
+	in.read(reinterpret_cast<char*>(&header), sizeof(RecordHeader));
+	if (!in || header.pixels > max_pixels) return false;
+
+	pixels.resize(header.pixels);
+	in.read(reinterpret_cast<char*>(pixels.data()), pixels.size()*sizeof(Pixel));
+	return in && checksum(pixels) == header.checksum;
+}
+
+std::string Checkpoint::getMismatch(const Header& old, const Key& key) {
+	std::stringstream log;
+	if (old.version != version) {
+		log << "is from another version of the ray tracer";
+	}
+	else if (old.key.width != key.width || old.key.height != key.height || old.key.tile_size != key.tile_size) {
+		log << "is of a " << old.key.width << "x" << old.key.height << " image in tiles of " << old.key.tile_size
+			<< " pixels, not " << key.width << "x" << key.height << " in tiles of " << key.tile_size;
+	}
+	else if (old.key.camera != key.camera) {
+		log << "is of another camera position";
+	}
+	else if (old.key.scene != key.scene) {
+		log << "is of another scene";
+	}
+	else if (old.key.effects != key.effects) {
+		log << "is of other effects or lights";
+	}
+	else if (old.key.adaptive != key.adaptive) {
+		log << "is " << (old.key.adaptive ? "adaptively sampled" : "sampled at fixed offsets") << ", not "
+			<< (key.adaptive ? "adaptively" : "at fixed offsets");
+	}
+	return log.str();
+}
+
+void Checkpoint::compact(const Header& header) {
+	std::string tmp_filename = filename + ".tmp";
+	std::ifstream existing(filename.c_str(), std::ios::binary);
+	std::ofstream compacted(tmp_filename.c_str(), std::ios::binary | std::ios::trunc);
+	compacted.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+	size = sizeof(Header);
+
+	RecordHeader record;
+	std::vector<Pixel> pixels;
+	for (unsigned int i=0; i<n_tiles; ++i) {
+		if (offsets[i] == 0) continue;
+		if (!readRecord(existing, offsets[i], record, pixels)) {
+			offsets[i] = 0;
+			continue;
+		}
+		compacted.write(reinterpret_cast<const char*>(&record), sizeof(RecordHeader));
+		compacted.write(reinterpret_cast<const char*>(pixels.data()), pixels.size()*sizeof(Pixel));
+		offsets[i] = size;
+		size += sizeof(RecordHeader) + pixels.size()*sizeof(Pixel);
+		resumed_tiles++;
+	}
+	existing.close();
+	compacted.close();
+
+	//The old file is only replaced once the new one is complete
+#ifdef _WIN32
+	bool replaced = (MoveFileExA(tmp_filename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0);
+#else
+	bool replaced = (std::rename(tmp_filename.c_str(), filename.c_str()) == 0);
+#endif
+	if (compacted.fail() || !replaced) {
+		std::remove(tmp_filename.c_str());
+		std::stringstream log;
+		log << "Unable to write checkpoint file " << filename;
+		throw std::runtime_error(log.str());
+	}
+}
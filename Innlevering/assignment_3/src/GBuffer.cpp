@@ -0,0 +1,144 @@
+#include "GBuffer.h"
+
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include "SceneBlob.hpp"
+#include "TextureCache.hpp"
+
+namespace {
+	const uint32_t version = 1;
+
+	/**
+	  * A G-buffer file is a blob starting with this header, followed by the
+	  * first hit of each pixel and the hits of every tile
+	  */
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t hit_size; //< sizeof(HitRecord), which must match to use the hits in place
+		GBuffer::Key key;
+		uint64_t geometry; //< See RayTracerState::getGeometryHash()
+	};
+
+	const char* getMagic() {
+		return "RTGBUF";
+	}
+}
+
+GBuffer::GBuffer(const Key& key) {
+	this->key = key;
+	tiles_x = (key.width + key.tile_size-1)/key.tile_size;
+	unsigned int tiles_y = (key.height + key.tile_size-1)/key.tile_size;
+	tiles.resize(tiles_x*tiles_y);
+}
+
+const HitRecord* GBuffer::find(unsigned int x, unsigned int y, unsigned int k) const {
+	if (x >= key.width || y >= key.height) return NULL;
+	unsigned int tx = x/key.tile_size;
+	unsigned int ty = y/key.tile_size;
+	const TileHits& tile = tiles[ty*tiles_x + tx];
+	if (tile.first.empty()) return NULL;
+
+	//Tiles in the last column may be narrower
+	unsigned int x0 = tx*key.tile_size;
+	unsigned int w = std::min(key.tile_size, key.width-x0);
+	unsigned int p = (y - ty*key.tile_size)*w + (x-x0);
+	uint32_t begin = tile.first[p];
+	uint32_t end = tile.first[p+1];
+	return (k < end-begin) ? &tile.hits[begin+k] : NULL;
+}
+
+void GBuffer::setTile(const Tile& tile, const std::vector<unsigned int>& counts, const std::vector<HitRecord>& hits) {
+	std::vector<uint32_t> first(counts.size()+1);
+	first[0] = 0;
+	for (unsigned int p=0; p<counts.size(); ++p) first[p+1] = first[p] + counts[p];
+	if (first.back() != hits.size()) throw std::runtime_error("G-buffer tile has the wrong number of hits");
+
+	TileHits& stored = tiles.at(tile.index);
+	stored.first.swap(first);
+	stored.hits.assign(hits);
+}
+
+void GBuffer::write(std::string filename, uint64_t geometry) const {
+	BlobWriter out;
+	Header header = Header();
+	std::memcpy(header.magic, getMagic(), std::strlen(getMagic()));
+	header.version = version;
+	header.hit_size = sizeof(HitRecord);
+	header.key = key;
+	header.geometry = geometry;
+	out.write(header);
+	for (unsigned int i=0; i<tiles.size(); ++i) {
+		out.writeArray(tiles[i].first);
+		out.writeArray(tiles[i].hits);
+	}
+
+	//Written to a temporary file and renamed into place, so that a
+	//G-buffer is never read partially written
+	std::string tmp_filename = filename + ".tmp";
+	{
+		std::ofstream file(tmp_filename.c_str(), std::ios::binary | std::ios::trunc);
+		const std::vector<char>& data = out.getData();
+		file.write(&data[0], static_cast<std::streamsize>(data.size()));
+		file.close();
+		if (file.fail()) {
+			std::remove(tmp_filename.c_str());
+			std::stringstream log;
+			log << "Unable to write G-buffer " << filename;
+			throw std::runtime_error(log.str());
+		}
+	}
+#ifdef _WIN32
+	bool replaced = (MoveFileExA(tmp_filename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0);
+#else
+	bool replaced = (std::rename(tmp_filename.c_str(), filename.c_str()) == 0);
+#endif
+	if (!replaced) {
+		std::remove(tmp_filename.c_str());
+		std::stringstream log;
+		log << "Unable to write G-buffer " << filename;
+		throw std::runtime_error(log.str());
+	}
+}
+
+std::shared_ptr<GBuffer> GBuffer::read(std::string filename, const Key& key, uint64_t geometry) {
+	//A G-buffer that is missing, stale or damaged is only a cache miss
+	std::shared_ptr<GBuffer> result;
+	try {
+		std::shared_ptr<MappedFile> file(new MappedFile(filename));
+		BlobReader in(file->getData(), file->getSize(), file);
+		Header header = in.read<Header>();
+		if (std::memcmp(header.magic, getMagic(), std::strlen(getMagic())) != 0 || header.version != version
+				|| header.hit_size != sizeof(HitRecord) || !(header.key == key) || header.geometry != geometry) {
+			return result;
+		}
+
+		result.reset(new GBuffer(key));
+		for (unsigned int i=0; i<result->tiles.size(); ++i) {
+			TileHits& tile = result->tiles[i];
+			in.readArray(tile.first);
+			in.readArray(tile.hits);
+
+			//A tile holds the first hit of each of its pixels, and one past the last.
+			//Tiles in the last column and row may be smaller.
+			unsigned int x0 = (i % result->tiles_x)*key.tile_size;
+			unsigned int y0 = (i / result->tiles_x)*key.tile_size;
+			size_t pixels = static_cast<size_t>(std::min(key.tile_size, key.width-x0))*std::min(key.tile_size, key.height-y0);
+
+			//The first hits must be in order, and end with the number of hits
+			bool valid = tile.first.empty() ? tile.hits.empty()
+				: (tile.first.size() == pixels+1 && tile.first[0] == 0 && tile.first.back() == tile.hits.size());
+			for (unsigned int p=1; p<tile.first.size() && valid; ++p) valid = (tile.first[p-1] <= tile.first[p]);
+			if (!valid) return std::shared_ptr<GBuffer>();
+		}
+	}
+	catch (std::runtime_error&) {
+		return std::shared_ptr<GBuffer>();
+	}
+	return result;
+}
@@ -0,0 +1,103 @@
+#include "ImageStream.h"
+
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <cerrno>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+ImageStream::ImageStream(unsigned int width, unsigned int height, std::string basename, std::string extension) {
+	this->width = width;
+	this->height = height;
+	format = ImageWriter::getFormat(extension);
+	if (format == ImageWriter::OTHER) {
+		std::stringstream log;
+		log << "Unable to stream ." << extension << " images, use ppm, pfm or bmp";
+		throw std::runtime_error(log.str());
+	}
+
+	std::string header = ImageWriter::getHeader(width, height, format);
+	header_size = header.size();
+	row_size = ImageWriter::getRowSize(width, format);
+	pixel_size = (format == ImageWriter::PFM) ? 3*sizeof(float) : 3;
+
+	fd = ImageWriter::createUniqueFile(basename, extension, filename);
+	try {
+		ImageWriter::writeAll(fd, header.data(), header.size());
+
+		//Extending the file fills it with zeros, which the file system
+		//usually does not even store until they are overwritten
+		uint64_t size = header_size + static_cast<uint64_t>(row_size)*height;
+#ifdef _WIN32
+		bool sized = (_chsize_s(fd, static_cast<__int64>(size)) == 0);
+#else
+		bool sized = (ftruncate(fd, static_cast<off_t>(size)) == 0);
+#endif
+		if (!sized) {
+			std::stringstream log;
+			log << "Unable to allocate " << size << " bytes for " << filename;
+			throw std::runtime_error(log.str());
+		}
+	}
+	catch (...) {
+		ImageWriter::closeFile(fd);
+		std::remove(filename.c_str());
+		throw;
+	}
+}
+
+ImageStream::~ImageStream() {
+	ImageWriter::closeFile(fd);
+}
+
+void ImageStream::writeTile(const Tile& tile, const float* rgb) {
+	const unsigned int n = tile.x1-tile.x0;
+	std::vector<unsigned char> row(n*pixel_size);
+
+	for (unsigned int y=tile.y0; y<tile.y1; ++y) {
+		ImageWriter::convert(rgb + 3*static_cast<size_t>(y-tile.y0)*n, n, format, row.data());
+		uint64_t offset = header_size + static_cast<uint64_t>(ImageWriter::getFileRow(y, height, format))*row_size + tile.x0*pixel_size;
+		writeAt(row.data(), row.size(), offset);
+	}
+}
+
+void ImageStream::writeAt(const void* data, size_t size, uint64_t offset) {
+	const char* p = static_cast<const char*>(data);
+	while (size > 0) {
+#ifdef _WIN32
+		//The offset in the OVERLAPPED structure is used instead of the file pointer
+		OVERLAPPED position = {0};
+		position.Offset = static_cast<DWORD>(offset & 0xffffffff);
+		position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+		DWORD chunk = static_cast<DWORD>(std::min(size, static_cast<size_t>(1 << 30)));
+		DWORD written = 0;
+		HANDLE file = reinterpret_cast<HANDLE>(_get_osfhandle(fd));
+		if (!WriteFile(file, p, chunk, &written, &position)) written = 0;
+#else
+		ssize_t written = pwrite(fd, p, size, static_cast<off_t>(offset));
+		if (written < 0 && errno == EINTR) continue;
+#endif
+		if (written <= 0) {
+			std::stringstream log;
+			log << "Unable to write to " << filename;
+			throw std::runtime_error(log.str());
+		}
+		p += written;
+		size -= written;
+		offset += written;
+	}
+}
@@ -0,0 +1,341 @@
+#include "ImageWriter.h"
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGEWRITER_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <IL/il.h>
+#include <IL/ilu.h>
+
+namespace {
+	const unsigned int max_number = 10000; //< File names are numbered 0000 to 9999
+	const size_t band_size = 4 << 20; //< Bytes converted before each write
+
+	std::mutex next_number_lock;
+	std::map<std::string, unsigned int> next_numbers; //< First number that may be free, per file name pattern
+
+	std::string getFilename(const std::string& basename, unsigned int number, const std::string& extension) {
+		std::stringstream filename;
+		filename << basename << std::setw(4) << std::setfill('0') << number << "." << extension;
+		return filename.str();
+	}
+
+	bool exists(const std::string& filename) {
+		struct stat buffer;
+		return stat(filename.c_str(), &buffer) == 0;
+	}
+
+	void put16(unsigned char* p, unsigned int v) {
+		p[0] = v & 0xff;
+		p[1] = (v >> 8) & 0xff;
+	}
+
+	void put32(unsigned char* p, unsigned int v) {
+		put16(p, v & 0xffff);
+		put16(p+2, v >> 16);
+	}
+}
+
+std::string ImageWriter::save(FrameBuffer& fb, std::string basename, std::string extension) {
+	std::string filename;
+	int fd = createUniqueFile(basename, extension, filename);
+	Format format = getFormat(extension);
+
+	try {
+		if (format == OTHER) {
+			closeFile(fd);
+			fd = -1;
+			saveDevIL(fb, filename);
+		}
+		else {
+			writeNative(fd, fb, format);
+			closeFile(fd);
+		}
+	}
+	catch (...) {
+		if (fd >= 0) closeFile(fd);
+		std::remove(filename.c_str());
+		throw;
+	}
+
+	return filename;
+}
+
+void ImageWriter::saveAs(FrameBuffer& fb, std::string filename) {
+	size_t dot = filename.find_last_of("./\\");
+	if (dot == std::string::npos || filename[dot] != '.') {
+		std::stringstream log;
+		log << "No image format given by the extension of " << filename;
+		throw std::runtime_error(log.str());
+	}
+	Format format = getFormat(filename.substr(dot+1));
+	if (format == OTHER) {
+		saveDevIL(fb, filename);
+		return;
+	}
+
+#ifdef _WIN32
+	int fd = _open(filename.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+	if (fd < 0) {
+		std::stringstream log;
+		log << "Unable to create " << filename;
+		throw std::runtime_error(log.str());
+	}
+	try {
+		writeNative(fd, fb, format);
+	}
+	catch (...) {
+		closeFile(fd);
+		std::remove(filename.c_str());
+		throw;
+	}
+	closeFile(fd);
+}
+
+int ImageWriter::createUniqueFile(std::string basename, std::string extension, std::string& filename) {
+	std::lock_guard<std::mutex> lock(next_number_lock);
+
+	std::string pattern = basename + "." + extension;
+	std::map<std::string, unsigned int>::iterator next = next_numbers.find(pattern);
+	if (next == next_numbers.end()) {
+		unsigned int first = 0;
+		unsigned int last = max_number;
+		while (first < last) {
+			unsigned int middle = first + (last-first)/2;
+			if (exists(getFilename(basename, middle, extension))) first = middle+1;
+			else last = middle;
+		}
+		next = next_numbers.insert(std::make_pair(pattern, first)).first;
+	}
+
+	//Names taken since the search, or gaps in the numbering, are skipped
+	for (unsigned int i=next->second; i<max_number; ++i) {
+		filename = getFilename(basename, i, extension);
+#ifdef _WIN32
+		int fd = _open(filename.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+		int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+#endif
+		if (fd >= 0) {
+			next->second = i+1;
+			return fd;
+		}
+		else if (errno != EEXIST) {
+			std::stringstream log;
+			log << "Unable to create " << filename;
+			throw std::runtime_error(log.str());
+		}
+	}
+
+	next->second = max_number;
+	std::stringstream log;
+	log << "Unable to find unique filename for " << basename << "%d." << extension;
+	throw std::runtime_error(log.str());
+}
+
+void ImageWriter::writeAll(int fd, const void* data, size_t size) {
+	const char* p = static_cast<const char*>(data);
+	while (size > 0) {
+		//Windows takes the size as an unsigned int
+		unsigned int chunk = static_cast<unsigned int>(std::min(size, static_cast<size_t>(1 << 30)));
+#ifdef _WIN32
+		int written = _write(fd, p, chunk);
+#else
+		ssize_t written = write(fd, p, chunk);
+		if (written < 0 && errno == EINTR) continue;
+#endif
+		if (written <= 0) throw std::runtime_error("Unable to write image file");
+		p += written;
+		size -= written;
+	}
+}
+
+void ImageWriter::closeFile(int fd) {
+#ifdef _WIN32
+	_close(fd);
+#else
+	close(fd);
+#endif
+}
+
+ImageWriter::Format ImageWriter::getFormat(std::string extension) {
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	if (extension == "ppm") return PPM;
+	else if (extension == "pfm") return PFM;
+	else if (extension == "bmp") return BMP;
+	else return OTHER;
+}
+
+std::string ImageWriter::getHeader(unsigned int width, unsigned int height, Format format) {
+	if (format == PFM) {
+		//Little endian floats, stored bottom up like the frame buffer
+		std::stringstream header;
+		header << "PF\n" << width << " " << height << "\n-1.0\n";
+		return header.str();
+	}
+	else if (format == BMP) {
+		size_t row_size = getRowSize(width, format);
+		unsigned long long file_size = 54 + static_cast<unsigned long long>(row_size)*height;
+		if (file_size > 0xffffffffull) throw std::runtime_error("Image too large for BMP");
+
+		unsigned char header[54] = {0};
+		header[0] = 'B';
+		header[1] = 'M';
+		put32(header+2, static_cast<unsigned int>(file_size));
+		put32(header+10, 54); //Offset of the pixels
+		put32(header+14, 40); //Size of the info header
+		put32(header+18, width);
+		put32(header+22, height); //Positive height: bottom up
+		put16(header+26, 1); //Planes
+		put16(header+28, 24); //Bits per pixel
+		put32(header+34, static_cast<unsigned int>(row_size*height));
+		put32(header+38, 2835); //72 DPI
+		put32(header+42, 2835);
+		return std::string(reinterpret_cast<const char*>(header), sizeof(header));
+	}
+	else if (format == PPM) {
+		std::stringstream header;
+		header << "P6\n" << width << " " << height << "\n255\n";
+		return header.str();
+	}
+	throw std::runtime_error("Only ppm, pfm and bmp images can be written natively");
+}
+
+size_t ImageWriter::getRowSize(unsigned int width, Format format) {
+	if (format == PFM) return 3*sizeof(float)*static_cast<size_t>(width);
+	//BMP rows are padded to a multiple of four bytes
+	else if (format == BMP) return (3*static_cast<size_t>(width) + 3) & ~static_cast<size_t>(3);
+	else return 3*static_cast<size_t>(width);
+}
+
+unsigned int ImageWriter::getFileRow(unsigned int y, unsigned int height, Format format) {
+	//PPM is stored top down, the others bottom up like the frame buffer
+	return (format == PPM) ? height-1-y : y;
+}
+
+void ImageWriter::convert(const float* in, unsigned int n, Format format, unsigned char* out) {
+	if (format == PFM) {
+		std::memcpy(out, in, 3*sizeof(float)*static_cast<size_t>(n));
+		return;
+	}
+	quantize(in, 3*static_cast<size_t>(n), out);
+	if (format == BMP) {
+		for (unsigned int x=0; x<n; ++x) std::swap(out[3*x], out[3*x+2]);
+	}
+}
+
+void ImageWriter::writeNative(int fd, FrameBuffer& fb, Format format) {
+	const unsigned int width = fb.getWidth();
+	const unsigned int height = fb.getHeight();
+	const float* data = fb.getData().data();
+
+	std::string header = getHeader(width, height, format);
+	writeAll(fd, header.data(), header.size());
+
+	if (format == PFM) {
+		//Already in the layout of the file
+		writeAll(fd, data, 3*static_cast<size_t>(width)*height*sizeof(float));
+		return;
+	}
+
+	size_t row_size = getRowSize(width, format);
+	unsigned int band_rows = static_cast<unsigned int>(std::max(band_size/row_size, static_cast<size_t>(1)));
+	std::vector<unsigned char> band(std::min(band_rows, height)*row_size, 0);
+	unsigned int n_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+	//Rows are written in file order, a band at a time
+	for (unsigned int first=0; first<height; first+=band_rows) {
+		unsigned int rows = std::min(band_rows, height-first);
+
+		//Every thread converts every n_threads'th row of the band
+		auto convert_rows = [&](unsigned int id) {
+			for (unsigned int r=id; r<rows; r+=n_threads) {
+				//Flipping is its own inverse, so this is also the frame buffer row of a file row
+				unsigned int y = getFileRow(first+r, height, format);
+				convert(data + 3*static_cast<size_t>(y)*width, width, format, &band[r*row_size]);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (unsigned int id=1; id<std::min(n_threads, rows); ++id) threads.push_back(std::thread(convert_rows, id));
+		convert_rows(0);
+		for (unsigned int i=0; i<threads.size(); ++i) threads[i].join();
+
+		writeAll(fd, band.data(), rows*row_size);
+	}
+}
+
+void ImageWriter::quantize(const float* in, size_t n, unsigned char* out) {
+	size_t i = 0;
+#ifdef IMAGEWRITER_SSE2
+	//Clamping with max first also turns NaN into 0, like the scalar code
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	for (; i+16<=n; i+=16) {
+		__m128i v[4];
+		for (unsigned int k=0; k<4; ++k) {
+			__m128 x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in+i+4*k), zero), one);
+			v[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(x, scale), half));
+		}
+		__m128i lo = _mm_packs_epi32(v[0], v[1]);
+		__m128i hi = _mm_packs_epi32(v[2], v[3]);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out+i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; i<n; ++i) {
+		float x = in[i];
+		if (!(x > 0.0f)) x = 0.0f;
+		if (x > 1.0f) x = 1.0f;
+		out[i] = static_cast<unsigned char>(x*255.0f + 0.5f);
+	}
+}
+
+void ImageWriter::saveDevIL(FrameBuffer& fb, std::string filename) {
+	ILuint texid;
+
+	ilOriginFunc(IL_ORIGIN_UPPER_LEFT);
+
+	//Create image
+	ilGenImages(1, &texid);
+	ilBindImage(texid);
+	//FIXME: Ugly const cast:( DevILs fault, unfortunately
+	ilTexImage(fb.getWidth(), fb.getHeight(), 1, 3, IL_RGB, IL_FLOAT, const_cast<float*>(fb.getData().data()));
+
+	//The file was created empty to reserve its name
+	ilEnable(IL_FILE_OVERWRITE);
+	bool saved = (ilSaveImage(filename.c_str()) != 0);
+	ilDisable(IL_FILE_OVERWRITE);
+	ilDeleteImages(1, &texid);
+
+	if (!saved) {
+		std::stringstream log;
+		log << "Unable to save " << filename;
+		throw std::runtime_error(log.str());
+	}
+}
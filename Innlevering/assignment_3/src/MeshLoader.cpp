@@ -0,0 +1,96 @@
+#include "MeshLoader.h"
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "AABB.hpp"
+
+std::shared_ptr<TriangleMesh> MeshLoader::load(std::string filename, std::shared_ptr<SceneObjectEffect> effect) {
+	std::vector<glm::vec3> vertices;
+	std::vector<unsigned int> indices;
+	loadVertices(filename, vertices, indices);
+	return std::shared_ptr<TriangleMesh>(new TriangleMesh(vertices, indices, effect));
+}
+
+std::shared_ptr<TriangleMesh> MeshLoader::load(std::string filename, std::shared_ptr<SceneObjectEffect> effect,
+		glm::vec3 center, float size) {
+	std::vector<glm::vec3> vertices;
+	std::vector<unsigned int> indices;
+	loadVertices(filename, vertices, indices);
+
+	//Fit the bounding box of the model to the requested center and size
+	AABB bounds;
+	for (unsigned int i=0; i<vertices.size(); ++i) bounds.expand(vertices[i]);
+	glm::vec3 extent = bounds.max - bounds.min;
+	float largest = std::max(extent.x, std::max(extent.y, extent.z));
+	float scale = (largest > 0.0f) ? size/largest : 1.0f;
+	glm::vec3 translation = bounds.getCentroid();
+	for (unsigned int i=0; i<vertices.size(); ++i) {
+		vertices[i] = (vertices[i] - translation)*scale + center;
+	}
+
+	return std::shared_ptr<TriangleMesh>(new TriangleMesh(vertices, indices, effect));
+}
+
+void MeshLoader::loadVertices(std::string filename, std::vector<glm::vec3>& vertices, std::vector<unsigned int>& indices) {
+	//Join identical vertices so that triangles share them
+	unsigned int load_flags = aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType;
+	const aiScene* scene = aiImportFile(filename.c_str(), load_flags);
+	if (!scene) {
+		std::stringstream log;
+		log << "Unable to load mesh from " << filename << ": " << aiGetErrorString();
+		throw std::runtime_error(log.str());
+	}
+
+	aiMatrix4x4 transform;
+	aiIdentityMatrix4(&transform);
+	unsigned int skipped_faces = 0;
+	loadRecursive(vertices, indices, skipped_faces, scene, scene->mRootNode, transform);
+	aiReleaseImport(scene);
+
+	if (skipped_faces > 0) {
+		std::cout << "Skipped " << skipped_faces << " faces in " << filename << " that were not triangles" << std::endl;
+	}
+	if (indices.empty()) {
+		std::stringstream log;
+		log << "No triangles found in " << filename;
+		throw std::runtime_error(log.str());
+	}
+}
+
+void MeshLoader::loadRecursive(std::vector<glm::vec3>& vertices, std::vector<unsigned int>& indices,
+		unsigned int& skipped_faces, const aiScene* scene, const aiNode* node, aiMatrix4x4 transform) {
+	//Accumulate the transform from the root to this node
+	aiMultiplyMatrix4(&transform, &node->mTransformation);
+
+	for (unsigned int n=0; n<node->mNumMeshes; ++n) {
+		const aiMesh* mesh = scene->mMeshes[node->mMeshes[n]];
+		unsigned int base = static_cast<unsigned int>(vertices.size());
+
+		//A mesh referenced by several nodes is added once per node, with that node's transform
+		vertices.reserve(vertices.size() + mesh->mNumVertices);
+		for (unsigned int i=0; i<mesh->mNumVertices; ++i) {
+			aiVector3D v = mesh->mVertices[i];
+			aiTransformVecByMatrix4(&v, &transform);
+			vertices.push_back(glm::vec3(v.x, v.y, v.z));
+		}
+
+		indices.reserve(indices.size() + 3*mesh->mNumFaces);
+		for (unsigned int t=0; t<mesh->mNumFaces; ++t) {
+			const aiFace& face = mesh->mFaces[t];
+			if (face.mNumIndices != 3) {
+				++skipped_faces;
+				continue;
+			}
+			for (unsigned int i=0; i<3; ++i) {
+				indices.push_back(base + face.mIndices[i]);
+			}
+		}
+	}
+
+	for (unsigned int n=0; n<node->mNumChildren; ++n) {
+		loadRecursive(vertices, indices, skipped_faces, scene, node->mChildren[n], transform);
+	}
+}
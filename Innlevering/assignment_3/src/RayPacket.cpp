@@ -0,0 +1,51 @@
+#include "RayPacket.hpp"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RAYPACKET_X86
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "RayPacketKernels.hpp"
+
+static const PacketKernels sse2_packet_kernels = {
+	"SSE2",
+	intersectBox<SSE2>,
+	intersectSphere<SSE2>,
+	intersectTriangle<SSE2>
+};
+
+extern const PacketKernels avx2_packet_kernels;
+
+/**
+  * Checks that both the CPU and the OS (saving the YMM registers) support AVX2
+  */
+static bool hasAVX2() {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#else
+	return false;
+#endif
+}
+#endif
+
+const PacketKernels* getPacketKernels() {
+#ifdef RAYPACKET_X86
+	static const PacketKernels* kernels = hasAVX2() ? &avx2_packet_kernels : &sse2_packet_kernels;
+	return kernels;
+#else
+	return NULL;
+#endif
+}
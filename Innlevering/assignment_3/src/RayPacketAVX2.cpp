@@ -0,0 +1,24 @@
+/**
+  * AVX2 instantiation of the packet kernels. The kernels are compiled for
+  * AVX2 through a target attribute rather than a compiler flag for the whole
+  * file, so that nothing else in this translation unit (or inlined from
+  * headers) can end up using AVX2 on a CPU that does not support it.
+  * getPacketKernels() only hands these out after checking the CPU.
+  */
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+
+#if defined(__GNUC__)
+#define RAYPACKET_TARGET __attribute__((target("avx2")))
+#endif
+#define RAYPACKET_AVX2
+
+#include "RayPacketKernels.hpp"
+
+extern const PacketKernels avx2_packet_kernels = {
+	"AVX2",
+	intersectBox<AVX2>,
+	intersectSphere<AVX2>,
+	intersectTriangle<AVX2>
+};
+
+#endif
@@ -4,118 +4,810 @@
 #include <sstream>
 #include <iomanip>
 #include <limits>
-#include <sys/stat.h>
+#include <cstdio>
 
 #include <IL/il.h>
 #include <IL/ilu.h>
 
 #include "CubeMap.hpp"
+#include "ImageWriter.h"
+#include "RayPacket.hpp"
+#include "Timer.h"
 
 RayTracer::RayTracer(unsigned int width, unsigned int height) {
 	const glm::vec3 camera_position(0.0f, 0.0f, 10.0f);
 
-	//Initialize framebuffer and virtual screen
-	fb.reset(new FrameBuffer(width, height));
-	float aspect = width/static_cast<float>(height);
-	screen.top = 1.0f;
-	screen.bottom = -1.0f;
-	screen.right = aspect;
-	screen.left = -aspect;
+	//Initialize virtual screen. The frame buffer is allocated by render(),
+	//unless the output is streamed
+	setResolution(width, height);
 	
 	//Initialize state
 	state.reset(new RayTracerState(camera_position));
+	use_packets = true;
+	n_threads = 0;
+	tile_size = 16;
+	ray_budget = 0;
+	sample_budget = 0;
+	total_samples = 0;
+	cancelled = false;
+	times.build = times.refit = times.trace = 0.0;
+	checkpoint_resume = false;
+	checkpoint_interval = 30.0;
+	checkpoint_keep = false;
+	gbuffer_enabled = false;
+	gbuffer_generation = 0;
+	setAdaptiveSampling(1, 0);
 	
 	//Initialize IL and ILU
 	ilInit();
 	iluInit();
 }
 
+void RayTracer::setResolution(unsigned int width, unsigned int height) {
+	this->width = width;
+	this->height = height;
+	float aspect = width/static_cast<float>(height);
+	screen.top = 1.0f;
+	screen.bottom = -1.0f;
+	screen.right = aspect;
+	screen.left = -aspect;
+
+	fb.reset();
+	sample_counts.reset();
+}
+
+void RayTracer::setCamera(glm::vec3 position) {
+	state->setCamPos(position);
+}
+
+glm::vec3 RayTracer::getCamera() {
+	return state->getCamPos();
+}
+
 void RayTracer::addSceneObject(std::shared_ptr<SceneObject>& o) {
-	state->getScene().push_back(o);
+	state->addSceneObject(o);
 }
 
-void RayTracer::render() {
-	//For every pixel, ray-trace using multiple CPUs
-#ifdef _OPENMP
-#pragma omp parallel for
-	for (int j=0; j<static_cast<int>(fb->getHeight()); ++j) {
-#else
-	for (unsigned int j=0; j<fb->getHeight(); ++j) {
-#endif
-		for (unsigned int i=0; i<fb->getWidth(); ++i) {
-			glm::vec3 out_color(0.0, 0.0, 0.0);
-			float t = std::numeric_limits<float>::max();
-			float x1, y1, x2, y2, x3, y3, x4, y4, z;
+void RayTracer::markSceneObjectsMoved() {
+	state->markMoved();
+}
 
-			// Create the ray using the view screen definition 
-			x1 = (i-0.25f)*(screen.right-screen.left)/static_cast<float>(fb->getWidth()) + screen.left;
-			y1 = (j-0.25f)*(screen.top-screen.bottom)/static_cast<float>(fb->getHeight()) + screen.bottom;
+void RayTracer::readAccelerationStructure(BlobReader& in) {
+	state->readAccelerationStructure(in);
+}
 
-			x2 = (i-0.25f)*(screen.right-screen.left)/static_cast<float>(fb->getWidth()) + screen.left;
-			y2 = (j+0.25f)*(screen.top-screen.bottom)/static_cast<float>(fb->getHeight()) + screen.bottom;
+/**
+  * Sub-pixel offsets of the four rays we shoot through each pixel
+  */
+static const float sample_offsets[4][2] = {
+	{-0.25f, -0.25f}, {-0.25f, 0.25f}, {0.25f, 0.25f}, {0.25f, -0.25f}
+};
 
-			x3 = (i+0.25f)*(screen.right-screen.left)/static_cast<float>(fb->getWidth()) + screen.left;
-			y3 = (j+0.25f)*(screen.top-screen.bottom)/static_cast<float>(fb->getHeight()) + screen.bottom;
+void RayTracer::setPacketTracing(bool enable) {
+	use_packets = enable;
+}
 
-			x4 = (i+0.25f)*(screen.right-screen.left)/static_cast<float>(fb->getWidth()) + screen.left;
-			y4 = (j-0.25f)*(screen.top-screen.bottom)/static_cast<float>(fb->getHeight()) + screen.bottom;
-			z = -1.0f;
-			
-			glm::vec3 directionR1 = glm::vec3(x1, y1, z);
-			Ray r1 = Ray(state->getCamPos(), directionR1);
+void RayTracer::setThreads(unsigned int n_threads) {
+	this->n_threads = n_threads;
+}
 
-			glm::vec3 directionR2 = glm::vec3(x2, y2, z);
-			Ray r2 = Ray(state->getCamPos(), directionR2);
+void RayTracer::setTileSize(unsigned int tile_size) {
+	this->tile_size = std::max(tile_size, 1u);
+}
 
-			glm::vec3 directionR3 = glm::vec3(x3, y3, z);
-			Ray r3 = Ray(state->getCamPos(), directionR3);
+void RayTracer::setAdaptiveSampling(unsigned int min_samples, unsigned int max_samples, float threshold) {
+	adaptive.min_samples = std::max(min_samples, 1u);
+	adaptive.max_samples = (max_samples > 0) ? std::max(max_samples, adaptive.min_samples) : 0;
+	adaptive.threshold = threshold;
+}
 
-			glm::vec3 directionR4 = glm::vec3(x4, y4, z);
-			Ray r4 = Ray(state->getCamPos(), directionR4);
+void RayTracer::setStochasticBranching(bool enable) {
+	state->setStochasticBranching(enable);
+}
 
-			//Now do the ray-tracing to shade the pixel
-			out_color = (state->rayTrace(r1) + state->rayTrace(r2) + state->rayTrace(r3) + state->rayTrace(r4)) * 0.25f;
+void RayTracer::setRussianRoulette(unsigned int min_depth) {
+	state->setRussianRoulette(min_depth);
+}
 
-			fb->setPixel(i, j, out_color);
-		}
+void RayTracer::setRayBudget(unsigned int rays_per_pixel) {
+	ray_budget = rays_per_pixel;
+}
+
+void RayTracer::setStreamingOutput(std::string basename, std::string extension) {
+	if (!basename.empty() && ImageWriter::getFormat(extension) == ImageWriter::OTHER) {
+		std::stringstream log;
+		log << "Unable to stream ." << extension << " images, use ppm, pfm or bmp";
+		throw std::runtime_error(log.str());
+	}
+	stream_basename = basename;
+	stream_extension = extension;
+
+	//The frame buffer of an earlier render is no longer needed
+	if (!stream_basename.empty()) {
+		fb.reset();
+		sample_counts.reset();
 	}
 }
 
-void RayTracer::save(std::string basename, std::string extension) {
-	ILuint texid;
-	struct stat buffer;
-	int i;
-	std::stringstream filename;
+void RayTracer::setCheckpoint(std::string filename, bool resume, double interval, bool keep) {
+	checkpoint_filename = filename;
+	checkpoint_resume = resume;
+	checkpoint_interval = interval;
+	checkpoint_keep = keep;
+}
 
-	ilOriginFunc(IL_ORIGIN_UPPER_LEFT);
+void RayTracer::setWorkers(std::shared_ptr<TileCoordinator> workers, std::string scene) {
+	this->workers = workers;
+	worker_scene = scene;
+}
 
-	//Create image
-	ilGenImages(1, &texid);
-	ilBindImage(texid);
-	//FIXME: Ugly const cast:( DevILs fault, unfortunately
-	ilTexImage(fb->getWidth(), fb->getHeight(), 1, 3, IL_RGB, IL_FLOAT, const_cast<float*>(fb->getData().data()));
+void RayTracer::setGBufferCache(bool enable, std::string filename) {
+	gbuffer_enabled = enable;
+	gbuffer_filename = enable ? filename : "";
+	if (!enable) gbuffer.reset();
+}
 
-	//Find a unique filename...
-	for (i=0; i<10000; ++i) {
-		filename.str("");
-		filename << basename << std::setw(4) << std::setfill('0') << i << "." << extension;
-		if (stat(filename.str().c_str(), &buffer) != 0) break;
+std::string RayTracer::getWorkerScene() {
+	std::stringstream scene;
+	glm::vec3 camera = state->getCamPos();
+	scene << std::setprecision(9) << worker_scene << " width=" << width << " height=" << height
+		<< " camera=" << camera.x << "," << camera.y << "," << camera.z;
+	if (adaptive.max_samples > 0) {
+		scene << " samples=" << adaptive.min_samples << "," << adaptive.max_samples << "," << adaptive.threshold;
 	}
+	return scene.str();
+}
 
-	if (i == 10000) {
-		std::stringstream log;
-		log << "Unable to find unique filename for " << basename << "%d." << extension;
-		throw std::runtime_error(log.str());
+double RayTracer::getAverageSampleCount() {
+	return static_cast<double>(total_samples)/(static_cast<double>(width)*height);
+}
+
+Ray RayTracer::createPrimaryRay(float x, float y) {
+	// Create the ray using the view screen definition 
+	float sx = x*(screen.right-screen.left)/static_cast<float>(width) + screen.left;
+	float sy = y*(screen.top-screen.bottom)/static_cast<float>(height) + screen.bottom;
+	Ray r(state->getCamPos(), glm::vec3(sx, sy, -1.0f));
+
+	//The ray cone of a pinhole camera starts out as a point, and
+	//spreads over one pixel at the virtual screen
+	float pixel = (screen.right-screen.left)/static_cast<float>(width);
+	r.spread = pixel/glm::length(r.getDirection());
+
+	//The primary ray itself is part of the budget
+	if (sample_budget > 0) r.budget = sample_budget-1;
+
+	//Seed the random sequence from the sample position, so that
+	//the result does not depend on which thread traces the sample
+	unsigned int ix = static_cast<unsigned int>((x+1.0f)*65536.0f);
+	unsigned int iy = static_cast<unsigned int>((y+1.0f)*65536.0f);
+	r.seed = Ray::hash(ix ^ Ray::hash(iy));
+	return r;
+}
+
+void RayTracer::prepare() {
+	Timer timer;
+	RayTracerState::Update update = state->buildAccelerationStructure();
+	if (update == RayTracerState::BUILT) times.build = timer.elapsed();
+	else if (update == RayTracerState::REFITTED) times.refit = timer.elapsed();
+
+	//Split the per pixel ray budget evenly between the samples in a pixel
+	sample_budget = 0;
+	if (ray_budget > 0) {
+		unsigned int samples = (adaptive.max_samples > 0) ? adaptive.max_samples : 4;
+		sample_budget = std::max(ray_budget/samples, 1u);
 	}
+}
 
-	if (!ilSaveImage(filename.str().c_str())) {
-		std::stringstream log;
-		log << "Unable to save " << filename.str();
-		throw std::runtime_error(log.str());
+bool RayTracer::render() {
+	const PacketKernels* kernels = use_packets ? getPacketKernels() : NULL;
+
+	//A cancel() that came before the render is kept, and stops it right away
+	times.build = times.refit = times.trace = 0.0;
+	bool finished;
+	try {
+		//The workers load the scene themselves
+		if (!workers) prepare();
+		finished = renderTiles(kernels);
+	}
+	catch (...) {
+		cancelled = false;
+		throw;
+	}
+	cancelled = false;
+	return finished;
+}
+
+bool RayTracer::renderProgressive(PassCallback publish, unsigned int block_size) {
+	if (workers || !stream_basename.empty()) {
+		throw std::runtime_error("Progressive rendering needs the frame buffer, and is not available with streaming output or workers");
+	}
+	const PacketKernels* kernels = use_packets ? getPacketKernels() : NULL;
+	times.build = times.refit = times.trace = 0.0;
+	bool finished;
+	try {
+		finished = renderPasses(publish, block_size, kernels);
+	}
+	catch (...) {
+		cancelled = false;
+		throw;
+	}
+	cancelled = false;
+	return finished;
+}
+
+bool RayTracer::renderPasses(PassCallback publish, unsigned int block_size, const PacketKernels* kernels) {
+	prepare();
+	Timer timer;
+
+	//The preview passes draw into the frame buffer, so that it always holds the best image so far
+	if (!fb) {
+		fb.reset(new FrameBuffer(width, height));
+		sample_counts.reset(new FrameBuffer(width, height));
+	}
+	std::vector<glm::vec3> centers(width*height);
+	std::vector<unsigned char> traced(width*height, 0);
+
+	scheduler.reset(new TileScheduler(width, height, tile_size, n_threads));
+	unsigned int pass = 0;
+	for (unsigned int size=std::max(block_size, 1u); !cancelled; size/=2) {
+		scheduler->run([&](const Tile& tile) {
+			if (!cancelled) renderPreviewTile(tile, kernels, size, centers, traced);
+		});
+		if (cancelled) break;
+		if (publish) publish(*fb, pass, false);
+		++pass;
+		if (size == 1) break;
+	}
+	times.trace = timer.elapsed();
+
+	//The samples of the full quality pass are not at the pixel centers, so nothing is reused
+	if (cancelled || !renderTiles(kernels)) return false;
+	if (publish) publish(*fb, pass, true);
+	return true;
+}
+
+void RayTracer::cancel() {
+	cancelled = true;
+}
+
+bool RayTracer::renderTiles(const PacketKernels* kernels) {
+	Timer timer;
+
+	total_samples = 0;
+	if (!checkpoint_filename.empty()) {
+		//The samples depend on the view and the scene, besides the tiles
+		Checkpoint::Key key;
+		key.width = width;
+		key.height = height;
+		key.tile_size = tile_size;
+		key.adaptive = (adaptive.max_samples > 0) ? 1 : 0;
+		key.scene = state->getGeometryHash();
+		key.effects = state->getEffectHash();
+		key.camera = state->getCamPos();
+		checkpoint.reset(new Checkpoint(checkpoint_filename, key, checkpoint_resume, checkpoint_interval));
+		if (!checkpoint->getDiscardReason().empty()) std::cout << checkpoint->getDiscardReason() << std::endl;
+		if (checkpoint->getResumedTileCount() > 0) {
+			std::cout << "Resuming " << checkpoint->getResumedTileCount() << " tiles from " << checkpoint_filename << std::endl;
+		}
+	}
+	if (!stream_basename.empty()) {
+		stream.reset(new ImageStream(width, height, stream_basename, stream_extension));
+		std::cout << "Streaming to " << stream->getFilename() << std::endl;
+	}
+	else if (!fb) {
+		fb.reset(new FrameBuffer(width, height));
+		sample_counts.reset(new FrameBuffer(width, height));
+	}
+
+	//Primary hits of an earlier render can be reused as long as the
+	//primary rays and the geometry they hit are the same. The geometry
+	//hash is only needed for the file, since the generation tells whether
+	//the G-buffer in memory is still valid.
+	if (gbuffer_enabled && !workers) {
+		GBuffer::Key key;
+		key.width = width;
+		key.height = height;
+		key.tile_size = tile_size;
+		key.adaptive = (adaptive.max_samples > 0) ? 1 : 0;
+		key.camera = state->getCamPos();
+		if (gbuffer && gbuffer->getKey() == key && gbuffer_generation == state->getGeneration()) {
+			cached_hits = gbuffer;
+		}
+		else if (!gbuffer_filename.empty()) {
+			cached_hits = GBuffer::read(gbuffer_filename, key, state->getGeometryHash());
+			if (cached_hits) std::cout << "Reusing primary hits from " << gbuffer_filename << std::endl;
+		}
+		traced_hits.reset(new GBuffer(key));
+	}
+
+	//Split the frame into tiles, and ray-trace them using multiple CPUs,
+	//or multiple worker processes
+	scheduler.reset(new TileScheduler(width, height, tile_size, n_threads));
+	stats.reset();
+	if (RayCounters::enabled && !workers) {
+		stats.reset(new RenderStats(width, height, static_cast<unsigned int>(scheduler->getTiles().size())));
+	}
+	try {
+		if (workers) {
+			std::vector<Tile> tiles;
+			TileSamples resumed;
+			for (unsigned int i=0; i<scheduler->getTiles().size(); ++i) {
+				const Tile& tile = scheduler->getTiles()[i];
+				if (findResumed(tile, resumed)) storeTile(tile, resumed);
+				else tiles.push_back(tile);
+			}
+			scheduler.reset();
+			workers->run(getWorkerScene(), tiles, [&](const Tile& tile, const TileSamples& samples) {
+				storeTile(tile, samples);
+				if (checkpoint) checkpoint->add(tile, samples);
+			});
+		}
+		else {
+			scheduler->run([&](const Tile& tile) {
+				if (!cancelled) processTile(tile, kernels);
+			});
+		}
+	}
+	catch (...) {
+		//Closes the files, keeping the tiles finished so far
+		stream.reset();
+		checkpoint.reset();
+		cached_hits.reset();
+		traced_hits.reset();
+		throw;
+	}
+
+	//Tiles handed to workers are rendered even if cancelled
+	bool finished = workers || !cancelled;
+
+	//The hits of a cancelled render are missing the skipped tiles, and are
+	//dropped, so that the G-buffer of the last finished render is kept
+	cached_hits.reset();
+	if (!finished) traced_hits.reset();
+	if (traced_hits) {
+		gbuffer = traced_hits;
+		gbuffer_generation = state->getGeneration();
+		traced_hits.reset();
+		if (!gbuffer_filename.empty()) gbuffer->write(gbuffer_filename, state->getGeometryHash());
+	}
+
+	if (checkpoint) {
+		checkpoint->flush();
+		checkpoint.reset();
+
+		//Nothing is left to resume once all tiles are done
+		if (finished && !checkpoint_keep) std::remove(checkpoint_filename.c_str());
+	}
+
+	if (stats) stats->merge();
+	times.trace += timer.elapsed();
+
+	if (stream) {
+		if (finished) std::cout << "Saved " << stream->getFilename() << std::endl;
+		else std::cout << "Cancelled, " << stream->getFilename() << " only holds the tiles finished so far" << std::endl;
+		stream.reset();
+	}
+	return finished;
+}
+
+void RayTracer::traceSamples(const std::vector<glm::vec2>& points, std::vector<glm::vec3>& colors, const PacketKernels* kernels,
+		std::vector<float>* costs, PrimaryHits* primary) {
+	colors.resize(points.size());
+	if (costs != NULL) costs->resize(points.size());
+
+	//Samples with a hit in the G-buffer are only shaded
+	std::vector<unsigned int> traced;
+	traced.reserve(points.size());
+	if (primary != NULL) primary->hits.resize(points.size());
+	for (unsigned int i=0; i<points.size(); ++i) {
+		if (primary == NULL || primary->cached[i] == NULL) {
+			traced.push_back(i);
+			continue;
+		}
+		unsigned long long tests = RayCounters::getThreadTests();
+		Ray r = createPrimaryRay(points[i].x, points[i].y);
+		colors[i] = state->shadeHit(r, *primary->cached[i]);
+		primary->hits[i] = *primary->cached[i];
+		if (costs != NULL) (*costs)[i] = static_cast<float>(RayCounters::getThreadTests()-tests);
+	}
+	RayCounters::countRays(RayCounters::PRIMARY_RAY, static_cast<unsigned int>(traced.size()));
+
+	if (kernels != NULL) {
+		//Trace neighbouring samples together as one packet
+		std::vector<Ray> rays;
+		glm::vec3 packet_colors[RayPacket::width];
+		HitRecord packet_hits[RayPacket::width];
+		rays.reserve(RayPacket::width);
+		for (unsigned int i=0; i<traced.size(); i+=RayPacket::width) {
+			unsigned int n = std::min(RayPacket::width, static_cast<unsigned int>(traced.size())-i);
+			rays.clear();
+			for (unsigned int k=0; k<n; ++k) {
+				const glm::vec2& point = points[traced[i+k]];
+				rays.push_back(createPrimaryRay(point.x, point.y));
+			}
+			unsigned long long tests = RayCounters::getThreadTests();
+			state->rayTracePacket(rays.data(), n, packet_colors, *kernels, (primary != NULL) ? packet_hits : NULL);
+			float cost = static_cast<float>(RayCounters::getThreadTests()-tests)/n;
+			for (unsigned int k=0; k<n; ++k) {
+				colors[traced[i+k]] = packet_colors[k];
+				if (primary != NULL) primary->hits[traced[i+k]] = packet_hits[k];
+				if (costs != NULL) (*costs)[traced[i+k]] = cost;
+			}
+		}
 	}
 	else {
-		std::cout << "Saved " << filename.str() << std::endl;
+		for (unsigned int i=0; i<traced.size(); ++i) {
+			unsigned int s = traced[i];
+			unsigned long long tests = RayCounters::getThreadTests();
+			Ray r = createPrimaryRay(points[s].x, points[s].y);
+			colors[s] = state->rayTrace(r, (primary != NULL) ? &primary->hits[s] : NULL);
+			if (costs != NULL) (*costs)[s] = static_cast<float>(RayCounters::getThreadTests()-tests);
+		}
+	}
+}
+
+static inline float luminance(const glm::vec3& c) {
+	return glm::dot(c, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+TileSamples RayTracer::getSamplingSettings() {
+	TileSamples settings;
+	settings.min_samples = (adaptive.max_samples > 0) ? adaptive.min_samples : 4;
+	settings.max_samples = adaptive.max_samples;
+	settings.threshold = (adaptive.max_samples > 0) ? adaptive.threshold : 0.0f;
+	return settings;
+}
+
+void RayTracer::sampleTile(const Tile& tile, TileSamples& samples) {
+	const PacketKernels* kernels = use_packets ? getPacketKernels() : NULL;
+	prepare();
+	if (adaptive.max_samples > 0) renderTileAdaptive(tile, kernels, NULL, samples);
+	else renderTile(tile, kernels, samples);
+}
+
+bool RayTracer::findResumed(const Tile& tile, TileSamples& resumed) {
+	if (!checkpoint || !checkpoint->find(tile, resumed)) return false;
+
+	//Samples at fixed offsets cannot be refined, so checkpointed tiles are used as they are
+	return adaptive.max_samples == 0 || resumed.sameSettings(getSamplingSettings());
+}
+
+void RayTracer::processTile(const Tile& tile, const PacketKernels* kernels) {
+	TileSamples samples;
+	if (findResumed(tile, samples)) {
+		storeTile(tile, samples);
+		return;
+	}
+
+	//Count the work done by this thread on the tile, if statistics are compiled in
+	Timer timer;
+	RayCounters counters = RayCounters::getThreadCounters();
+	std::vector<float> costs;
+
+	//Adaptive sampling goes on from the samples of a tile checkpointed with other settings
+	if (adaptive.max_samples > 0) {
+		TileSamples resumed;
+		bool found = checkpoint && checkpoint->find(tile, resumed);
+		renderTileAdaptive(tile, kernels, found ? &resumed : NULL, samples, stats ? &costs : NULL);
+	}
+	else {
+		renderTile(tile, kernels, samples, stats ? &costs : NULL);
+	}
+
+	if (stats) {
+		RayCounters tile_counters = RayCounters::getThreadCounters();
+		tile_counters.subtract(counters);
+		stats->addTile(tile, timer.elapsed(), tile_counters, costs);
+	}
+
+	storeTile(tile, samples);
+	if (checkpoint) checkpoint->add(tile, samples);
+}
+
+void RayTracer::renderTile(const Tile& tile, const PacketKernels* kernels, TileSamples& samples, std::vector<float>* costs) {
+	std::vector<glm::vec2> points;
+	std::vector<glm::vec3> colors;
+	std::vector<float> sample_costs;
+	PrimaryHits primary;
+
+	for (unsigned int j=tile.y0; j<tile.y1; ++j) {
+		for (unsigned int i=tile.x0; i<tile.x1; ++i) {
+			for (unsigned int s=0; s<4; ++s) {
+				points.push_back(glm::vec2(i+sample_offsets[s][0], j+sample_offsets[s][1]));
+				if (traced_hits) primary.cached.push_back(cached_hits ? cached_hits->find(i, j, s) : NULL);
+			}
+		}
+	}
+
+	traceSamples(points, colors, kernels, costs ? &sample_costs : NULL, traced_hits ? &primary : NULL);
+
+	samples = getSamplingSettings();
+	unsigned int n = static_cast<unsigned int>(colors.size()/4);
+	if (traced_hits) traced_hits->setTile(tile, std::vector<unsigned int>(n, 4), primary.hits);
+	if (costs != NULL) {
+		costs->resize(n);
+		for (unsigned int p=0; p<n; ++p) {
+			(*costs)[p] = sample_costs[4*p] + sample_costs[4*p+1] + sample_costs[4*p+2] + sample_costs[4*p+3];
+		}
+	}
+	samples.sum.resize(n);
+	samples.sum_sq.resize(n);
+	samples.count.assign(n, 4);
+	for (unsigned int p=0; p<n; ++p) {
+		const glm::vec3* c = &colors[4*p];
+		samples.sum[p] = c[0] + c[1] + c[2] + c[3];
+		samples.sum_sq[p] = 0.0f;
+		for (unsigned int s=0; s<4; ++s) samples.sum_sq[p] += luminance(c[s])*luminance(c[s]);
+	}
+}
+
+/**
+  * Radical inverse of k in the given base, used for the Halton sequence
+  */
+static float radicalInverse(unsigned int k, unsigned int base) {
+	float inv_base = 1.0f/base;
+	float f = inv_base;
+	float r = 0.0f;
+	while (k > 0) {
+		r += f*(k % base);
+		k /= base;
+		f *= inv_base;
+	}
+	return r;
+}
+
+/**
+  * Offset from the pixel center of sample number k in a pixel. The offsets
+  * follow the Halton (2, 3) sequence, so that any number of samples is well
+  * stratified over the pixel. It is shifted so that the first sample is in
+  * the pixel center.
+  */
+static glm::vec2 adaptiveSampleOffset(unsigned int k) {
+	float u = radicalInverse(k, 2) + 0.5f;
+	float v = radicalInverse(k, 3) + 0.5f;
+	if (u >= 1.0f) u -= 1.0f;
+	if (v >= 1.0f) v -= 1.0f;
+	return glm::vec2(u-0.5f, v-0.5f);
+}
+
+void RayTracer::renderTileAdaptive(const Tile& tile, const PacketKernels* kernels, const TileSamples* resumed, TileSamples& samples,
+		std::vector<float>* costs) {
+	//Work on the tile plus a one pixel border, so that we can
+	//measure the contrast to neighbours in other tiles as well
+	const unsigned int x0 = (tile.x0 > 0) ? tile.x0-1 : 0;
+	const unsigned int y0 = (tile.y0 > 0) ? tile.y0-1 : 0;
+	const unsigned int x1 = std::min(tile.x1+1, width);
+	const unsigned int y1 = std::min(tile.y1+1, height);
+	const unsigned int w = x1-x0;
+	const unsigned int h = y1-y0;
+
+	std::vector<glm::vec3> sum(w*h, glm::vec3(0.0f));
+	std::vector<float> sum_sq(w*h, 0.0f); //< Sum of squared luminance
+	std::vector<unsigned int> count(w*h, 0);
+	std::vector<unsigned int> add(w*h, 0);
+	std::vector<glm::vec2> points;
+	std::vector<unsigned int> owner;
+	std::vector<glm::vec3> colors;
+	std::vector<float> sample_costs;
+	PrimaryHits primary;
+	std::vector<std::vector<HitRecord> > pixel_hits(traced_hits ? w*h : 0); //< Hits of the samples of each pixel, in order
+	if (costs != NULL) costs->assign((tile.x1-tile.x0)*(tile.y1-tile.y0), 0.0f);
+
+	//Resumed pixels start out with their earlier samples
+	if (resumed != NULL) {
+		unsigned int i = 0;
+		for (unsigned int y=tile.y0; y<tile.y1; ++y) {
+			for (unsigned int x=tile.x0; x<tile.x1; ++x) {
+				unsigned int p = (y-y0)*w + (x-x0);
+				sum[p] = resumed->sum[i];
+				sum_sq[p] = resumed->sum_sq[i];
+				count[p] = resumed->count[i];
+				++i;
+			}
+		}
+	}
+
+	//Border pixels only get the one sample needed to compare against
+	for (unsigned int y=y0; y<y1; ++y) {
+		for (unsigned int x=x0; x<x1; ++x) {
+			unsigned int p = (y-y0)*w + (x-x0);
+			bool inside = (x >= tile.x0 && x < tile.x1 && y >= tile.y0 && y < tile.y1);
+			add[p] = inside ? adaptive.min_samples - std::min(count[p], adaptive.min_samples) : 1;
+		}
+	}
+
+	//Resumed pixels may need no new samples before the error is estimated
+	bool estimated = false;
+	while (true) {
+		//Trace the requested samples for every pixel
+		points.clear();
+		owner.clear();
+		primary.cached.clear();
+		for (unsigned int p=0; p<w*h; ++p) {
+			glm::vec2 pixel(static_cast<float>(x0 + p%w), static_cast<float>(y0 + p/w));
+			for (unsigned int k=count[p]; k<count[p]+add[p]; ++k) {
+				points.push_back(pixel + adaptiveSampleOffset(k));
+				owner.push_back(p);
+				if (traced_hits) primary.cached.push_back(cached_hits ? cached_hits->find(x0 + p%w, y0 + p/w, k) : NULL);
+			}
+		}
+		if (points.empty() && estimated) break;
+
+		traceSamples(points, colors, kernels, costs ? &sample_costs : NULL, traced_hits ? &primary : NULL);
+		for (unsigned int s=0; s<points.size(); ++s) {
+			unsigned int p = owner[s];
+			float l = luminance(colors[s]);
+
+			//Samples before the first new one of a resumed pixel are not known,
+			//so only pixels with all their hits go into the G-buffer
+			if (traced_hits && pixel_hits[p].size() == count[p]) pixel_hits[p].push_back(primary.hits[s]);
+			sum[p] += colors[s];
+			sum_sq[p] += l*l;
+			count[p]++;
+		}
+
+		//The samples of border pixels are part of the cost of the closest pixel in the tile
+		if (costs != NULL) {
+			for (unsigned int s=0; s<points.size(); ++s) {
+				unsigned int x = std::min(std::max(x0 + owner[s]%w, tile.x0), tile.x1-1);
+				unsigned int y = std::min(std::max(y0 + owner[s]/w, tile.y0), tile.y1-1);
+				(*costs)[(y-tile.y0)*(tile.x1-tile.x0) + (x-tile.x0)] += sample_costs[s];
+			}
+		}
+
+		//Estimate the error of every pixel in the tile, and double the
+		//number of samples in the pixels that have not converged
+		estimated = true;
+		for (unsigned int y=tile.y0; y<tile.y1; ++y) {
+			for (unsigned int x=tile.x0; x<tile.x1; ++x) {
+				unsigned int p = (y-y0)*w + (x-x0);
+				float n = static_cast<float>(count[p]);
+				float mean = luminance(sum[p])/n;
+				float error = 0.0f;
+
+				//Standard error of the mean from the sample variance
+				if (count[p] > 1) {
+					float variance = std::max(0.0f, (sum_sq[p] - n*mean*mean)/(n-1.0f));
+					error = glm::sqrt(variance/n);
+				}
+
+				//Contrast against the four neighbours catches edges that a
+				//single sample cannot see the variance of
+				const int neighbours[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+				for (int k=0; k<4; ++k) {
+					int nx = static_cast<int>(x) + neighbours[k][0];
+					int ny = static_cast<int>(y) + neighbours[k][1];
+					if (nx < static_cast<int>(x0) || nx >= static_cast<int>(x1) || ny < static_cast<int>(y0) || ny >= static_cast<int>(y1)) continue;
+					unsigned int q = (ny-y0)*w + (nx-x0);
+					error = std::max(error, glm::abs(mean - luminance(sum[q])/count[q]));
+				}
+
+				add[p] = 0;
+				if (error > adaptive.threshold && count[p] < adaptive.max_samples) {
+					add[p] = std::min(count[p], adaptive.max_samples-count[p]);
+				}
+			}
+		}
+
+		//The border is never refined
+		for (unsigned int p=0; p<w*h; ++p) {
+			unsigned int x = x0 + p%w;
+			unsigned int y = y0 + p/w;
+			if (x < tile.x0 || x >= tile.x1 || y < tile.y0 || y >= tile.y1) add[p] = 0;
+		}
 	}
 
-	ilDeleteImages(1, &texid);
+	samples = getSamplingSettings();
+	std::vector<unsigned int> hit_counts;
+	std::vector<HitRecord> hits;
+	for (unsigned int y=tile.y0; y<tile.y1; ++y) {
+		for (unsigned int x=tile.x0; x<tile.x1; ++x) {
+			unsigned int p = (y-y0)*w + (x-x0);
+			samples.sum.push_back(sum[p]);
+			samples.sum_sq.push_back(sum_sq[p]);
+			samples.count.push_back(count[p]);
+			if (traced_hits) {
+				hit_counts.push_back(static_cast<unsigned int>(pixel_hits[p].size()));
+				hits.insert(hits.end(), pixel_hits[p].begin(), pixel_hits[p].end());
+			}
+		}
+	}
+	if (traced_hits) traced_hits->setTile(tile, hit_counts, hits);
+}
+
+void RayTracer::renderPreviewTile(const Tile& tile, const PacketKernels* kernels, unsigned int block_size,
+		std::vector<glm::vec3>& centers, std::vector<unsigned char>& traced) {
+	//The first pixel of the block that a pixel is in
+	auto first = [&](unsigned int x, unsigned int begin) {
+		return std::max(begin, x - x%block_size);
+	};
+
+	std::vector<glm::vec2> points;
+	std::vector<glm::vec3> colors;
+	for (unsigned int y=tile.y0; y<tile.y1; ++y) {
+		for (unsigned int x=tile.x0; x<tile.x1; ++x) {
+			if (first(x, tile.x0) == x && first(y, tile.y0) == y && !traced[y*width + x]) {
+				points.push_back(glm::vec2(static_cast<float>(x), static_cast<float>(y)));
+			}
+		}
+	}
+
+	traceSamples(points, colors, kernels);
+	for (unsigned int i=0; i<points.size(); ++i) {
+		unsigned int p = static_cast<unsigned int>(points[i].y)*width + static_cast<unsigned int>(points[i].x);
+		centers[p] = colors[i];
+		traced[p] = 1;
+	}
+
+	for (unsigned int y=tile.y0; y<tile.y1; ++y) {
+		for (unsigned int x=tile.x0; x<tile.x1; ++x) {
+			bool sampled = (first(x, tile.x0) == x && first(y, tile.y0) == y);
+			fb->setPixel(x, y, centers[first(y, tile.y0)*width + first(x, tile.x0)]);
+			sample_counts->setPixel(x, y, glm::vec3(sampled ? 1.0f : 0.0f));
+		}
+	}
+}
+
+void RayTracer::storeTile(const Tile& tile, const TileSamples& samples) {
+	std::vector<glm::vec3> pixels(samples.count.size());
+	unsigned long long n = 0;
+	for (unsigned int p=0; p<pixels.size(); ++p) {
+		pixels[p] = samples.sum[p]/static_cast<float>(samples.count[p]);
+		n += samples.count[p];
+	}
+	total_samples += n;
+
+	if (stream) {
+		stream->writeTile(tile, &pixels[0].x);
+		return;
+	}
+
+	unsigned int p = 0;
+	for (unsigned int y=tile.y0; y<tile.y1; ++y) {
+		for (unsigned int x=tile.x0; x<tile.x1; ++x) {
+			fb->setPixel(x, y, pixels[p]);
+			sample_counts->setPixel(x, y, glm::vec3(static_cast<float>(samples.count[p])));
+			++p;
+		}
+	}
+}
+
+void RayTracer::printSchedulerStats(std::ostream& out) {
+	if (scheduler) scheduler->printStats(out);
+}
+
+void RayTracer::save(std::string basename, std::string extension) {
+	if (!fb) throw std::runtime_error("No frame buffer to save: nothing rendered, or the output was streamed");
+	saveFrameBuffer(*fb, basename, extension);
+}
+
+void RayTracer::saveAs(std::string filename) {
+	if (!fb) throw std::runtime_error("No frame buffer to save: nothing rendered, or the output was streamed");
+	ImageWriter::saveAs(*fb, filename);
+}
+
+void RayTracer::saveSampleCounts(std::string basename, std::string extension) {
+	if (!sample_counts) throw std::runtime_error("No sample counts to save: nothing rendered, or the output was streamed");
+
+	//Scale so that the maximum number of samples is white
+	float scale = 1.0f/((adaptive.max_samples > 0) ? adaptive.max_samples : 4);
+	FrameBuffer image(sample_counts->getWidth(), sample_counts->getHeight());
+	for (unsigned int j=0; j<image.getHeight(); ++j) {
+		for (unsigned int i=0; i<image.getWidth(); ++i) {
+			float n = sample_counts->getData().at(3*(i+j*image.getWidth()));
+			image.setPixel(i, j, glm::vec3(n*scale));
+		}
+	}
+	saveFrameBuffer(image, basename, extension);
+}
+
+void RayTracer::saveStats(std::string basename, std::string extension) {
+	if (!RayCounters::enabled) throw std::runtime_error("No render statistics to save: built without RAYTRACER_STATS");
+	if (!stats) throw std::runtime_error("No render statistics to save: nothing rendered, or the tiles were rendered by workers");
+	stats->save(basename, extension);
+}
+
+void RayTracer::saveFrameBuffer(FrameBuffer& fb, std::string basename, std::string extension) {
+	std::string filename = ImageWriter::save(fb, basename, extension);
+	std::cout << "Saved " << filename << std::endl;
 }
\ No newline at end of file
@@ -0,0 +1,348 @@
+#include "RayTracerState.h"
+
+#include <limits>
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <stdexcept>
+#include <typeinfo>
+#include <cstring>
+#include <stdint.h>
+
+#include "SceneObjectEffect.hpp"
+
+namespace {
+	/**
+	  * The object that blocked the last shadow ray on this thread. It is only
+	  * valid for the state and acceleration structure generation it came from.
+	  */
+	struct LastOccluder {
+		const RayTracerState* state;
+		unsigned int generation;
+		int object;
+	};
+	thread_local LastOccluder last_occluder = { NULL, 0, -1 };
+
+	std::atomic<unsigned int> next_generation(1);
+}
+
+RayTracerState::Update RayTracerState::buildAccelerationStructure() {
+	if (!dirty && moved) {
+		moved = false;
+		if (refitAccelerationStructure()) {
+			generation = next_generation++;
+			return REFITTED;
+		}
+		dirty = true;
+	}
+	if (!dirty) return UNCHANGED;
+
+	std::vector<AABB> bounds;
+	storage.clear();
+	bounded.clear();
+	unbounded.clear();
+	effects.resize(scene.size());
+	for (unsigned int k=0; k<scene.size(); ++k) {
+		AABB b;
+		effects[k] = scene.at(k)->getEffect();
+		if (scene.at(k)->store(storage, k)) {
+			continue;
+		}
+		else if (scene.at(k)->getBounds(b)) {
+			bounded.push_back(k);
+			bounds.push_back(b);
+		}
+		else {
+			unbounded.push_back(k);
+		}
+	}
+	storage.build();
+	bvh.build(bounds);
+	generation = next_generation++;
+	dirty = false;
+	moved = false;
+	return BUILT;
+}
+
+bool RayTracerState::refitAccelerationStructure() {
+	//Store the primitives again, in the same order as when they were built
+	storage.spheres.clear();
+	storage.triangles.clear();
+	std::vector<AABB> bounds;
+	bounds.reserve(bounded.size());
+	for (unsigned int k=0; k<scene.size(); ++k) {
+		AABB b;
+		if (scene.at(k)->store(storage, k)) {
+			continue;
+		}
+		else if (scene.at(k)->getBounds(b)) {
+			//An object that changed from stored or unbounded to bounded needs a new build
+			if (bounds.size() >= bounded.size() || bounded[bounds.size()] != k) return false;
+			bounds.push_back(b);
+		}
+	}
+	if (bounds.size() != bounded.size()) return false;
+	return storage.refit() && bvh.refit(bounds);
+}
+
+uint64_t RayTracerState::getGeometryHash() {
+	if (geometry_hashed) return geometry_hash;
+
+	//The primitives are stored in scene order, since the storage of the
+	//acceleration structures is sorted by them, and may not be built
+	SceneStorage primitives;
+	BlobWriter out;
+	out.write(static_cast<uint32_t>(scene.size()));
+	for (unsigned int k=0; k<scene.size(); ++k) {
+		AABB bounds;
+		uint32_t stored = scene[k]->store(primitives, k) ? 1 : 0;
+		uint32_t bounded = (!stored && scene[k]->getBounds(bounds)) ? 1 : 0;
+		out.write(stored);
+		out.write(bounded);
+		if (bounded) out.write(bounds);
+
+		//The bounds do not tell meshes and other objects apart
+		out.write(scene[k]->getGeometryHash());
+	}
+	primitives.spheres.write(out);
+	primitives.triangles.write(out);
+
+	const std::vector<char>& data = out.getData();
+	geometry_hash = hashBytes(reinterpret_cast<const unsigned char*>(data.data()), data.size());
+	geometry_hashed = true;
+	return geometry_hash;
+}
+
+uint64_t RayTracerState::getEffectHash() {
+	uint64_t hash = hashBytes(NULL, 0);
+	for (unsigned int k=0; k<scene.size(); ++k) {
+		SceneObjectEffect* effect = scene[k]->getEffect();
+		uint64_t parameters = 0;
+		if (effect != NULL) {
+			const char* type = typeid(*effect).name();
+			hash = hashBytes(reinterpret_cast<const unsigned char*>(type), std::strlen(type), hash);
+			parameters = effect->getParameterHash();
+		}
+		hash = hashBytes(reinterpret_cast<const unsigned char*>(&parameters), sizeof(parameters), hash);
+	}
+	return hash;
+}
+
+void RayTracerState::writeAccelerationStructure(BlobWriter& out) {
+	buildAccelerationStructure();
+	out.write(static_cast<uint32_t>(scene.size()));
+	storage.write(out);
+	bvh.write(out);
+	out.writeArray(bounded);
+	out.writeArray(unbounded);
+}
+
+void RayTracerState::readAccelerationStructure(BlobReader& in) {
+	dirty = true;
+	uint32_t n_objects = in.read<uint32_t>();
+	if (n_objects != scene.size()) {
+		std::stringstream log;
+		log << "Acceleration structure is for " << n_objects << " objects, but the scene has " << scene.size();
+		throw std::runtime_error(log.str());
+	}
+	storage.read(in);
+	bvh.read(in);
+	in.readArray(bounded);
+	in.readArray(unbounded);
+	if (bvh.getIndices().size() != bounded.size()) {
+		throw std::runtime_error("Acceleration structure does not match its objects");
+	}
+	for (unsigned int i=0; i<bounded.size(); ++i) {
+		if (bounded[i] >= scene.size()) throw std::runtime_error("Acceleration structure does not match its objects");
+	}
+	for (unsigned int i=0; i<unbounded.size(); ++i) {
+		if (unbounded[i] >= scene.size()) throw std::runtime_error("Acceleration structure does not match its objects");
+	}
+
+	effects.resize(scene.size());
+	for (unsigned int k=0; k<scene.size(); ++k) {
+		effects[k] = scene.at(k)->getEffect();
+	}
+	generation = next_generation++;
+	dirty = false;
+}
+
+void RayTracerState::intersect(const Ray& ray, HitRecord& hit) {
+	if (use_bvh && !dirty) {
+		storage.intersect(ray, hit);
+
+		auto intersect = [&](unsigned int i) {
+			scene[bounded[i]]->intersect(ray, bounded[i], hit);
+		};
+		bvh.traverse(ray, hit.t, intersect);
+		RayCounters::countPrimitiveTests(static_cast<unsigned int>(unbounded.size()));
+		for (unsigned int i=0; i<unbounded.size(); ++i) {
+			scene[unbounded[i]]->intersect(ray, unbounded[i], hit);
+		}
+	}
+	else {
+		RayCounters::countPrimitiveTests(static_cast<unsigned int>(scene.size()));
+		for (unsigned int k=0; k<scene.size(); ++k) {
+			scene[k]->intersect(ray, k, hit);
+		}
+	}
+}
+
+bool RayTracerState::occluded(const glm::vec3& origin, const glm::vec3& dir, float t_max) {
+	Ray ray(origin, dir);
+	HitRecord hit;
+	hit.t = t_max;
+	hit.object = std::numeric_limits<int>::max(); //< So that hits exactly at t_max do not count
+	RayCounters::countRays(RayCounters::SHADOW_RAY, 1);
+
+	LastOccluder& last = last_occluder;
+	if (!dirty && last.state == this && last.generation == generation) {
+		RayCounters::countPrimitiveTests(1);
+		if (scene[last.object]->intersect(ray, last.object, hit)) return true;
+	}
+
+	bool found = false;
+	if (use_bvh && !dirty) {
+		found = storage.occluded(ray, hit);
+
+		auto visit_leaf = [&](unsigned int offset, unsigned int count) {
+			for (unsigned int i=offset; i<offset+count; ++i) {
+				unsigned int k = bounded[bvh.getIndices()[i]];
+				if (scene[k]->intersect(ray, k, hit)) return true;
+			}
+			return false;
+		};
+		if (!found) found = bvh.traverseLeavesAny(ray, t_max, visit_leaf);
+		for (unsigned int i=0; i<unbounded.size() && !found; ++i) {
+			RayCounters::countPrimitiveTests(1);
+			found = scene[unbounded[i]]->intersect(ray, unbounded[i], hit);
+		}
+	}
+	else {
+		for (unsigned int k=0; k<scene.size() && !found; ++k) {
+			RayCounters::countPrimitiveTests(1);
+			found = scene[k]->intersect(ray, k, hit);
+		}
+	}
+
+	if (found && !dirty) {
+		last.state = this;
+		last.generation = generation;
+		last.object = hit.object;
+	}
+	return found;
+}
+
+glm::vec3 RayTracerState::shade(Ray& ray, HitRecord& hit) {
+	hit.point = ray.getOrigin() + ray.getDirection() * hit.t;
+	SceneObjectEffect* effect = dirty ? scene.at(hit.object)->getEffect() : effects[hit.object];
+	return effect->rayTrace(ray, hit, *this);
+}
+
+glm::vec3 RayTracerState::rayTrace(Ray& ray, HitRecord* closest) {
+	if (!ray.isValid()) return glm::vec3(0.0f);
+
+	//Russian roulette: keep the ray with a probability given by its throughput
+	float survival = 1.0f;
+	if (roulette_depth > 0 && ray.getDepth() >= roulette_depth) {
+		survival = std::min(1.0f, ray.getWeight());
+		if (ray.random() >= survival) return glm::vec3(0.0f);
+		ray.scaleWeight(1.0f/survival);
+	}
+
+	//Find the closest intersection, if any. This is essentially just ray-casting
+	HitRecord hit;
+	RayCounters::countDepth(ray.getDepth());
+	intersect(ray, hit);
+	if (closest != NULL) {
+		*closest = hit;
+		if (hit.object >= 0) closest->point = ray.getOrigin() + ray.getDirection() * hit.t;
+	}
+
+	if (hit.object >= 0) {
+		return shade(ray, hit) / survival;
+	}
+	else {
+		return glm::vec3(0.7f) / survival;
+	}
+}
+
+glm::vec3 RayTracerState::shadeHit(Ray& ray, const HitRecord& closest) {
+	if (closest.object < 0) return glm::vec3(0.7f);
+	if (closest.object >= static_cast<int>(scene.size())) {
+		std::stringstream log;
+		log << "Hit object " << closest.object << " is not in the scene";
+		throw std::runtime_error(log.str());
+	}
+	HitRecord hit = closest;
+	return shade(ray, hit);
+}
+
+void RayTracerState::rayTracePacket(Ray* rays, unsigned int n, glm::vec3* colors, const PacketKernels& kernels,
+		HitRecord* closest) {
+	RayPacket packet;
+	packet.active = 0;
+	for (unsigned int lane=0; lane<RayPacket::width; ++lane) {
+		//Unused lanes get a copy of the first ray, but are never marked active
+		const Ray& r = rays[(lane < n) ? lane : 0];
+		const glm::vec3& o = r.getOrigin();
+		const glm::vec3& d = r.getDirection();
+		packet.ox[lane] = o.x; packet.oy[lane] = o.y; packet.oz[lane] = o.z;
+		packet.dx[lane] = d.x; packet.dy[lane] = d.y; packet.dz[lane] = d.z;
+		packet.inv_dx[lane] = 1.0f/d.x; packet.inv_dy[lane] = 1.0f/d.y; packet.inv_dz[lane] = 1.0f/d.z;
+		packet.t[lane] = std::numeric_limits<float>::max();
+		packet.object[lane] = -1;
+		if (lane < n && r.isValid()) packet.active |= (1u << lane);
+	}
+
+	//Primary rays, at depth 0
+	const unsigned int lanes = RayCounters::countLanes(packet.active);
+	RayCounters::countDepth(0, lanes);
+
+	if (use_bvh && !dirty) {
+		storage.intersectPacket(packet, kernels);
+
+		auto intersect = [&](unsigned int i) {
+			scene[bounded[i]]->intersectPacket(packet, kernels, bounded[i]);
+		};
+		bvh.traversePacket(packet, kernels, intersect);
+		RayCounters::countPrimitiveTests(static_cast<unsigned int>(unbounded.size())*lanes);
+		for (unsigned int i=0; i<unbounded.size(); ++i) {
+			scene[unbounded[i]]->intersectPacket(packet, kernels, unbounded[i]);
+		}
+	}
+	else {
+		RayCounters::countPrimitiveTests(static_cast<unsigned int>(scene.size())*lanes);
+		for (unsigned int k=0; k<scene.size(); ++k) {
+			scene[k]->intersectPacket(packet, kernels, k);
+		}
+	}
+
+	for (unsigned int lane=0; lane<n; ++lane) {
+		if (closest != NULL) closest[lane] = HitRecord();
+		if (!(packet.active & (1u << lane))) {
+			colors[lane] = glm::vec3(0.0f);
+		}
+		else if (packet.object[lane] >= 0) {
+			//The SIMD kernels only find t, so intersect the closest object once
+			//more to fill in the normal etc. Rounding may differ between the
+			//scalar and SIMD tests, e.g., with contracted multiply-adds, so a
+			//ray the scalar test misses is traced again on its own.
+			HitRecord hit;
+			int k = packet.object[lane];
+			RayCounters::countPrimitiveTests(1);
+			if (!scene.at(k)->intersect(rays[lane], k, hit)) {
+				colors[lane] = rayTrace(rays[lane], (closest != NULL) ? &closest[lane] : NULL);
+				continue;
+			}
+			if (closest != NULL) {
+				closest[lane] = hit;
+				closest[lane].point = rays[lane].getOrigin() + rays[lane].getDirection() * hit.t;
+			}
+			colors[lane] = shade(rays[lane], hit);
+		}
+		else {
+			colors[lane] = glm::vec3(0.7f);
+		}
+	}
+}
@@ -0,0 +1,335 @@
+#include "RenderServer.h"
+
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "DemoScene.hpp"
+#include "MeshLoader.h"
+#include "SceneFile.h"
+#include "Timer.h"
+
+namespace {
+	/**
+	  * Parses value as a T, with nothing left over
+	  */
+	template <typename T>
+	T parseValue(const std::string& key, const std::string& value) {
+		std::stringstream in(value);
+		T result;
+		in >> result;
+		if (in.fail() || !in.eof()) {
+			std::stringstream log;
+			log << "Invalid value '" << value << "' for " << key;
+			throw std::runtime_error(log.str());
+		}
+		return result;
+	}
+
+	/**
+	  * Splits a comma separated value into n parts
+	  */
+	std::vector<std::string> splitValue(const std::string& key, const std::string& value, unsigned int n) {
+		std::vector<std::string> parts;
+		std::stringstream in(value);
+		std::string part;
+		while (std::getline(in, part, ',')) parts.push_back(part);
+		if (parts.size() != n) {
+			std::stringstream log;
+			log << "Expected " << n << " comma separated values for " << key << ", got '" << value << "'";
+			throw std::runtime_error(log.str());
+		}
+		return parts;
+	}
+
+#ifndef _WIN32
+	/**
+	  * Writes all of data to fd
+	  * @return false if the connection was closed
+	  */
+	bool writeAll(int fd, const std::string& data) {
+		size_t written = 0;
+		while (written < data.size()) {
+			//MSG_NOSIGNAL: a client that went away is an error, not SIGPIPE
+			ssize_t n = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			written += n;
+		}
+		return true;
+	}
+#endif
+}
+
+RenderServer::RenderServer(unsigned int max_scenes) {
+	this->max_scenes = max_scenes;
+}
+
+void RenderServer::run(std::istream& in, std::ostream& out) {
+	std::string line;
+	while (std::getline(in, line)) {
+		if (!handle(line, out)) break;
+	}
+}
+
+#ifdef _WIN32
+
+void RenderServer::runSocket(std::string path) {
+	throw std::runtime_error("Serving on a socket is only supported on POSIX systems");
+}
+
+#else
+
+void RenderServer::runSocket(std::string path) {
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+		std::stringstream log;
+		log << "Invalid socket path '" << path << "'";
+		throw std::runtime_error(log.str());
+	}
+	std::memcpy(address.sun_path, path.c_str(), path.size());
+
+	//Only replace sockets, not files given by mistake
+	struct stat status;
+	if (stat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) unlink(path.c_str());
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) throw std::runtime_error("Unable to create a socket");
+	if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 4) != 0) {
+		close(listener);
+		std::stringstream log;
+		log << "Unable to listen on " << path << ": " << std::strerror(errno);
+		throw std::runtime_error(log.str());
+	}
+
+	bool quit = false;
+	while (!quit) {
+		int client = accept(listener, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR) continue;
+			close(listener);
+			unlink(path.c_str());
+			throw std::runtime_error("Unable to accept clients");
+		}
+
+		std::string received;
+		bool connected = true;
+		while (connected && !quit) {
+			char buffer[4096];
+			ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) break;
+			received.append(buffer, n);
+
+			size_t end;
+			while (connected && !quit && (end = received.find('\n')) != std::string::npos) {
+				std::string line = received.substr(0, end);
+				received.erase(0, end+1);
+				std::stringstream reply;
+				quit = !handle(line, reply);
+				connected = writeAll(client, reply.str());
+			}
+		}
+		close(client);
+	}
+	close(listener);
+	unlink(path.c_str());
+}
+
+#endif
+
+bool RenderServer::handle(std::string line, std::ostream& out) {
+	//Also accept lines ending with \r\n
+	if (!line.empty() && line[line.size()-1] == '\r') line.erase(line.size()-1);
+	size_t start = line.find_first_not_of(" \t");
+	if (start == std::string::npos || line[start] == '#') return true;
+	if (line.substr(start) == "quit") return false;
+
+	try {
+		Timer timer;
+		std::string output = render(line);
+		out << "ok " << output << " " << timer.elapsed() << std::endl;
+	}
+	catch (std::exception& e) {
+		out << "error " << e.what() << std::endl;
+	}
+	return true;
+}
+
+std::string RenderServer::render(std::string line) {
+	Job job = parse(line);
+	if (job.output.empty()) throw std::runtime_error("No output given");
+
+	std::shared_ptr<RayTracer> rt = setup(job);
+	if (!rt->render()) throw std::runtime_error("Render cancelled");
+	rt->saveAs(job.output);
+	return job.output;
+}
+
+void RenderServer::runWorker(int fd) {
+	std::shared_ptr<RayTracer> rt;
+	TileCoordinator::serve(fd, [&](const std::string& scene) {
+		rt.reset();
+		rt = setup(parse(scene));
+	}, [&](const Tile& tile, TileSamples& samples) {
+		if (!rt) throw std::runtime_error("No scene loaded");
+		rt->sampleTile(tile, samples);
+	});
+}
+
+std::shared_ptr<RayTracer> RenderServer::setup(const Job& job) {
+	std::shared_ptr<RayTracer> rt = getScene(job);
+
+	//Everything set by a job is set by every job, since the ray tracer is reused
+	rt->setResolution(job.width, job.height);
+	rt->setCamera(job.has_camera ? job.camera : cameras[getSceneKey(job)]);
+	rt->setAdaptiveSampling(job.min_samples, job.max_samples, job.threshold);
+	return rt;
+}
+
+RenderServer::Job RenderServer::parse(std::string line) {
+	Job job;
+	job.width = 800;
+	job.height = 600;
+	job.camera = glm::vec3(0.0f, 0.0f, 10.0f);
+	job.has_camera = false;
+	job.cube_map = "cubemaps/SaintLazarusChurch3";
+	job.min_samples = 1;
+	job.max_samples = 0;
+	job.threshold = 0.05f;
+
+	std::stringstream in(line);
+	std::string pair;
+	while (in >> pair) {
+		size_t split = pair.find('=');
+		if (split == std::string::npos) {
+			std::stringstream log;
+			log << "Expected key=value, got '" << pair << "'";
+			throw std::runtime_error(log.str());
+		}
+		std::string key = pair.substr(0, split);
+		std::string value = pair.substr(split+1);
+
+		if (key == "output") job.output = value;
+		else if (key == "width") job.width = parseValue<unsigned int>(key, value);
+		else if (key == "height") job.height = parseValue<unsigned int>(key, value);
+		else if (key == "scene") job.scene = value;
+		else if (key == "cubemap") job.cube_map = value;
+		else if (key == "model") job.model = value;
+		else if (key == "camera") {
+			std::vector<std::string> parts = splitValue(key, value, 3);
+			for (unsigned int k=0; k<3; ++k) job.camera[k] = parseValue<float>(key, parts[k]);
+			job.has_camera = true;
+		}
+		else if (key == "samples") {
+			std::vector<std::string> parts = splitValue(key, value, 3);
+			job.min_samples = parseValue<unsigned int>(key, parts[0]);
+			job.max_samples = parseValue<unsigned int>(key, parts[1]);
+			job.threshold = parseValue<float>(key, parts[2]);
+		}
+		else {
+			std::stringstream log;
+			log << "Unknown key " << key;
+			throw std::runtime_error(log.str());
+		}
+	}
+
+	if (job.width == 0 || job.height == 0) throw std::runtime_error("Width and height must be positive");
+	return job;
+}
+
+std::string RenderServer::getSceneKey(const Job& job) {
+	if (!job.scene.empty()) return "scene " + job.scene + "\n" + job.model;
+	return job.cube_map + "\n" + job.model;
+}
+
+std::shared_ptr<RayTracer> RenderServer::getScene(const Job& job) {
+	std::string key = getSceneKey(job);
+	std::map<std::string, std::shared_ptr<RayTracer> >::iterator found = scenes.find(key);
+	if (found != scenes.end()) {
+		scene_order.remove(key);
+		scene_order.push_front(key);
+		return found->second;
+	}
+
+	std::shared_ptr<RayTracer> rt(new RayTracer(job.width, job.height));
+	rt->setGBufferCache(true);
+	glm::vec3 camera(0.0f, 0.0f, 10.0f);
+	if (!job.scene.empty()) {
+		SceneFile::load(job.scene, *rt);
+		camera = rt->getCamera();
+	}
+	else {
+		DemoScene::addObjects(*rt);
+		std::shared_ptr<SceneObject> cube_map = getCubeMap(job.cube_map);
+		rt->addSceneObject(cube_map);
+	}
+	if (!job.model.empty()) {
+		std::shared_ptr<SceneObject> model = getModel(job.model);
+		rt->addSceneObject(model);
+	}
+
+	scenes[key] = rt;
+	cameras[key] = camera;
+	scene_order.push_front(key);
+
+	//Drop the least recently used ray tracers, and then the cube maps and
+	//models only this cache still holds
+	if (scene_order.size() > max_scenes) {
+		while (scene_order.size() > max_scenes && scene_order.size() > 1) {
+			scenes.erase(scene_order.back());
+			cameras.erase(scene_order.back());
+			scene_order.pop_back();
+		}
+		for (std::map<std::string, std::shared_ptr<SceneObject> >::iterator i = cube_maps.begin(); i != cube_maps.end();) {
+			if (i->second.use_count() == 1) cube_maps.erase(i++);
+			else ++i;
+		}
+		for (std::map<std::string, std::shared_ptr<TriangleMesh> >::iterator i = models.begin(); i != models.end();) {
+			if (i->second.use_count() == 1) models.erase(i++);
+			else ++i;
+		}
+	}
+	return rt;
+}
+
+std::shared_ptr<SceneObject> RenderServer::getCubeMap(std::string directory) {
+	std::shared_ptr<SceneObject>& cube_map = cube_maps[directory];
+	if (!cube_map) {
+		try {
+			cube_map = DemoScene::loadCubeMap(directory);
+		}
+		catch (...) {
+			cube_maps.erase(directory);
+			throw;
+		}
+	}
+	return cube_map;
+}
+
+std::shared_ptr<TriangleMesh> RenderServer::getModel(std::string filename) {
+	std::shared_ptr<TriangleMesh>& model = models[filename];
+	if (!model) {
+		try {
+			model = MeshLoader::load(filename, DemoScene::getModelEffect(),
+				DemoScene::getModelPosition(), DemoScene::getModelSize());
+		}
+		catch (...) {
+			models.erase(filename);
+			throw;
+		}
+	}
+	return model;
+}
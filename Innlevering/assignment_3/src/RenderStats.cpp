@@ -0,0 +1,161 @@
+#include "RenderStats.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ImageWriter.h"
+
+#ifdef RAYTRACER_STATS
+thread_local RayCounters RayCounters::thread_counters;
+#endif
+
+namespace {
+	const char* ray_type_names[RayCounters::RAY_TYPES] = { "primary", "reflect", "refract", "shadow" };
+	const unsigned int n_slowest = 10; //< Number of tiles listed in the JSON summary
+
+	/**
+	  * Maps t in [0, 1] to black, blue, red, yellow and white
+	  */
+	glm::vec3 heatColor(float t) {
+		const glm::vec3 colors[5] = {
+			glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 0.0f, 0.0f),
+			glm::vec3(1.0f, 1.0f, 0.0f), glm::vec3(1.0f)
+		};
+		float x = glm::clamp(t, 0.0f, 1.0f)*4.0f;
+		unsigned int i = std::min(static_cast<unsigned int>(x), 3u);
+		return glm::mix(colors[i], colors[i+1], x-i);
+	}
+
+	double ratio(unsigned long long a, unsigned long long b) {
+		return (b > 0) ? static_cast<double>(a)/b : 0.0;
+	}
+}
+
+RenderStats::RenderStats(unsigned int width, unsigned int height, unsigned int n_tiles) {
+	this->width = width;
+	this->height = height;
+	TileRecord empty = { Tile(), 0.0, RayCounters(), false };
+	tiles.assign(n_tiles, empty);
+	costs.assign(width*height, 0.0f);
+	totals = RayCounters();
+}
+
+void RenderStats::addTile(const Tile& tile, double seconds, const RayCounters& counters, const std::vector<float>& costs) {
+	TileRecord& record = tiles.at(tile.index);
+	record.tile = tile;
+	record.seconds = seconds;
+	record.counters = counters;
+	record.rendered = true;
+
+	unsigned int p = 0;
+	for (unsigned int y=tile.y0; y<tile.y1; ++y) {
+		for (unsigned int x=tile.x0; x<tile.x1; ++x) {
+			this->costs[y*width + x] = costs.at(p++);
+		}
+	}
+}
+
+void RenderStats::merge() {
+	totals = RayCounters();
+	for (unsigned int i=0; i<tiles.size(); ++i) {
+		if (tiles[i].rendered) totals.add(tiles[i].counters);
+	}
+}
+
+void RenderStats::writeJson(std::ostream& out) const {
+	std::vector<const TileRecord*> rendered;
+	double seconds = 0.0;
+	for (unsigned int i=0; i<tiles.size(); ++i) {
+		if (!tiles[i].rendered) continue;
+		rendered.push_back(&tiles[i]);
+		seconds += tiles[i].seconds;
+	}
+
+	unsigned long long rays = totals.getRays();
+	out << std::setprecision(6);
+	out << "{\n  \"width\": " << width << ", \"height\": " << height << ",\n";
+	out << "  \"rays\": {";
+	for (unsigned int i=0; i<RayCounters::RAY_TYPES; ++i) {
+		out << "\"" << ray_type_names[i] << "\": " << totals.rays[i] << ", ";
+	}
+	out << "\"total\": " << rays << "},\n";
+	out << "  \"intersection_tests\": {\"node\": " << totals.node_tests << ", \"primitive\": " << totals.primitive_tests
+		<< ", \"per_ray\": " << ratio(totals.getTests(), rays) << "},\n";
+
+	//Rays intersected with the scene, by recursion depth
+	out << "  \"depth_histogram\": [";
+	for (unsigned int i=0; i<RayCounters::depth_bins; ++i) {
+		out << totals.depth[i] << ((i+1 < RayCounters::depth_bins) ? ", " : "");
+	}
+	out << "],\n";
+
+	double max_seconds = 0.0;
+	for (unsigned int i=0; i<rendered.size(); ++i) max_seconds = std::max(max_seconds, rendered[i]->seconds);
+	out << "  \"tiles\": {\"rendered\": " << rendered.size() << ", \"seconds\": " << seconds
+		<< ", \"mean_seconds\": " << (rendered.empty() ? 0.0 : seconds/rendered.size())
+		<< ", \"max_seconds\": " << max_seconds << "},\n";
+
+	float max_cost = 0.0f;
+	double total_cost = 0.0;
+	for (unsigned int i=0; i<costs.size(); ++i) {
+		max_cost = std::max(max_cost, costs[i]);
+		total_cost += costs[i];
+	}
+	out << "  \"pixel_cost\": {\"mean\": " << (costs.empty() ? 0.0 : total_cost/costs.size()) << ", \"max\": " << max_cost
+		<< ", \"heatmap_white\": " << getHeatmapScale() << "},\n";
+
+	//The most expensive tiles, with enough to tell why
+	size_t n = std::min(rendered.size(), static_cast<size_t>(n_slowest));
+	std::partial_sort(rendered.begin(), rendered.begin()+n, rendered.end(), [](const TileRecord* a, const TileRecord* b) {
+		return a->seconds > b->seconds;
+	});
+	out << "  \"slowest_tiles\": [\n";
+	for (size_t i=0; i<n; ++i) {
+		const TileRecord& r = *rendered[i];
+		out << "    {\"x0\": " << r.tile.x0 << ", \"y0\": " << r.tile.y0 << ", \"x1\": " << r.tile.x1 << ", \"y1\": " << r.tile.y1
+			<< ", \"seconds\": " << r.seconds << ", \"rays\": " << r.counters.getRays()
+			<< ", \"tests_per_ray\": " << ratio(r.counters.getTests(), r.counters.getRays()) << "}"
+			<< ((i+1 < n) ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+float RenderStats::getHeatmapScale() const {
+	std::vector<float> sorted(costs);
+	if (sorted.empty()) return 0.0f;
+	size_t k = (sorted.size()-1)*99/100;
+	std::nth_element(sorted.begin(), sorted.begin()+k, sorted.end());
+	return sorted[k];
+}
+
+std::shared_ptr<FrameBuffer> RenderStats::getHeatmap() const {
+	float scale = getHeatmapScale();
+	float inv_scale = (scale > 0.0f) ? 1.0f/scale : 0.0f;
+	std::shared_ptr<FrameBuffer> image(new FrameBuffer(width, height));
+	for (unsigned int y=0; y<height; ++y) {
+		for (unsigned int x=0; x<width; ++x) {
+			image->setPixel(x, y, heatColor(costs[y*width + x]*inv_scale));
+		}
+	}
+	return image;
+}
+
+void RenderStats::save(std::string basename, std::string extension) const {
+	std::string json = basename + "_stats.json";
+	std::ofstream out(json.c_str());
+	writeJson(out);
+	if (!out.good()) {
+		std::stringstream log;
+		log << "Unable to write render statistics to " << json;
+		throw std::runtime_error(log.str());
+	}
+	std::cout << "Saved " << json << std::endl;
+
+	std::shared_ptr<FrameBuffer> heatmap = getHeatmap();
+	std::string filename = ImageWriter::save(*heatmap, basename + "_cost", extension);
+	std::cout << "Saved " << filename << std::endl;
+}
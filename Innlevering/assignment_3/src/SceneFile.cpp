@@ -0,0 +1,665 @@
+#include "SceneFile.h"
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glm/glm.hpp>
+
+#include "RayTracerState.h"
+#include "SceneBlob.hpp"
+#include "TextureCache.hpp"
+#include "Sphere.hpp"
+#include "Triangle.h"
+#include "TriangleMesh.hpp"
+#include "MeshInstance.hpp"
+#include "MeshLoader.h"
+#include "DemoScene.hpp"
+
+namespace {
+	const uint32_t version = 2;
+
+	enum EffectType {
+		COLOR_EFFECT = 1,
+		PHONG_EFFECT = 2,
+		FRESNEL_EFFECT = 3,
+		REFLECT_EFFECT = 4
+	};
+
+	enum ObjectType {
+		SPHERE_OBJECT = 1,
+		TRIANGLE_OBJECT = 2,
+		MESH_OBJECT = 3, //< Followed by the mesh, see TriangleMesh::write()
+		ENVIRONMENT_OBJECT = 4,
+		INSTANCE_OBJECT = 5 //< See InstanceRecord
+	};
+
+	/**
+	  * The compiled scene is a blob starting with this header, followed by
+	  * the meshes it was compiled from, the camera, the environment, the
+	  * effects, lights, objects and instances, the models, the meshes, and the
+	  * acceleration structures, see RayTracerState::writeAccelerationStructure()
+	  */
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t node_size; //< sizeof(BVH::Node), which must match to use the BVHs in place
+		uint64_t source_hash; //< Of the text scene
+	};
+
+	struct EffectRecord {
+		uint32_t type;
+		uint32_t shadows;
+		float color[3];
+	};
+
+	struct LightRecord {
+		float position[3];
+		float diffuse[3];
+		float specular[3];
+	};
+
+	struct ObjectRecord {
+		uint32_t type;
+		uint32_t effect; //< Index of the effect, unused by the environment
+		float data[9]; //< Center and radius of a sphere, or the corners of a triangle
+	};
+
+	struct InstanceRecord {
+		uint32_t model; //< Index of the model
+		float transform[16]; //< From the model to the scene, column by column
+	};
+
+	struct MeshSource {
+		std::string filename;
+		bool fitted; //< Moved and scaled to center and size
+		glm::vec3 center;
+		float size;
+	};
+
+	/**
+	  * A parsed text scene
+	  */
+	struct Description {
+		glm::vec3 camera;
+		std::string environment;
+		std::vector<EffectRecord> effects;
+		std::vector<LightRecord> lights;
+		std::vector<ObjectRecord> objects;
+		std::vector<MeshSource> meshes; //< In the order of their objects
+		std::vector<MeshSource> models; //< Meshes shared by instances
+		std::vector<InstanceRecord> instances; //< In the order of their objects
+	};
+
+	/**
+	  * Stands in for the cube map while compiling, since the acceleration
+	  * structures only need to know that it is unbounded
+	  */
+	class EnvironmentPlaceholder : public SceneObject {
+	public:
+		bool intersect(const Ray& r, int k, HitRecord& hit) { return false; }
+	};
+
+	const char* getMagic() {
+		return "RTSCENE";
+	}
+
+	/**
+	  * Returns the transform that rotates a model angle degrees about the y
+	  * axis, scales it by scale, and then moves it to position
+	  */
+	glm::mat4 getInstanceTransform(glm::vec3 position, float angle, float scale) {
+		float radians = angle*3.14159265358979f/180.0f;
+		float c = std::cos(radians)*scale;
+		float s = std::sin(radians)*scale;
+		glm::mat4 transform(1.0f);
+		transform[0] = glm::vec4(c, 0.0f, -s, 0.0f);
+		transform[1] = glm::vec4(0.0f, scale, 0.0f, 0.0f);
+		transform[2] = glm::vec4(s, 0.0f, c, 0.0f);
+		transform[3] = glm::vec4(position, 1.0f);
+		return transform;
+	}
+
+	glm::mat4 getTransform(const InstanceRecord& instance) {
+		glm::mat4 transform;
+		for (unsigned int i=0; i<4; ++i) {
+			for (unsigned int j=0; j<4; ++j) transform[i][j] = instance.transform[4*i+j];
+		}
+		return transform;
+	}
+
+	/**
+	  * Gets the size and modification time of a file
+	  * @return false if the file does not exist
+	  */
+	bool getFileStamp(const std::string& filename, uint64_t& size, int64_t& modified) {
+#ifdef _WIN32
+		struct _stat64 info;
+		if (_stat64(filename.c_str(), &info) != 0) return false;
+#else
+		struct stat info;
+		if (stat(filename.c_str(), &info) != 0) return false;
+#endif
+		size = static_cast<uint64_t>(info.st_size);
+		modified = static_cast<int64_t>(info.st_mtime);
+		return true;
+	}
+
+	/**
+	  * One line of a text scene, split into words
+	  */
+	class Statement {
+	public:
+		Statement(const std::string& filename, unsigned int line, const std::vector<std::string>& words) {
+			this->filename = filename;
+			this->line = line;
+			this->words = words;
+		}
+
+		inline const std::string& operator[](size_t i) const { return words[i]; }
+		inline size_t size() const { return words.size(); }
+
+		/**
+		  * Fails unless the statement has one of the given numbers of words
+		  */
+		void expect(size_t n0, size_t n1=0, size_t n2=0) const {
+			size_t n = words.size();
+			if (n == n0 || n == n1 || n == n2) return;
+			std::stringstream log;
+			log << "Wrong number of values for " << words[0];
+			fail(log.str());
+		}
+
+		float getFloat(size_t i) const {
+			std::stringstream in(words[i]);
+			float value;
+			in >> value;
+			if (in.fail() || !in.eof()) {
+				std::stringstream log;
+				log << "Invalid number '" << words[i] << "'";
+				fail(log.str());
+			}
+			return value;
+		}
+
+		void getFloats(size_t i, size_t n, float* values) const {
+			for (size_t k=0; k<n; ++k) values[k] = getFloat(i+k);
+		}
+
+		glm::vec3 getVector(size_t i) const {
+			return glm::vec3(getFloat(i), getFloat(i+1), getFloat(i+2));
+		}
+
+		void fail(std::string message) const {
+			std::stringstream log;
+			log << filename << ":" << line << ": " << message;
+			throw std::runtime_error(log.str());
+		}
+
+	private:
+		std::string filename;
+		unsigned int line;
+		std::vector<std::string> words;
+	};
+
+	/**
+	  * Parses "filename [x y z size]" starting at word i of a mesh or model statement
+	  */
+	MeshSource parseMeshSource(const Statement& statement, size_t i) {
+		MeshSource mesh;
+		mesh.filename = statement[i];
+		mesh.fitted = (statement.size() == i+5);
+		mesh.center = mesh.fitted ? statement.getVector(i+1) : glm::vec3(0.0f);
+		mesh.size = mesh.fitted ? statement.getFloat(i+4) : 0.0f;
+		if (mesh.fitted && mesh.size <= 0.0f) statement.fail("The size must be positive");
+		return mesh;
+	}
+
+	std::shared_ptr<TriangleMesh> loadMesh(const MeshSource& mesh, std::shared_ptr<SceneObjectEffect> effect) {
+		return mesh.fitted ? MeshLoader::load(mesh.filename, effect, mesh.center, mesh.size)
+			: MeshLoader::load(mesh.filename, effect);
+	}
+
+	Description parse(const std::string& text, const std::string& filename) {
+		Description scene;
+		scene.camera = glm::vec3(0.0f, 0.0f, 10.0f);
+		std::map<std::string, uint32_t> effect_names;
+		std::map<std::string, uint32_t> model_names;
+		bool uses_phong = false;
+
+		std::stringstream lines(text);
+		std::string line;
+		unsigned int line_number = 0;
+		while (std::getline(lines, line)) {
+			++line_number;
+			size_t comment = line.find('#');
+			if (comment != std::string::npos) line.erase(comment);
+
+			std::vector<std::string> words;
+			std::stringstream in(line);
+			std::string word;
+			while (in >> word) words.push_back(word);
+			if (words.empty()) continue;
+
+			Statement statement(filename, line_number, words);
+			const std::string& type = words[0];
+			if (type == "camera") {
+				statement.expect(4);
+				scene.camera = statement.getVector(1);
+			}
+			else if (type == "environment") {
+				statement.expect(2);
+				if (!scene.environment.empty()) statement.fail("The scene already has an environment");
+				scene.environment = statement[1];
+			}
+			else if (type == "light") {
+				statement.expect(4, 7, 10);
+				LightRecord light = { {0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.7f, 0.7f, 0.7f} };
+				statement.getFloats(1, 3, light.position);
+				if (statement.size() >= 7) statement.getFloats(4, 3, light.diffuse);
+				if (statement.size() >= 10) statement.getFloats(7, 3, light.specular);
+				scene.lights.push_back(light);
+			}
+			else if (type == "effect") {
+				if (statement.size() < 3) statement.expect(3);
+				if (effect_names.count(statement[1]) > 0) statement.fail("Effect " + statement[1] + " is already defined");
+
+				EffectRecord effect = { 0, 0, {0.0f, 0.0f, 0.0f} };
+				const std::string& effect_type = statement[2];
+				if (effect_type == "color") {
+					statement.expect(6);
+					effect.type = COLOR_EFFECT;
+					statement.getFloats(3, 3, effect.color);
+				}
+				else if (effect_type == "phong") {
+					statement.expect(6, 7);
+					effect.type = PHONG_EFFECT;
+					statement.getFloats(3, 3, effect.color);
+					effect.shadows = 1;
+					if (statement.size() == 7) {
+						if (statement[6] != "noshadows") statement.fail("Expected noshadows, got '" + statement[6] + "'");
+						effect.shadows = 0;
+					}
+					uses_phong = true;
+				}
+				else if (effect_type == "fresnel") {
+					statement.expect(3);
+					effect.type = FRESNEL_EFFECT;
+				}
+				else if (effect_type == "reflect") {
+					statement.expect(3);
+					effect.type = REFLECT_EFFECT;
+				}
+				else {
+					statement.fail("Unknown effect type " + effect_type);
+				}
+				effect_names[statement[1]] = static_cast<uint32_t>(scene.effects.size());
+				scene.effects.push_back(effect);
+			}
+			else if (type == "model") {
+				statement.expect(3, 7);
+				if (model_names.count(statement[1]) > 0) statement.fail("Model " + statement[1] + " is already defined");
+				model_names[statement[1]] = static_cast<uint32_t>(scene.models.size());
+				scene.models.push_back(parseMeshSource(statement, 2));
+			}
+			else if (type == "sphere" || type == "triangle" || type == "mesh" || type == "instance") {
+				if (statement.size() < 2) statement.expect(2);
+				std::map<std::string, uint32_t>::iterator effect = effect_names.find(statement[1]);
+				if (effect == effect_names.end()) statement.fail("Unknown effect " + statement[1]);
+
+				ObjectRecord object;
+				std::memset(&object, 0, sizeof(ObjectRecord));
+				object.effect = effect->second;
+				if (type == "sphere") {
+					statement.expect(6);
+					object.type = SPHERE_OBJECT;
+					statement.getFloats(2, 4, object.data);
+					if (object.data[3] <= 0.0f) statement.fail("The radius must be positive");
+				}
+				else if (type == "triangle") {
+					statement.expect(11);
+					object.type = TRIANGLE_OBJECT;
+					statement.getFloats(2, 9, object.data);
+				}
+				else if (type == "mesh") {
+					statement.expect(3, 7);
+					object.type = MESH_OBJECT;
+					scene.meshes.push_back(parseMeshSource(statement, 2));
+				}
+				else {
+					statement.expect(6, 7, 8);
+					object.type = INSTANCE_OBJECT;
+					std::map<std::string, uint32_t>::iterator model = model_names.find(statement[2]);
+					if (model == model_names.end()) statement.fail("Unknown model " + statement[2]);
+					float angle = (statement.size() >= 7) ? statement.getFloat(6) : 0.0f;
+					float scale = (statement.size() >= 8) ? statement.getFloat(7) : 1.0f;
+					if (scale <= 0.0f) statement.fail("The scale must be positive");
+
+					InstanceRecord instance;
+					instance.model = model->second;
+					glm::mat4 transform = getInstanceTransform(statement.getVector(3), angle, scale);
+					for (unsigned int i=0; i<4; ++i) {
+						for (unsigned int j=0; j<4; ++j) instance.transform[4*i+j] = transform[i][j];
+					}
+					scene.instances.push_back(instance);
+				}
+				scene.objects.push_back(object);
+			}
+			else {
+				statement.fail("Unknown statement " + type);
+			}
+		}
+
+		if (uses_phong && scene.lights.empty()) {
+			std::stringstream log;
+			log << filename << ": Phong effects need at least one light";
+			throw std::runtime_error(log.str());
+		}
+
+		//The environment is tested for every ray anyway, so it goes last
+		if (!scene.environment.empty()) {
+			ObjectRecord object;
+			std::memset(&object, 0, sizeof(ObjectRecord));
+			object.type = ENVIRONMENT_OBJECT;
+			scene.objects.push_back(object);
+		}
+		return scene;
+	}
+
+	std::vector<std::shared_ptr<SceneObjectEffect> > createEffects(const std::vector<EffectRecord>& effects,
+			const std::vector<LightRecord>& lights) {
+		std::vector<std::shared_ptr<SceneObjectEffect> > result;
+		for (unsigned int i=0; i<effects.size(); ++i) {
+			const EffectRecord& e = effects[i];
+			glm::vec3 color(e.color[0], e.color[1], e.color[2]);
+			switch (e.type) {
+			case COLOR_EFFECT:
+				result.push_back(std::shared_ptr<SceneObjectEffect>(new ColorEffect(color)));
+				break;
+			case PHONG_EFFECT: {
+				if (lights.empty()) throw std::runtime_error("Phong effects need at least one light");
+				std::shared_ptr<PhongEffect> phong;
+				for (unsigned int j=0; j<lights.size(); ++j) {
+					const LightRecord& l = lights[j];
+					glm::vec3 position(l.position[0], l.position[1], l.position[2]);
+					glm::vec3 diffuse(l.diffuse[0], l.diffuse[1], l.diffuse[2]);
+					glm::vec3 specular(l.specular[0], l.specular[1], l.specular[2]);
+					if (!phong) phong.reset(new PhongEffect(color, position, diffuse, specular));
+					else phong->addLight(position, diffuse, specular);
+				}
+				phong->setShadows(e.shadows != 0);
+				result.push_back(phong);
+				break;
+			}
+			case FRESNEL_EFFECT:
+				result.push_back(std::shared_ptr<SceneObjectEffect>(new FresnelEffect()));
+				break;
+			case REFLECT_EFFECT:
+				result.push_back(std::shared_ptr<SceneObjectEffect>(new ReflectSteelEffect()));
+				break;
+			default:
+				throw std::runtime_error("Unknown effect type in compiled scene");
+			}
+		}
+		return result;
+	}
+
+	/**
+	  * Creates a sphere or triangle from its record
+	  */
+	std::shared_ptr<SceneObject> createPrimitive(const ObjectRecord& object, std::shared_ptr<SceneObjectEffect> effect) {
+		const float* d = object.data;
+		if (object.type == SPHERE_OBJECT) {
+			return std::shared_ptr<SceneObject>(new Sphere(glm::vec3(d[0], d[1], d[2]), d[3], effect));
+		}
+		return std::shared_ptr<SceneObject>(new Triangle(glm::vec3(d[0], d[1], d[2]),
+			glm::vec3(d[3], d[4], d[5]), glm::vec3(d[6], d[7], d[8]), effect));
+	}
+
+	/**
+	  * Reads the header of a compiled scene
+	  * @return false if it is not a compiled scene of this version
+	  */
+	bool readHeader(BlobReader& in, Header& header) {
+		try {
+			header = in.read<Header>();
+		}
+		catch (std::runtime_error&) {
+			return false;
+		}
+		return std::memcmp(header.magic, getMagic(), sizeof(header.magic)) == 0
+			&& header.version == version && header.node_size == sizeof(BVH::Node);
+	}
+
+	bool isCompiled(std::shared_ptr<MappedFile> file) {
+		BlobReader in(file->getData(), file->getSize(), file);
+		Header header;
+		return readHeader(in, header);
+	}
+
+	/**
+	  * Reads the meshes the scene was compiled from, following the header
+	  * @return false if any of them has changed since
+	  */
+	bool readMeshStamps(BlobReader& in) {
+		bool up_to_date = true;
+		uint32_t n = in.read<uint32_t>();
+		for (uint32_t i=0; i<n; ++i) {
+			std::string filename = in.readString();
+			uint64_t size = in.read<uint64_t>();
+			int64_t modified = in.read<int64_t>();
+			uint64_t current_size;
+			int64_t current_modified;
+			if (!getFileStamp(filename, current_size, current_modified)
+					|| current_size != size || current_modified != modified) {
+				up_to_date = false;
+			}
+		}
+		return up_to_date;
+	}
+
+	/**
+	  * Checks that a compiled scene is up to date with the text scene whose
+	  * contents hash to source_hash, and with the meshes it loads
+	  */
+	bool isUpToDate(std::shared_ptr<MappedFile> file, uint64_t source_hash) {
+		try {
+			BlobReader in(file->getData(), file->getSize(), file);
+			Header header;
+			return readHeader(in, header) && header.source_hash == source_hash && readMeshStamps(in);
+		}
+		catch (std::runtime_error&) {
+			return false;
+		}
+	}
+
+	/**
+	  * Adds the scene in a compiled scene file to rt
+	  */
+	void readScene(std::shared_ptr<MappedFile> file, RayTracer& rt) {
+		BlobReader in(file->getData(), file->getSize(), file);
+		Header header;
+		if (!readHeader(in, header)) throw std::runtime_error("Not a compiled scene of this version");
+		readMeshStamps(in);
+
+		glm::vec3 camera = in.read<glm::vec3>();
+		std::string environment = in.readString();
+		std::vector<EffectRecord> effect_records;
+		std::vector<LightRecord> lights;
+		std::vector<ObjectRecord> objects;
+		std::vector<InstanceRecord> instances;
+		in.readArray(effect_records);
+		in.readArray(lights);
+		in.readArray(objects);
+		in.readArray(instances);
+		std::vector<std::shared_ptr<SceneObjectEffect> > effects = createEffects(effect_records, lights);
+
+		//The models are only shaded through the effects of their instances
+		std::vector<std::shared_ptr<TriangleMesh> > models(in.read<uint32_t>());
+		for (unsigned int i=0; i<models.size(); ++i) {
+			models[i].reset(new TriangleMesh(in, std::shared_ptr<SceneObjectEffect>()));
+		}
+		unsigned int n_instances = 0;
+
+		for (unsigned int k=0; k<objects.size(); ++k) {
+			const ObjectRecord& object = objects[k];
+			std::shared_ptr<SceneObject> o;
+			if (object.type == ENVIRONMENT_OBJECT) {
+				o = DemoScene::loadCubeMap(environment);
+			}
+			else if (object.effect >= effects.size()) {
+				throw std::runtime_error("Invalid effect in compiled scene");
+			}
+			else if (object.type == SPHERE_OBJECT || object.type == TRIANGLE_OBJECT) {
+				o = createPrimitive(object, effects[object.effect]);
+			}
+			else if (object.type == MESH_OBJECT) {
+				o.reset(new TriangleMesh(in, effects[object.effect]));
+			}
+			else if (object.type == INSTANCE_OBJECT) {
+				if (n_instances >= instances.size() || instances[n_instances].model >= models.size()) {
+					throw std::runtime_error("Invalid instance in compiled scene");
+				}
+				const InstanceRecord& instance = instances[n_instances++];
+				o.reset(new MeshInstance(models[instance.model], getTransform(instance), effects[object.effect]));
+			}
+			else {
+				throw std::runtime_error("Unknown object type in compiled scene");
+			}
+			rt.addSceneObject(o);
+		}
+
+		rt.setCamera(camera);
+		rt.readAccelerationStructure(in);
+	}
+}
+
+void SceneFile::load(std::string filename, RayTracer& rt) {
+	std::shared_ptr<MappedFile> file(new MappedFile(filename));
+	if (!isCompiled(file)) {
+		uint64_t source_hash = hashBytes(file->getData(), file->getSize());
+		std::string compiled = getCompiledFilename(filename);
+		try {
+			file.reset(new MappedFile(compiled));
+			if (!isUpToDate(file, source_hash)) file.reset();
+		}
+		catch (std::runtime_error&) {
+			file.reset();
+		}
+
+		if (!file) {
+			compile(filename, compiled);
+			file.reset(new MappedFile(compiled));
+		}
+	}
+	readScene(file, rt);
+}
+
+void SceneFile::compile(std::string source, std::string compiled) {
+	MappedFile source_file(source);
+	const unsigned char* text = source_file.getData();
+	std::string source_text;
+	if (text != NULL) source_text.assign(reinterpret_cast<const char*>(text), source_file.getSize());
+	Description scene = parse(source_text, source);
+
+	std::vector<std::shared_ptr<SceneObjectEffect> > effects = createEffects(scene.effects, scene.lights);
+	std::vector<std::shared_ptr<TriangleMesh> > meshes;
+	std::vector<std::shared_ptr<TriangleMesh> > models;
+	for (unsigned int i=0; i<scene.models.size(); ++i) {
+		models.push_back(loadMesh(scene.models[i], std::shared_ptr<SceneObjectEffect>()));
+	}
+
+	RayTracerState state(scene.camera);
+	unsigned int n_instances = 0;
+	for (unsigned int k=0; k<scene.objects.size(); ++k) {
+		const ObjectRecord& object = scene.objects[k];
+		std::shared_ptr<SceneObject> o;
+		if (object.type == ENVIRONMENT_OBJECT) {
+			o.reset(new EnvironmentPlaceholder());
+		}
+		else if (object.type == MESH_OBJECT) {
+			meshes.push_back(loadMesh(scene.meshes[meshes.size()], effects[object.effect]));
+			o = meshes.back();
+		}
+		else if (object.type == INSTANCE_OBJECT) {
+			const InstanceRecord& instance = scene.instances[n_instances++];
+			o.reset(new MeshInstance(models[instance.model], getTransform(instance), effects[object.effect]));
+		}
+		else {
+			o = createPrimitive(object, effects[object.effect]);
+		}
+		state.addSceneObject(o);
+	}
+
+	BlobWriter out;
+	Header header;
+	std::memcpy(header.magic, getMagic(), sizeof(header.magic));
+	header.version = version;
+	header.node_size = sizeof(BVH::Node);
+	header.source_hash = hashBytes(text, source_file.getSize());
+	out.write(header);
+
+	std::vector<MeshSource> sources(scene.meshes);
+	sources.insert(sources.end(), scene.models.begin(), scene.models.end());
+	out.write(static_cast<uint32_t>(sources.size()));
+	for (unsigned int i=0; i<sources.size(); ++i) {
+		uint64_t size = 0;
+		int64_t modified = 0;
+		getFileStamp(sources[i].filename, size, modified);
+		out.writeString(sources[i].filename);
+		out.write(size);
+		out.write(modified);
+	}
+
+	out.write(scene.camera);
+	out.writeString(scene.environment);
+	out.writeArray(scene.effects);
+	out.writeArray(scene.lights);
+	out.writeArray(scene.objects);
+	out.writeArray(scene.instances);
+	out.write(static_cast<uint32_t>(models.size()));
+	for (unsigned int i=0; i<models.size(); ++i) models[i]->write(out);
+	for (unsigned int i=0; i<meshes.size(); ++i) meshes[i]->write(out);
+	state.writeAccelerationStructure(out);
+
+	//Written to a temporary file and renamed into place, so that the
+	//compiled scene is never seen partially written
+	std::string tmp_filename = compiled + ".tmp";
+	{
+		std::ofstream file(tmp_filename.c_str(), std::ios::binary | std::ios::trunc);
+		const std::vector<char>& data = out.getData();
+		file.write(&data[0], static_cast<std::streamsize>(data.size()));
+		file.close();
+		if (file.fail()) {
+			std::remove(tmp_filename.c_str());
+			std::stringstream log;
+			log << "Unable to write compiled scene " << compiled;
+			throw std::runtime_error(log.str());
+		}
+	}
+#ifdef _WIN32
+	bool replaced = (MoveFileExA(tmp_filename.c_str(), compiled.c_str(), MOVEFILE_REPLACE_EXISTING) != 0);
+#else
+	bool replaced = (std::rename(tmp_filename.c_str(), compiled.c_str()) == 0);
+#endif
+	if (!replaced) {
+		std::remove(tmp_filename.c_str());
+		std::stringstream log;
+		log << "Unable to write compiled scene " << compiled;
+		throw std::runtime_error(log.str());
+	}
+}
+
+std::string SceneFile::getCompiledFilename(std::string filename) {
+	return filename + ".bin";
+}
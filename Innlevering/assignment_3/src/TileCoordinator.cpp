@@ -0,0 +1,373 @@
+#include "TileCoordinator.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+namespace {
+	const unsigned int tiles_in_flight = 2; //< Tiles queued at every worker
+	const uint32_t max_message_size = 1 << 30;
+
+#ifndef _WIN32
+	/**
+	  * Reads exactly size bytes from fd
+	  * @return false if the connection was closed first
+	  */
+	bool readAll(int fd, void* data, size_t size) {
+		char* p = static_cast<char*>(data);
+		while (size > 0) {
+			ssize_t n = read(fd, p, size);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			p += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	/**
+	  * Writes exactly size bytes to fd
+	  * @return false if the connection was closed
+	  */
+	bool writeAll(int fd, const void* data, size_t size) {
+		const char* p = static_cast<const char*>(data);
+		while (size > 0) {
+			//MSG_NOSIGNAL: a closed connection is an error, not SIGPIPE
+			ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			p += n;
+			size -= n;
+		}
+		return true;
+	}
+#endif
+}
+
+#ifdef _WIN32
+
+TileCoordinator::TileCoordinator(std::string program, unsigned int n_workers) {
+	throw std::runtime_error("Worker processes are only supported on POSIX systems");
+}
+
+TileCoordinator::~TileCoordinator() {
+}
+
+void TileCoordinator::run(std::string scene, const std::vector<Tile>& tiles, std::function<void (const Tile&, const TileSamples&)> store) {
+	throw std::runtime_error("Worker processes are only supported on POSIX systems");
+}
+
+unsigned int TileCoordinator::getWorkerCount() const {
+	return 0;
+}
+
+void TileCoordinator::serve(int fd, std::function<void (const std::string&)> load_scene,
+		std::function<void (const Tile&, TileSamples&)> render_tile) {
+	throw std::runtime_error("Worker processes are only supported on POSIX systems");
+}
+
+#else
+
+TileCoordinator::TileCoordinator(std::string program, unsigned int n_workers) {
+	this->program = program;
+	workers.resize(n_workers);
+	for (unsigned int i=0; i<workers.size(); ++i) {
+		workers[i].fd = -1;
+		workers[i].pid = -1;
+	}
+	try {
+		for (unsigned int i=0; i<workers.size(); ++i) start(workers[i]);
+	}
+	catch (...) {
+		stopAll();
+		throw;
+	}
+}
+
+void TileCoordinator::start(Worker& worker) {
+	int sockets[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+		throw std::runtime_error("Unable to create a socket for a worker");
+	}
+	//Later workers must not inherit our end, or they keep it open after this worker dies
+	fcntl(sockets[0], F_SETFD, FD_CLOEXEC);
+
+	std::stringstream fd;
+	fd << sockets[1];
+	std::string fd_arg = fd.str();
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(sockets[0]);
+		const char* argv[] = { program.c_str(), "--worker", fd_arg.c_str(), NULL };
+		execvp(program.c_str(), const_cast<char* const*>(argv));
+		_exit(127);
+	}
+	close(sockets[1]);
+	if (pid < 0) {
+		close(sockets[0]);
+		throw std::runtime_error("Unable to start a worker process");
+	}
+
+	worker.fd = sockets[0];
+	worker.pid = pid;
+	worker.tiles.clear();
+	worker.received.clear();
+}
+
+TileCoordinator::~TileCoordinator() {
+	for (unsigned int i=0; i<workers.size(); ++i) {
+		stop(workers[i], false);
+	}
+}
+
+unsigned int TileCoordinator::getWorkerCount() const {
+	unsigned int n = 0;
+	for (unsigned int i=0; i<workers.size(); ++i) {
+		if (workers[i].fd >= 0) ++n;
+	}
+	return n;
+}
+
+void TileCoordinator::run(std::string scene, const std::vector<Tile>& tiles, std::function<void (const Tile&, const TileSamples&)> store) {
+	std::deque<unsigned int> queue;
+	for (unsigned int i=0; i<tiles.size(); ++i) queue.push_back(i);
+	unsigned int done = 0;
+
+	last_failure.clear();
+	try {
+		for (unsigned int i=0; i<workers.size(); ++i) {
+			workers[i].tiles.clear();
+			workers[i].received.clear();
+
+			//Workers that died or failed during an earlier run are started again
+			if (workers[i].fd < 0) {
+				stop(workers[i], true);
+				start(workers[i]);
+			}
+			if (!send(workers[i], LOAD_SCENE, scene.data(), scene.size())) stop(workers[i], true);
+		}
+
+		std::vector<pollfd> fds;
+		std::vector<unsigned int> polled;
+		while (done < tiles.size()) {
+			fds.clear();
+			polled.clear();
+			for (unsigned int i=0; i<workers.size(); ++i) {
+				Worker& w = workers[i];
+				while (w.fd >= 0 && w.tiles.size() < tiles_in_flight && !queue.empty()) {
+					const Tile& tile = tiles[queue.front()];
+					TileMessage message = { tile.x0, tile.y0, tile.x1, tile.y1, tile.index };
+					if (!send(w, RENDER_TILE, &message, sizeof(message))) {
+						//Its tiles are handed out again below
+						close(w.fd);
+						w.fd = -1;
+						break;
+					}
+					w.tiles.push_back(queue.front());
+					queue.pop_front();
+				}
+				if (w.fd >= 0) {
+					pollfd p = { w.fd, POLLIN, 0 };
+					fds.push_back(p);
+					polled.push_back(i);
+				}
+				else if (w.pid > 0) {
+					//The worker died: hand out its tiles first, in the same order
+					queue.insert(queue.begin(), w.tiles.begin(), w.tiles.end());
+					w.tiles.clear();
+					stop(w, true);
+				}
+			}
+
+			if (fds.empty()) {
+				std::stringstream log;
+				log << "All workers stopped with " << (tiles.size()-done) << " tiles left";
+				if (!last_failure.empty()) log << ", the last failed: " << last_failure;
+				throw std::runtime_error(log.str());
+			}
+			if (poll(fds.data(), fds.size(), -1) < 0) {
+				if (errno == EINTR) continue;
+				throw std::runtime_error("Unable to wait for the workers");
+			}
+
+			for (unsigned int k=0; k<fds.size(); ++k) {
+				if (fds[k].revents == 0) continue;
+				Worker& w = workers[polled[k]];
+
+				char buffer[65536];
+				ssize_t n = recv(w.fd, buffer, sizeof(buffer), 0);
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) {
+					//Handled when filling the queues
+					close(w.fd);
+					w.fd = -1;
+					continue;
+				}
+				w.received.insert(w.received.end(), buffer, buffer + n);
+				handleMessages(w, tiles, done, store);
+			}
+		}
+	}
+	catch (...) {
+		stopAll();
+		throw;
+	}
+}
+
+void TileCoordinator::handleMessages(Worker& worker, const std::vector<Tile>& tiles, unsigned int& done,
+		std::function<void (const Tile&, const TileSamples&)>& store) {
+	size_t used = 0;
+	while (worker.received.size() - used >= sizeof(MessageHeader)) {
+		MessageHeader header;
+		std::memcpy(&header, &worker.received[used], sizeof(MessageHeader));
+		if (header.size > max_message_size) throw std::runtime_error("Invalid message from worker");
+		if (worker.received.size() - used - sizeof(MessageHeader) < header.size) break;
+		const char* data = &worker.received[used + sizeof(MessageHeader)];
+		used += sizeof(MessageHeader) + header.size;
+
+		if (header.type == FAILED) {
+			//Its tiles, starting with the one that failed, are handed to the others
+			last_failure = std::string(data, header.size);
+			close(worker.fd);
+			worker.fd = -1;
+			worker.received.clear();
+			return;
+		}
+		else if (header.type != TILE_DONE || worker.tiles.empty() || header.size < sizeof(SamplesHeader)) {
+			throw std::runtime_error("Unexpected message from worker");
+		}
+
+		//Workers render their tiles in the order they were sent
+		const Tile& tile = tiles[worker.tiles.front()];
+		SamplesHeader samples_header;
+		std::memcpy(&samples_header, data, sizeof(SamplesHeader));
+		size_t n = static_cast<size_t>(tile.x1-tile.x0)*(tile.y1-tile.y0);
+		if (samples_header.index != tile.index || samples_header.pixels != n || header.size != sizeof(SamplesHeader) + n*sizeof(Pixel)) {
+			throw std::runtime_error("Worker returned the wrong tile");
+		}
+
+		TileSamples samples;
+		samples.min_samples = samples_header.min_samples;
+		samples.max_samples = samples_header.max_samples;
+		samples.threshold = samples_header.threshold;
+		samples.sum.resize(n);
+		samples.sum_sq.resize(n);
+		samples.count.resize(n);
+		for (size_t i=0; i<n; ++i) {
+			Pixel pixel;
+			std::memcpy(&pixel, data + sizeof(SamplesHeader) + i*sizeof(Pixel), sizeof(Pixel));
+			samples.sum[i] = glm::vec3(pixel.sum[0], pixel.sum[1], pixel.sum[2]);
+			samples.sum_sq[i] = pixel.sum_sq;
+			samples.count[i] = pixel.count;
+		}
+
+		worker.tiles.pop_front();
+		store(tile, samples);
+		done++;
+	}
+	worker.received.erase(worker.received.begin(), worker.received.begin() + used);
+}
+
+void TileCoordinator::serve(int fd, std::function<void (const std::string&)> load_scene,
+		std::function<void (const Tile&, TileSamples&)> render_tile) {
+	std::vector<char> data;
+	MessageHeader header;
+	while (readAll(fd, &header, sizeof(MessageHeader))) {
+		if (header.size > max_message_size) break;
+		data.resize(header.size);
+		if (!readAll(fd, data.data(), data.size())) break;
+
+		std::vector<char> reply;
+		try {
+			if (header.type == LOAD_SCENE) {
+				load_scene(std::string(data.begin(), data.end()));
+				continue;
+			}
+			else if (header.type == RENDER_TILE && data.size() == sizeof(TileMessage)) {
+				TileMessage message;
+				std::memcpy(&message, data.data(), sizeof(TileMessage));
+				Tile tile;
+				tile.x0 = message.x0;
+				tile.y0 = message.y0;
+				tile.x1 = message.x1;
+				tile.y1 = message.y1;
+				tile.index = message.index;
+
+				TileSamples samples;
+				render_tile(tile, samples);
+				reply = encodeSamples(tile, samples);
+			}
+			else {
+				throw std::runtime_error("Unexpected message from coordinator");
+			}
+		}
+		catch (std::exception& e) {
+			std::string error = e.what();
+			MessageHeader failed = { FAILED, static_cast<uint32_t>(error.size()) };
+			reply.assign(reinterpret_cast<const char*>(&failed), reinterpret_cast<const char*>(&failed) + sizeof(MessageHeader));
+			reply.insert(reply.end(), error.begin(), error.end());
+		}
+		if (!writeAll(fd, reply.data(), reply.size())) break;
+	}
+}
+
+std::vector<char> TileCoordinator::encodeSamples(const Tile& tile, const TileSamples& samples) {
+	SamplesHeader samples_header;
+	samples_header.index = tile.index;
+	samples_header.pixels = static_cast<uint32_t>(samples.count.size());
+	samples_header.min_samples = samples.min_samples;
+	samples_header.max_samples = samples.max_samples;
+	samples_header.threshold = samples.threshold;
+	MessageHeader header = { TILE_DONE, static_cast<uint32_t>(sizeof(SamplesHeader) + samples.count.size()*sizeof(Pixel)) };
+
+	std::vector<char> message(sizeof(MessageHeader) + header.size);
+	std::memcpy(&message[0], &header, sizeof(MessageHeader));
+	std::memcpy(&message[sizeof(MessageHeader)], &samples_header, sizeof(SamplesHeader));
+	char* pixels = &message[sizeof(MessageHeader) + sizeof(SamplesHeader)];
+	for (size_t i=0; i<samples.count.size(); ++i) {
+		Pixel pixel;
+		pixel.sum[0] = samples.sum[i].r;
+		pixel.sum[1] = samples.sum[i].g;
+		pixel.sum[2] = samples.sum[i].b;
+		pixel.sum_sq = samples.sum_sq[i];
+		pixel.count = samples.count[i];
+		std::memcpy(pixels + i*sizeof(Pixel), &pixel, sizeof(Pixel));
+	}
+	return message;
+}
+
+bool TileCoordinator::send(Worker& worker, uint32_t type, const void* data, size_t size) {
+	MessageHeader header = { type, static_cast<uint32_t>(size) };
+	return writeAll(worker.fd, &header, sizeof(MessageHeader)) && writeAll(worker.fd, data, size);
+}
+
+void TileCoordinator::stop(Worker& worker, bool kill) {
+	if (worker.fd >= 0) close(worker.fd);
+	worker.fd = -1;
+	if (worker.pid > 0) {
+		if (kill) ::kill(worker.pid, SIGKILL);
+		int status;
+		while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR);
+	}
+	worker.pid = -1;
+}
+
+void TileCoordinator::stopAll() {
+	for (unsigned int i=0; i<workers.size(); ++i) {
+		stop(workers[i], true);
+	}
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include "TileScheduler.h"
+
+#include <algorithm>
+#include <thread>
+#include <iomanip>
+
+#include "Timer.h"
+
+TileScheduler::TileScheduler(unsigned int width, unsigned int height, unsigned int tile_size, unsigned int n_threads) {
+	if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+	if (n_threads == 0) n_threads = 1;
+	this->n_threads = n_threads;
+	elapsed = 0.0;
+	abort = false;
+
+	//Create the tiles, clipping the last row and column to the frame
+	unsigned int n_x = (width+tile_size-1)/tile_size;
+	unsigned int n_y = (height+tile_size-1)/tile_size;
+	std::vector<std::pair<unsigned int, unsigned int> > order;
+	for (unsigned int ty=0; ty<n_y; ++ty) {
+		for (unsigned int tx=0; tx<n_x; ++tx) {
+			Tile t;
+			t.x0 = tx*tile_size;
+			t.y0 = ty*tile_size;
+			t.x1 = std::min(t.x0+tile_size, width);
+			t.y1 = std::min(t.y0+tile_size, height);
+			t.index = ty*n_x + tx;
+			tiles.push_back(t);
+			order.push_back(std::make_pair(mortonCode(tx, ty), t.index));
+		}
+	}
+
+	//Sort the tiles along the Morton curve
+	std::sort(order.begin(), order.end());
+	std::vector<Tile> sorted(tiles.size());
+	for (unsigned int i=0; i<order.size(); ++i) {
+		sorted[i] = tiles[order[i].second];
+	}
+	tiles.swap(sorted);
+
+	for (unsigned int i=0; i<n_threads; ++i) {
+		queues.push_back(std::make_shared<WorkQueue>());
+	}
+}
+
+void TileScheduler::run(std::function<void (const Tile&)> render_tile) {
+	std::vector<std::thread> threads;
+	Timer timer;
+
+	//Give each thread a contiguous part of the Morton curve
+	for (unsigned int i=0; i<n_threads; ++i) {
+		unsigned int begin = static_cast<unsigned int>(tiles.size()*i/n_threads);
+		unsigned int end = static_cast<unsigned int>(tiles.size()*(i+1)/n_threads);
+		queues[i]->tiles.clear();
+		for (unsigned int k=begin; k<end; ++k) {
+			queues[i]->tiles.push_back(k);
+		}
+	}
+
+	stats.assign(n_threads, ThreadStats());
+	error = std::exception_ptr();
+	abort = false;
+
+	//The calling thread does its share of the work as worker 0
+	for (unsigned int i=1; i<n_threads; ++i) {
+		threads.push_back(std::thread(&TileScheduler::worker, this, i, std::ref(render_tile)));
+	}
+	worker(0, render_tile);
+	for (unsigned int i=0; i<threads.size(); ++i) {
+		threads[i].join();
+	}
+
+	elapsed = timer.elapsed();
+	for (unsigned int i=0; i<n_threads; ++i) {
+		stats[i].idle = std::max(0.0, elapsed - stats[i].busy);
+	}
+
+	if (error) std::rethrow_exception(error);
+}
+
+void TileScheduler::worker(unsigned int id, std::function<void (const Tile&)>& render_tile) {
+	ThreadStats& s = stats[id];
+	s.busy = 0.0;
+	s.tiles = 0;
+	s.stolen = 0;
+
+	while (true) {
+		unsigned int tile;
+		bool stolen = false;
+		if (!pop(id, tile)) {
+			if (!steal(id, tile)) break;
+			stolen = true;
+		}
+
+		Timer timer;
+		try {
+			render_tile(tiles[tile]);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> guard(error_lock);
+			if (!error) error = std::current_exception();
+			abort = true;
+		}
+		s.busy += timer.elapsed();
+		s.tiles++;
+		if (stolen) s.stolen++;
+	}
+}
+
+bool TileScheduler::pop(unsigned int id, unsigned int& tile) {
+	WorkQueue& q = *queues[id];
+	std::lock_guard<std::mutex> guard(q.lock);
+	if (q.tiles.empty() || abort) return false;
+	tile = q.tiles.front();
+	q.tiles.pop_front();
+	return true;
+}
+
+bool TileScheduler::steal(unsigned int id, unsigned int& tile) {
+	//No new tiles are ever added, so one pass over the other
+	//queues that finds nothing means that we are done
+	for (unsigned int i=1; i<n_threads; ++i) {
+		WorkQueue& q = *queues[(id+i) % n_threads];
+		std::lock_guard<std::mutex> guard(q.lock);
+		if (!q.tiles.empty() && !abort) {
+			tile = q.tiles.back();
+			q.tiles.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+unsigned int TileScheduler::mortonCode(unsigned int x, unsigned int y) {
+	unsigned int code = 0;
+	for (unsigned int b=0; b<16; ++b) {
+		code |= ((x >> b) & 1u) << (2*b);
+		code |= ((y >> b) & 1u) << (2*b+1);
+	}
+	return code;
+}
+
+void TileScheduler::printStats(std::ostream& out) const {
+	double busy = 0.0;
+	for (unsigned int i=0; i<stats.size(); ++i) {
+		busy += stats[i].busy;
+		out << "Thread " << std::setw(3) << i << ": busy " << std::fixed << std::setprecision(3) << stats[i].busy
+			<< "s, idle " << stats[i].idle << "s, " << stats[i].tiles << " tiles (" << stats[i].stolen << " stolen)" << std::endl;
+	}
+	if (elapsed > 0.0) {
+		out << "Parallel efficiency: " << std::setprecision(1) << 100.0*busy/(elapsed*n_threads) << "% of "
+			<< n_threads << " threads over " << std::setprecision(3) << elapsed << "s" << std::endl;
+	}
+	out.unsetf(std::ios::floatfield);
+	out << std::setprecision(6);
+}
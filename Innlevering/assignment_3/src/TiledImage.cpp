@@ -0,0 +1,180 @@
+#include "TiledImage.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+TiledImage::TiledImage() {
+	format = RGB9E5;
+}
+
+TiledImage::TiledImage(const std::vector<float>& rgb, unsigned int width, unsigned int height, Format format) {
+	if (width == 0 || height == 0 || rgb.size() < 3*static_cast<size_t>(width)*height) {
+		std::stringstream error;
+		error << "Invalid image: " << width << "x" << height << " texels from " << rgb.size()/3 << " colors";
+		throw std::runtime_error(error.str());
+	}
+	this->format = format;
+
+	//Lay out all levels first, so that they can share one allocation
+	size_t size = 0;
+	for (unsigned int w=width, h=height; ; w=std::max(w/2, 1u), h=std::max(h/2, 1u)) {
+		levels.push_back(createLevel(w, h));
+		size += levels.back().size;
+		if (w == 1 && h == 1) break;
+	}
+	storage.reset(new std::vector<unsigned char>(size, 0));
+
+	//Each mip level is the previous level box filtered down to half the size
+	std::vector<float> level(rgb.begin(), rgb.begin() + 3*static_cast<size_t>(width)*height);
+	std::vector<float> next;
+	unsigned char* texels = storage->data();
+	for (unsigned int i=0; i<levels.size(); ++i) {
+		levels[i].texels = texels;
+		encodeLevel(level, levels[i], texels);
+		texels += levels[i].size;
+		if (i+1 == levels.size()) break;
+
+		unsigned int next_width = levels[i+1].width;
+		unsigned int next_height = levels[i+1].height;
+		next.resize(3*static_cast<size_t>(next_width)*next_height);
+		for (unsigned int y=0; y<next_height; ++y) {
+			unsigned int y0 = std::min(2*y, height-1);
+			unsigned int y1 = std::min(2*y+1, height-1);
+			for (unsigned int x=0; x<next_width; ++x) {
+				unsigned int x0 = std::min(2*x, width-1);
+				unsigned int x1 = std::min(2*x+1, width-1);
+				for (unsigned int k=0; k<3; ++k) {
+					float sum = level[3*(y0*width+x0)+k] + level[3*(y0*width+x1)+k]
+						+ level[3*(y1*width+x0)+k] + level[3*(y1*width+x1)+k];
+					next[3*(y*next_width+x)+k] = 0.25f*sum;
+				}
+			}
+		}
+		level.swap(next);
+		width = next_width;
+		height = next_height;
+	}
+}
+
+TiledImage::TiledImage(const TextureCache::Entry& entry) {
+	if (entry.format == getCacheFormat(RGB9E5)) format = RGB9E5;
+	else if (entry.format == getCacheFormat(RGB16F)) format = RGB16F;
+	else throw std::runtime_error("Texture cache entry is not a tiled image");
+
+	//The levels must be exactly what the constructor would have created
+	for (unsigned int i=0; i<entry.levels.size(); ++i) {
+		const TextureCache::Level& cached = entry.levels[i];
+		bool valid = (cached.width > 0 && cached.height > 0);
+		if (i > 0) {
+			valid = valid && cached.width == std::max(levels.back().width/2, 1u)
+				&& cached.height == std::max(levels.back().height/2, 1u);
+		}
+		if (valid) {
+			levels.push_back(createLevel(cached.width, cached.height));
+			levels.back().texels = cached.data;
+			valid = (cached.size == levels.back().size) && (reinterpret_cast<size_t>(cached.data) % sizeof(uint32_t) == 0);
+		}
+		if (!valid) {
+			std::stringstream error;
+			error << "Invalid level " << i << " in texture cache entry";
+			throw std::runtime_error(error.str());
+		}
+	}
+	if (levels.empty() || levels.back().width != 1 || levels.back().height != 1) {
+		throw std::runtime_error("Incomplete mip chain in texture cache entry");
+	}
+	mapping = entry.file;
+}
+
+bool TiledImage::store(TextureCache& cache, std::string key) const {
+	std::vector<TextureCache::Level> cached(levels.size());
+	for (unsigned int i=0; i<levels.size(); ++i) {
+		cached[i].width = levels[i].width;
+		cached[i].height = levels[i].height;
+		cached[i].data = levels[i].texels;
+		cached[i].size = levels[i].size;
+	}
+	return cache.store(key, getCacheFormat(format), cached);
+}
+
+size_t TiledImage::getMemoryUsage() const {
+	size_t size = 0;
+	for (unsigned int i=0; i<levels.size(); ++i) size += levels[i].size;
+	return size;
+}
+
+TiledImage::Level TiledImage::createLevel(unsigned int width, unsigned int height) const {
+	Level l;
+	l.width = width;
+	l.height = height;
+	l.tiles_x = (width + tile_mask) >> tile_shift;
+	unsigned int tiles_y = (height + tile_mask) >> tile_shift;
+	size_t texel_size = (format == RGB9E5) ? sizeof(uint32_t) : 3*sizeof(uint16_t);
+	l.texels = NULL;
+	l.size = static_cast<size_t>(l.tiles_x)*tiles_y*tile_texels*texel_size;
+	return l;
+}
+
+void TiledImage::encodeLevel(const std::vector<float>& rgb, const Level& l, unsigned char* texels) {
+	//Texels in partially covered tiles are left as padding
+	for (unsigned int y=0; y<l.height; ++y) {
+		for (unsigned int x=0; x<l.width; ++x) {
+			const float* c = &rgb[3*(static_cast<size_t>(y)*l.width+x)];
+			size_t i = index(l, x, y);
+			if (format == RGB9E5) {
+				reinterpret_cast<uint32_t*>(texels)[i] = encodeRGB9E5(glm::vec3(c[0], c[1], c[2]));
+			}
+			else {
+				uint16_t* h = reinterpret_cast<uint16_t*>(texels) + 3*i;
+				for (unsigned int k=0; k<3; ++k) h[k] = encodeHalf(c[k]);
+			}
+		}
+	}
+}
+
+uint32_t TiledImage::encodeRGB9E5(glm::vec3 color) {
+	const float max_value = 511.0f/512.0f * 65536.0f;
+	for (unsigned int k=0; k<3; ++k) {
+		if (!(color[k] > 0.0f)) color[k] = 0.0f;
+		color[k] = std::min(color[k], max_value);
+	}
+
+	//The shared exponent is chosen so the largest channel fits in 9 bits
+	float largest = std::max(color.r, std::max(color.g, color.b));
+	int exponent;
+	std::frexp(largest, &exponent);
+	int shared = std::max(0, exponent + 15);
+	float scale = static_cast<float>(std::ldexp(1.0, 15 + 9 - shared));
+	if (std::floor(largest*scale + 0.5f) >= 512.0f) {
+		//Rounded up to the next power of two
+		shared += 1;
+		scale *= 0.5f;
+	}
+
+	uint32_t r = static_cast<uint32_t>(std::floor(color.r*scale + 0.5f));
+	uint32_t g = static_cast<uint32_t>(std::floor(color.g*scale + 0.5f));
+	uint32_t b = static_cast<uint32_t>(std::floor(color.b*scale + 0.5f));
+	return r | (g << 9) | (b << 18) | (static_cast<uint32_t>(shared) << 27);
+}
+
+uint16_t TiledImage::encodeHalf(float f) {
+	if (!(f > 0.0f)) return 0;
+	if (f >= 65504.0f) return 0x7bff;
+
+	uint32_t bits;
+	std::memcpy(&bits, &f, sizeof(float));
+	int exponent = static_cast<int>(bits >> 23) - 127 + 15;
+	uint32_t mantissa = (bits & 0x7fffff) | 0x800000;
+	if (exponent <= 0) {
+		//Denormal: shift the mantissa including its implicit bit into place
+		unsigned int shift = 14 - exponent;
+		if (shift > 24) return 0;
+		return static_cast<uint16_t>((mantissa + (1u << (shift-1))) >> shift);
+	}
+
+	//Rounding may carry into the exponent, which gives the right result
+	uint32_t h = (static_cast<uint32_t>(exponent) << 10) + ((mantissa & 0x7fffff) >> 13);
+	return static_cast<uint16_t>(h + ((mantissa >> 12) & 1));
+}
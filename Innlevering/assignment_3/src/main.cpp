@@ -1,14 +1,17 @@
 #include <iostream>
 #include <string>
+#include <cstdlib>
 
 #ifdef _WIN32
 #include <Windows.h>
 #endif
 
 #include "RayTracer.h"
-#include "Sphere.hpp"
-#include "Triangle.h"
-#include "CubeMap.hpp"
+#include "DemoScene.hpp"
+#include "RenderServer.h"
+#include "SceneFile.h"
+#include "MeshLoader.h"
+#include "ImageWriter.h"
 #include "Timer.h"
 
 /**
@@ -18,33 +21,119 @@ int main(int argc, char *argv[]) {
 	try {
 		RayTracer* rt;
 		Timer t;
+		std::string model;
+		std::string scene_file;
+		bool checkpoint = false;
+		bool resume = false;
+		bool preview = false;
+		bool gbuffer = false;
+		bool server = false;
+		std::string socket_path;
+		unsigned int n_workers = 0;
+
+		//Usage: raytracer [--checkpoint] [--resume] [--preview] [--gbuffer] [--workers n] [--scene file] [model],
+		//raytracer --server [--socket path], or raytracer --compile scene compiled_scene
+		for (int i=1; i<argc; ++i) {
+			std::string arg = argv[i];
+			if (arg == "--checkpoint") checkpoint = true;
+			else if (arg == "--resume") resume = true;
+			else if (arg == "--preview") preview = true;
+			else if (arg == "--gbuffer") gbuffer = true;
+			else if (arg == "--scene" && i+1 < argc) scene_file = argv[++i];
+			else if (arg == "--compile" && i+2 < argc) {
+				SceneFile::compile(argv[i+1], argv[i+2]);
+				std::cout << "Compiled " << argv[i+1] << " to " << argv[i+2] << std::endl;
+				return 0;
+			}
+			else if (arg == "--server") server = true;
+			else if (arg == "--socket" && i+1 < argc) socket_path = argv[++i];
+			else if (arg == "--workers" && i+1 < argc) n_workers = std::atoi(argv[++i]);
+			else if (arg == "--worker" && i+1 < argc) {
+				//Started by the TileCoordinator of another raytracer process
+				RenderServer worker;
+				worker.runWorker(std::atoi(argv[++i]));
+				return 0;
+			}
+			else model = arg;
+		}
+
+		//Render jobs from stdin until it is closed, or from the clients of a socket, see RenderServer
+		if (server) {
+			RenderServer render_server;
+			if (!socket_path.empty()) {
+				render_server.runSocket(socket_path);
+				return 0;
+			}
+
+			//Only the replies go to stdout, and log messages to stderr
+			std::ostream replies(std::cout.rdbuf());
+			std::streambuf* log = std::cout.rdbuf(std::cerr.rdbuf());
+			render_server.run(std::cin, replies);
+			std::cout.rdbuf(log);
+			return 0;
+		}
+
 		rt = new RayTracer(800, 600);
+
+		//With --checkpoint, finished tiles are kept in test.checkpoint until the render is done,
+		//so that an interrupted render can be resumed with --resume
+		if (checkpoint || resume) rt->setCheckpoint("test.checkpoint", resume);
+
+		//With --gbuffer, the primary hits are kept in test.gbuffer, so that rendering the
+		//same view again, e.g., after changing the effects, only shades them
+		if (gbuffer) rt->setGBufferCache(true, "test.gbuffer");
+
+		//Render the tiles in worker processes running this program
+		if (n_workers > 0) {
+			std::string scene = scene_file.empty() ? "cubemap=cubemaps/SaintLazarusChurch3" : "scene=" + scene_file;
+			if (!model.empty()) scene += " model=" + model;
+			rt->setWorkers(std::make_shared<TileCoordinator>(argv[0], n_workers), scene);
+		}
 		
-		std::shared_ptr<SceneObjectEffect> color(new ColorEffect(glm::vec3(0.0, 1.0, 0.0)));
-		std::shared_ptr<SceneObjectEffect> phong(new PhongEffect(glm::vec3(0.3, 0.3, 0.3), glm::vec3(0.0, 0.0, 10.0)));
-		std::shared_ptr<SceneObjectEffect> fresnel(new FresnelEffect());
-		std::shared_ptr<SceneObjectEffect> reflect(new ReflectSteelEffect());
-
-		std::shared_ptr<SceneObject> s1(new Sphere(glm::vec3(-3.0f, 0.0f, 6.0f), 2.0f, fresnel));
-		rt->addSceneObject(s1);
-		std::shared_ptr<SceneObject> s2(new Sphere(glm::vec3(3.0f, 0.0f, 3.0f), 2.0f, phong));
-		rt->addSceneObject(s2);
-		std::shared_ptr<SceneObject> s3(new Sphere(glm::vec3(0.0f, 3.0f, 9.0f), 2.0f, reflect));
-		rt->addSceneObject(s3);
-		std::shared_ptr<SceneObject> s4(new Triangle(glm::vec3(-2.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.5f, 0.0f), glm::vec3(2.0f, 0.0f, 0.0f), reflect));
-		rt->addSceneObject(s4);
-
-		std::shared_ptr<SceneObject> cube_map(new CubeMap("cubemaps/SaintLazarusChurch3/posx.jpg", "cubemaps/SaintLazarusChurch3/negx.jpg",
-			"cubemaps/SaintLazarusChurch3/posy.jpg", "cubemaps/SaintLazarusChurch3/negy.jpg",
-			"cubemaps/SaintLazarusChurch3/posz.jpg", "cubemaps/SaintLazarusChurch3/negz.jpg"));
-		rt->addSceneObject(cube_map);
+		//Load a scene file, e.g., scenes/demo.scene, or set up the demo scene
+		if (!scene_file.empty()) {
+			t.restart();
+			SceneFile::load(scene_file, *rt);
+			std::cout << "Loaded " << scene_file << " in " << t.elapsed() << " seconds" << std::endl;
+		}
+		else {
+			DemoScene::addObjects(*rt);
+			std::shared_ptr<SceneObject> cube_map = DemoScene::loadCubeMap("cubemaps/SaintLazarusChurch3");
+			rt->addSceneObject(cube_map);
+		}
+
+		//Optionally add a model given on the command line, e.g., bunny.obj
+		if (!model.empty()) {
+			std::shared_ptr<TriangleMesh> mesh = MeshLoader::load(model, DemoScene::getModelEffect(),
+				DemoScene::getModelPosition(), DemoScene::getModelSize());
+			std::cout << "Loaded " << mesh->getTriangleCount() << " triangles from " << model << std::endl;
+			std::shared_ptr<SceneObject> model(mesh);
+			rt->addSceneObject(model);
+		}
 				
 		t.restart();
-		rt->render();
+		if (preview) {
+			//Coarse passes are written to preview.bmp as they finish, for a quick look at the framing
+			rt->renderProgressive([&](FrameBuffer& image, unsigned int pass, bool last) {
+				if (last) return;
+				ImageWriter::saveAs(image, "preview.bmp");
+				std::cout << "Preview pass " << pass << " saved to preview.bmp after " << t.elapsed() << " seconds" << std::endl;
+			});
+		}
+		else {
+			rt->render();
+		}
 		double elapsed = t.elapsed();
 		std::cout << "Computed in " << elapsed << " seconds" <<  std::endl;
+		const RayTracer::RenderTimes& times = rt->getRenderTimes();
+		std::cout << "Acceleration structure built in " << times.build << " seconds, tiles traced in "
+			<< times.trace << " seconds" << std::endl;
+		rt->printSchedulerStats(std::cout);
 		rt->save("test", "bmp"); //We want to write out bmp's to get proper bit-maps (jpeg encoding is lossy)
 
+		//Ray counts and a heatmap of the cost of each pixel, when built with RAYTRACER_STATS
+		if (RayCounters::enabled) rt->saveStats("test", "bmp");
+
 		delete rt;
 	} catch (std::exception &e) {
 		std::string err = e.what();
@@ -0,0 +1,82 @@
+#ifndef _IMAGELOADER_HPP__
+#define _IMAGELOADER_HPP__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <exception>
+
+#include "GLUtils/TextureCache.hpp"
+
+namespace GLUtils {
+
+/**
+  * Loads a batch of images on a pool of threads, and hands them back to the
+  * thread that owns the GL context for uploading. Reading and hashing the
+  * files, looking them up in the texture cache, and computing mip levels run
+  * in parallel. JPEG and PNG images are decoded in parallel as well, while
+  * other images are decoded one at a time, since DevIL keeps the bound image
+  * in global state. Images found in the cache load fastest.
+  */
+class ImageLoader {
+public:
+	ImageLoader(TextureCache& cache) : cache(cache) {}
+
+	/**
+	  * Adds an image to the batch
+	  * @return The index of the image in the result of load()
+	  */
+	unsigned int add(std::string filename) {
+		filenames.push_back(filename);
+		return static_cast<unsigned int>(filenames.size()-1);
+	}
+
+	/**
+	  * Loads all images added since the last call, with as many threads as
+	  * there are images or hardware threads, whichever is fewer. The images
+	  * are returned in the order they were added. If an image fails to load,
+	  * the error of the first such image is thrown once all threads are done.
+	  */
+	std::vector<TextureCache::Entry> load() {
+		std::vector<TextureCache::Entry> images(filenames.size());
+		std::vector<std::exception_ptr> errors(filenames.size());
+		std::atomic<unsigned int> next(0);
+
+		//Every thread, including this one, loads images until none are left
+		auto work = [&]() {
+			for (unsigned int i=next++; i<filenames.size(); i=next++) {
+				try {
+					images[i] = loadCachedImage(cache, filenames[i]);
+				}
+				catch (...) {
+					errors[i] = std::current_exception();
+				}
+			}
+		};
+
+		unsigned int n_threads = std::thread::hardware_concurrency();
+		if (n_threads == 0 || n_threads > filenames.size()) n_threads = static_cast<unsigned int>(filenames.size());
+		std::vector<std::thread> threads;
+		for (unsigned int i=1; i<n_threads; ++i) threads.push_back(std::thread(work));
+		work();
+		for (unsigned int i=0; i<threads.size(); ++i) threads[i].join();
+
+		filenames.clear();
+		for (unsigned int i=0; i<errors.size(); ++i) {
+			if (errors[i]) std::rethrow_exception(errors[i]);
+		}
+		return images;
+	}
+
+private:
+	ImageLoader(const ImageLoader&);
+	ImageLoader& operator=(const ImageLoader&);
+
+	TextureCache& cache;
+	std::vector<std::string> filenames;
+};
+
+} //Namespace GLUtils
+
+#endif
@@ -0,0 +1,455 @@
+#ifndef _TEXTURECACHE_HPP__
+#define _TEXTURECACHE_HPP__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <IL/il.h>
+#include <IL/ilu.h>
+#include <GL/glew.h>
+
+#include "GLUtils/ImageDecoder.hpp"
+
+namespace GLUtils {
+
+/**
+  * A read-only memory mapping of a whole file. The file is paged in on
+  * demand by the operating system, and shared between processes mapping it.
+  */
+class MappedFile {
+public:
+	MappedFile(std::string filename) {
+		ptr = NULL;
+		length = 0;
+#ifdef _WIN32
+		mapping = NULL;
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) fail(filename);
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size)) fail(filename);
+		length = static_cast<size_t>(size.QuadPart);
+		if (length > 0) {
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping == NULL) fail(filename);
+			ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (ptr == NULL) fail(filename);
+		}
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) fail(filename);
+		struct stat info;
+		if (fstat(fd, &info) != 0) {
+			close(fd);
+			fail(filename);
+		}
+		length = static_cast<size_t>(info.st_size);
+		if (length > 0) {
+			ptr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (ptr == MAP_FAILED) ptr = NULL;
+		}
+		//The mapping stays valid after the file is closed
+		close(fd);
+		if (length > 0 && ptr == NULL) fail(filename);
+#endif
+	}
+
+	~MappedFile() {
+		release();
+	}
+
+	inline const unsigned char* getData() const { return static_cast<const unsigned char*>(ptr); }
+	inline size_t getSize() const { return length; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	void release() {
+#ifdef _WIN32
+		if (ptr != NULL) UnmapViewOfFile(ptr);
+		if (mapping != NULL) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (ptr != NULL) munmap(ptr, length);
+#endif
+		ptr = NULL;
+	}
+
+	void fail(std::string filename) {
+		release();
+		std::stringstream error;
+		error << "Unable to map file " << filename;
+		throw std::runtime_error(error.str());
+	}
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+	void* ptr;
+	size_t length;
+};
+
+/**
+  * On-disk cache of decoded images, so that images only need to be decoded
+  * the first time they are loaded. Entries are named by a hash of the
+  * contents of the source file and of how it was decoded, so that changed
+  * files are decoded again. Each entry is a raw file holding all mip levels,
+  * which is memory mapped and used in place when found.
+  */
+class TextureCache {
+public:
+	/**
+	  * One image in an entry, usually a mip level
+	  */
+	struct Level {
+		unsigned int width;
+		unsigned int height;
+		const unsigned char* data;
+		size_t size; //< Size of data in bytes
+	};
+
+	/**
+	  * A cached image. The data of the levels points into the mapped file,
+	  * which stays mapped as long as the entry or a copy of it exists.
+	  */
+	struct Entry {
+		unsigned int format; //< Tag given to store(), identifying the layout of the data
+		std::vector<Level> levels;
+		std::shared_ptr<MappedFile> file;
+		std::shared_ptr<std::vector<unsigned char> > memory; //< Holds the levels instead of file, if set
+	};
+
+	TextureCache(std::string directory="texture_cache") {
+		this->directory = directory;
+	}
+
+	/**
+	  * Returns the name of the entry for the file decoded as described by
+	  * variant, or an empty string if the file cannot be read
+	  */
+	std::string getKey(std::string filename, std::string variant) {
+		try {
+			MappedFile source(filename);
+			return getKey(source.getData(), source.getSize(), variant);
+		}
+		catch (std::runtime_error&) {
+			return "";
+		}
+	}
+
+	/**
+	  * Returns the name of the entry for the file contents in data, decoded
+	  * as described by variant
+	  */
+	std::string getKey(const unsigned char* data, size_t size, std::string variant) {
+		uint64_t hash = 14695981039346656037ULL; //FNV-1a
+		hash = fnv1a(hash, data, size);
+		hash = fnv1a(hash, reinterpret_cast<const unsigned char*>(variant.data()), variant.size());
+
+		std::stringstream key;
+		key << std::hex;
+		key.width(16);
+		key.fill('0');
+		key << hash;
+		return key.str();
+	}
+
+	/**
+	  * Maps the entry with the given key
+	  * @return false if there is no valid entry
+	  */
+	bool find(std::string key, Entry& entry) {
+		if (key.empty()) return false;
+
+		std::shared_ptr<MappedFile> file;
+		try {
+			file.reset(new MappedFile(getFilename(key)));
+		}
+		catch (std::runtime_error&) {
+			return false;
+		}
+
+		const unsigned char* data = file->getData();
+		size_t size = file->getSize();
+		Header header;
+		if (size < sizeof(Header)) return false;
+		std::memcpy(&header, data, sizeof(Header));
+		if (std::memcmp(header.magic, getMagic(), sizeof(header.magic)) != 0 || header.version != version) return false;
+		if (header.levels > max_levels || size < sizeof(Header) + header.levels*sizeof(LevelHeader)) return false;
+
+		entry.format = header.format;
+		entry.levels.resize(header.levels);
+		for (unsigned int i=0; i<header.levels; ++i) {
+			LevelHeader level;
+			std::memcpy(&level, data + sizeof(Header) + i*sizeof(LevelHeader), sizeof(LevelHeader));
+			if (level.offset > size || level.size > size - level.offset) return false;
+			entry.levels[i].width = level.width;
+			entry.levels[i].height = level.height;
+			entry.levels[i].data = data + level.offset;
+			entry.levels[i].size = static_cast<size_t>(level.size);
+		}
+		entry.file = file;
+		return true;
+	}
+
+	/**
+	  * Stores levels as the entry with the given key. The entry is written to
+	  * a temporary file and renamed into place, so that other processes never
+	  * map a partially written entry. Failing to store is not an error, since
+	  * the images can always be decoded again.
+	  * @param format Tag returned in Entry::format when the entry is found
+	  * @return true if the entry was stored
+	  */
+	bool store(std::string key, unsigned int format, const std::vector<Level>& levels) {
+		if (key.empty() || levels.size() > max_levels) return false;
+
+#ifdef _WIN32
+		_mkdir(directory.c_str());
+#else
+		mkdir(directory.c_str(), 0755);
+#endif
+
+		//The process id and a stack address are unique among the processes and
+		//threads storing at the same time, e.g., render workers loading a cube map
+		std::stringstream tmp_filename;
+		tmp_filename << getFilename(key) << "." << getProcessId() << "." << reinterpret_cast<size_t>(&tmp_filename) << ".tmp";
+
+		Header header;
+		std::memcpy(header.magic, getMagic(), sizeof(header.magic));
+		header.version = version;
+		header.format = format;
+		header.levels = static_cast<unsigned int>(levels.size());
+		header.reserved = 0;
+
+		std::vector<LevelHeader> level_headers(levels.size());
+		uint64_t offset = sizeof(Header) + levels.size()*sizeof(LevelHeader);
+		for (unsigned int i=0; i<levels.size(); ++i) {
+			offset = (offset + alignment-1) & ~static_cast<uint64_t>(alignment-1);
+			level_headers[i].width = levels[i].width;
+			level_headers[i].height = levels[i].height;
+			level_headers[i].offset = offset;
+			level_headers[i].size = levels[i].size;
+			offset += levels[i].size;
+		}
+
+		{
+			std::ofstream out(tmp_filename.str().c_str(), std::ios::binary);
+			out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+			if (!level_headers.empty()) {
+				out.write(reinterpret_cast<const char*>(&level_headers[0]), level_headers.size()*sizeof(LevelHeader));
+			}
+			const char padding[alignment] = {0};
+			uint64_t position = sizeof(Header) + levels.size()*sizeof(LevelHeader);
+			for (unsigned int i=0; i<levels.size(); ++i) {
+				out.write(padding, static_cast<std::streamsize>(level_headers[i].offset - position));
+				out.write(reinterpret_cast<const char*>(levels[i].data), levels[i].size);
+				position = level_headers[i].offset + levels[i].size;
+			}
+			if (!out.good()) {
+				out.close();
+				std::remove(tmp_filename.str().c_str());
+				return false;
+			}
+		}
+
+		//An entry another process or thread stored first holds the same data, so
+		//it is replaced on POSIX, while on Windows the rename fails, which is fine
+		if (std::rename(tmp_filename.str().c_str(), getFilename(key).c_str()) != 0) {
+			std::remove(tmp_filename.str().c_str());
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static const unsigned int version = 1;
+	static const unsigned int max_levels = 32;
+	static const unsigned int alignment = 64; //< Level data starts on a cache line
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t format;
+		uint32_t levels;
+		uint32_t reserved;
+	};
+
+	struct LevelHeader {
+		uint32_t width;
+		uint32_t height;
+		uint64_t offset; //< Offset of the data from the start of the file
+		uint64_t size;
+	};
+
+	static unsigned long getProcessId() {
+#ifdef _WIN32
+		return static_cast<unsigned long>(GetCurrentProcessId());
+#else
+		return static_cast<unsigned long>(getpid());
+#endif
+	}
+
+	static const char* getMagic() {
+		return "TEXCACHE";
+	}
+
+	static uint64_t fnv1a(uint64_t hash, const unsigned char* data, size_t size) {
+		for (size_t i=0; i<size; ++i) {
+			hash ^= data[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	std::string getFilename(std::string key) {
+		return directory + "/" + key + ".texcache";
+	}
+
+	std::string directory;
+};
+
+/**
+  * Returns the lock that serializes calls into DevIL, which keeps the bound
+  * image in global state, and is not safe to call from several threads
+  */
+inline std::mutex& getDevILMutex() {
+	static std::mutex mutex;
+	return mutex;
+}
+
+/**
+  * Loads an image as tightly packed RGB8 texels with a complete, box filtered
+  * mip chain, ready to be passed to glTexImage2D with GL_UNPACK_ALIGNMENT 1.
+  * The image is mapped from the cache if it has been loaded before, and
+  * otherwise decoded and added to the cache. JPEG and PNG images are decoded
+  * by ImageDecoder, and other images by DevIL. Safe to call from several
+  * threads at once; see ImageLoader.
+  */
+inline TextureCache::Entry loadCachedImage(TextureCache& cache, std::string filename) {
+	const unsigned int format = 0x38424752; //"RGB8"
+	MappedFile source(filename);
+	std::string key = cache.getKey(source.getData(), source.getSize(), "RGB8 mipmapped");
+
+	TextureCache::Entry entry;
+	if (cache.find(key, entry) && entry.format == format && !entry.levels.empty()) {
+		bool valid = true;
+		for (unsigned int i=0; i<entry.levels.size(); ++i) {
+			const TextureCache::Level& level = entry.levels[i];
+			valid = valid && level.size == 3*static_cast<size_t>(level.width)*level.height;
+		}
+		if (valid) return entry;
+	}
+
+	//Decode the image from the mapped file. Only images that fall back to
+	//DevIL need to hold the lock on it while decoding.
+	unsigned int width, height;
+	std::vector<unsigned char> rgb;
+	bool decoded = ImageDecoder::decode(source.getData(), source.getSize(), width, height, rgb);
+	std::unique_lock<std::mutex> lock(getDevILMutex(), std::defer_lock);
+	ILuint ImageName = 0;
+	if (!decoded) {
+		lock.lock();
+		ilGenImages(1, &ImageName); // Grab a new image name.
+		ilBindImage(ImageName); 
+
+		if (!ilLoadL(IL_TYPE_UNKNOWN, source.getData(), static_cast<ILuint>(source.getSize()))) {
+			ILenum e;
+			std::stringstream error;
+			error << "Unable to load " << filename << std::endl;
+			while ((e = ilGetError()) != IL_NO_ERROR) {
+				error << e << ": " << iluErrorString(e) << std::endl;
+			}
+			ilDeleteImages(1, &ImageName); // Delete the image name. 
+			throw std::runtime_error(error.str());
+		}
+		
+		width = ilGetInteger(IL_IMAGE_WIDTH); // getting image width
+		height = ilGetInteger(IL_IMAGE_HEIGHT); // and height
+	}
+
+	//Lay out all levels in one allocation, level 0 first. The parentheses
+	//around std::max keep the macros from windows.h out of the way.
+	entry = TextureCache::Entry();
+	entry.format = format;
+	size_t size = 0;
+	for (unsigned int w=width, h=height; ; w=(std::max)(w/2, 1u), h=(std::max)(h/2, 1u)) {
+		TextureCache::Level level;
+		level.width = w;
+		level.height = h;
+		level.data = NULL;
+		level.size = 3*static_cast<size_t>(w)*h;
+		entry.levels.push_back(level);
+		size += level.size;
+		if (w == 1 && h == 1) break;
+	}
+	entry.memory.reset(new std::vector<unsigned char>(size));
+	
+	unsigned char* data = entry.memory->data();
+	if (decoded) {
+		std::memcpy(data, rgb.data(), rgb.size());
+	}
+	else {
+		ilCopyPixels(0, 0, 0, width, height, 1, IL_RGB, IL_UNSIGNED_BYTE, data);
+		ilDeleteImages(1, &ImageName); // Delete the image name. 
+		lock.unlock();
+	}
+
+	//Each level is the previous level box filtered down to half the size
+	for (unsigned int i=0; i<entry.levels.size(); ++i) {
+		entry.levels[i].data = data;
+		if (i+1 == entry.levels.size()) break;
+
+		const TextureCache::Level& src = entry.levels[i];
+		const TextureCache::Level& dst = entry.levels[i+1];
+		unsigned char* next = data + src.size;
+		for (unsigned int y=0; y<dst.height; ++y) {
+			unsigned int y0 = (std::min)(2*y, src.height-1);
+			unsigned int y1 = (std::min)(2*y+1, src.height-1);
+			for (unsigned int x=0; x<dst.width; ++x) {
+				unsigned int x0 = (std::min)(2*x, src.width-1);
+				unsigned int x1 = (std::min)(2*x+1, src.width-1);
+				for (unsigned int k=0; k<3; ++k) {
+					unsigned int sum = data[3*(y0*src.width+x0)+k] + data[3*(y0*src.width+x1)+k]
+						+ data[3*(y1*src.width+x0)+k] + data[3*(y1*src.width+x1)+k];
+					next[3*(y*dst.width+x)+k] = static_cast<unsigned char>((sum+2)/4);
+				}
+			}
+		}
+		data = next;
+	}
+
+	cache.store(key, format, entry.levels);
+	return entry;
+}
+
+} //Namespace GLUtils
+
+#endif
@@ -9,6 +9,7 @@
 #include <glm/glm.hpp>
 #include "Timer.h"
 #include "GLUtils/GLUtils.hpp"
+#include "GLUtils/TextureCache.hpp"
 
 
 /**
@@ -158,9 +159,10 @@ private:
 	TerrainMesh createTriangleFanMesh(unsigned int nx, unsigned int ny);
 
 	/**
-	  * Loads a texture into the OpenGL texture texture
+	  * Creates an OpenGL texture from an image with all its mip levels,
+	  * as loaded by GLUtils::loadCachedImage() or GLUtils::ImageLoader
 	  */
-	static GLuint loadTexture(std::string filename);
+	static GLuint createTexture(const GLUtils::TextureCache::Entry& image);
 };
 
 #endif // _GAMEMANAGER_H_
@@ -13,6 +13,9 @@
 #include <IL/il.h>
 #include <IL/ilu.h>
 
+#include "GLUtils/TextureCache.hpp"
+#include "GLUtils/ImageLoader.hpp"
+
 using std::cerr;
 using std::endl;
 using GLUtils::VBO;
@@ -169,9 +172,15 @@ void GameManager::init() {
 	ilInit();
 	iluInit();
 
-	//Get the textures from file and into an OpenGL texture
-	height_texture = loadTexture("ex05_height.bmp");
-	color_texture = loadTexture("ex05_tex.bmp");
+	//Get the textures from file, loading both at the same time,
+	//and then into OpenGL textures
+	GLUtils::TextureCache cache;
+	GLUtils::ImageLoader loader(cache);
+	unsigned int height_image = loader.add("ex05_height.bmp");
+	unsigned int color_image = loader.add("ex05_tex.bmp");
+	std::vector<GLUtils::TextureCache::Entry> images = loader.load();
+	height_texture = createTexture(images[height_image]);
+	color_texture = createTexture(images[color_image]);
 }
 
 void GameManager::render() {
@@ -283,39 +292,22 @@ GameManager::TerrainMesh GameManager::createTriangleFanMesh(unsigned int nx, uns
 }
 
 
-GLuint GameManager::loadTexture(std::string filename) {
-	std::vector<unsigned char> data;
-	ILuint ImageName;
-	unsigned int width, height;
+GLuint GameManager::createTexture(const GLUtils::TextureCache::Entry& image) {
 	GLuint texture;
-		
-	ilGenImages(1, &ImageName); // Grab a new image name.
-	ilBindImage(ImageName);
-
-	if (!ilLoadImage(filename.c_str())) {
-		ILenum e;
-		std::stringstream error;
-		while ((e = ilGetError()) != IL_NO_ERROR) {
-			error << e << ": " << iluErrorString(e) << std::endl;
-		}
-		ilDeleteImages(1, &ImageName); // Delete the image name. 
-		throw std::runtime_error(error.str());
-	}
-				
-	width = ilGetInteger(IL_IMAGE_WIDTH); // getting image width
-	height = ilGetInteger(IL_IMAGE_HEIGHT); // and height
-	data.resize(width*height*3);
-				
-	ilCopyPixels(0, 0, 0, width, height, 1, IL_RGB, IL_UNSIGNED_BYTE, data.data());
-	ilDeleteImages(1, &ImageName); // Delete the image name. 
-		
+
+	//Images found in the texture cache are uploaded straight from the mapped file
 	glGenTextures(1, &texture);
 	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (unsigned int level=0; level<image.levels.size(); ++level) {
+		const GLUtils::TextureCache::Level& l = image.levels[level];
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, l.width, l.height, 0, GL_RGB, GL_UNSIGNED_BYTE, l.data);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 	glBindTexture(GL_TEXTURE_2D, 0);
 	CHECK_GL_ERROR();
 
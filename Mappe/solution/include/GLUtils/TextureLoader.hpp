@@ -9,6 +9,9 @@
 #include <IL/ilu.h>
 #include <GL/glew.h>
 
+#include "GLUtils/TextureCache.hpp"
+#include "GLUtils/ImageLoader.hpp"
+
 namespace GLUtils {
 
 	/**
@@ -25,46 +28,35 @@ namespace GLUtils {
 			GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
 			GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z};
 		GLuint cube_map_name;
-		std::vector<float> data;
 
 		//Allocate texture name and set parameters
 		glGenTextures(1, &cube_map_name);
 		glBindTexture(GL_TEXTURE_CUBE_MAP, cube_map_name);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-		//Load each face and set texture
+		//Load all faces at the same time. Faces that have been loaded before
+		//are mapped from the texture cache instead of decoded.
+		TextureCache cache;
+		ImageLoader loader(cache);
 		for (int i=0; i<6; ++i) {
 			std::stringstream filename;
-			ILuint ImageName;
-			unsigned int width, height;
-
-			ilGenImages(1, &ImageName); // Grab a new image name.
-			ilBindImage(ImageName); 
-
 			filename << base_filename << name_exts[i] << "." << extension;
+			loader.add(filename.str());
+		}
+		std::vector<TextureCache::Entry> images = loader.load();
 
-			if (!ilLoadImage(filename.str().c_str())) {
-				ILenum e;
-				std::stringstream error;
-				while ((e = ilGetError()) != IL_NO_ERROR) {
-					error << e << ": " << iluErrorString(e) << std::endl;
-				}
-				ilDeleteImages(1, &ImageName); // Delete the image name. 
-				throw std::runtime_error(error.str());
+		//Set each face, including all mip levels
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int i=0; i<6; ++i) {
+			for (unsigned int level=0; level<images[i].levels.size(); ++level) {
+				const TextureCache::Level& l = images[i].levels[level];
+				glTexImage2D(faces[i], level, GL_RGB, l.width, l.height, 0, GL_RGB, GL_UNSIGNED_BYTE, l.data);
 			}
-			
-			width = ilGetInteger(IL_IMAGE_WIDTH); // getting image width
-			height = ilGetInteger(IL_IMAGE_HEIGHT); // and height
-			data.resize(width*height*3);
-			
-			ilCopyPixels(0, 0, 0, width, height, 1, IL_RGB, IL_UNSIGNED_BYTE, data.data());
-			ilDeleteImages(1, &ImageName); // Delete the image name. 
-			
-			glTexImage2D(faces[i], 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data.data());
 		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
 		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 